@@ -0,0 +1,171 @@
+#include <QtCore/QCoreApplication>
+#include <QtCore/QElapsedTimer>
+#include <QtCore/QThread>
+#include <QtCore/QVector>
+#include <atomic>
+#include <cstdio>
+#include <cstdlib>
+#include <memory>
+#include <vector>
+#include "../include/opuscodec.h"
+#include "../include/workerpool.h"
+
+// Audio format of every encoded stream
+const int SAMPLE_RATE = 48000;
+const int CHANNELS = 2;
+
+// One Opus frame (10 ms) per encode
+const int FRAME_DURATION_MS = 10;
+const int ENCODE_FRAMES = SAMPLE_RATE * FRAME_DURATION_MS / 1000;
+
+/**
+ * @brief A stream whose strand encodes one frame per run and asks for the next right away.
+ */
+struct Stream
+{
+    OpusCodec codec;
+    std::unique_ptr<WorkerStrand> strand;
+    std::atomic<quint64> encodes;
+    std::atomic<bool> running;
+};
+
+/**
+ * @brief Result of one benchmark run.
+ */
+struct BenchmarkResult
+{
+    quint64 encodes;        ///< Frames encoded by all streams
+    quint64 fewestEncodes;  ///< Frames encoded by the stream that got the fewest runs
+    quint64 mostEncodes;    ///< Frames encoded by the stream that got the most runs
+    double seconds;         ///< Wall-clock duration
+};
+
+/**
+ * @brief Keeps every strand of a pool busy and counts the encodes.
+ * @param workers The number of pool workers.
+ * @param strands The number of streams, each with a strand of its own.
+ * @param durationMs How long to measure.
+ * @param result The measurement (output).
+ * @return True if the codecs could be opened, false otherwise.
+ */
+static bool benchmarkPool(int workers, int strands, int durationMs, BenchmarkResult &result)
+{
+    // Noise, so the encoder has real work to do
+    QVector<float> input(ENCODE_FRAMES * CHANNELS);
+    quint32 seed = 1;
+    for (float &sample : input) {
+        seed = seed * 1664525u + 1013904223u;
+        sample = static_cast<qint32>(seed) / 4294967296.0f;
+    }
+    
+    WorkerPool pool(workers);
+    std::vector<std::unique_ptr<Stream>> streams;
+    for (int i = 0; i < strands; i++) {
+        streams.emplace_back(new Stream);
+        Stream *stream = streams.back().get();
+        if (!stream->codec.open(SAMPLE_RATE)) {
+            return false;
+        }
+        stream->codec.setFrameDuration(FRAME_DURATION_MS);
+        stream->encodes = 0;
+        stream->running = true;
+        stream->strand.reset(new WorkerStrand(&pool, [stream, &input]() {
+            EncodedPacket packet;
+            stream->codec.encode(input.constData(), ENCODE_FRAMES, packet);
+            stream->encodes.fetch_add(1, std::memory_order_relaxed);
+            
+            // Folded into one more run, which is queued behind the other streams
+            if (stream->running.load(std::memory_order_relaxed)) {
+                stream->strand->schedule();
+            }
+        }));
+    }
+    
+    QElapsedTimer clock;
+    clock.start();
+    for (const std::unique_ptr<Stream> &stream : streams) {
+        stream->strand->schedule();
+    }
+    QThread::msleep(durationMs);
+    
+    // Count before stopping, the runs after this are not timed
+    result.encodes = 0;
+    result.fewestEncodes = ~0ULL;
+    result.mostEncodes = 0;
+    for (const std::unique_ptr<Stream> &stream : streams) {
+        quint64 encodes = stream->encodes.load(std::memory_order_relaxed);
+        result.encodes += encodes;
+        result.fewestEncodes = qMin(result.fewestEncodes, encodes);
+        result.mostEncodes = qMax(result.mostEncodes, encodes);
+    }
+    result.seconds = clock.nsecsElapsed() / 1.0e9;
+    
+    for (const std::unique_ptr<Stream> &stream : streams) {
+        stream->running = false;
+    }
+    for (const std::unique_ptr<Stream> &stream : streams) {
+        stream->strand->waitUntilIdle();
+    }
+    return true;
+}
+
+/**
+ * @brief Prints one line of results.
+ * @param workers The number of pool workers.
+ * @param strands The number of streams.
+ * @param result The measurement.
+ * @param baseline The encodes per second of one worker with the same number of streams.
+ */
+static void printResult(int workers, int strands, const BenchmarkResult &result, double baseline)
+{
+    double perSecond = result.encodes / result.seconds;
+    printf("%3d workers %4d strands %10.0f encodes/s  (x%5.2f of 1 worker, %6.1f streams in real time,"
+           " fewest/most runs per strand %.2f)\n",
+           workers, strands, perSecond, baseline > 0.0 ? perSecond / baseline : 0.0,
+           perSecond * FRAME_DURATION_MS / 1000.0,
+           result.mostEncodes > 0 ? static_cast<double>(result.fewestEncodes) / result.mostEncodes : 0.0);
+}
+
+/**
+ * @brief Main function of the worker pool benchmark.
+ *
+ * Usage: poolbench [max workers] [milliseconds per run]
+ *
+ * Every strand encodes 10 ms stereo Opus frames back to back, so the pool is
+ * saturated. For 1, 4, 16 and 64 strands the pool runs with 1, 2, 4, ...
+ * workers up to the limit (the number of cores by default), and the encodes
+ * per second, the speedup over one worker and how evenly the runs were
+ * spread over the strands (fewest/most, 1.00 is perfectly fair) are
+ * printed. Without libopus the codec is a copy and this measures the pool's
+ * own overhead.
+ *
+ * @param argc The number of command line arguments.
+ * @param argv The command line arguments.
+ * @return The exit code.
+ */
+int main(int argc, char *argv[])
+{
+    QCoreApplication app(argc, argv);
+    
+    int maxWorkers = argc > 1 ? qMax(1, atoi(argv[1])) : qMax(1, QThread::idealThreadCount());
+    int durationMs = argc > 2 ? atoi(argv[2]) : 2000;
+    printf("%d ms stereo frames at %d Hz, up to %d workers, %d ms per run\n",
+           FRAME_DURATION_MS, SAMPLE_RATE, maxWorkers, durationMs);
+    
+    for (int strands : { 1, 4, 16, 64 }) {
+        double baseline = 0.0;
+        for (int workers = 1; workers <= maxWorkers; workers *= 2) {
+            BenchmarkResult result;
+            if (!benchmarkPool(workers, strands, durationMs, result)) {
+                fprintf(stderr, "Failed to open the codec\n");
+                return 1;
+            }
+            if (workers == 1) {
+                baseline = result.encodes / result.seconds;
+            }
+            printResult(workers, strands, result, baseline);
+        }
+    }
+    
+    return 0;
+}
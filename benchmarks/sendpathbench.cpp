@@ -0,0 +1,208 @@
+#include <QtCore/QCoreApplication>
+#include <QtCore/QElapsedTimer>
+#include <QtCore/QThread>
+#include <QtCore/QTimer>
+#include <QtNetwork/QTcpServer>
+#include <QtNetwork/QHostAddress>
+#include <cstdio>
+#include <cstdlib>
+#include <time.h>
+#include "../include/networkmanager.h"
+
+// Audio format of the measured stream
+const int SAMPLE_RATE = 48000;
+const int CHANNELS = 2;
+
+// How often the feeding timer hands the due buffers over (as the send path
+// is drained by the network thread)
+const int FEED_INTERVAL_MS = 1;
+
+/**
+ * @brief Result of one benchmark run.
+ */
+struct BenchmarkResult
+{
+    qint64 frames;       ///< Audio buffers handed to the sender
+    double seconds;      ///< Wall-clock duration
+    double cpuSeconds;   ///< CPU time of the sender's thread
+};
+
+/**
+ * @brief Gets the CPU time the calling thread has used.
+ * @return The CPU time in seconds.
+ */
+static double threadCpuTime()
+{
+    struct timespec now;
+    clock_gettime(CLOCK_THREAD_CPUTIME_ID, &now);
+    return now.tv_sec + now.tv_nsec / 1.0e9;
+}
+
+/**
+ * @brief Finds a free port on the loopback interface.
+ * @return The port, 0 if none was found.
+ */
+static quint16 freePort()
+{
+    QTcpServer probe;
+    if (!probe.listen(QHostAddress::LocalHost)) {
+        return 0;
+    }
+    return probe.serverPort();
+}
+
+/**
+ * @brief Runs the event loop until a condition holds or the time is up.
+ * @param condition The condition.
+ * @param timeoutMs The time limit in milliseconds.
+ * @return True if the condition holds, false on a timeout.
+ */
+template<typename Condition>
+static bool waitFor(Condition condition, int timeoutMs)
+{
+    QElapsedTimer clock;
+    clock.start();
+    while (!condition() && clock.elapsed() < timeoutMs) {
+        QCoreApplication::processEvents(QEventLoop::AllEvents, 10);
+    }
+    return condition();
+}
+
+/**
+ * @brief Feeds the sender one buffer at a time at the device's rate and measures its CPU time.
+ * @param sender The connected sender.
+ * @param bufferFrames The frames per device buffer.
+ * @param framesPerPacket The buffers aggregated into one packet.
+ * @param durationMs How long to measure.
+ * @param result The measurement (output).
+ */
+static void benchmarkSend(NetworkManager *sender, int bufferFrames, int framesPerPacket, int durationMs,
+                          BenchmarkResult &result)
+{
+    // Let a whole aggregate fill up before the latency cap flushes it
+    sender->setFramesPerPacket(framesPerPacket);
+    sender->setMaxAggregationDelay(framesPerPacket * bufferFrames * 1000 / SAMPLE_RATE + 1);
+    
+    QByteArray buffer(bufferFrames * CHANNELS * static_cast<int>(sizeof(float)), '\0');
+    qint64 framesSent = 0;
+    
+    // Every buffer that is due goes out as its own sendAudioData() call
+    QElapsedTimer clock;
+    QTimer feedTimer;
+    feedTimer.setTimerType(Qt::PreciseTimer);
+    feedTimer.setInterval(FEED_INTERVAL_MS);
+    QObject::connect(&feedTimer, &QTimer::timeout, [&]() {
+        qint64 due = clock.nsecsElapsed() * SAMPLE_RATE / (bufferFrames * 1000000000LL);
+        while (framesSent < due) {
+            sender->sendAudioData(buffer, ClockSync::now());
+            framesSent++;
+        }
+    });
+    
+    double cpuStart = threadCpuTime();
+    clock.start();
+    feedTimer.start();
+    QTimer::singleShot(durationMs, QCoreApplication::instance(), &QCoreApplication::quit);
+    QCoreApplication::exec();
+    feedTimer.stop();
+    
+    result.frames = framesSent;
+    result.seconds = clock.nsecsElapsed() / 1.0e9;
+    result.cpuSeconds = threadCpuTime() - cpuStart;
+}
+
+/**
+ * @brief Prints one line of results.
+ * @param framesPerPacket The buffers aggregated into one packet.
+ * @param result The measurement.
+ * @param baseline The measurement without aggregation, for the ratio.
+ */
+static void printResult(int framesPerPacket, const BenchmarkResult &result, const BenchmarkResult &baseline)
+{
+    double perFrameUs = result.frames > 0 ? 1.0e6 * result.cpuSeconds / result.frames : 0.0;
+    double baselineUs = baseline.frames > 0 ? 1.0e6 * baseline.cpuSeconds / baseline.frames : 0.0;
+    printf("%3d frames/packet %8.0f buffers/s %8.2f us CPU per buffer  (%5.2f of 1 frame/packet, CPU %5.1f %%)\n",
+           framesPerPacket, result.frames / result.seconds, perFrameUs,
+           baselineUs > 0.0 ? perFrameUs / baselineUs : 0.0, 100.0 * result.cpuSeconds / result.seconds);
+}
+
+/**
+ * @brief Main function of the send path benchmark.
+ *
+ * Usage: sendpathbench [frames per buffer] [milliseconds per run]
+ *
+ * A sender and a receiver NetworkManager are connected over loopback TCP,
+ * the receiver on a thread of its own. The sender gets a raw stereo buffer
+ * at the rate a device with this buffer size delivers them, once without
+ * aggregation and then with 2, 4 and 8 buffers per packet, and the CPU time
+ * of its thread per buffer is printed.
+ *
+ * @param argc The number of command line arguments.
+ * @param argv The command line arguments.
+ * @return The exit code.
+ */
+int main(int argc, char *argv[])
+{
+    QCoreApplication app(argc, argv);
+    
+    int bufferFrames = argc > 1 ? qMax(16, atoi(argv[1])) : 128;
+    int durationMs = argc > 2 ? atoi(argv[2]) : 5000;
+    printf("Raw stereo buffers of %d frames at %d Hz over loopback TCP, %d ms per run\n",
+           bufferFrames, SAMPLE_RATE, durationMs);
+    
+    SessionCapabilities capabilities = SessionHandshake::localCapabilities(SAMPLE_RATE, bufferFrames,
+                                                                            TransmissionMode::Raw);
+    ChannelMap layout = AudioFormat::defaultChannelMap(CHANNELS);
+    quint16 port = freePort();
+    
+    // The receiver drains the stream on its own thread
+    QThread receiverThread;
+    NetworkManager *receiver = new NetworkManager;
+    receiver->moveToThread(&receiverThread);
+    QObject::connect(&receiverThread, &QThread::finished, receiver, &QObject::deleteLater);
+    receiverThread.start();
+    
+    bool listening = false;
+    QMetaObject::invokeMethod(receiver, [&]() {
+        receiver->setKernelTimestamps(false);
+        receiver->setLocalCapabilities(capabilities);
+        receiver->setLocalFormat(layout, layout);
+        listening = receiver->startServer(port);
+    }, Qt::BlockingQueuedConnection);
+    
+    NetworkManager sender;
+    bool negotiated = false;
+    QObject::connect(&sender, &NetworkManager::sessionNegotiated, [&]() {
+        negotiated = true;
+    });
+    sender.setKernelTimestamps(false);
+    sender.setAutoReconnect(false);
+    sender.setLocalCapabilities(capabilities);
+    sender.setLocalFormat(layout, layout);
+    
+    if (!listening || !sender.connectToServer("127.0.0.1", port) ||
+        !waitFor([&]() { return sender.isConnected() && negotiated; }, 5000)) {
+        fprintf(stderr, "Failed to connect the sender to the receiver\n");
+        receiverThread.quit();
+        receiverThread.wait();
+        return 1;
+    }
+    
+    BenchmarkResult baseline;
+    benchmarkSend(&sender, bufferFrames, 1, durationMs, baseline);
+    printResult(1, baseline, baseline);
+    
+    for (int framesPerPacket : { 2, 4, 8 }) {
+        BenchmarkResult result;
+        benchmarkSend(&sender, bufferFrames, framesPerPacket, durationMs, result);
+        printResult(framesPerPacket, result, baseline);
+    }
+    
+    sender.disconnect();
+    QMetaObject::invokeMethod(receiver, [&]() {
+        receiver->disconnect();
+    }, Qt::BlockingQueuedConnection);
+    receiverThread.quit();
+    receiverThread.wait();
+    return 0;
+}
@@ -0,0 +1,330 @@
+#include <QtCore/QCoreApplication>
+#include <QtCore/QElapsedTimer>
+#include <QtCore/QTimer>
+#include <QtNetwork/QTcpServer>
+#include <QtNetwork/QTcpSocket>
+#include <QtNetwork/QHostAddress>
+#include <atomic>
+#include <cstdio>
+#include <cstdlib>
+#include <functional>
+#include <thread>
+#include <time.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <unistd.h>
+#include "../include/packetframing.h"
+#include "../include/uringtransport.h"
+
+// Packets framed per write of the peer thread and per batch of the tested sender
+const int BATCH_PACKETS = 32;
+
+// Send backlog the tested sender keeps in flight
+const qint64 SEND_BACKLOG_BYTES = 256 * 1024;
+
+/**
+ * @brief Result of one benchmark run.
+ */
+struct BenchmarkResult
+{
+    qint64 packets;      ///< Packets received or sent
+    double seconds;      ///< Wall-clock duration
+    double cpuSeconds;   ///< CPU time of the thread running the tested path
+};
+
+/**
+ * @brief Gets the CPU time the calling thread has used.
+ * @return The CPU time in seconds.
+ */
+static double threadCpuTime()
+{
+    struct timespec now;
+    clock_gettime(CLOCK_THREAD_CPUTIME_ID, &now);
+    return now.tv_sec + now.tv_nsec / 1.0e9;
+}
+
+/**
+ * @brief Frames a batch of audio packets as they appear on the wire.
+ * @param payloadSize The payload size of every packet.
+ * @return The framed packets.
+ */
+static QByteArray framedBatch(int payloadSize)
+{
+    QByteArray batch;
+    OutgoingPacket packet = PacketFraming::frame(PACKET_TYPE_AUDIO, QByteArray(payloadSize, '\x55'));
+    for (int i = 0; i < BATCH_PACKETS; i++) {
+        batch.append(PacketFraming::flatten(packet));
+    }
+    return batch;
+}
+
+/**
+ * @brief Counts and consumes the complete packets in a receive buffer.
+ * @param buffer The receive buffer; the incomplete tail stays.
+ * @return The number of packets.
+ */
+static qint64 consumePackets(QByteArray &buffer)
+{
+    PacketView packet;
+    qint64 packets = 0;
+    int offset = 0;
+    
+    while (PacketFraming::parse(buffer.constData() + offset, buffer.size() - offset, packet)) {
+        offset += PacketFraming::HeaderSize + packet.size;
+        packets++;
+    }
+    
+    buffer.remove(0, offset);
+    return packets;
+}
+
+/**
+ * @brief Opens a blocking TCP connection to the benchmark server.
+ * @param port The port on the loopback interface.
+ * @return The socket descriptor, or -1 on failure.
+ */
+static int connectLoopback(quint16 port)
+{
+    int fd = ::socket(AF_INET, SOCK_STREAM, 0);
+    if (fd < 0) {
+        return -1;
+    }
+    
+    struct sockaddr_in address = {};
+    address.sin_family = AF_INET;
+    address.sin_port = htons(port);
+    address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    if (::connect(fd, reinterpret_cast<struct sockaddr*>(&address), sizeof(address)) < 0) {
+        ::close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+/**
+ * @brief Measures the receive path: a peer thread floods the tested socket with packets.
+ * @param useUring Whether to receive through the io_uring transport instead of QTcpSocket.
+ * @param payloadSize The payload size of every packet.
+ * @param durationMs How long to measure.
+ * @param result The measurement (output).
+ * @return True if the run completed, false otherwise.
+ */
+static bool benchmarkReceive(bool useUring, int payloadSize, int durationMs, BenchmarkResult &result)
+{
+    QTcpServer server;
+    if (!server.listen(QHostAddress::LocalHost)) {
+        return false;
+    }
+    
+    std::atomic<bool> stop(false);
+    QByteArray batch = framedBatch(payloadSize);
+    quint16 port = server.serverPort();
+    std::thread peer([&]() {
+        int fd = connectLoopback(port);
+        while (fd >= 0 && !stop.load()) {
+            if (::send(fd, batch.constData(), batch.size(), MSG_NOSIGNAL) < 0) {
+                break;
+            }
+        }
+        if (fd >= 0) {
+            ::close(fd);
+        }
+    });
+    
+    if (!server.waitForNewConnection(5000)) {
+        stop = true;
+        peer.join();
+        return false;
+    }
+    QTcpSocket *socket = server.nextPendingConnection();
+    
+    QByteArray buffer;
+    qint64 packets = 0;
+    UringTransport transport;
+    if (useUring) {
+        QString errorMessage;
+        if (!transport.open(::dup(static_cast<int>(socket->socketDescriptor())), &errorMessage)) {
+            fprintf(stderr, "io_uring transport: %s\n", qPrintable(errorMessage));
+            stop = true;
+            peer.join();
+            return false;
+        }
+        buffer.append(socket->readAll());
+        socket->abort();
+        QObject::connect(&transport, &UringTransport::readyRead, [&]() {
+            transport.read(buffer);
+            packets += consumePackets(buffer);
+        });
+    } else {
+        QObject::connect(socket, &QTcpSocket::readyRead, [&]() {
+            buffer.append(socket->readAll());
+            packets += consumePackets(buffer);
+        });
+    }
+    
+    QElapsedTimer clock;
+    double cpuStart = threadCpuTime();
+    clock.start();
+    QTimer::singleShot(durationMs, QCoreApplication::instance(), &QCoreApplication::quit);
+    QCoreApplication::exec();
+    
+    result.packets = packets;
+    result.seconds = clock.nsecsElapsed() / 1.0e9;
+    result.cpuSeconds = threadCpuTime() - cpuStart;
+    
+    transport.close();
+    socket->abort();
+    stop = true;
+    peer.join();
+    return true;
+}
+
+/**
+ * @brief Measures the send path: the tested socket sends batches to a draining peer thread.
+ * @param useUring Whether to send through the io_uring transport instead of QTcpSocket.
+ * @param payloadSize The payload size of every packet.
+ * @param durationMs How long to measure.
+ * @param result The measurement (output).
+ * @return True if the run completed, false otherwise.
+ */
+static bool benchmarkSend(bool useUring, int payloadSize, int durationMs, BenchmarkResult &result)
+{
+    QTcpServer server;
+    if (!server.listen(QHostAddress::LocalHost)) {
+        return false;
+    }
+    
+    std::atomic<bool> stop(false);
+    quint16 port = server.serverPort();
+    int sinkFd = connectLoopback(port);
+    if (sinkFd < 0 || !server.waitForNewConnection(5000)) {
+        if (sinkFd >= 0) {
+            ::close(sinkFd);
+        }
+        return false;
+    }
+    QTcpSocket *socket = server.nextPendingConnection();
+    
+    std::thread peer([&]() {
+        char sink[64 * 1024];
+        while (!stop.load() && ::read(sinkFd, sink, sizeof(sink)) > 0) {
+        }
+    });
+    
+    // Send the packets one write per packet, as the send queue hands them over
+    OutgoingPacket packet = PacketFraming::frame(PACKET_TYPE_AUDIO, QByteArray(payloadSize, '\x55'));
+    qint64 packetSize = packet.wireSize();
+    qint64 bytesTaken = 0;
+    UringTransport transport;
+    std::function<void()> pump;
+    
+    if (useUring) {
+        QString errorMessage;
+        if (!transport.open(::dup(static_cast<int>(socket->socketDescriptor())), &errorMessage)) {
+            fprintf(stderr, "io_uring transport: %s\n", qPrintable(errorMessage));
+            ::shutdown(sinkFd, SHUT_RDWR);
+            peer.join();
+            ::close(sinkFd);
+            return false;
+        }
+        socket->abort();
+        pump = [&]() {
+            while (transport.bytesToWrite() < SEND_BACKLOG_BYTES) {
+                for (int i = 0; i < BATCH_PACKETS; i++) {
+                    transport.write(packet.header.constData(), packet.header.size());
+                    transport.write(packet.payloads.first().constData(), packet.payloads.first().size());
+                }
+                transport.flush();
+            }
+        };
+        QObject::connect(&transport, &UringTransport::bytesWritten, [&](qint64 bytes) {
+            bytesTaken += bytes;
+            pump();
+        });
+    } else {
+        pump = [&]() {
+            while (socket->bytesToWrite() < SEND_BACKLOG_BYTES) {
+                for (int i = 0; i < BATCH_PACKETS; i++) {
+                    socket->write(packet.header);
+                    socket->write(packet.payloads.first());
+                }
+            }
+        };
+        QObject::connect(socket, &QTcpSocket::bytesWritten, [&](qint64 bytes) {
+            bytesTaken += bytes;
+            pump();
+        });
+    }
+    
+    QElapsedTimer clock;
+    double cpuStart = threadCpuTime();
+    clock.start();
+    pump();
+    QTimer::singleShot(durationMs, QCoreApplication::instance(), &QCoreApplication::quit);
+    QCoreApplication::exec();
+    
+    result.packets = bytesTaken / packetSize;
+    result.seconds = clock.nsecsElapsed() / 1.0e9;
+    result.cpuSeconds = threadCpuTime() - cpuStart;
+    
+    transport.close();
+    socket->abort();
+    stop = true;
+    ::shutdown(sinkFd, SHUT_RDWR);
+    peer.join();
+    ::close(sinkFd);
+    return true;
+}
+
+/**
+ * @brief Prints one line of results.
+ * @param name The name of the run.
+ * @param result The measurement.
+ */
+static void printResult(const char *name, const BenchmarkResult &result)
+{
+    double perSecond = result.packets / result.seconds;
+    double perCore = result.cpuSeconds > 0.0 ? result.packets / result.cpuSeconds : 0.0;
+    printf("%-14s %12.0f packets/s %12.0f packets/s per core  (CPU %5.1f %%)\n",
+           name, perSecond, perCore, 100.0 * result.cpuSeconds / result.seconds);
+}
+
+/**
+ * @brief Main function of the transport benchmark.
+ *
+ * Usage: transportbench [payload bytes] [milliseconds per run]
+ *
+ * @param argc The number of command line arguments.
+ * @param argv The command line arguments.
+ * @return The exit code.
+ */
+int main(int argc, char *argv[])
+{
+    QCoreApplication app(argc, argv);
+    
+    int payloadSize = argc > 1 ? atoi(argv[1]) : 160;
+    int durationMs = argc > 2 ? atoi(argv[2]) : 3000;
+    printf("Audio packets of %d payload bytes over loopback TCP, %d ms per run\n", payloadSize, durationMs);
+    
+    bool uring = UringTransport::isAvailable();
+    if (!uring) {
+        printf("io_uring transport not available, measuring the Qt path only\n");
+    }
+    
+    BenchmarkResult result;
+    if (benchmarkReceive(false, payloadSize, durationMs, result)) {
+        printResult("receive qt", result);
+    }
+    if (uring && benchmarkReceive(true, payloadSize, durationMs, result)) {
+        printResult("receive uring", result);
+    }
+    if (benchmarkSend(false, payloadSize, durationMs, result)) {
+        printResult("send qt", result);
+    }
+    if (uring && benchmarkSend(true, payloadSize, durationMs, result)) {
+        printResult("send uring", result);
+    }
+    
+    return 0;
+}
@@ -0,0 +1,70 @@
+#ifndef ACTIVITYDETECTOR_H
+#define ACTIVITYDETECTOR_H
+
+#include <QtCore/QtGlobal>
+
+/**
+ * @brief The ActivityDetector class decides whether a capture buffer carries signal.
+ *
+ * A buffer is active when its RMS level exceeds a threshold. After the last
+ * active buffer the detector stays active for a hangover period, so word endings
+ * and decaying notes are not cut off. While inactive it tracks the level of the
+ * background noise, which the receiver uses to synthesize comfort noise.
+ */
+class ActivityDetector
+{
+public:
+    /**
+     * @brief Constructor for ActivityDetector.
+     */
+    ActivityDetector();
+    
+    /**
+     * @brief Sets the level above which a buffer counts as active.
+     * @param thresholdDb The threshold in dBFS.
+     */
+    void setThreshold(float thresholdDb);
+    
+    /**
+     * @brief Sets how long the detector stays active after the last active buffer.
+     * @param milliseconds The hangover in milliseconds.
+     */
+    void setHangover(int milliseconds);
+    
+    /**
+     * @brief Prepares the detector for a stream and starts in the active state.
+     * @param sampleRate The sample rate.
+     */
+    void reset(int sampleRate);
+    
+    /**
+     * @brief Analyzes a buffer of interleaved samples.
+     * @param samples The interleaved samples.
+     * @param frames The number of frames.
+     * @param channels The number of channels.
+     * @return True if the buffer should be transmitted, false if it is silence.
+     */
+    bool process(const float *samples, int frames, int channels);
+    
+    /**
+     * @brief Checks if the detector is currently active.
+     * @return True if active (including hangover), false otherwise.
+     */
+    bool isActive() const;
+    
+    /**
+     * @brief Gets the estimated background noise level.
+     * @return The noise RMS level (linear, 0 for digital silence).
+     */
+    float getNoiseLevel() const;
+
+private:
+    float threshold;
+    int hangoverMs;
+    int hangoverFrames;
+    int framesSinceActivity;
+    float noiseLevel;
+    bool active;
+};
+
+#endif // ACTIVITYDETECTOR_H
@@ -0,0 +1,96 @@
+#ifndef AUDIOFORMAT_H
+#define AUDIOFORMAT_H
+
+#include <QtCore/QMetaType>
+#include <QtCore/QString>
+#include <QtCore/QVector>
+
+/**
+ * @brief Speaker position of a channel in an interleaved stream.
+ */
+enum ChannelPosition : quint8 {
+    FrontLeft = 0,    ///< L
+    FrontRight,       ///< R
+    FrontCenter,      ///< C
+    LowFrequency,     ///< LFE
+    BackLeft,         ///< BL (surround left in 5.1)
+    BackRight,        ///< BR (surround right in 5.1)
+    SideLeft,         ///< SL
+    SideRight,        ///< SR
+    BackCenter,       ///< BC
+    Aux0 = 16         ///< First discrete channel (Aux0 + n for AUXn)
+};
+
+/**
+ * @brief The positions of the channels of an interleaved stream, in order.
+ */
+typedef QVector<ChannelPosition> ChannelMap;
+
+/**
+ * @brief Largest number of channels in a stream.
+ */
+const int MAX_CHANNELS = 8;
+
+/**
+ * @brief Enum representing the audio transmission mode.
+ */
+enum class TransmissionMode : quint8 {
+    Raw,    ///< Raw audio data (lowest latency)
+    Opus    ///< Opus-encoded audio (compressed)
+};
+
+Q_DECLARE_METATYPE(TransmissionMode)
+
+/**
+ * @brief The AudioFormat class provides helpers for channel maps.
+ */
+class AudioFormat
+{
+public:
+    /**
+     * @brief Gets the conventional channel map for a channel count.
+     *
+     * Channels are in WAVE/SMPTE order (L R C LFE BL BR SL SR), which is what
+     * multichannel audio interfaces deliver.
+     *
+     * @param channels The number of channels (1 to MAX_CHANNELS).
+     * @return The channel map.
+     */
+    static ChannelMap defaultChannelMap(int channels);
+    
+    /**
+     * @brief Parses a channel map such as "L,R,C,LFE,BL,BR" or "AUX0,AUX1".
+     * @param text The comma-separated channel names.
+     * @return The channel map, or an empty map if the text is invalid.
+     */
+    static ChannelMap parseChannelMap(const QString &text);
+    
+    /**
+     * @brief Formats a channel map as comma-separated channel names.
+     * @param map The channel map.
+     * @return The channel names.
+     */
+    static QString channelMapToString(const ChannelMap &map);
+    
+    /**
+     * @brief Checks if a channel map can be streamed.
+     * @param map The channel map.
+     * @return True if it has 1 to MAX_CHANNELS distinct channels, false otherwise.
+     */
+    static bool isValidChannelMap(const ChannelMap &map);
+    
+    /**
+     * @brief Determines the layout of a stream between two peers.
+     *
+     * The sender never sends more channels than the receiver can play, so a
+     * surround source is downmixed before it goes on the wire, while a mono
+     * source stays mono. Both peers evaluate this independently and agree.
+     *
+     * @param senderCapture The channel map of the sender's input device.
+     * @param receiverPlayback The channel map of the receiver's output device.
+     * @return The channel map of the stream.
+     */
+    static ChannelMap negotiateStreamMap(const ChannelMap &senderCapture, const ChannelMap &receiverPlayback);
+};
+
+#endif // AUDIOFORMAT_H
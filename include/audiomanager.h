@@ -10,14 +10,34 @@
 #include <QtMultimedia/QAudioDeviceInfo>
 #include <QtCore/QTimer>
 #include <QtCore/QMutex>
+#include <QtCore/QVector>
 #include <portaudio.h>
+#include <atomic>
+#include "activitydetector.h"
+#include "audioformat.h"
+#include "deviceregistry.h"
+#include "channelmixer.h"
+#include "dspgraph.h"
+#include "echocanceller.h"
+#include "loadmeter.h"
+#include "opuscodec.h"
+#include "ringbuffer.h"
+#include "rtcheck.h"
+#include "spectrumanalyzer.h"
+#include "streamrecorder.h"
+#include "workerpool.h"
 
 /**
- * @brief Enum representing the audio transmission mode.
+ * @brief Counters describing the playout side of the stream.
  */
-enum class TransmissionMode {
-    Raw,    ///< Raw audio data (lowest latency)
-    Opus    ///< Opus-encoded audio (compressed)
+struct PlayoutStats
+{
+    quint64 framesPlayed;     ///< Frames requested by the output device
+    quint64 underrunFrames;   ///< Frames that had no audio to play
+    quint64 overflowFrames;   ///< Received frames dropped because the FIFO was full
+    quint64 silentFrames;     ///< Frames filled with comfort noise while the peer was idle
+    quint64 lateFrames;       ///< Received frames dropped because they missed their presentation time
+    qint64 endToEndDelayUs;   ///< Capture at the peer to our DAC of the audio last played (0 if unknown)
 };
 
 /**
@@ -26,6 +46,20 @@ enum class TransmissionMode {
  * This class is responsible for managing audio devices, capturing audio from
  * the input device, playing audio to the output device, and processing audio
  * data (raw or with Opus encoding/decoding).
+ *
+ * The input and output devices each have their own channel map. The layout of
+ * each direction's stream is negotiated with the peer (see setPeerFormat()):
+ * captured audio is mixed to the send stream's layout before encoding, and the
+ * received stream is mixed to the output device's layout before playout.
+ *
+ * The send path (capture processing chain, silence suppression, mixing and
+ * encoding) runs in the capture callback, or, with a worker pool (see
+ * setWorkerPool()), on a strand of the pool that the callback hands its
+ * buffers to. Either way it runs on one thread at a time and in order.
+ *
+ * The send path does not emit signals, which allocate: it hands its packets
+ * and announcements to the network thread through a preallocated lock-free
+ * queue, and drainSendQueue() emits them there, in order.
  */
 class AudioManager : public QObject
 {
@@ -45,14 +79,46 @@ public:
     
     /**
      * @brief Initializes the audio system.
+     *
+     * Waits for the device registry to finish probing the devices.
+     *
      * @return True if initialization was successful, false otherwise.
      */
     bool initialize();
     
+    /**
+     * @brief Shares a device registry with other managers (before the first use).
+     *
+     * Without one the manager creates its own on first use. A shared registry
+     * must outlive the manager.
+     *
+     * @param registry The device registry.
+     */
+    void setDeviceRegistry(DeviceRegistry *registry);
+    
+    /**
+     * @brief Gets the device registry, creating one if none was set.
+     * @return The device registry.
+     */
+    DeviceRegistry *getDeviceRegistry();
+    
+    /**
+     * @brief Runs the send path on a worker pool (takes effect on start()).
+     *
+     * The capture callback then only copies its buffers into a queue that
+     * holds CAPTURE_QUEUE_BUFFERS buffers; the pool encodes them, so many
+     * streams encode on all cores instead of on their capture threads. What
+     * the queue cannot hold is dropped (see getDroppedCaptureFrames()). The
+     * pool must outlive the manager.
+     *
+     * @param pool The worker pool, nullptr to encode in the capture callback.
+     */
+    void setWorkerPool(WorkerPool *pool);
+    
     /**
      * @brief Starts audio capture and playback.
-     * @param inputDeviceName The name of the input device.
-     * @param outputDeviceName The name of the output device.
+     * @param inputDeviceName The identifier or the name of the input device.
+     * @param outputDeviceName The identifier or the name of the output device.
      * @param sampleRate The sample rate to use.
      * @param bufferSize The buffer size to use.
      * @param mode The transmission mode (Raw or Opus).
@@ -61,48 +127,365 @@ public:
     bool start(const QString &inputDeviceName, const QString &outputDeviceName,
                int sampleRate, int bufferSize, TransmissionMode mode);
     
+    /**
+     * @brief Starts audio capture and playback on the device registry's probe thread.
+     *
+     * Returns right away; startFinished() tells the outcome. The manager must
+     * not be used until then.
+     *
+     * @param inputDeviceName The identifier or the name of the input device.
+     * @param outputDeviceName The identifier or the name of the output device.
+     * @param sampleRate The sample rate to use.
+     * @param bufferSize The buffer size to use.
+     * @param mode The transmission mode (Raw or Opus).
+     */
+    void startAsync(const QString &inputDeviceName, const QString &outputDeviceName,
+                    int sampleRate, int bufferSize, TransmissionMode mode);
+    
     /**
      * @brief Stops audio capture and playback.
      */
     void stop();
     
     /**
-     * @brief Gets a list of available input devices.
+     * @brief Starts recording what is played to a WAV/RF64 file.
+     *
+     * The recording keeps running across restarts of the streams until
+     * stopRecording() is called.
+     *
+     * @param filePath The path of the file to create.
+     * @return True if recording started, false otherwise.
+     */
+    bool startRecording(const QString &filePath);
+    
+    /**
+     * @brief Stops recording and finalizes the file.
+     */
+    void stopRecording();
+    
+    /**
+     * @brief Checks if a recording is running.
+     * @return True if recording, false otherwise.
+     */
+    bool isRecording() const;
+    
+    /**
+     * @brief Selects the audio the spectrum analyzer looks at.
+     *
+     * The analysis runs on its own low-priority thread while audio is running;
+     * the callbacks only copy the selected audio into its ring.
+     *
+     * @param source The audio to analyse, or SpectrumSource::Off.
+     */
+    void setSpectrumSource(SpectrumSource source);
+    
+    /**
+     * @brief Sets how many spectrum frames per second are computed.
+     * @param framesPerSecond The frame rate.
+     */
+    void setSpectrumFrameRate(int framesPerSecond);
+    
+    /**
+     * @brief Replaces the processing chain applied to captured audio before it is sent.
+     *
+     * The chain runs in the input callback at the input device's layout and
+     * may be changed while audio is running.
+     *
+     * @param description The chain description (see DspGraph::parseChain(), empty for none).
+     * @return True if the description was valid, false otherwise.
+     */
+    bool setCaptureProcessing(const QString &description);
+    
+    /**
+     * @brief Replaces the processing chain applied to received audio before it is played.
+     *
+     * The chain runs in the output callback at the output device's layout and
+     * may be changed while audio is running.
+     *
+     * @param description The chain description (see DspGraph::parseChain(), empty for none).
+     * @return True if the description was valid, false otherwise.
+     */
+    bool setPlayoutProcessing(const QString &description);
+    
+    /**
+     * @brief Gets the CPU cost of the capture processing nodes.
+     * @return The statistics, in processing order.
+     */
+    QVector<DspNodeStats> getCaptureProcessingStats() const;
+    
+    /**
+     * @brief Gets the CPU cost of the playout processing nodes.
+     * @return The statistics, in processing order.
+     */
+    QVector<DspNodeStats> getPlayoutProcessingStats() const;
+    
+    /**
+     * @brief Enables or disables cancelling the echo of the playout from the input.
+     * @param enabled Whether echo cancellation is enabled.
+     */
+    void setEchoCancellation(bool enabled);
+    
+    /**
+     * @brief Sets the length of the echo path the canceller covers (takes effect on start()).
+     * @param milliseconds The tail length in milliseconds.
+     */
+    void setEchoTailLength(int milliseconds);
+    
+    /**
+     * @brief Gets the convergence and ERLE metrics of the echo canceller.
+     * @return The echo cancellation metrics.
+     */
+    EchoStats getEchoStats() const;
+    
+    /**
+     * @brief Gets a list of available input devices (from the registry's cache).
      * @return A list of input device names.
      */
     QStringList getInputDevices() const;
     
     /**
-     * @brief Gets a list of available output devices.
+     * @brief Gets a list of available output devices (from the registry's cache).
      * @return A list of output device names.
      */
     QStringList getOutputDevices() const;
     
+    /**
+     * @brief Sets the channel maps of the devices (takes effect on start()).
+     *
+     * A map is reduced to the device's default layout if the device has fewer
+     * channels.
+     *
+     * @param inputMap The channel map of the input device.
+     * @param outputMap The channel map of the output device.
+     */
+    void setChannelMaps(const ChannelMap &inputMap, const ChannelMap &outputMap);
+    
+    /**
+     * @brief Gets the channel map the input device was opened with.
+     * @return The input channel map.
+     */
+    ChannelMap getInputChannelMap() const;
+    
+    /**
+     * @brief Gets the channel map the output device was opened with.
+     * @return The output channel map.
+     */
+    ChannelMap getOutputChannelMap() const;
+    
     /**
      * @brief Processes incoming audio data.
+     *
+     * The data may reference the network receive buffer; it is consumed before
+     * this function returns. Frames with the same capture time as the previous
+     * call continue where that call ended (the frames of a batch packet).
+     *
      * @param data The audio data to process.
+     * @param captureTimeUs When the peer captured the first frame, on the local ClockSync::now()
+     *                      clock (0 if unknown).
+     */
+    void processIncomingAudio(const QByteArray &data, qint64 captureTimeUs = 0);
+    
+    /**
+     * @brief Processes a comfort noise update from the peer.
+     *
+     * The peer stopped sending audio because its input is silent. Playout fills
+     * the gap with comfort noise instead of counting underruns.
+     *
+     * @param noiseLevel The RMS level of the peer's background noise.
      */
-    void processIncomingAudio(const QByteArray &data);
+    void processComfortNoise(float noiseLevel);
     
     /**
-     * @brief Sets the transmission mode.
+     * @brief Covers a dropped link until the peer's audio arrives again.
+     *
+     * Queued audio still plays out, then playout continues with comfort noise
+     * at the peer's last noise level instead of counting underruns. The
+     * stream re-primes once audio arrives.
+     */
+    void concealLinkLoss();
+    
+    /**
+     * @brief Applies the peer's device layouts and derives both stream layouts.
+     *
+     * No audio is sent until the peer's format is known. Must be called on the
+     * thread that calls processIncomingAudio().
+     *
+     * @param peerInputMap The channel map of the peer's input device.
+     * @param peerOutputMap The channel map of the peer's output device.
+     */
+    void setPeerFormat(const ChannelMap &peerInputMap, const ChannelMap &peerOutputMap);
+    
+    /**
+     * @brief Forgets the peer's format (stops sending until the next one arrives).
+     */
+    void clearPeerFormat();
+    
+    /**
+     * @brief Sets the transmission mode of the stream we send.
+     *
+     * While running, the send path switches at the next buffer boundary
+     * and announces the new format to the peer (see codecChanged()); the device
+     * streams keep running.
+     *
      * @param mode The transmission mode to use.
      */
     void setTransmissionMode(TransmissionMode mode);
+    
+    /**
+     * @brief Switches the decoding of the received stream to the peer's format.
+     *
+     * Must be called on the thread that calls processIncomingAudio(), so the
+     * switch happens between two packets.
+     *
+     * @param mode The transmission mode of the peer's stream.
+     */
+    void setReceiveTransmissionMode(TransmissionMode mode);
+    
+    /**
+     * @brief Gets the playout counters.
+     * @return The playout statistics since start().
+     */
+    PlayoutStats getPlayoutStats() const;
+    
+    /**
+     * @brief Gets the time spent in the audio callbacks and on the send path.
+     * @return The time in nanoseconds since construction (compare two reads for a load).
+     */
+    qint64 getBusyTime() const;
+    
+    /**
+     * @brief Gets the captured frames the worker pool or the network thread fell too far behind to send.
+     * @return The number of frames since start().
+     */
+    quint64 getDroppedCaptureFrames() const;
+    
+    /**
+     * @brief Gets the memory held by the capture and playout buffers (control thread).
+     * @return The size in bytes, as allocated by the last start().
+     */
+    qint64 getBufferMemory() const;
+    
+    /**
+     * @brief Gets a descriptor that turns readable when the send path queues packets.
+     *
+     * Watch it on the network thread and call drainSendQueue() whenever it is
+     * readable (see NetworkManager::watchAudioQueue()); drainSendQueue() makes
+     * it unreadable again.
+     *
+     * @return The descriptor, -1 if the platform has none (poll instead).
+     */
+    int getSendQueueDescriptor() const;
+    
+    /**
+     * @brief Enables or disables silence suppression (takes effect on start()).
+     * @param enabled Whether silent input is replaced by comfort noise updates.
+     */
+    void setSilenceSuppression(bool enabled);
+    
+    /**
+     * @brief Sets the input level below which audio counts as silence.
+     * @param thresholdDb The threshold in dBFS.
+     */
+    void setActivityThreshold(float thresholdDb);
+    
+    /**
+     * @brief Sets how long audio keeps being sent after the input fell silent.
+     * @param milliseconds The hangover in milliseconds.
+     */
+    void setActivityHangover(int milliseconds);
+    
+    /**
+     * @brief Sets the interval of comfort noise updates while the input is silent.
+     * @param milliseconds The interval in milliseconds.
+     */
+    void setComfortNoiseInterval(int milliseconds);
+    
+    /**
+     * @brief Sets the fixed end-to-end delay playout is scheduled to (takes effect on start()).
+     *
+     * Every received frame carries the time the peer captured it. The output
+     * callback maps it to the time the buffer reaches the DAC and plays the
+     * frame exactly this long after its capture: a frame that is due later
+     * waits, one that is late is dropped, and small deviations (clock drift)
+     * are slewed out by inserting or dropping single frames. Without capture
+     * times (clocks not yet synchronized, replays) playout falls back to
+     * playing audio as it arrives.
+     *
+     * @param milliseconds The delay from the peer's ADC to our DAC, 0 to play audio as it arrives.
+     */
+    void setPlayoutDelay(int milliseconds);
+
+public slots:
+    /**
+     * @brief Emits what the send path queued since the last call (network thread).
+     *
+     * Emits audioDataReady(), comfortNoiseReady() and codecChanged() in the
+     * order the send path produced them. Must always be called from the same
+     * thread, whenever getSendQueueDescriptor() is readable (see
+     * NetworkManager::readyForAudio()); what the queue cannot hold meanwhile
+     * is dropped.
+     */
+    void drainSendQueue();
+    
+    /**
+     * @brief Changes the Opus encoder settings without restarting the streams.
+     *
+     * The settings are applied by the send path at the next buffer boundary.
+     *
+     * @param bitrate The bitrate in bits per second.
+     * @param fec Whether in-band FEC is enabled.
+     * @param packetLossPercent The expected packet loss (0-100).
+     * @param frameDurationMs The frame duration in milliseconds.
+     */
+    void setEncoderSettings(int bitrate, bool fec, int packetLossPercent, int frameDurationMs);
 
 signals:
     /**
-     * @brief Signal emitted when audio data is ready to be sent.
+     * @brief Signal emitted when startAsync() finished (from the probe thread).
+     * @param started Whether the streams are running.
+     */
+    void startFinished(bool started);
+    
+    /**
+     * @brief Signal emitted when audio data is ready to be sent (from drainSendQueue()).
      * @param data The audio data to send.
+     * @param captureTimeUs When the first frame reached the ADC, on the ClockSync::now() clock.
+     */
+    void audioDataReady(const QByteArray &data, qint64 captureTimeUs);
+    
+    /**
+     * @brief Signal emitted instead of audio data while the input is silent (from drainSendQueue()).
+     *
+     * It is emitted when the input falls silent and then periodically as a
+     * keepalive.
+     *
+     * @param noiseLevel The RMS level of the background noise.
+     */
+    void comfortNoiseReady(float noiseLevel);
+    
+    /**
+     * @brief Signal emitted when the format of the sent stream changes.
+     *
+     * It is emitted from drainSendQueue() ahead of the first packet in the
+     * new format.
+     *
+     * @param mode The transmission mode of the stream.
+     * @param bitrate The bitrate of the stream in bits per second.
      */
-    void audioDataReady(const QByteArray &data);
+    void codecChanged(TransmissionMode mode, int bitrate);
     
     /**
-     * @brief Signal emitted when the audio level changes.
+     * @brief Signal emitted when the audio level changes (at most every LEVEL_INTERVAL_MS).
      * @param level The current audio level (0-100).
      */
     void audioLevelChanged(int level);
     
+    /**
+     * @brief Signal emitted for every spectrum frame (from the analysis thread).
+     * @param frame The spectrum.
+     */
+    void spectrumReady(const SpectrumFrame &frame);
+    
     /**
      * @brief Signal emitted when an error occurs.
      * @param errorMessage The error message.
@@ -110,6 +493,50 @@ signals:
     void error(const QString &errorMessage);
 
 private:
+    // Drives the callbacks without devices (tests/rtchecktest.cpp)
+    friend class RtCheckTest;
+    
+    /**
+     * @brief The capture time of a position in the playout FIFO.
+     */
+    struct PlayoutMark
+    {
+        quint64 frame;       ///< FIFO position in frames since start()
+        qint64 captureUs;    ///< Capture time of the frame at that position
+    };
+    
+    /**
+     * @brief What the send path hands to the network thread.
+     */
+    enum class SendKind
+    {
+        Audio,          ///< A packet, its bytes are in sendQueue
+        ComfortNoise,   ///< A comfort noise update
+        Codec           ///< A format announcement
+    };
+    
+    /**
+     * @brief An entry of the queue from the send path to the network thread.
+     */
+    struct SendBlock
+    {
+        SendKind kind;           ///< What the entry carries
+        qint64 captureUs;        ///< Capture time of the first frame (Audio)
+        int bytes;               ///< Size of the packet in sendQueue (Audio)
+        float noiseLevel;        ///< Level of the background noise (ComfortNoise)
+        TransmissionMode mode;   ///< Transmission mode of the stream (Codec)
+        int bitrate;             ///< Bitrate of the stream (Codec)
+    };
+    
+    /**
+     * @brief A capture buffer queued for the send path.
+     */
+    struct CaptureBlock
+    {
+        qint64 captureUs;    ///< Capture time of the first frame
+        int frames;          ///< Frames in the buffer
+    };
+    
     /**
      * @brief Callback function for PortAudio input stream.
      * @param inputBuffer The input buffer.
@@ -142,6 +569,71 @@ private:
                              PaStreamCallbackFlags statusFlags,
                              void *userData);
     
+    /**
+     * @brief Sets up the buffers and the state of the callbacks for the channel maps.
+     *
+     * Everything the callbacks use is allocated here, so they never allocate.
+     *
+     * @param sampleRate The sample rate to use.
+     * @param bufferSize The buffer size to use.
+     * @param mode The transmission mode (Raw or Opus).
+     * @return True if successful, false otherwise.
+     */
+    bool prepareStreams(int sampleRate, int bufferSize, TransmissionMode mode);
+    
+    /**
+     * @brief Fills an output buffer from the playout FIFO (output thread).
+     * @param out The output buffer.
+     * @param framesPerBuffer The number of frames to fill.
+     * @param presentationUs When the buffer reaches the DAC, on the ClockSync::now() clock.
+     */
+    void renderOutput(float *out, unsigned long framesPerBuffer, qint64 presentationUs);
+    
+    /**
+     * @brief Gets the capture time of the next frame in the playout FIFO (output thread).
+     * @return The capture time on the ClockSync::now() clock, 0 if unknown.
+     */
+    qint64 playoutHeadCaptureTime();
+    
+    /**
+     * @brief Reads from the playout FIFO, slewing by one frame to stay on schedule (output thread).
+     * @param out The output buffer.
+     * @param frames The number of frames to fill.
+     * @param slew 1 to drop a frame, -1 to repeat one, 0 to read as is.
+     * @return The number of samples filled.
+     */
+    int readPlayout(float *out, int frames, int slew);
+    
+    /**
+     * @brief Processes, encodes and emits a capture buffer (send path).
+     * @param samples The interleaved samples of the input device.
+     * @param frames The number of frames.
+     * @param captureUs When the first frame was captured, on the ClockSync::now() clock.
+     * @param scratch A buffer for the processing chain (may be samples itself).
+     */
+    void processCapture(const float *samples, unsigned long frames, qint64 captureUs, float *scratch);
+    
+    /**
+     * @brief Queues a capture buffer for the encode strand (capture thread).
+     * @param samples The interleaved samples of the input device.
+     * @param frames The number of frames.
+     * @param captureUs When the first frame was captured, on the ClockSync::now() clock.
+     */
+    void queueCapture(const float *samples, unsigned long frames, qint64 captureUs);
+    
+    /**
+     * @brief Runs the send path on the queued capture buffers (encode strand).
+     */
+    void drainCapture();
+    
+    /**
+     * @brief Queues an entry for drainSendQueue() (send path).
+     * @param block The entry.
+     * @param data The bytes of an Audio entry's packet.
+     * @return True if queued, false if the queue is full.
+     */
+    bool queueSend(const SendBlock &block, const char *data = nullptr);
+    
     /**
      * @brief Calculates the audio level from raw audio data.
      * @param data The audio data.
@@ -151,35 +643,180 @@ private:
     int calculateAudioLevel(const float *data, unsigned long size) const;
     
     /**
-     * @brief Encodes raw audio data using Opus.
-     * @param rawData The raw audio data.
-     * @return The encoded audio data.
+     * @brief Decodes Opus-encoded audio data.
+     * @param encodedData The encoded audio data.
+     * @return The number of decoded frames in decodeBuffer, or -1 on error.
      */
-    QByteArray encodeAudio(const QByteArray &rawData);
+    int decodeAudio(const QByteArray &encodedData);
     
     /**
-     * @brief Decodes Opus-encoded audio data.
-     * @param encodedData The encoded audio data.
-     * @return The decoded audio data.
+     * @brief Applies encoder settings queued by setEncoderSettings() (send path).
+     */
+    void applyPendingEncoderSettings();
+    
+    /**
+     * @brief Applies a send stream layout queued by setPeerFormat() (send path).
+     */
+    void applyPendingSendFormat();
+    
+    /**
+     * @brief Applies a transmission mode queued by setTransmissionMode() (send path).
+     */
+    void applyPendingTransmissionMode();
+    
+    /**
+     * @brief Gets the bitrate of the sent stream (send path).
+     * @return The bitrate in bits per second.
      */
-    QByteArray decodeAudio(const QByteArray &encodedData);
+    int getSendBitrate() const;
+    
+    /**
+     * @brief Configures the receive side for a stream layout (network thread).
+     * @param map The channel map of the received stream, empty to drop audio.
+     */
+    void setReceiveFormat(const ChannelMap &map);
+    
+    /**
+     * @brief Runs silence suppression on a capture buffer (send path).
+     * @param samples The interleaved samples.
+     * @param frames The number of frames.
+     * @return True if the buffer should be sent, false if it was suppressed.
+     */
+    bool detectActivity(const float *samples, unsigned long frames);
+    
+    /**
+     * @brief Fills an output buffer with comfort noise (output thread).
+     * @param out The output buffer.
+     * @param samples The number of samples to fill.
+     */
+    void generateComfortNoise(float *out, int samples);
 
     PaStream *inputStream;
     PaStream *outputStream;
     QByteArray inputBuffer;
-    QByteArray outputBuffer;
     QMutex inputMutex;
-    QMutex outputMutex;
     int sampleRate;
     int bufferSize;
-    int channels;
+    int inputChannels;
+    int outputChannels;
     TransmissionMode transmissionMode;
-    bool isInitialized;
+    DeviceRegistry *deviceRegistry;
     bool isRunning;
     
-    // Opus codec state (would be implemented with actual Opus types)
-    void *opusEncoder;
-    void *opusDecoder;
+    // Device layouts and the negotiated stream layouts
+    ChannelMap inputMap;
+    ChannelMap outputMap;
+    ChannelMap peerInputMap;
+    ChannelMap peerOutputMap;
+    ChannelMap receiveMap;
+    ChannelMixer captureMixer;
+    ChannelMixer playoutMixer;
+    QVector<float> captureMixBuffer;
+    QVector<float> playoutMixBuffer;
+    ChannelMap sendMap;
+    int sendChannels;
+    bool sendEnabled;
+    
+    // Wire format of each direction: the sent one is switched by the capture
+    // callback, the received one follows the peer's announcements
+    TransmissionMode sendMode;
+    TransmissionMode receiveMode;
+    std::atomic<TransmissionMode> pendingTransmissionMode;
+    std::atomic<bool> transmissionModePending;
+    bool codecAnnouncePending;
+    
+    // Send layout handed from setPeerFormat() to the send path
+    QMutex sendFormatMutex;
+    ChannelMap pendingSendMap;
+    std::atomic<bool> sendFormatPending;
+    
+    // Playout FIFO between the network and the output callback
+    SpscRingBuffer<float> playoutBuffer;
+    QVector<float> decodeBuffer;
+    bool playoutPrimed;
+    bool playoutStarted;
+    std::atomic<quint64> framesPlayed;
+    std::atomic<quint64> underrunFrames;
+    std::atomic<quint64> overflowFrames;
+    std::atomic<quint64> silentFrames;
+    
+    // Presentation-time playout: the capture time of FIFO positions, handed
+    // from the network thread to the output callback
+    SpscRingBuffer<PlayoutMark> playoutMarks;
+    PlayoutMark playoutAnchor;
+    PlayoutMark nextPlayoutMark;
+    bool nextPlayoutMarkPending;
+    qint64 playoutDelayUs;
+    qint64 lastPacketCaptureUs;
+    qint64 nextCaptureUs;
+    qint64 inputLatencyUs;
+    qint64 outputLatencyUs;
+    std::atomic<quint64> lateFrames;
+    std::atomic<qint64> endToEndDelayUs;
+    
+    // Silence suppression: detector state on the capture side, peer state on playout
+    ActivityDetector activityDetector;
+    bool silenceSuppression;
+    int comfortNoiseIntervalMs;
+    int framesSinceComfortNoise;
+    std::atomic<bool> peerSilent;
+    std::atomic<float> comfortNoiseLevel;
+    quint32 noiseSeed;
+    
+    // Records what is played, fed from the output callback
+    StreamRecorder *recorder;
+    
+    // Live spectrum of the capture or the playout, fed from the matching callback
+    SpectrumAnalyzer *spectrumAnalyzer;
+    std::atomic<SpectrumSource> spectrumSource;
+    
+    // Processing chains between capture and encode, and decode and playout
+    DspGraph captureGraph;
+    DspGraph playoutGraph;
+    QVector<float> captureDspBuffer;
+    
+    // Echo cancellation, referenced to what the output callback plays
+    EchoCanceller echoCanceller;
+    std::atomic<bool> echoCancellation;
+    
+    // Time spent in the callbacks and on the send path, for the per-session load
+    LoadMeter loadMeter;
+    
+    // Opus codec and the settings waiting to be applied by the send path
+    OpusCodec opusCodec;
+    std::atomic<int> pendingBitrate;
+    std::atomic<int> pendingPacketLossPercent;
+    std::atomic<int> pendingFrameDurationMs;
+    std::atomic<bool> pendingFec;
+    std::atomic<bool> encoderSettingsPending;
+    
+    // Capture handed from the callback to the send path on the worker pool
+    WorkerPool *workerPool;
+    WorkerStrand *encodeStrand;
+    SpscRingBuffer<float> captureQueue;
+    SpscRingBuffer<CaptureBlock> captureBlocks;
+    QVector<float> encodeInputBuffer;
+    std::atomic<quint64> droppedCaptureFrames;
+    
+    // Packets and announcements handed from the send path to the network
+    // thread (allocated once, the network thread may drain them any time)
+    SpscRingBuffer<char> sendQueue;
+    SpscRingBuffer<SendBlock> sendBlocks;
+    
+    // A pipe whose read end is readable while the network thread has been
+    // woken for entries it has not drained yet (at most one write per drain)
+    int sendWakeDescriptors[2];
+    std::atomic<bool> sendWakePending;
+    
+    // Payloads handed to audioDataReady() in turn, reused once the network
+    // side has let go of them (network thread)
+    QVector<QByteArray> sendPacketBuffers;
+    int nextSendPacketBuffer;
+    
+    // Input level stored by the capture callback, reported by a timer
+    std::atomic<int> audioLevel;
+    int reportedLevel;
+    QTimer *levelTimer;
 };
 
 #endif // AUDIOMANAGER_H
@@ -0,0 +1,187 @@
+#ifndef BRIDGESESSION_H
+#define BRIDGESESSION_H
+
+#include <QtCore/QObject>
+#include <QtCore/QElapsedTimer>
+#include <QtCore/QSettings>
+#include <QtCore/QThread>
+#include <QtCore/QTimer>
+#include <functional>
+#include "audiomanager.h"
+#include "networkmanager.h"
+#include "ratecontroller.h"
+
+/**
+ * @brief The settings of one bridge in a sessions file.
+ */
+struct SessionConfig
+{
+    QString name;                                        ///< Name of the session (its group in the file)
+    bool sender = true;                                  ///< Connects to host (sender) or listens on port (receiver)
+    QString host;                                        ///< Address of the receiver (sender only)
+    int port = 8000;                                     ///< Port connected to or listened on
+    QString inputDevice;                                 ///< Name of the input device
+    QString outputDevice;                                ///< Name of the output device
+    int sampleRate = 48000;                              ///< Sample rate of both devices
+    int bufferSize = 256;                                ///< Frames per device buffer
+    TransmissionMode mode = TransmissionMode::Raw;       ///< Transmission mode offered in the handshake
+    int opusBitrate = 64000;                             ///< Initial Opus bitrate
+    int playoutDelayMs = 0;                              ///< Fixed end-to-end delay (0 plays audio as it arrives)
+    int framesPerPacket = 1;                             ///< Buffers aggregated into one packet
+    int maxQueueDelayMs = 150;                           ///< Longest audio may wait in the send queue
+    bool silenceSuppression = true;                      ///< Whether silent input is replaced by comfort noise
+    TransportBackend transport = TransportBackend::Qt;   ///< Network transport
+    bool kernelTimestamps = false;                       ///< Whether latency is measured with kernel timestamps (Linux)
+    
+    /**
+     * @brief Reads a session from its group in a sessions file.
+     *
+     * Keys: role (sender or receiver), host, port, inputDevice, outputDevice,
+     * sampleRate, bufferSize, mode (raw or opus), opusBitrate, playoutDelayMs,
+     * framesPerPacket, maxQueueDelayMs, silenceSuppression, transport (qt or uring)
+     * and kernelTimestamps.
+     *
+     * @param settings The sessions file.
+     * @param name The name of the session's group.
+     * @param config The session (output).
+     * @param errorMessage Receives the reason if the session is invalid (optional).
+     * @return True if the session was valid, false otherwise.
+     */
+    static bool parse(const QSettings &settings, const QString &name, SessionConfig &config,
+                      QString *errorMessage = nullptr);
+};
+
+/**
+ * @brief A snapshot of the state and cost of a session.
+ */
+struct SessionStats
+{
+    QString name;                      ///< Name of the session
+    bool running = false;              ///< Whether the session's audio and network are started
+    bool connected = false;            ///< Whether a peer is connected
+    int worker = -1;                   ///< Worker thread the session's network side runs on
+    int latencyMs = 0;                 ///< Round-trip time to the peer (on the wire with kernel timestamps)
+    int queueingMs = -1;               ///< Rest of the round trip, spent queueing in both peers (-1 if unknown)
+    double cpuLoad = 0.0;              ///< Share of one core spent on the session since the last snapshot
+    qint64 memoryBytes = 0;            ///< Memory held by the session's buffers and queues
+    quint64 lostFrames = 0;            ///< Frames played as silence or skipped as late since start
+    quint64 droppedPackets = 0;        ///< Audio packets the send queue dropped since start
+    quint64 droppedCaptureFrames = 0;  ///< Captured frames the encode pool fell too far behind to send
+};
+
+/**
+ * @brief The BridgeSession class runs one bridge without a window.
+ *
+ * It owns an AudioManager, a NetworkManager and a RateController and wires
+ * them like MainWindow does. The NetworkManager, and with it the receive path
+ * into the AudioManager, runs on a worker thread handed in by the owner, which
+ * may carry other sessions too; the send path (processing and encoding) runs
+ * on a worker pool shared by the sessions. The session itself, its timers and
+ * the rate controller live on the thread that created it.
+ */
+class BridgeSession : public QObject
+{
+    Q_OBJECT
+
+public:
+    /**
+     * @brief Constructor for BridgeSession.
+     * @param config The settings of the session.
+     * @param worker The thread the network side runs on (must be running).
+     * @param devices The device registry shared by the sessions (must outlive the session).
+     * @param encoders The pool the send path runs on (must outlive the session), nullptr for the capture thread.
+     * @param parent The parent object.
+     */
+    BridgeSession(const SessionConfig &config, QThread *worker, DeviceRegistry *devices, WorkerPool *encoders,
+                  QObject *parent = nullptr);
+    
+    /**
+     * @brief Destructor for BridgeSession.
+     */
+    ~BridgeSession();
+    
+    /**
+     * @brief Starts the audio devices and the connection.
+     * @return True if started successfully, false otherwise.
+     */
+    bool start();
+    
+    /**
+     * @brief Stops the connection and the audio devices.
+     */
+    void stop();
+    
+    /**
+     * @brief Checks if the session is started.
+     * @return True if it is, false otherwise.
+     */
+    bool isRunning() const;
+    
+    /**
+     * @brief Gets the settings of the session.
+     * @return The settings.
+     */
+    SessionConfig getConfig() const;
+    
+    /**
+     * @brief Takes a snapshot of the session's state.
+     *
+     * The CPU load covers the audio callbacks and the session's share of its
+     * worker thread, measured from the previous snapshot to this one.
+     *
+     * @return The statistics (worker is left for the owner to fill in).
+     */
+    SessionStats sampleStats();
+
+signals:
+    /**
+     * @brief Signal emitted when the connection status changes.
+     * @param connected Whether a peer is connected.
+     * @param message The status message.
+     */
+    void connectionStatusChanged(bool connected, const QString &message);
+    
+    /**
+     * @brief Signal emitted when the audio or network side reports an error.
+     * @param message The error message.
+     */
+    void error(const QString &message);
+
+private slots:
+    /**
+     * @brief Sends the playout loss since the last report to the peer.
+     */
+    void sendReceiverReport();
+
+private:
+    /**
+     * @brief Starts or stops the rate controller for the given transmission mode.
+     * @param mode The active transmission mode.
+     */
+    void updateRateControl(TransmissionMode mode);
+    
+    /**
+     * @brief Runs a function on the worker thread and waits for it to return.
+     * @param function The function to run.
+     */
+    void runOnNetworkThread(const std::function<void()> &function);
+    
+    SessionConfig config;
+    AudioManager *audioManager;
+    NetworkManager *networkManager;
+    RateController *rateController;
+    QTimer *reportTimer;
+    PlayoutStats lastPlayoutStats;
+    TransmissionMode sendMode;
+    bool running;
+    bool connected;
+    int latencyMs;
+    int queueingMs;
+    
+    // Busy time at the previous snapshot, for the load in between
+    QElapsedTimer statsClock;
+    qint64 lastStatsNs;
+    qint64 lastBusyNs;
+};
+
+#endif // BRIDGESESSION_H
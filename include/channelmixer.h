@@ -0,0 +1,121 @@
+#ifndef CHANNELMIXER_H
+#define CHANNELMIXER_H
+
+#include <QtCore/QVector>
+#include "audioformat.h"
+
+/**
+ * @brief The ChannelMixer class converts interleaved audio between channel maps.
+ *
+ * Channels present in both maps are copied, missing ones are folded into their
+ * neighbours with ITU-R BS.775 style coefficients (LFE is dropped on downmix),
+ * and a mono source is duplicated to left and right. Identical maps and the
+ * common mono/stereo conversions take dedicated fast paths; everything else is
+ * mixed planar, with loops simple enough for the compiler to vectorize.
+ *
+ * prepare() allocates; configure() and process() do not, so they may be called
+ * from the audio callbacks.
+ */
+class ChannelMixer
+{
+public:
+    /**
+     * @brief Constructor for ChannelMixer.
+     */
+    ChannelMixer();
+    
+    /**
+     * @brief Allocates the scratch buffers.
+     * @param maxFrames The largest number of frames passed to process() in one block.
+     */
+    void prepare(int maxFrames);
+    
+    /**
+     * @brief Builds the mix matrix for a conversion.
+     * @param inputMap The channel map of the input.
+     * @param outputMap The channel map of the output.
+     */
+    void configure(const ChannelMap &inputMap, const ChannelMap &outputMap);
+    
+    /**
+     * @brief Checks if the conversion leaves the audio unchanged.
+     * @return True if the input can be used as output directly, false otherwise.
+     */
+    bool isIdentity() const;
+    
+    /**
+     * @brief Gets the number of input channels.
+     * @return The input channel count.
+     */
+    int getInputChannels() const;
+    
+    /**
+     * @brief Gets the number of output channels.
+     * @return The output channel count.
+     */
+    int getOutputChannels() const;
+    
+    /**
+     * @brief Converts interleaved audio.
+     * @param input The interleaved input samples.
+     * @param frames The number of frames.
+     * @param output The interleaved output samples (must not overlap the input).
+     */
+    void process(const float *input, int frames, float *output);
+    
+    /**
+     * @brief Splits interleaved samples into one buffer per channel.
+     * @param input The interleaved samples.
+     * @param frames The number of frames.
+     * @param channels The number of channels.
+     * @param planes The per-channel output buffers.
+     */
+    static void deinterleave(const float *input, int frames, int channels, float *const *planes);
+    
+    /**
+     * @brief Merges one buffer per channel into interleaved samples.
+     * @param planes The per-channel input buffers.
+     * @param frames The number of frames.
+     * @param channels The number of channels.
+     * @param output The interleaved samples.
+     */
+    static void interleave(const float *const *planes, int frames, int channels, float *output);
+
+private:
+    /**
+     * @brief The fast path selected by configure().
+     */
+    enum class Mode {
+        Identity,       ///< Maps are equal, copy
+        MonoToStereo,   ///< Duplicate one channel to left and right
+        StereoToMono,   ///< Average left and right
+        Matrix          ///< General planar mix
+    };
+    
+    /**
+     * @brief Adds an input channel to the output, folding missing positions.
+     * @param outputMap The channel map of the output.
+     * @param position The position the input channel is routed to.
+     * @param input The input channel index.
+     * @param gain The gain of the route.
+     */
+    void route(const ChannelMap &outputMap, ChannelPosition position, int input, float gain);
+    
+    /**
+     * @brief Mixes one block of at most blockFrames frames through the matrix.
+     * @param input The interleaved input samples.
+     * @param frames The number of frames.
+     * @param output The interleaved output samples.
+     */
+    void processMatrix(const float *input, int frames, float *output);
+    
+    Mode mode;
+    int inputChannels;
+    int outputChannels;
+    int blockFrames;
+    float gains[MAX_CHANNELS][MAX_CHANNELS];
+    QVector<float> inputPlanes;
+    QVector<float> outputPlanes;
+};
+
+#endif // CHANNELMIXER_H
@@ -0,0 +1,139 @@
+#ifndef CLOCKSYNC_H
+#define CLOCKSYNC_H
+
+#include <QtCore/QtGlobal>
+#include <QtCore/QMetaType>
+#include <QtCore/QVector>
+
+/**
+ * @brief A snapshot of the estimated relation between the peer's clock and ours.
+ *
+ * The peer's monotonic clock reads localTime + offsetUs + skew * (localTime - referenceUs).
+ * Snapshots are plain values, so they can be handed to other threads.
+ */
+struct ClockEstimate
+{
+    bool synchronized = false;   ///< Whether enough exchanges were filtered for an estimate
+    qint64 referenceUs = 0;      ///< Local time the offset refers to
+    double offsetUs = 0.0;       ///< Peer clock minus local clock at referenceUs
+    double skew = 0.0;           ///< Rate of the peer clock relative to ours, minus one
+    qint64 roundTripUs = 0;      ///< Smallest round-trip time in the filter window
+    double errorUs = 0.0;        ///< Spread of the filtered offsets around the fit
+    
+    /**
+     * @brief Converts a local time to the peer's clock.
+     * @param localUs The local time in microseconds.
+     * @return The peer's clock at that moment.
+     */
+    qint64 toPeer(qint64 localUs) const;
+    
+    /**
+     * @brief Converts a time on the peer's clock to the local clock.
+     * @param peerUs The peer's time in microseconds.
+     * @return The local clock at that moment.
+     */
+    qint64 toLocal(qint64 peerUs) const;
+    
+    /**
+     * @brief Extends a 32-bit packet timestamp to the peer's full clock.
+     *
+     * Packet headers only carry the low 32 bits of the sender's clock (about
+     * 71 minutes); the full time is the one closest to the peer's clock now.
+     *
+     * @param timestamp The packet timestamp.
+     * @param localUs The local time the packet is looked at.
+     * @return The peer's time in microseconds.
+     */
+    qint64 unwrapPeerTime(quint32 timestamp, qint64 localUs) const;
+};
+
+Q_DECLARE_METATYPE(ClockEstimate)
+
+/**
+ * @brief The ClockSync class estimates the offset and skew between our clock and the peer's.
+ *
+ * It works on NTP-style exchanges over the control channel: we send at t1,
+ * the peer receives at t2 and replies at t3 (its clock), and the reply arrives
+ * at t4. Each exchange yields an offset, ((t2 - t1) + (t3 - t4)) / 2, that is
+ * only as good as the asymmetry of its round trip, so the estimator keeps a
+ * window of recent exchanges and only trusts those whose round trip is close
+ * to the smallest one seen - queueing delay inflates round trips and biases
+ * the offset, the fastest exchanges are the symmetric ones. A weighted least
+ * squares line through the trusted offsets over time gives the offset and the
+ * skew, so the estimate stays accurate between exchanges as the crystals
+ * drift apart.
+ *
+ * All times are in microseconds on the monotonic clock of now().
+ */
+class ClockSync
+{
+public:
+    /**
+     * @brief Constructor for ClockSync.
+     */
+    ClockSync();
+    
+    /**
+     * @brief Gets the local monotonic clock the estimates refer to.
+     * @return The time in microseconds (same clock on every thread).
+     */
+    static qint64 now();
+    
+    /**
+     * @brief Forgets every exchange (a new peer, or a new connection).
+     */
+    void reset();
+    
+    /**
+     * @brief Adds an exchange and updates the estimate.
+     * @param t1 When we sent the request (local clock).
+     * @param t2 When the peer received it (peer clock).
+     * @param t3 When the peer sent the reply (peer clock).
+     * @param t4 When the reply arrived (local clock).
+     * @return True if the exchange was plausible and taken into account, false otherwise.
+     */
+    bool addExchange(qint64 t1, qint64 t2, qint64 t3, qint64 t4);
+    
+    /**
+     * @brief Gets the number of exchanges in the filter window.
+     * @return The number of exchanges.
+     */
+    int getExchangeCount() const;
+    
+    /**
+     * @brief Gets the current estimate.
+     * @return The estimate (not synchronized until a few exchanges were made).
+     */
+    ClockEstimate getEstimate() const;
+
+private:
+    /**
+     * @brief One request/reply exchange.
+     */
+    struct Exchange
+    {
+        qint64 localUs;       ///< Local time of the exchange (midpoint of t1 and t4)
+        double offsetUs;      ///< Offset the exchange measured
+        qint64 roundTripUs;   ///< Round trip without the peer's processing time
+    };
+    
+    /**
+     * @brief A trusted exchange as the fit sees it.
+     */
+    struct FitPoint
+    {
+        double time;     ///< Local time relative to the first trusted exchange
+        double offset;   ///< Offset the exchange measured
+        double weight;   ///< Weight in the fit
+    };
+    
+    /**
+     * @brief Fits the offset and skew to the trusted exchanges.
+     */
+    void updateEstimate();
+    
+    QVector<Exchange> exchanges;
+    ClockEstimate estimate;
+};
+
+#endif // CLOCKSYNC_H
@@ -0,0 +1,201 @@
+#ifndef DEVICEREGISTRY_H
+#define DEVICEREGISTRY_H
+
+#include <QtCore/QObject>
+#include <QtCore/QMutex>
+#include <QtCore/QStringList>
+#include <QtCore/QThread>
+#include <QtCore/QTimer>
+#include <QtCore/QVector>
+#include <QtCore/QWaitCondition>
+#include <functional>
+
+class QFileSystemWatcher;
+
+/**
+ * @brief An audio device as PortAudio enumerated it.
+ */
+struct AudioDeviceInfo
+{
+    QString id;                             ///< Stable identifier: host API and name (see DeviceRegistry)
+    QString name;                           ///< Name as reported by the host API
+    QString hostApi;                        ///< Name of the host API
+    int index = -1;                         ///< PortAudio device index, valid until the next enumeration
+    int maxInputChannels = 0;               ///< Input channels (0 for output-only devices)
+    int maxOutputChannels = 0;              ///< Output channels (0 for input-only devices)
+    double defaultSampleRate = 0.0;         ///< Default sample rate in Hz
+    double defaultLowInputLatency = 0.0;    ///< Suggested input latency in seconds
+    double defaultLowOutputLatency = 0.0;   ///< Suggested output latency in seconds
+    bool defaultInput = false;              ///< Whether this is the default input device
+    bool defaultOutput = false;             ///< Whether this is the default output device
+};
+
+/**
+ * @brief The DeviceRegistry class owns PortAudio and a cached list of its devices.
+ *
+ * Initializing PortAudio probes every host API, which takes seconds with
+ * some Bluetooth and ALSA devices. The registry does it once, on a probe
+ * thread of its own that starts with the registry, and keeps the result: the
+ * device lists and the device lookups of AudioManager read the cache instead
+ * of walking PortAudio. Streams can be opened on the probe thread too (see
+ * runOnProbeThread()), so nothing that talks to the devices blocks the GUI.
+ *
+ * Device indices change whenever PortAudio enumerates again, so devices are
+ * identified by "<host API>/<name>", with "#2", "#3"... appended to repeated
+ * names in enumeration order. Lookups accept an identifier or a plain name.
+ *
+ * PortAudio only sees added and removed devices after it is terminated and
+ * initialized again, which would close every open stream. On Linux the
+ * registry watches /dev/snd and enumerates again once no stream is open;
+ * elsewhere refresh() does it on request. Every PortAudio call outside the
+ * stream callbacks must hold lock(), since PortAudio is not thread-safe.
+ *
+ * One registry serves any number of AudioManager instances in a process.
+ */
+class DeviceRegistry : public QObject
+{
+    Q_OBJECT
+
+public:
+    /**
+     * @brief Constructor for DeviceRegistry. Starts probing the devices.
+     * @param parent The parent object.
+     */
+    explicit DeviceRegistry(QObject *parent = nullptr);
+    
+    /**
+     * @brief Destructor for DeviceRegistry. Terminates PortAudio.
+     */
+    ~DeviceRegistry();
+    
+    /**
+     * @brief Checks if the first enumeration finished.
+     * @return True once the devices are known, false while probing.
+     */
+    bool isReady() const;
+    
+    /**
+     * @brief Waits for the first enumeration to finish.
+     * @return True if PortAudio is available, false otherwise.
+     */
+    bool waitUntilReady();
+    
+    /**
+     * @brief Gets the reason PortAudio is not available.
+     * @return The error message, empty if it is available.
+     */
+    QString getErrorString() const;
+    
+    /**
+     * @brief Gets every known device.
+     * @return The devices in enumeration order (empty while probing).
+     */
+    QVector<AudioDeviceInfo> getDevices() const;
+    
+    /**
+     * @brief Gets the devices that can capture.
+     * @return The input devices in enumeration order.
+     */
+    QVector<AudioDeviceInfo> getInputDevices() const;
+    
+    /**
+     * @brief Gets the devices that can play.
+     * @return The output devices in enumeration order.
+     */
+    QVector<AudioDeviceInfo> getOutputDevices() const;
+    
+    /**
+     * @brief Looks up an input device.
+     * @param device The identifier or the name of the device.
+     * @return The device, or the default input device if none matches (index -1 if there is none).
+     */
+    AudioDeviceInfo findInputDevice(const QString &device) const;
+    
+    /**
+     * @brief Looks up an output device.
+     * @param device The identifier or the name of the device.
+     * @return The device, or the default output device if none matches (index -1 if there is none).
+     */
+    AudioDeviceInfo findOutputDevice(const QString &device) const;
+    
+    /**
+     * @brief Enumerates the devices again (as soon as no stream is open).
+     */
+    void refresh();
+    
+    /**
+     * @brief Runs a function on the probe thread, after any enumeration in progress.
+     * @param function The function to run.
+     */
+    void runOnProbeThread(const std::function<void()> &function);
+    
+    /**
+     * @brief Runs the queued work and stops the probe thread (before the owner goes away).
+     */
+    void stopProbeThread();
+    
+    /**
+     * @brief Gets the lock every PortAudio call outside the callbacks must hold.
+     * @return The lock.
+     */
+    QMutex *lock();
+    
+    /**
+     * @brief Records that a stream was opened (PortAudio lock held).
+     */
+    void streamOpened();
+    
+    /**
+     * @brief Records that a stream was closed (PortAudio lock held).
+     */
+    void streamClosed();
+
+signals:
+    /**
+     * @brief Signal emitted as the probe proceeds (from the probe thread).
+     * @param message What the probe is doing.
+     */
+    void probeProgress(const QString &message);
+    
+    /**
+     * @brief Signal emitted when an enumeration finished (from the probe thread).
+     * @param available Whether PortAudio is available.
+     */
+    void devicesChanged(bool available);
+
+private:
+    /**
+     * @brief Initializes PortAudio (again) and reads the devices (probe thread).
+     *
+     * Deferred until the last stream closes if any stream is open.
+     */
+    void enumerate();
+    
+    /**
+     * @brief Looks up a device by identifier, then by name.
+     * @param device The identifier or the name of the device.
+     * @param input Whether an input device is wanted (an output device otherwise).
+     * @return The device, the default one if none matches.
+     */
+    AudioDeviceInfo findDevice(const QString &device, bool input) const;
+    
+    QThread *probeThread;
+    QObject *probeContext;
+    QTimer *refreshTimer;
+    QFileSystemWatcher *deviceWatcher;
+    
+    // Serializes the PortAudio calls
+    QMutex portAudioMutex;
+    int openStreams;
+    bool refreshPending;
+    bool initialized;
+    
+    // The cache, read from any thread
+    mutable QMutex cacheMutex;
+    QWaitCondition readyCondition;
+    QVector<AudioDeviceInfo> devices;
+    QString errorString;
+    bool ready;
+};
+
+#endif // DEVICEREGISTRY_H
@@ -0,0 +1,159 @@
+#ifndef DSPGRAPH_H
+#define DSPGRAPH_H
+
+#include <QtCore/QList>
+#include <QtCore/QString>
+#include <QtCore/QVector>
+#include <QtCore/QElapsedTimer>
+#include <atomic>
+#include "dspnode.h"
+
+/**
+ * @brief CPU cost of a node in a DspGraph.
+ */
+struct DspNodeStats
+{
+    QString name;                ///< Name of the node type
+    double averageMicroseconds;  ///< Average time per block
+    double load;                 ///< Time spent per unit of audio processed (1.0 = real time)
+};
+
+/**
+ * @brief The DspGraph class runs a chain of DspNodes on blocks of audio.
+ *
+ * The chain is replaced as a whole: the control thread builds and prepares
+ * the new nodes and publishes them with a single atomic pointer store. The
+ * audio thread picks the new chain up at the next block and crossfades from
+ * the old chain's output to the new one across that block, so a change never
+ * clicks. Replaced chains are freed on the control thread once the audio
+ * thread has acknowledged the switch, so process() never allocates, frees or
+ * waits.
+ *
+ * prepare() and setNodes() are called from the control thread; process() and
+ * isIdentity() from the audio thread.
+ */
+class DspGraph
+{
+public:
+    /**
+     * @brief Constructor for DspGraph.
+     */
+    DspGraph();
+    
+    /**
+     * @brief Destructor for DspGraph.
+     */
+    ~DspGraph();
+    
+    /**
+     * @brief Prepares the graph and its nodes for a stream format.
+     *
+     * Must not be called while process() may run (e.g. while the stream is stopped).
+     *
+     * @param sampleRate The sample rate.
+     * @param channels The number of interleaved channels.
+     * @param maxFrames The largest number of frames passed to process().
+     */
+    void prepare(int sampleRate, int channels, int maxFrames);
+    
+    /**
+     * @brief Replaces the chain of nodes.
+     * @param nodes The new nodes in processing order; the graph takes ownership.
+     */
+    void setNodes(const QList<DspNode*> &nodes);
+    
+    /**
+     * @brief Replaces the chain of nodes from a description.
+     * @param description The chain description (see parseChain()).
+     * @param errorMessage Receives the reason of a failure (optional).
+     * @return True if the description was valid, false otherwise (the chain is unchanged).
+     */
+    bool setChain(const QString &description, QString *errorMessage = nullptr);
+    
+    /**
+     * @brief Gets the number of nodes in the chain (control thread).
+     * @return The number of nodes.
+     */
+    int getNodeCount() const;
+    
+    /**
+     * @brief Gets a node of the chain, e.g. to change its parameters (control thread).
+     * @param index The position of the node in the chain.
+     * @return The node, or nullptr if the index is out of range.
+     */
+    DspNode *getNode(int index) const;
+    
+    /**
+     * @brief Gets the CPU cost of every node in the chain (control thread).
+     * @return The statistics, in processing order.
+     */
+    QVector<DspNodeStats> getStats() const;
+    
+    /**
+     * @brief Checks if processing would leave the audio unchanged (audio thread).
+     * @return True if the chain is empty and no switch is pending, false otherwise.
+     */
+    bool isIdentity() const;
+    
+    /**
+     * @brief Runs a block of interleaved samples through the chain in place (audio thread).
+     * @param samples The interleaved samples.
+     * @param frames The number of frames.
+     */
+    void process(float *samples, int frames);
+    
+    /**
+     * @brief Builds nodes from a chain description.
+     *
+     * The description lists nodes separated by semicolons, each with optional
+     * arguments in parentheses, for example
+     * "gate(-50); eq(peaking, 1000, 3, 1); compressor(-20, 4, 5, 100, 2); limiter(-1)".
+     * Supported nodes: gain(dB), eq(type, Hz, dB, Q),
+     * compressor(threshold dB, ratio, attack ms, release ms, make-up dB),
+     * limiter(ceiling dB, release ms) and
+     * gate(threshold dB, attack ms, hold ms, release ms, range dB).
+     *
+     * @param description The chain description.
+     * @param nodes The new nodes (output); the caller takes ownership.
+     * @param errorMessage Receives the reason of a failure (optional).
+     * @return True if the description was valid, false otherwise.
+     */
+    static bool parseChain(const QString &description, QList<DspNode*> &nodes, QString *errorMessage = nullptr);
+
+private:
+    /**
+     * @brief A published chain of nodes, owning its nodes.
+     */
+    struct Chain
+    {
+        QVector<DspNode*> nodes;
+        
+        ~Chain();
+    };
+    
+    /**
+     * @brief Runs a block through the nodes of a chain, accounting their time.
+     * @param chain The chain.
+     * @param samples The interleaved samples.
+     * @param frames The number of frames.
+     */
+    void runChain(Chain *chain, float *samples, int frames);
+    
+    /**
+     * @brief Frees the replaced chains the audio thread no longer uses.
+     * @param force Whether to free them regardless (the audio thread is stopped).
+     */
+    void collectRetired(bool force);
+    
+    std::atomic<Chain*> published;
+    std::atomic<Chain*> acknowledged;
+    Chain *current;
+    QList<Chain*> retired;
+    QVector<float> crossfadeBuffer;
+    QElapsedTimer clock;
+    int sampleRate;
+    int channels;
+    int maxFrames;
+};
+
+#endif // DSPGRAPH_H
@@ -0,0 +1,86 @@
+#ifndef DSPNODE_H
+#define DSPNODE_H
+
+#include <QtCore/QString>
+#include <atomic>
+
+/**
+ * @brief The DspNode class is the interface of a processing stage in a DspGraph.
+ *
+ * A node processes blocks of interleaved float samples in place. prepare() is
+ * called from the control thread before the node is used and may allocate;
+ * process() runs on the audio thread and must neither allocate nor block.
+ * Parameter setters of the built-in nodes store atomics that process() picks
+ * up at the next block, so they may be called while audio is running.
+ */
+class DspNode
+{
+public:
+    /**
+     * @brief Constructor for DspNode.
+     */
+    DspNode();
+    
+    /**
+     * @brief Destructor for DspNode.
+     */
+    virtual ~DspNode();
+    
+    /**
+     * @brief Gets the name of the node type.
+     * @return The name, as used in chain descriptions.
+     */
+    virtual QString name() const = 0;
+    
+    /**
+     * @brief Prepares the node for a stream format (control thread).
+     * @param sampleRate The sample rate.
+     * @param channels The number of interleaved channels.
+     * @param maxFrames The largest number of frames passed to process().
+     */
+    virtual void prepare(int sampleRate, int channels, int maxFrames);
+    
+    /**
+     * @brief Processes a block of interleaved samples in place (audio thread).
+     * @param samples The interleaved samples.
+     * @param frames The number of frames.
+     */
+    virtual void process(float *samples, int frames) = 0;
+    
+    /**
+     * @brief Adds the cost of a processed block to the node's statistics.
+     * @param nanoseconds The time process() took.
+     * @param frames The number of frames processed.
+     */
+    void addProcessingTime(qint64 nanoseconds, int frames);
+    
+    /**
+     * @brief Gets the total time spent in process().
+     * @return The time in nanoseconds.
+     */
+    qint64 getProcessingTime() const;
+    
+    /**
+     * @brief Gets the total number of frames processed.
+     * @return The number of frames.
+     */
+    qint64 getProcessedFrames() const;
+    
+    /**
+     * @brief Gets the number of blocks processed.
+     * @return The number of blocks.
+     */
+    qint64 getProcessedBlocks() const;
+
+protected:
+    int sampleRate;
+    int channels;
+    int maxFrames;
+
+private:
+    std::atomic<qint64> processingTime;
+    std::atomic<qint64> processedFrames;
+    std::atomic<qint64> processedBlocks;
+};
+
+#endif // DSPNODE_H
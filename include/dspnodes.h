@@ -0,0 +1,275 @@
+#ifndef DSPNODES_H
+#define DSPNODES_H
+
+#include <atomic>
+#include "audioformat.h"
+#include "dspnode.h"
+
+/**
+ * @brief The GainNode class applies a gain, ramped across a block when it changes.
+ */
+class GainNode : public DspNode
+{
+public:
+    /**
+     * @brief Constructor for GainNode.
+     * @param gainDb The gain in dB.
+     */
+    explicit GainNode(float gainDb = 0.0f);
+    
+    /**
+     * @brief Gets the name of the node type.
+     * @return "gain".
+     */
+    QString name() const override;
+    
+    /**
+     * @brief Sets the gain.
+     * @param gainDb The gain in dB.
+     */
+    void setGain(float gainDb);
+    
+    /**
+     * @brief Processes a block of interleaved samples in place (audio thread).
+     * @param samples The interleaved samples.
+     * @param frames The number of frames.
+     */
+    void process(float *samples, int frames) override;
+
+private:
+    std::atomic<float> targetGain;
+    float currentGain;
+};
+
+/**
+ * @brief The BiquadNode class is a second-order IIR filter (RBJ cookbook designs).
+ *
+ * The filter runs in transposed direct form II with independent state per
+ * channel. Coefficients are recomputed on the audio thread at the first block
+ * after a parameter change.
+ */
+class BiquadNode : public DspNode
+{
+public:
+    /**
+     * @brief The filter response.
+     */
+    enum class Type {
+        LowPass,     ///< Second-order low pass
+        HighPass,    ///< Second-order high pass
+        BandPass,    ///< Band pass (0 dB peak gain)
+        Notch,       ///< Band stop
+        Peaking,     ///< Peaking EQ band
+        LowShelf,    ///< Low shelf
+        HighShelf    ///< High shelf
+    };
+    
+    /**
+     * @brief Constructor for BiquadNode.
+     * @param type The filter response.
+     * @param frequency The center or corner frequency in Hz.
+     * @param gainDb The gain in dB (peaking and shelf filters only).
+     * @param q The quality factor.
+     */
+    BiquadNode(Type type, float frequency, float gainDb = 0.0f, float q = 0.707f);
+    
+    /**
+     * @brief Gets the name of the node type.
+     * @return "eq".
+     */
+    QString name() const override;
+    
+    /**
+     * @brief Changes the filter.
+     * @param type The filter response.
+     * @param frequency The center or corner frequency in Hz.
+     * @param gainDb The gain in dB (peaking and shelf filters only).
+     * @param q The quality factor.
+     */
+    void setParameters(Type type, float frequency, float gainDb, float q);
+    
+    /**
+     * @brief Prepares the node for a stream format (control thread).
+     * @param sampleRate The sample rate.
+     * @param channels The number of interleaved channels.
+     * @param maxFrames The largest number of frames passed to process().
+     */
+    void prepare(int sampleRate, int channels, int maxFrames) override;
+    
+    /**
+     * @brief Processes a block of interleaved samples in place (audio thread).
+     * @param samples The interleaved samples.
+     * @param frames The number of frames.
+     */
+    void process(float *samples, int frames) override;
+    
+    /**
+     * @brief Parses a filter type name such as "peaking" or "lowshelf".
+     * @param text The type name.
+     * @param type The filter type (output).
+     * @return True if the name is known, false otherwise.
+     */
+    static bool parseType(const QString &text, Type &type);
+
+private:
+    /**
+     * @brief Computes the coefficients from the current parameters.
+     */
+    void updateCoefficients();
+    
+    std::atomic<int> type;
+    std::atomic<float> frequency;
+    std::atomic<float> gainDb;
+    std::atomic<float> q;
+    std::atomic<bool> parametersChanged;
+    float b0, b1, b2, a1, a2;
+    float z1[MAX_CHANNELS];
+    float z2[MAX_CHANNELS];
+};
+
+/**
+ * @brief The CompressorNode class is a feed-forward compressor with linked channels.
+ *
+ * The peak of each frame across all channels drives an attack/release
+ * envelope; levels above the threshold are reduced by the ratio, and the
+ * make-up gain is applied afterwards.
+ */
+class CompressorNode : public DspNode
+{
+public:
+    /**
+     * @brief Constructor for CompressorNode.
+     * @param thresholdDb The threshold in dBFS.
+     * @param ratio The compression ratio (e.g. 4 for 4:1).
+     * @param attackMs The attack time in milliseconds.
+     * @param releaseMs The release time in milliseconds.
+     * @param makeupDb The make-up gain in dB.
+     */
+    CompressorNode(float thresholdDb = -20.0f, float ratio = 4.0f, float attackMs = 5.0f,
+                   float releaseMs = 100.0f, float makeupDb = 0.0f);
+    
+    /**
+     * @brief Gets the name of the node type.
+     * @return "compressor".
+     */
+    QString name() const override;
+    
+    /**
+     * @brief Changes the compressor settings.
+     * @param thresholdDb The threshold in dBFS.
+     * @param ratio The compression ratio.
+     * @param attackMs The attack time in milliseconds.
+     * @param releaseMs The release time in milliseconds.
+     * @param makeupDb The make-up gain in dB.
+     */
+    void setParameters(float thresholdDb, float ratio, float attackMs, float releaseMs, float makeupDb);
+    
+    /**
+     * @brief Prepares the node for a stream format (control thread).
+     * @param sampleRate The sample rate.
+     * @param channels The number of interleaved channels.
+     * @param maxFrames The largest number of frames passed to process().
+     */
+    void prepare(int sampleRate, int channels, int maxFrames) override;
+    
+    /**
+     * @brief Processes a block of interleaved samples in place (audio thread).
+     * @param samples The interleaved samples.
+     * @param frames The number of frames.
+     */
+    void process(float *samples, int frames) override;
+
+private:
+    std::atomic<float> thresholdDb;
+    std::atomic<float> ratio;
+    std::atomic<float> attackMs;
+    std::atomic<float> releaseMs;
+    std::atomic<float> makeupDb;
+    float envelope;
+};
+
+/**
+ * @brief The LimiterNode class keeps peaks below a ceiling.
+ *
+ * A compressor with a very high ratio, an instant attack and a short release.
+ */
+class LimiterNode : public CompressorNode
+{
+public:
+    /**
+     * @brief Constructor for LimiterNode.
+     * @param ceilingDb The ceiling in dBFS.
+     * @param releaseMs The release time in milliseconds.
+     */
+    explicit LimiterNode(float ceilingDb = -1.0f, float releaseMs = 50.0f);
+    
+    /**
+     * @brief Gets the name of the node type.
+     * @return "limiter".
+     */
+    QString name() const override;
+};
+
+/**
+ * @brief The NoiseGateNode class mutes the signal while it stays below a threshold.
+ *
+ * The gate opens with the attack time as soon as a frame peak exceeds the
+ * threshold, stays open for the hold time and then closes with the release
+ * time down to the range (the attenuation of the closed gate).
+ */
+class NoiseGateNode : public DspNode
+{
+public:
+    /**
+     * @brief Constructor for NoiseGateNode.
+     * @param thresholdDb The threshold in dBFS.
+     * @param attackMs The attack time in milliseconds.
+     * @param holdMs The hold time in milliseconds.
+     * @param releaseMs The release time in milliseconds.
+     * @param rangeDb The attenuation of the closed gate in dB (negative).
+     */
+    NoiseGateNode(float thresholdDb = -50.0f, float attackMs = 1.0f, float holdMs = 50.0f,
+                  float releaseMs = 100.0f, float rangeDb = -80.0f);
+    
+    /**
+     * @brief Gets the name of the node type.
+     * @return "gate".
+     */
+    QString name() const override;
+    
+    /**
+     * @brief Changes the gate settings.
+     * @param thresholdDb The threshold in dBFS.
+     * @param attackMs The attack time in milliseconds.
+     * @param holdMs The hold time in milliseconds.
+     * @param releaseMs The release time in milliseconds.
+     * @param rangeDb The attenuation of the closed gate in dB (negative).
+     */
+    void setParameters(float thresholdDb, float attackMs, float holdMs, float releaseMs, float rangeDb);
+    
+    /**
+     * @brief Prepares the node for a stream format (control thread).
+     * @param sampleRate The sample rate.
+     * @param channels The number of interleaved channels.
+     * @param maxFrames The largest number of frames passed to process().
+     */
+    void prepare(int sampleRate, int channels, int maxFrames) override;
+    
+    /**
+     * @brief Processes a block of interleaved samples in place (audio thread).
+     * @param samples The interleaved samples.
+     * @param frames The number of frames.
+     */
+    void process(float *samples, int frames) override;
+
+private:
+    std::atomic<float> thresholdDb;
+    std::atomic<float> attackMs;
+    std::atomic<float> holdMs;
+    std::atomic<float> releaseMs;
+    std::atomic<float> rangeDb;
+    float gain;
+    int holdRemaining;
+};
+
+#endif // DSPNODES_H
@@ -0,0 +1,153 @@
+#ifndef ECHOCANCELLER_H
+#define ECHOCANCELLER_H
+
+#include <QtCore/QVector>
+#include <atomic>
+#include "realfft.h"
+#include "ringbuffer.h"
+
+/**
+ * @brief Echo cancellation metrics.
+ */
+struct EchoStats
+{
+    float erleDb;            ///< Echo return loss enhancement (echo removed by the filter)
+    float erlDb;             ///< Echo return loss (playout level above the echo in the mic)
+    bool converged;          ///< Whether the filter removes a useful amount of echo
+    bool doubleTalk;         ///< Whether near-end speech is currently freezing adaptation
+    quint64 adaptedBlocks;   ///< Number of blocks the filter adapted on
+};
+
+/**
+ * @brief The EchoCanceller class removes the echo of the playout from the captured audio.
+ *
+ * The playout (downmixed to mono) is the reference. Each captured channel has
+ * its own partitioned-block frequency-domain NLMS filter (overlap-save with
+ * 128-frame blocks), which covers the echo tail in partitions of one block.
+ * Adaptation is normalized by the smoothed reference power per bin, frozen
+ * while the reference is silent or a Geigel detector sees near-end speech,
+ * and the gradient constraint is applied to one partition per block in turn.
+ * The complex multiply-accumulate kernels use SSE2 where available.
+ *
+ * prepare() allocates; pushReference() (output thread) and process() (input
+ * thread) are lock-free and do not allocate.
+ */
+class EchoCanceller
+{
+public:
+    /**
+     * @brief Frames per block, the granularity of the filter.
+     */
+    static const int BlockSize = 128;
+    
+    /**
+     * @brief Constructor for EchoCanceller.
+     */
+    EchoCanceller();
+    
+    /**
+     * @brief Sets the length of the echo path the filter covers (applied by prepare()).
+     * @param milliseconds The tail length in milliseconds.
+     */
+    void setTailLength(int milliseconds);
+    
+    /**
+     * @brief Allocates the filters and resets the adaptation.
+     * @param sampleRate The sample rate.
+     * @param micChannels The number of captured channels.
+     * @param referenceChannels The number of playout channels.
+     * @param maxFrames The largest number of frames per call.
+     */
+    void prepare(int sampleRate, int micChannels, int referenceChannels, int maxFrames);
+    
+    /**
+     * @brief Queues played audio as the echo reference (output thread).
+     * @param samples The interleaved playout samples.
+     * @param frames The number of frames.
+     */
+    void pushReference(const float *samples, int frames);
+    
+    /**
+     * @brief Removes the echo from captured audio in place (input thread).
+     *
+     * Frames beyond the last whole block pass through unprocessed, so the
+     * buffer size should be a multiple of BlockSize.
+     *
+     * @param samples The interleaved captured samples.
+     * @param frames The number of frames.
+     */
+    void process(float *samples, int frames);
+    
+    /**
+     * @brief Gets the current metrics.
+     * @return The echo cancellation metrics.
+     */
+    EchoStats getStats() const;
+
+private:
+    /**
+     * @brief Adaptive filter state of one captured channel.
+     */
+    struct ChannelFilter
+    {
+        QVector<float> weightsRe;   ///< Real parts of the filter spectra, partitions x bins
+        QVector<float> weightsIm;   ///< Imaginary parts of the filter spectra
+    };
+    
+    /**
+     * @brief Processes one block of one channel.
+     * @param filter The channel's filter.
+     * @param mic The block of mic samples, replaced by the echo-free signal.
+     * @param adapt Whether the filter may adapt on this block.
+     */
+    void processChannel(ChannelFilter &filter, float *mic, bool adapt);
+    
+    /**
+     * @brief Applies the gradient constraint to one partition of a filter.
+     * @param filter The channel's filter.
+     * @param partition The partition index.
+     */
+    void constrainPartition(ChannelFilter &filter, int partition);
+    
+    /**
+     * @brief Updates the metrics from one block that was adapted on.
+     * @param referencePower The power of the reference block.
+     * @param micPower The power of the captured block.
+     * @param errorPower The power of the block after cancellation.
+     */
+    void updateStats(float referencePower, float micPower, float errorPower);
+    
+    RealFft fft;
+    SpscRingBuffer<float> referenceRing;
+    QVector<float> referenceScratch;
+    QVector<float> referenceBlock;
+    QVector<float> historyRe;
+    QVector<float> historyIm;
+    QVector<float> referencePower;
+    QVector<float> blockPeaks;
+    QVector<float> micBlock;
+    QVector<float> timeBuffer;
+    QVector<float> spectrumRe;
+    QVector<float> spectrumIm;
+    QVector<float> gainRe;
+    QVector<float> gainIm;
+    QVector<ChannelFilter> filters;
+    int sampleRate;
+    int micChannels;
+    int referenceChannels;
+    int tailMs;
+    int partitions;
+    int bins;
+    int historyHead;
+    int constraintPartition;
+    int doubleTalkHold;
+    float smoothedMicPower;
+    float smoothedErrorPower;
+    float smoothedReferencePower;
+    std::atomic<float> erleDb;
+    std::atomic<float> erlDb;
+    std::atomic<bool> doubleTalk;
+    std::atomic<quint64> adaptedBlocks;
+};
+
+#endif // ECHOCANCELLER_H
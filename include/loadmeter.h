@@ -0,0 +1,83 @@
+#ifndef LOADMETER_H
+#define LOADMETER_H
+
+#include <QtCore/QtGlobal>
+#include <atomic>
+#include <chrono>
+
+/**
+ * @brief Adds up the time a component spends doing work, across threads.
+ *
+ * A Scope measures the block it lives in and adds the time when it goes out
+ * of scope, whichever way the block is left. The total only ever grows;
+ * readers take the difference between two reads over an interval, so the
+ * meter never needs resetting and any thread may read it. Adding is a single
+ * relaxed atomic addition, cheap enough for the PortAudio callbacks.
+ */
+class LoadMeter
+{
+public:
+    /**
+     * @brief Measures the time until it is destroyed.
+     */
+    class Scope
+    {
+    public:
+        /**
+         * @brief Constructor for Scope.
+         * @param meter The meter the time is added to.
+         */
+        explicit Scope(LoadMeter &meter)
+            : meter(meter)
+            , start(std::chrono::steady_clock::now())
+        {
+        }
+        
+        /**
+         * @brief Destructor for Scope, adds the elapsed time to the meter.
+         */
+        ~Scope()
+        {
+            meter.add(std::chrono::duration_cast<std::chrono::nanoseconds>(
+                std::chrono::steady_clock::now() - start).count());
+        }
+        
+        Scope(const Scope &) = delete;
+        Scope &operator=(const Scope &) = delete;
+    
+    private:
+        LoadMeter &meter;
+        std::chrono::steady_clock::time_point start;
+    };
+    
+    /**
+     * @brief Constructor for LoadMeter.
+     */
+    LoadMeter()
+        : busyNs(0)
+    {
+    }
+    
+    /**
+     * @brief Adds time spent working.
+     * @param nanoseconds The time in nanoseconds.
+     */
+    void add(qint64 nanoseconds)
+    {
+        busyNs.fetch_add(nanoseconds, std::memory_order_relaxed);
+    }
+    
+    /**
+     * @brief Gets the time spent working since construction.
+     * @return The time in nanoseconds.
+     */
+    qint64 getBusyTime() const
+    {
+        return busyNs.load(std::memory_order_relaxed);
+    }
+
+private:
+    std::atomic<qint64> busyNs;
+};
+
+#endif // LOADMETER_H
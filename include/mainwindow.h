@@ -4,8 +4,12 @@
 #include <QtWidgets/QMainWindow>
 #include <QtCore/QSettings>
 #include <QtCore/QTimer>
+#include <QtCore/QThread>
+#include <functional>
 #include "audiomanager.h"
 #include "networkmanager.h"
+#include "ratecontroller.h"
+#include "spectrumwidget.h"
 
 QT_BEGIN_NAMESPACE
 namespace Ui { class MainWindow; }
@@ -16,6 +20,8 @@ QT_END_NAMESPACE
  * 
  * This class is responsible for setting up the UI, handling user interactions,
  * managing the application state, and connecting to the AudioManager and NetworkManager.
+ * The NetworkManager runs on its own thread, which also carries the receive path
+ * into the AudioManager; the window only observes its status and statistics.
  */
 class MainWindow : public QMainWindow
 {
@@ -32,6 +38,25 @@ public:
      * @brief Destructor for MainWindow.
      */
     ~MainWindow();
+    
+    /**
+     * @brief Sets a file that received packets are captured to while the bridge runs.
+     * @param filePath The path of the capture file (empty disables capturing).
+     */
+    void setCaptureFile(const QString &filePath);
+    
+    /**
+     * @brief Sets a capture file that is replayed instead of connecting to a peer.
+     * @param filePath The path of the capture file (empty disables replay).
+     * @param realtime Whether to reproduce the recorded timing.
+     */
+    void setReplayFile(const QString &filePath, bool realtime);
+    
+    /**
+     * @brief Sets the network conditions simulated on received packets while the bridge runs.
+     * @param profile The network conditions (a profile without impairments disables it).
+     */
+    void setImpairment(const ImpairmentProfile &profile);
 
 private slots:
     /**
@@ -102,7 +127,9 @@ private:
     void saveSettings();
     
     /**
-     * @brief Populates the audio device combo boxes.
+     * @brief Populates the audio device combo boxes from the device registry.
+     *
+     * The selection survives a refresh if the device is still there.
      */
     void populateAudioDevices();
     
@@ -122,17 +149,63 @@ private:
      */
     void startBridge();
     
+    /**
+     * @brief Starts the network side once the audio streams are running.
+     * @param sampleRate The sample rate of the streams.
+     * @param bufferSize The buffer size of the streams.
+     * @param mode The transmission mode.
+     */
+    void startNetwork(int sampleRate, int bufferSize, TransmissionMode mode);
+    
     /**
      * @brief Stops the audio bridge.
      */
     void stopBridge();
+    
+    /**
+     * @brief Starts or stops the rate controller for the given transmission mode.
+     * @param mode The active transmission mode.
+     */
+    void updateRateControl(TransmissionMode mode);
+    
+    /**
+     * @brief Sends the playout loss since the last report to the peer.
+     */
+    void sendReceiverReport();
+    
+    /**
+     * @brief Runs a function on the network thread and waits for it to return.
+     * @param function The function to run.
+     */
+    void runOnNetworkThread(const std::function<void()> &function);
+    
+    /**
+     * @brief Reads a device channel map from the settings.
+     * @param countKey The key of the channel count.
+     * @param mapKey The key of the explicit channel map (takes precedence).
+     * @return The channel map.
+     */
+    ChannelMap channelMapSetting(const QString &countKey, const QString &mapKey) const;
 
     Ui::MainWindow *ui;
     AudioManager *audioManager;
     NetworkManager *networkManager;
+    QThread *networkThread;
+    RateController *rateController;
     QSettings *settings;
     QTimer *audioLevelTimer;
+    QTimer *reportTimer;
+    SpectrumWidget *spectrumWidget;
+    PlayoutStats lastPlayoutStats;
+    LatencyStats latencyStats;
+    QMetaObject::Connection audioStartConnection;
+    QString captureFile;
+    QString replayFile;
+    ImpairmentProfile impairmentProfile;
+    TransmissionMode sendMode;
+    bool replayRealtime;
     bool isRunning;
+    bool isStarting;
     bool isSenderMode;
 };
 
@@ -0,0 +1,186 @@
+#ifndef NETWORKIMPAIRMENT_H
+#define NETWORKIMPAIRMENT_H
+
+#include <QtCore/QObject>
+#include <QtCore/QByteArray>
+#include <QtCore/QElapsedTimer>
+#include <QtCore/QList>
+#include <QtCore/QString>
+#include <QtCore/QTimer>
+#include <random>
+#include "packetframing.h"
+
+/**
+ * @brief Network conditions the impairment simulator reproduces.
+ *
+ * Loss follows a Gilbert-Elliott model: in the good state packets are lost
+ * with lossPercent, in the bad state with burstLossPercent; the model enters
+ * the bad state with burstEnterPercent and leaves it with burstExitPercent per
+ * packet. Without burstEnterPercent it is plain random loss.
+ */
+struct ImpairmentProfile
+{
+    double lossPercent = 0.0;          ///< Loss probability in the good state
+    double burstEnterPercent = 0.0;    ///< Probability per packet of entering the bad state
+    double burstExitPercent = 100.0;   ///< Probability per packet of leaving the bad state
+    double burstLossPercent = 100.0;   ///< Loss probability in the bad state
+    int delayMs = 0;                   ///< Fixed one-way delay
+    int jitterMs = 0;                  ///< Maximum deviation from the delay (uniform)
+    double reorderPercent = 0.0;       ///< Probability of a packet skipping the delay (overtaking)
+    double duplicatePercent = 0.0;     ///< Probability of a packet arriving twice
+    int rateKbps = 0;                  ///< Bottleneck bandwidth (0 for unlimited)
+    int queueMs = 200;                 ///< Bottleneck queue; packets that would wait longer are dropped
+    quint32 seed = 1;                  ///< Seed of the random decisions, for reproducible runs
+    
+    /**
+     * @brief Checks if the profile changes anything.
+     * @return True if any impairment is configured, false otherwise.
+     */
+    bool isEnabled() const;
+    
+    /**
+     * @brief Parses a profile such as "loss=1,burst=2:30,delay=40,jitter=10,rate=512,seed=7".
+     *
+     * Keys: loss, burst (enter:exit[:loss] in percent), delay, jitter,
+     * reorder, duplicate, rate (kbit/s), queue (ms) and seed.
+     *
+     * @param text The profile description.
+     * @param profile The parsed profile (output).
+     * @param errorMessage Receives the reason if the description is invalid (optional).
+     * @return True if the description was valid, false otherwise.
+     */
+    static bool parse(const QString &text, ImpairmentProfile &profile, QString *errorMessage = nullptr);
+    
+    /**
+     * @brief Describes the profile in the syntax parse() accepts.
+     * @return The description.
+     */
+    QString toString() const;
+};
+
+/**
+ * @brief Counters of the impairment simulator.
+ */
+struct ImpairmentStats
+{
+    quint64 packets = 0;            ///< Packets submitted
+    quint64 lost = 0;               ///< Media packets dropped by the loss model
+    quint64 queueDropped = 0;       ///< Media packets dropped at the full bottleneck queue
+    quint64 duplicated = 0;         ///< Media packets delivered twice
+    quint64 reordered = 0;          ///< Media packets that overtook earlier ones
+};
+
+/**
+ * @brief The NetworkImpairment class degrades received packets like a bad network would.
+ *
+ * It sits between the packet parser and the packet handlers of
+ * NetworkManager. Every submitted packet passes a bottleneck of the
+ * configured rate and queue, then waits for its delay plus jitter in a hold
+ * queue and is handed back through packetReleased() when due. Only media
+ * packets (audio and comfort noise) are lost, duplicated or reordered;
+ * control packets are only delayed and keep their order, so the session
+ * itself survives any profile. All random decisions come from one seeded
+ * generator, so a profile with the same seed impairs a replayed capture the
+ * same way every time.
+ */
+class NetworkImpairment : public QObject
+{
+    Q_OBJECT
+
+public:
+    /**
+     * @brief Constructor for NetworkImpairment.
+     * @param parent The parent object.
+     */
+    explicit NetworkImpairment(QObject *parent = nullptr);
+    
+    /**
+     * @brief Sets the impairments and starts over with the profile's seed.
+     * @param profile The network conditions.
+     */
+    void setProfile(const ImpairmentProfile &profile);
+    
+    /**
+     * @brief Gets the impairments.
+     * @return The network conditions.
+     */
+    ImpairmentProfile getProfile() const;
+    
+    /**
+     * @brief Checks if packets are impaired.
+     * @return True if a profile with impairments is set, false otherwise.
+     */
+    bool isEnabled() const;
+    
+    /**
+     * @brief Impairs a packet; it comes back through packetReleased() unless it is lost.
+     * @param packet The packet (copied).
+     */
+    void submit(const PacketView &packet);
+    
+    /**
+     * @brief Drops every held packet and restarts the bottleneck and the loss model.
+     */
+    void reset();
+    
+    /**
+     * @brief Gets the counters since the profile was set.
+     * @return The statistics.
+     */
+    ImpairmentStats getStats() const;
+
+signals:
+    /**
+     * @brief Signal emitted when a packet is due.
+     * @param packet The packet; its data is only valid during the emission.
+     */
+    void packetReleased(const PacketView &packet);
+
+private slots:
+    /**
+     * @brief Releases the held packets that are due.
+     */
+    void releasePackets();
+
+private:
+    /**
+     * @brief A packet waiting for its release time.
+     */
+    struct HeldPacket
+    {
+        qint64 releaseUs;     ///< When the packet is due
+        char type;            ///< Packet type
+        PacketStamp stamp;    ///< Sequence, timestamp, stream and codec
+        QByteArray payload;   ///< Packet payload
+    };
+    
+    /**
+     * @brief Draws a random decision.
+     * @param percent The probability in percent.
+     * @return True with the given probability.
+     */
+    bool chance(double percent);
+    
+    /**
+     * @brief Queues a packet for release, keeping the hold queue sorted.
+     * @param packet The packet.
+     */
+    void hold(const HeldPacket &packet);
+    
+    /**
+     * @brief Starts the release timer for the earliest held packet.
+     */
+    void scheduleRelease();
+    
+    ImpairmentProfile profile;
+    ImpairmentStats stats;
+    QList<HeldPacket> heldPackets;
+    QTimer *releaseTimer;
+    QElapsedTimer clock;
+    std::mt19937 random;
+    qint64 linkFreeUs;
+    qint64 lastInOrderReleaseUs;
+    bool burstState;
+};
+
+#endif // NETWORKIMPAIRMENT_H
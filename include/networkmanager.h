@@ -8,13 +8,78 @@
 #include <QtCore/QTimer>
 #include <QtCore/QElapsedTimer>
 #include <QtCore/QQueue>
+#include <QtCore/QHash>
 #include <QtCore/QMutex>
+#include <QtCore/QSocketNotifier>
+#include <QtCore/QStringList>
+#include "audioformat.h"
+#include "clocksync.h"
+#include "loadmeter.h"
+#include "networkimpairment.h"
+#include "packetcapture.h"
+#include "packetframing.h"
+#include "relayforwarder.h"
+#include "sessionhandshake.h"
+#include "streamtransport.h"
+
+/**
+ * @brief What to drop when queued audio exceeds the maximum queueing delay.
+ */
+enum class DropPolicy {
+    DropOldest,       ///< Drop the audio packets that waited too long, keep the rest
+    DropToKeyframe    ///< Drop all queued audio up to the newest packet the decoder can resume on
+};
+
+/**
+ * @brief How the bytes of a connection move between the socket and the packets.
+ */
+enum class TransportBackend {
+    Qt,               ///< QTcpSocket reads and writev() sends, one syscall per read or batch
+    Uring             ///< io_uring with a multishot receive and batched sends (Linux, falls back to Qt)
+};
+
+/**
+ * @brief Counters describing the send queue.
+ */
+struct SendQueueStats
+{
+    int queuedPackets;        ///< Packets waiting in the send queue
+    qint64 queuedBytes;       ///< Bytes waiting in the send queue
+    int queueDelayMs;         ///< Time the oldest queued packet has waited
+    quint64 droppedPackets;   ///< Audio packets dropped because they waited too long
+    quint64 droppedBytes;     ///< Bytes of those packets
+};
+
+/**
+ * @brief Where the round trip of the last ping went.
+ *
+ * With kernel timestamps on both peers the round trip splits into the time
+ * spent between the two kernels (the network and the protocol stacks) and
+ * the time the ping and its pong waited in the applications: in the socket
+ * buffers behind audio, in the event loops, and on the way to the socket.
+ * The wire and queueing parts add up to the round trip.
+ */
+struct LatencyStats
+{
+    bool kernelTimestamps = false;  ///< Whether the last exchange was measured with kernel timestamps
+    qint64 roundTripUs = 0;         ///< Round trip between the applications, without the peer's processing
+    qint64 wireRoundTripUs = 0;     ///< Round trip between the kernels (0 without kernel timestamps)
+    qint64 localQueueingUs = 0;     ///< Time the ping and the pong spent in our application and socket buffers
+    qint64 peerQueueingUs = 0;      ///< The same on the peer
+};
+
+Q_DECLARE_METATYPE(LatencyStats)
 
 /**
  * @brief The NetworkManager class handles network communication.
  * 
  * This class is responsible for managing network connections, sending and
  * receiving audio data, handling connection status and errors, and measuring latency.
+ * It is meant to live on a thread of its own: received audio is delivered
+ * through its signals on that thread, and the send methods must be called on
+ * that thread too: they start timers and touch the send queue without a lock.
+ * Other threads hand their audio over through AudioManager's send queue (see
+ * watchAudioQueue()) and their reports through a queued call.
  */
 class NetworkManager : public QObject
 {
@@ -47,29 +112,310 @@ public:
      */
     bool connectToServer(const QString &address, int port);
     
+    /**
+     * @brief Starts a relay: accepts a sender and passes its stream on to downstream receivers.
+     *
+     * The stream is not decoded: the sender's packets are written to every
+     * downstream as they arrived (see RelayForwarder), and nothing is emitted
+     * through audioDataReceived(). The relay answers the sender's hello with
+     * the sender's own capabilities and announces the format of the first
+     * downstream, so the sender streams as it would to that receiver.
+     *
+     * @param port The port to listen on for the sender.
+     * @param downstreams The downstream receivers as "host:port".
+     * @return True if the relay started, false otherwise.
+     */
+    bool startRelay(int port, const QStringList &downstreams);
+    
+    /**
+     * @brief Checks if this manager relays a stream instead of playing it.
+     * @return True if relaying, false otherwise.
+     */
+    bool isRelaying() const;
+    
+    /**
+     * @brief Gets the relay counters.
+     * @return The statistics of the relay, all zero if not relaying.
+     */
+    RelayStats getRelayStats() const;
+    
     /**
      * @brief Disconnects from the server or stops the server.
+     *
+     * This ends the session, so the peer can no longer resume it.
      */
     void disconnect();
     
+    /**
+     * @brief Enables or disables reconnecting automatically after the link drops.
+     *
+     * The client retries with jittered exponential backoff and resumes the
+     * session. The server keeps the session open for the client to come back.
+     *
+     * @param enabled Whether to reconnect automatically.
+     */
+    void setAutoReconnect(bool enabled);
+    
     /**
      * @brief Sends audio data to the connected peer.
+     *
+     * The capture time goes into the packet header (of a batch packet, the
+     * capture time of its first frame), so the peer can schedule playout.
+     * Call on the network thread.
+     *
      * @param data The audio data to send.
+     * @param captureTimeUs When the first frame was captured, on the ClockSync::now() clock
+     *                      (0 for the send time).
      * @return True if data was queued for sending, false otherwise.
      */
-    bool sendAudioData(const QByteArray &data);
+    bool sendAudioData(const QByteArray &data, qint64 captureTimeUs = 0);
+    
+    /**
+     * @brief Tells the peer that the input is silent (instead of sending audio).
+     * @param noiseLevel The RMS level of the background noise.
+     * @return True if the update was queued for sending, false otherwise.
+     */
+    bool sendComfortNoise(float noiseLevel);
     
     /**
      * @brief Gets the current latency.
+     *
+     * The wire round trip when the connection has kernel timestamps, the
+     * round trip between the applications otherwise.
+     *
      * @return The current latency in milliseconds.
      */
     int getLatency() const;
     
+    /**
+     * @brief Gets the breakdown of the last measured round trip.
+     * @return The latency statistics.
+     */
+    LatencyStats getLatencyStats() const;
+    
     /**
      * @brief Checks if connected to a peer.
      * @return True if connected, false otherwise.
      */
     bool isConnected() const;
+    
+    /**
+     * @brief Sets how many audio frames are aggregated into one packet.
+     * @param frames The number of frames per packet (1 disables aggregation).
+     */
+    void setFramesPerPacket(int frames);
+    
+    /**
+     * @brief Gets the number of audio frames aggregated into one packet.
+     * @return The number of frames per packet.
+     */
+    int getFramesPerPacket() const;
+    
+    /**
+     * @brief Sets the maximum time a frame may wait for aggregation.
+     * @param delayMs The latency cap in milliseconds.
+     */
+    void setMaxAggregationDelay(int delayMs);
+    
+    /**
+     * @brief Gets the maximum time a frame may wait for aggregation.
+     * @return The latency cap in milliseconds.
+     */
+    int getMaxAggregationDelay() const;
+    
+    /**
+     * @brief Sets how long audio may wait in the send queue before it is dropped.
+     *
+     * Audio is only handed to the socket while the kernel send buffer has room,
+     * so under congestion it waits in the send queue, where the drop policy
+     * keeps the queueing delay bounded. Control packets are never dropped.
+     *
+     * @param delayMs The maximum queueing delay in milliseconds.
+     * @param policy What to drop once queued audio is older than that.
+     */
+    void setSendQueueLimit(int delayMs, DropPolicy policy);
+    
+    /**
+     * @brief Gets the send queue counters.
+     * @return The send queue statistics since startServer() or connectToServer().
+     */
+    SendQueueStats getSendQueueStats() const;
+    
+    /**
+     * @brief Gets the time spent receiving, dispatching and sending packets.
+     *
+     * The receive path includes the decoding and playout buffering it drives
+     * through audioDataReceived().
+     *
+     * @return The time in nanoseconds since construction (compare two reads for a load).
+     */
+    qint64 getBusyTime() const;
+    
+    /**
+     * @brief Gets the memory held by the receive buffer and the packets waiting to be sent.
+     * @return The size in bytes (approximate).
+     */
+    qint64 getBufferMemory() const;
+    
+    /**
+     * @brief Sets the transport used by the next connection.
+     *
+     * The io_uring transport takes over the socket once it is connected. Where
+     * it is not available (not built in, kernel too old) the connection stays
+     * on the Qt socket.
+     *
+     * @param backend The transport backend.
+     */
+    void setTransportBackend(TransportBackend backend);
+    
+    /**
+     * @brief Checks if the current connection runs on the io_uring transport.
+     * @return True if it does, false otherwise.
+     */
+    bool isUsingUring() const;
+    
+    /**
+     * @brief Sets whether the next connection measures its latency with kernel timestamps.
+     *
+     * On Linux, a connection on the Qt backend then moves to a socket
+     * transport that reads the kernel's software send and receive timestamps
+     * (SO_TIMESTAMPING); the io_uring backend has none and keeps the
+     * application's times. Elsewhere this has no effect. Off by default,
+     * since it takes the connection off Qt's socket.
+     *
+     * @param enabled True to use kernel timestamps, false otherwise.
+     */
+    void setKernelTimestamps(bool enabled);
+    
+    /**
+     * @brief Checks if the current connection has kernel timestamps.
+     * @return True if it does, false otherwise.
+     */
+    bool isUsingKernelTimestamps() const;
+    
+    /**
+     * @brief Emits readyForAudio() whenever a descriptor turns readable.
+     *
+     * Call on the network thread with AudioManager::getSendQueueDescriptor(),
+     * so the thread wakes only when the send path has queued packets. Without
+     * a descriptor (-1) the queue is polled every millisecond while connected.
+     *
+     * @param descriptor The descriptor to watch, -1 to poll.
+     */
+    void watchAudioQueue(int descriptor);
+    
+    /**
+     * @brief Impairs received packets like a bad network would (for soak tests).
+     *
+     * Applies to the live connection and to replayed captures; the simulator
+     * starts over with the profile's seed whenever a connection ends.
+     *
+     * @param profile The network conditions (a profile without impairments disables it).
+     */
+    void setImpairment(const ImpairmentProfile &profile);
+    
+    /**
+     * @brief Gets the counters of the impairment simulator.
+     * @return The statistics since the impairment was set.
+     */
+    ImpairmentStats getImpairmentStats() const;
+    
+    /**
+     * @brief Sets the local device layouts announced to the peer.
+     *
+     * The format is sent first thing on every connection, and right away if
+     * already connected.
+     *
+     * @param inputMap The channel map of the input device.
+     * @param outputMap The channel map of the output device.
+     */
+    void setLocalFormat(const ChannelMap &inputMap, const ChannelMap &outputMap);
+    
+    /**
+     * @brief Sets the capabilities announced to the peer in the handshake.
+     *
+     * Both sides send a hello first thing on every connection and agree on the
+     * transmission mode and packet size (see SessionHandshake). A peer that
+     * cannot agree, or that speaks another protocol version, fails the
+     * connection with an error instead of producing garbled audio.
+     *
+     * @param capabilities The local capabilities.
+     */
+    void setLocalCapabilities(const SessionCapabilities &capabilities);
+    
+    /**
+     * @brief Gets the number of bytes waiting to be sent.
+     *
+     * This covers the send queue, frames waiting for aggregation, the socket's
+     * write buffer and (on Linux) the kernel send queue.
+     *
+     * @return The send backlog in bytes.
+     */
+    qint64 getSendBacklog() const;
+    
+    /**
+     * @brief Starts logging every received packet to a capture file.
+     * @param filePath The path of the capture file to create.
+     * @return True if the capture file was created, false otherwise.
+     */
+    bool startCapture(const QString &filePath);
+    
+    /**
+     * @brief Stops logging received packets and closes the capture file.
+     */
+    void stopCapture();
+    
+    /**
+     * @brief Feeds a capture file through the receive pipeline instead of a peer.
+     *
+     * Packets are dispatched at their recorded arrival times, or back to back
+     * (a batch per event loop iteration) when realtime is false. Ping and pong
+     * packets belong to the recorded connection and are skipped. Call
+     * disconnect() to abort the replay.
+     *
+     * @param filePath The path of the capture file.
+     * @param realtime Whether to reproduce the recorded timing.
+     * @return True if the replay started, false otherwise.
+     */
+    bool startReplay(const QString &filePath, bool realtime);
+    
+    /**
+     * @brief Checks if a capture file is being replayed.
+     * @return True if replaying, false otherwise.
+     */
+    bool isReplaying() const;
+    
+    /**
+     * @brief Gets the estimated relation between the peer's clock and ours.
+     *
+     * The ping exchange doubles as an NTP-style clock exchange on the
+     * monotonic clocks of both sides (see ClockSync). The estimate survives a
+     * resumed connection and is forgotten when the session ends.
+     *
+     * @return The estimate; not synchronized until a few exchanges were made.
+     */
+    ClockEstimate getClockEstimate() const;
+
+public slots:
+    /**
+     * @brief Sends a playout loss report to the peer.
+     * @param framesExpected The number of frames the output device requested.
+     * @param framesLost The number of those frames that had no audio.
+     */
+    void sendReceiverReport(quint32 framesExpected, quint32 framesLost);
+    
+    /**
+     * @brief Announces the format of the audio we send from now on.
+     *
+     * The announcement is queued behind the audio already queued, so the peer
+     * switches its decoder exactly between the last packet in the old format
+     * and the first one in the new format.
+     *
+     * @param mode The transmission mode of the stream.
+     * @param bitrate The bitrate of the stream in bits per second.
+     * @return True if the announcement was queued for sending, false otherwise.
+     */
+    bool sendCodec(TransmissionMode mode, int bitrate);
 
 signals:
     /**
@@ -81,9 +427,57 @@ signals:
     
     /**
      * @brief Signal emitted when audio data is received.
+     *
+     * The data references the receive buffer and is only valid while the signal
+     * is being emitted, so receivers must use a direct connection and consume
+     * (decode or copy) it before returning.
+     *
      * @param data The received audio data.
+     * @param captureTimeUs When the peer captured it, converted to our ClockSync::now() clock;
+     *                      the frames of a batch share the batch's time. 0 until the clocks
+     *                      are synchronized.
+     */
+    void audioDataReceived(const QByteArray &data, qint64 captureTimeUs);
+    
+    /**
+     * @brief Signal emitted when the peer reports that its input is silent.
+     * @param noiseLevel The RMS level of the peer's background noise.
+     */
+    void comfortNoiseReceived(float noiseLevel);
+    
+    /**
+     * @brief Signal emitted when the peer announces its device layouts.
+     * @param inputMap The channel map of the peer's input device.
+     * @param outputMap The channel map of the peer's output device.
+     */
+    void peerFormatReceived(const ChannelMap &inputMap, const ChannelMap &outputMap);
+    
+    /**
+     * @brief Signal emitted when the peer announces the format of its audio.
+     *
+     * Like audioDataReceived(), receivers must use a direct connection so the
+     * switch happens in order with the audio.
+     *
+     * @param mode The transmission mode of the peer's stream.
+     * @param bitrate The bitrate of the peer's stream in bits per second.
+     */
+    void peerCodecReceived(TransmissionMode mode, int bitrate);
+    
+    /**
+     * @brief Signal emitted when the session with the peer is over.
+     *
+     * A dropped connection that is resumed does not end the session. It ends
+     * when disconnect() is called, when a different peer connects, or when the
+     * peer does not come back in time. Whatever was learned about the peer
+     * (its format and codec) is void from then on.
+     */
+    void sessionEnded();
+    
+    /**
+     * @brief Signal emitted when the handshake with the peer has agreed on the session.
+     * @param session The agreed transmission mode, sample rate and packet size.
      */
-    void audioDataReceived(const QByteArray &data);
+    void sessionNegotiated(const NegotiatedSession &session);
     
     /**
      * @brief Signal emitted when the latency changes.
@@ -91,6 +485,55 @@ signals:
      */
     void latencyChanged(int latencyMs);
     
+    /**
+     * @brief Signal emitted when a clock exchange updated the estimate of the peer's clock.
+     * @param estimate The new estimate.
+     */
+    void clockEstimateChanged(const ClockEstimate &estimate);
+    
+    /**
+     * @brief Signal emitted when a ping measured the round trip.
+     * @param stats The breakdown of the round trip.
+     */
+    void latencyStatsChanged(const LatencyStats &stats);
+    
+    /**
+     * @brief Signal emitted periodically with the current send backlog.
+     * @param bytes The number of bytes waiting to be sent.
+     */
+    void sendBacklogChanged(qint64 bytes);
+    
+    /**
+     * @brief Signal emitted when queued audio was dropped because it waited too long.
+     *
+     * The link cannot carry the stream at its current rate; the encoder should back off.
+     *
+     * @param packets The number of packets dropped.
+     */
+    void sendQueueOverflowed(int packets);
+    
+    /**
+     * @brief Signal emitted when the audio send path has queued packets (see watchAudioQueue()).
+     *
+     * The audio threads queue their packets instead of signalling the network
+     * thread; a direct connection to this signal collects them (see
+     * AudioManager::drainSendQueue()).
+     */
+    void readyForAudio();
+    
+    /**
+     * @brief Signal emitted when the peer reports its playout loss.
+     * @param framesExpected The number of frames the peer expected to play.
+     * @param framesLost The number of those frames that were missing.
+     */
+    void receiverReportReceived(quint32 framesExpected, quint32 framesLost);
+    
+    /**
+     * @brief Signal emitted when a replay has dispatched its last packet.
+     * @param packets The number of packets replayed.
+     */
+    void replayFinished(qint64 packets);
+    
     /**
      * @brief Signal emitted when an error occurs.
      * @param errorMessage The error message.
@@ -134,8 +577,175 @@ private slots:
      * @brief Processes the send queue.
      */
     void processSendQueue();
+    
+    /**
+     * @brief Moves the pending aggregated frames into the send queue.
+     */
+    void flushPendingFrames();
+    
+    /**
+     * @brief Publishes the transport statistics.
+     */
+    void updateStatistics();
+    
+    /**
+     * @brief Dispatches the replayed packets that are due.
+     */
+    void replayPackets();
+    
+    /**
+     * @brief Opens a new connection to the server for the current session.
+     */
+    void reconnect();
+    
+    /**
+     * @brief Reads the session packet of a connection that may take over the current one.
+     */
+    void readResumeRequest();
+    
+    /**
+     * @brief Ends the session (the peer did not come back in time, or another client took over).
+     */
+    void endSession();
+    
+    /**
+     * @brief Records the kernel send time of a ping, or sends that of a pong to the peer.
+     * @param id The id of the timestamp.
+     * @param timeUs The send time on our clock.
+     */
+    void handleTransmitTimestamp(qint64 id, qint64 timeUs);
 
 private:
+    /**
+     * @brief A clock exchange waiting for the kernel send time of its pong.
+     */
+    struct ClockExchange
+    {
+        qint64 pingSendUs = 0;          ///< Our ping leaving the application (t1)
+        qint64 pingReceiveUs = 0;       ///< The peer's application receiving it (t2)
+        qint64 pongSendUs = 0;          ///< The peer's application sending the pong (t3)
+        qint64 pongReceiveUs = 0;       ///< Our application receiving it (t4)
+        qint64 pingTransmitUs = 0;      ///< Our kernel sending the ping (k1)
+        qint64 pingArrivalUs = 0;       ///< The peer's kernel receiving it (k2)
+        qint64 pongArrivalUs = 0;       ///< Our kernel receiving the pong (k4)
+    };
+    
+    /**
+     * @brief Applies low-delay options to the connected socket.
+     */
+    void configureSocket();
+    
+    /**
+     * @brief Connects the signals of the current client socket.
+     */
+    void connectSocketSignals();
+    
+    /**
+     * @brief Moves the connected client socket to the io_uring transport, or
+     *        to the socket transport for kernel timestamps, if selected.
+     */
+    void startTransport();
+    
+    /**
+     * @brief Closes the transport of the current connection, if any.
+     */
+    void closeTransport();
+    
+    /**
+     * @brief Starts a connection attempt to the server.
+     */
+    void openConnection();
+    
+    /**
+     * @brief Ends the session from inside a handler of the connection.
+     *
+     * disconnect() closes the socket, which must not happen while one of its
+     * signals is being handled, so the teardown is queued.
+     */
+    void dropConnection();
+    
+    /**
+     * @brief Makes a connected socket the client socket (server side).
+     * @param socket The connected socket.
+     * @param message The connection status message.
+     */
+    void acceptClient(QTcpSocket *socket, const QString &message);
+    
+    /**
+     * @brief Schedules the next reconnect attempt.
+     */
+    void scheduleReconnect();
+    
+    /**
+     * @brief Sends the session token to the server.
+     */
+    void sendSession();
+    
+    /**
+     * @brief Sends the local format to the peer.
+     */
+    void sendFormat();
+    
+    /**
+     * @brief Sends the local capabilities to the peer.
+     */
+    void sendHello();
+    
+    /**
+     * @brief Stamps an audio packet with the next sequence number (sendQueueMutex held).
+     * @param timeUs The capture time of the audio (0 for the send time).
+     * @return The stamp.
+     */
+    PacketStamp mediaStamp(qint64 timeUs = 0);
+    
+    /**
+     * @brief Converts the timestamp of a received packet to our clock.
+     * @param stamp The packet's stamp.
+     * @return The local time, 0 while the clocks are not synchronized.
+     */
+    qint64 localPacketTime(const PacketStamp &stamp) const;
+    
+    /**
+     * @brief Stamps a control packet, which carries no sequence number.
+     * @return The stamp.
+     */
+    PacketStamp controlStamp() const;
+    
+    /**
+     * @brief Writes a batch of packets to the socket with as few syscalls as possible.
+     *
+     * With all set, every packet is written and whatever the kernel does not
+     * take is buffered by Qt. Otherwise writing stops once the kernel send
+     * buffer is full: at most one more packet is handed to Qt (whose
+     * bytesWritten() signal resumes sending), and the rest stays with the
+     * caller, where it can still be dropped.
+     *
+     * @param packets The packets to write, in order.
+     * @param all Whether every packet must be written.
+     * @param timestampId Receives the id of the kernel send timestamp of the
+     *                    last packet, -1 if there is none (optional).
+     * @return The number of packets written or buffered by Qt.
+     */
+    int writePackets(const QList<OutgoingPacket> &packets, bool all = true, qint64 *timestampId = nullptr);
+    
+    /**
+     * @brief Appends a packet to the send queue and wakes up the sender (sendQueueMutex held).
+     * @param packet The packet.
+     */
+    void enqueuePacket(OutgoingPacket packet);
+    
+    /**
+     * @brief Applies the drop policy to the send queue (sendQueueMutex held).
+     * @return The number of packets dropped.
+     */
+    int dropExpiredPackets();
+    
+    /**
+     * @brief Dispatches a parsed packet to its handler.
+     * @param packet The packet, referencing the receive buffer.
+     */
+    void dispatchPacket(const PacketView &packet);
+    
     /**
      * @brief Handles a ping packet.
      * @param data The ping packet data.
@@ -148,37 +758,149 @@ private:
      */
     void handlePongPacket(const QByteArray &data);
     
+    /**
+     * @brief Handles a pong follow-up packet, which completes a waiting clock exchange.
+     * @param data The follow-up packet data.
+     */
+    void handlePongFollowUpPacket(const QByteArray &data);
+    
+    /**
+     * @brief Feeds a clock exchange to the clock estimate and updates the latency.
+     * @param exchange The exchange.
+     * @param pongTransmitUs The peer's kernel sending the pong (k3), -1 to use the application times.
+     */
+    void completeClockExchange(const ClockExchange &exchange, qint64 pongTransmitUs);
+    
     /**
      * @brief Handles an audio packet.
      * @param data The audio packet data.
+     * @param captureTimeUs The capture time on our clock (0 if unknown).
+     */
+    void handleAudioPacket(const QByteArray &data, qint64 captureTimeUs);
+    
+    /**
+     * @brief Handles a receiver report packet.
+     * @param data The report packet data.
      */
-    void handleAudioPacket(const QByteArray &data);
+    void handleReportPacket(const QByteArray &data);
     
     /**
-     * @brief Creates a packet with the specified type and data.
-     * @param type The packet type.
-     * @param data The packet data.
-     * @return The complete packet.
+     * @brief Handles a comfort noise packet.
+     * @param data The comfort noise packet data.
      */
-    QByteArray createPacket(char type, const QByteArray &data) const;
+    void handleComfortNoisePacket(const QByteArray &data);
     
     /**
-     * @brief Parses a packet.
-     * @param packet The packet to parse.
-     * @param type The packet type (output).
-     * @param data The packet data (output).
-     * @return True if parsing was successful, false otherwise.
+     * @brief Handles a format packet.
+     * @param data The format packet data.
      */
-    bool parsePacket(const QByteArray &packet, char &type, QByteArray &data) const;
+    void handleFormatPacket(const QByteArray &data);
+    
+    /**
+     * @brief Decodes the payload of a format packet.
+     * @param data The format packet data.
+     * @param inputMap Receives the channel map of the input device.
+     * @param outputMap Receives the channel map of the output device.
+     * @return True if the payload was complete, false otherwise.
+     */
+    static bool decodeFormat(const QByteArray &data, ChannelMap &inputMap, ChannelMap &outputMap);
+    
+    /**
+     * @brief Handles a codec packet.
+     * @param data The codec packet data.
+     */
+    void handleCodecPacket(const QByteArray &data);
+    
+    /**
+     * @brief Handles a session packet.
+     * @param data The session packet data.
+     */
+    void handleSessionPacket(const QByteArray &data);
+    
+    /**
+     * @brief Handles a hello packet.
+     * @param data The hello packet data.
+     */
+    void handleHelloPacket(const QByteArray &data);
+    
+    /**
+     * @brief Handles an aggregated audio packet carrying several frames.
+     * @param packet The aggregated packet, referencing the receive buffer.
+     */
+    void handleAudioBatchPacket(const PacketView &packet);
+    
+    /**
+     * @brief Ends a replay and closes the capture file.
+     */
+    void stopReplay();
 
     QTcpServer *server;
     QTcpSocket *clientSocket;
+    StreamTransport *transport;
+    NetworkImpairment *impairment;
+    RelayForwarder *relay;
     QTimer *pingTimer;
     QTimer *sendQueueTimer;
-    QElapsedTimer latencyTimer;
-    QQueue<QByteArray> sendQueue;
-    QMutex sendQueueMutex;
+    QTimer *aggregationTimer;
+    QTimer *statsTimer;
+    QTimer *replayTimer;
+    QTimer *reconnectTimer;
+    QTimer *sessionTimer;
+    QTimer *audioPollTimer;
+    QSocketNotifier *audioNotifier;
+    QTcpSocket *resumeSocket;
+    QElapsedTimer receiveClock;
+    QElapsedTimer queueClock;
+    QQueue<OutgoingPacket> sendQueue;
+    mutable QMutex sendQueueMutex;
+    QList<QByteArray> pendingFrames;
+    qint64 pendingCaptureUs;
+    qint64 sendQueueBytes;
+    qint64 pendingFrameBytes;
+    quint64 droppedPackets;
+    quint64 droppedBytes;
+    int maxQueueDelayMs;
+    DropPolicy dropPolicy;
+    TransportBackend transportBackend;
+    bool kernelTimestamps;
+    QByteArray receiveBuffer;
+    CaptureWriter captureWriter;
+    CaptureReader captureReader;
+    CaptureRecord replayRecord;
+    QElapsedTimer replayClock;
+    qint64 replayedPackets;
+    bool replayRecordPending;
+    bool replayRealtime;
+    ChannelMap localInputMap;
+    ChannelMap localOutputMap;
+    SessionCapabilities localCapabilities;
+    ClockSync clockSync;
+    qint64 receiveTimeUs;
+    qint64 receiveTimestampUs;
+    
+    // Kernel send timestamps requested for pings (id -> ping send time),
+    // received for pings awaiting their pong (send time -> kernel time), and
+    // requested for pongs (id -> the peer's ping send time, our pong send
+    // time); exchanges whose pong awaits its follow-up (ping send time -> exchange)
+    QHash<qint64, qint64> pingTimestampIds;
+    QHash<qint64, qint64> pingTransmitTimes;
+    QHash<qint64, QPair<qint64, qint64>> pongTimestampIds;
+    QHash<qint64, ClockExchange> pendingExchanges;
+    LatencyStats latencyStats;
+    LoadMeter loadMeter;
+    quint32 sendSequence;
+    quint8 sendCodecId;
+    int framesPerPacket;
+    int negotiatedFramesPerPacket;
+    int maxAggregationDelayMs;
     int currentLatency;
+    QString serverAddress;
+    int serverPort;
+    quint64 sessionToken;
+    int reconnectAttempts;
+    bool autoReconnect;
+    bool sessionEstablished;
+    bool disconnectPending;
     bool isServer;
     bool connected;
 };
@@ -0,0 +1,166 @@
+#ifndef OPUSCODEC_H
+#define OPUSCODEC_H
+
+#include <QtCore/QByteArray>
+#include <QtCore/QString>
+#include <QtCore/QVector>
+#include "audioformat.h"
+
+/**
+ * @brief A packet completed by the encoder.
+ */
+struct EncodedPacket
+{
+    const char *data;    ///< The packet bytes, valid until the next encode()
+    int size;            ///< Size of the packet in bytes, 0 if none was completed
+    int frames;          ///< Frames of audio in the packet
+};
+
+/**
+ * @brief The OpusCodec class wraps an Opus encoder/decoder pair.
+ *
+ * When AudioBridge is built with libopus (AUDIOBRIDGE_HAVE_OPUS) the audio is
+ * really compressed. Buffers from the audio device are re-framed into valid Opus
+ * frame durations, so one input buffer may produce zero or several packets.
+ * Without libopus the codec falls back to an uncompressed passthrough format.
+ *
+ * Both halves use the Opus multistream API, so any channel map up to
+ * MAX_CHANNELS can be coded: left/right pairs become coupled (stereo) streams,
+ * every other channel a mono stream. The state memory is allocated for the
+ * largest layout in open(), so changing the channel map does not allocate.
+ *
+ * The encoder and decoder halves are independent: encode() may run on the
+ * capture thread while decode() runs on the network thread. The encoder
+ * controls must be called from the thread that encodes.
+ */
+class OpusCodec
+{
+public:
+    /**
+     * @brief Constructor for OpusCodec.
+     */
+    OpusCodec();
+    
+    /**
+     * @brief Destructor for OpusCodec.
+     */
+    ~OpusCodec();
+    
+    /**
+     * @brief Creates the encoder and decoder, both for stereo.
+     * @param sampleRate The sample rate.
+     * @param errorMessage The error description (output), if opening fails.
+     * @return True if the codec is ready, false otherwise.
+     */
+    bool open(int sampleRate, QString *errorMessage = nullptr);
+    
+    /**
+     * @brief Destroys the encoder and decoder.
+     */
+    void close();
+    
+    /**
+     * @brief Checks if the codec is open.
+     * @return True if open, false otherwise.
+     */
+    bool isOpen() const;
+    
+    /**
+     * @brief Re-initializes the encoder for a channel map (encoding thread).
+     *
+     * Any partially collected frame is discarded.
+     *
+     * @param map The channel map of the encoded stream.
+     * @return True if successful, false otherwise.
+     */
+    bool setEncoderChannelMap(const ChannelMap &map);
+    
+    /**
+     * @brief Re-initializes the decoder for a channel map (decoding thread).
+     * @param map The channel map of the decoded stream.
+     * @return True if successful, false otherwise.
+     */
+    bool setDecoderChannelMap(const ChannelMap &map);
+    
+    /**
+     * @brief Sets the target encoder bitrate.
+     * @param bitsPerSecond The bitrate in bits per second.
+     */
+    void setBitrate(int bitsPerSecond);
+    
+    /**
+     * @brief Gets the target encoder bitrate.
+     * @return The bitrate in bits per second.
+     */
+    int getBitrate() const;
+    
+    /**
+     * @brief Enables or disables in-band forward error correction.
+     * @param enabled Whether FEC is enabled.
+     */
+    void setFec(bool enabled);
+    
+    /**
+     * @brief Sets the packet loss the encoder should be robust against.
+     * @param percent The expected packet loss (0-100).
+     */
+    void setPacketLossPercent(int percent);
+    
+    /**
+     * @brief Sets the duration of each encoded frame.
+     * @param milliseconds The frame duration (5, 10, 20, 40 or 60 ms).
+     */
+    void setFrameDuration(int milliseconds);
+    
+    /**
+     * @brief Gets the duration of each encoded frame.
+     * @return The frame duration in milliseconds.
+     */
+    int getFrameDuration() const;
+    
+    /**
+     * @brief Gets the number of frames waiting in the encoder for a whole Opus frame.
+     * @return The number of frames.
+     */
+    int getPendingFrames() const;
+    
+    /**
+     * @brief Encodes interleaved samples until a packet is complete.
+     *
+     * Stops after the first completed packet, so a buffer that completes
+     * several takes one call per packet. The packet lives in a buffer
+     * allocated by open(); encoding does not allocate.
+     *
+     * @param samples The interleaved input samples.
+     * @param frames The number of frames in the input.
+     * @param packet The completed packet (output), its size is 0 if the input was used up first.
+     * @return The number of input frames consumed.
+     */
+    int encode(const float *samples, int frames, EncodedPacket &packet);
+    
+    /**
+     * @brief Decodes a packet.
+     * @param packet The encoded packet.
+     * @param output The decoded interleaved samples (output).
+     * @return The number of decoded frames, or -1 on error.
+     */
+    int decode(const QByteArray &packet, QVector<float> &output);
+
+private:
+    void *encoder;
+    void *decoder;
+    int sampleRate;
+    int encoderChannels;
+    int decoderChannels;
+    int bitrate;
+    int packetLossPercent;
+    bool fec;
+    int frameDurationMs;
+    int frameSize;
+    int requestedFrameSize;
+    QVector<float> pendingInput;
+    int pendingFrames;
+    QByteArray encodeBuffer;
+};
+
+#endif // OPUSCODEC_H
@@ -0,0 +1,171 @@
+#ifndef PACKETCAPTURE_H
+#define PACKETCAPTURE_H
+
+#include <QtCore/QFile>
+#include <QtCore/QByteArray>
+#include <QtCore/QElapsedTimer>
+#include "packetframing.h"
+
+/**
+ * @brief A packet read back from a capture file.
+ */
+struct CaptureRecord
+{
+    qint64 timestampUs;   ///< Arrival time in microseconds since the capture started
+    PacketView packet;    ///< The packet, referencing the mapped file
+};
+
+/**
+ * @brief The CaptureWriter class logs received packets to a capture file.
+ *
+ * A capture file starts with a 16-byte header: the magic "ABPC", a 32-bit
+ * format version and the wall-clock start time in milliseconds since the
+ * epoch. Every record is a 32-bit little-endian delta in microseconds since
+ * the previous record (measured on the monotonic clock), followed by the
+ * packet exactly as it was framed on the wire. Records are collected in a
+ * memory buffer and written in large blocks.
+ */
+class CaptureWriter
+{
+public:
+    /**
+     * @brief Constructor for CaptureWriter.
+     */
+    CaptureWriter();
+    
+    /**
+     * @brief Destructor for CaptureWriter.
+     */
+    ~CaptureWriter();
+    
+    /**
+     * @brief Creates a capture file.
+     * @param filePath The path of the file to create.
+     * @param errorMessage Receives the reason of a failure (optional).
+     * @return True if the file was created, false otherwise.
+     */
+    bool open(const QString &filePath, QString *errorMessage = nullptr);
+    
+    /**
+     * @brief Flushes and closes the capture file.
+     */
+    void close();
+    
+    /**
+     * @brief Checks if a capture file is open.
+     * @return True if open, false otherwise.
+     */
+    bool isOpen() const;
+    
+    /**
+     * @brief Logs a received packet with the current arrival time.
+     * @param packet The packet, referencing the receive buffer.
+     * @return True if successful, false on a write error.
+     */
+    bool write(const PacketView &packet);
+    
+    /**
+     * @brief Gets the number of packets logged.
+     * @return The packet count.
+     */
+    qint64 getPacketCount() const;
+    
+    /**
+     * @brief Gets the description of the last error.
+     * @return The error message.
+     */
+    QString errorString() const;
+
+private:
+    /**
+     * @brief Writes the buffered records to the file.
+     * @return True if successful, false on a write error.
+     */
+    bool flush();
+    
+    QFile file;
+    QByteArray buffer;
+    QElapsedTimer clock;
+    qint64 lastTimestampUs;
+    qint64 packetCount;
+};
+
+/**
+ * @brief The CaptureReader class reads a capture file written by CaptureWriter.
+ *
+ * The file is memory-mapped and the records are parsed in place, so reading
+ * a large capture costs no copies and no more memory than the pages touched.
+ */
+class CaptureReader
+{
+public:
+    /**
+     * @brief Constructor for CaptureReader.
+     */
+    CaptureReader();
+    
+    /**
+     * @brief Destructor for CaptureReader.
+     */
+    ~CaptureReader();
+    
+    /**
+     * @brief Opens and maps a capture file.
+     * @param filePath The path of the capture file.
+     * @param errorMessage Receives the reason of a failure (optional).
+     * @return True if the file is a valid capture, false otherwise.
+     */
+    bool open(const QString &filePath, QString *errorMessage = nullptr);
+    
+    /**
+     * @brief Unmaps and closes the capture file.
+     */
+    void close();
+    
+    /**
+     * @brief Checks if a capture file is open.
+     * @return True if open, false otherwise.
+     */
+    bool isOpen() const;
+    
+    /**
+     * @brief Reads the next record.
+     *
+     * The record references the mapped file and stays valid until close().
+     *
+     * @param record The record (output).
+     * @return True if a record was read, false at the end of the capture.
+     */
+    bool next(CaptureRecord &record);
+    
+    /**
+     * @brief Goes back to the first record.
+     */
+    void rewind();
+    
+    /**
+     * @brief Checks if reading stopped in front of an incomplete record.
+     *
+     * Only meaningful once next() has returned false, e.g. for a capture cut
+     * short by a crash.
+     *
+     * @return True if bytes are left after the last complete record, false otherwise.
+     */
+    bool isTruncated() const;
+    
+    /**
+     * @brief Gets the wall-clock time the capture started.
+     * @return The start time in milliseconds since the epoch.
+     */
+    qint64 getStartTime() const;
+
+private:
+    QFile file;
+    const uchar *data;
+    qint64 size;
+    qint64 offset;
+    qint64 timestampUs;
+    qint64 startTime;
+};
+
+#endif // PACKETCAPTURE_H
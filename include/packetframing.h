@@ -0,0 +1,178 @@
+#ifndef PACKETFRAMING_H
+#define PACKETFRAMING_H
+
+#include <QtCore/QByteArray>
+#include <QtCore/QList>
+#include <QtCore/QString>
+
+// Packet types
+const char PACKET_TYPE_AUDIO = 'A';
+const char PACKET_TYPE_AUDIO_BATCH = 'B';
+const char PACKET_TYPE_PING = 'P';
+const char PACKET_TYPE_PONG = 'O';
+const char PACKET_TYPE_PONG_FOLLOW_UP = 'T';
+const char PACKET_TYPE_REPORT = 'R';
+const char PACKET_TYPE_COMFORT_NOISE = 'N';
+const char PACKET_TYPE_FORMAT = 'F';
+const char PACKET_TYPE_CODEC = 'C';
+const char PACKET_TYPE_SESSION = 'S';
+const char PACKET_TYPE_HELLO = 'H';
+
+// Codec of a packet's payload
+const quint8 PACKET_CODEC_NONE = 0;      ///< Control packet
+const quint8 PACKET_CODEC_RAW = 1;       ///< 32-bit float samples, interleaved, little-endian
+const quint8 PACKET_CODEC_OPUS = 2;      ///< Opus multistream packets
+
+/**
+ * @brief Per-packet header fields besides the type and the length.
+ */
+struct PacketStamp
+{
+    quint32 sequence = 0;               ///< Position of the packet in the sender's stream
+    quint32 timestamp = 0;              ///< Send time (capture time for audio) in microseconds on the sender's clock (wraps)
+    quint8 stream = 0;                  ///< Stream the packet belongs to
+    quint8 codec = PACKET_CODEC_NONE;   ///< Codec of the payload
+};
+
+/**
+ * @brief A packet queued for sending.
+ *
+ * The header is built in a small inline buffer and the payload segments are
+ * implicitly shared with whoever produced them, so framing never copies audio
+ * data. The transport sends the header and the segments as separate iovecs.
+ */
+struct OutgoingPacket
+{
+    QByteArray header;            ///< Packet header (and any per-frame length table)
+    QList<QByteArray> payloads;   ///< Payload segments, sent back to back after the header
+    qint64 queuedAtMs = 0;        ///< When the packet entered the send queue (monotonic)
+    
+    /**
+     * @brief Gets the total number of bytes on the wire.
+     * @return The header size plus the size of every payload segment.
+     */
+    int wireSize() const;
+    
+    /**
+     * @brief Checks if the packet carries audio, which may be dropped under congestion.
+     * @return True for audio and audio batch packets, false for control packets.
+     */
+    bool isDroppable() const;
+};
+
+/**
+ * @brief A parsed packet referencing memory inside the receive buffer.
+ *
+ * A view is only valid until the receive buffer is next modified, i.e. for the
+ * duration of the packet handler.
+ */
+struct PacketView
+{
+    char type;          ///< Packet type
+    const char *data;   ///< Start of the payload inside the receive buffer
+    int size;           ///< Payload size in bytes
+    PacketStamp stamp;  ///< Sequence number, timestamp, stream and codec
+    
+    /**
+     * @brief Wraps the payload in a QByteArray without copying it.
+     * @return A QByteArray referencing the receive buffer.
+     */
+    QByteArray payload() const;
+};
+
+/**
+ * @brief Why a buffer does not start with a valid packet.
+ */
+enum class PacketError {
+    None,           ///< No error (the packet may just be incomplete)
+    Version,        ///< The peer speaks another protocol version
+    Size,           ///< The payload length exceeds the protocol limit
+    Checksum        ///< The packet was corrupted
+};
+
+/**
+ * @brief The PacketFraming class builds and parses the wire framing.
+ *
+ * Protocol version 2 puts a fixed 20-byte header in front of every payload,
+ * all fields in network byte order:
+ *
+ *     0  version (1)    1  type (1)    2  stream (1)    3  codec (1)
+ *     4  payload length (4)
+ *     8  sequence number (4)
+ *    12  timestamp (4)
+ *    16  CRC-32C of the header bytes 0-15 and the payload (4)
+ *
+ * An audio batch packet carries a frame count and a table of frame lengths in
+ * front of the frames, so the frames themselves can be sent as iovecs.
+ */
+class PacketFraming
+{
+public:
+    /**
+     * @brief Version of the wire protocol.
+     */
+    static const quint8 ProtocolVersion = 2;
+    
+    /**
+     * @brief Size of the packet header.
+     */
+    static const int HeaderSize = 20;
+    
+    /**
+     * @brief Largest payload a packet may carry.
+     */
+    static const int MaxPayloadSize = 16 * 1024 * 1024;
+    
+    /**
+     * @brief Frames a payload without copying it.
+     * @param type The packet type.
+     * @param payload The packet payload.
+     * @param stamp The sequence number, timestamp, stream and codec.
+     * @return The outgoing packet.
+     */
+    static OutgoingPacket frame(char type, const QByteArray &payload, const PacketStamp &stamp = PacketStamp());
+    
+    /**
+     * @brief Frames several audio frames as one batch packet without copying them.
+     * @param frames The audio frames, in order.
+     * @param stamp The sequence number, timestamp, stream and codec.
+     * @return The outgoing batch packet.
+     */
+    static OutgoingPacket frameBatch(const QList<QByteArray> &frames, const PacketStamp &stamp = PacketStamp());
+    
+    /**
+     * @brief Flattens an outgoing packet into a single buffer.
+     * @param packet The packet to flatten.
+     * @return The packet bytes as they appear on the wire.
+     */
+    static QByteArray flatten(const OutgoingPacket &packet);
+    
+    /**
+     * @brief Parses and verifies the packet at the start of a buffer.
+     * @param data The buffer.
+     * @param size The number of bytes in the buffer.
+     * @param view The parsed packet (output), referencing the buffer.
+     * @param error Receives why the buffer holds no valid packet (optional); PacketError::None
+     *              if more data is needed.
+     * @return True if a complete, valid packet was found, false otherwise.
+     */
+    static bool parse(const char *data, int size, PacketView &view, PacketError *error = nullptr);
+    
+    /**
+     * @brief Splits a batch payload into views of its frames.
+     * @param batch The batch packet payload.
+     * @param frames The frame views (output), referencing the payload.
+     * @return True if the batch was well formed, false otherwise.
+     */
+    static bool splitBatch(const PacketView &batch, QList<PacketView> &frames);
+    
+    /**
+     * @brief Describes a parse error for the user.
+     * @param error The error.
+     * @param data The start of the offending packet (for the version byte).
+     * @return The description.
+     */
+    static QString errorString(PacketError error, const char *data);
+};
+
+#endif // PACKETFRAMING_H
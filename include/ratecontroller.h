@@ -0,0 +1,125 @@
+#ifndef RATECONTROLLER_H
+#define RATECONTROLLER_H
+
+#include <QtCore/QObject>
+#include <QtCore/QTimer>
+#include <QtCore/QElapsedTimer>
+
+/**
+ * @brief The RateController class adapts the Opus encoder to the network.
+ *
+ * It combines the round-trip time from the ping/pong exchange, the send backlog
+ * (application queue, socket buffer and kernel send queue), audio dropped from
+ * the send queue and the loss reports of the receiver, and adjusts bitrate, FEC and frame duration so that the
+ * queueing delay stays below a configurable target. Bitrate is decreased
+ * multiplicatively on congestion and increased additively once the link has
+ * been clear for a while.
+ */
+class RateController : public QObject
+{
+    Q_OBJECT
+
+public:
+    /**
+     * @brief Constructor for RateController.
+     * @param parent The parent object.
+     */
+    explicit RateController(QObject *parent = nullptr);
+    
+    /**
+     * @brief Starts controlling from the given initial bitrate.
+     * @param initialBitrate The bitrate to start with, in bits per second.
+     */
+    void start(int initialBitrate);
+    
+    /**
+     * @brief Stops controlling.
+     */
+    void stop();
+    
+    /**
+     * @brief Sets the queueing delay the controller keeps the stream under.
+     * @param delayMs The target queueing delay in milliseconds.
+     */
+    void setTargetQueueDelay(int delayMs);
+    
+    /**
+     * @brief Sets the range the bitrate is adjusted in.
+     * @param minBitrate The lowest bitrate, in bits per second.
+     * @param maxBitrate The highest bitrate, in bits per second.
+     */
+    void setBitrateRange(int minBitrate, int maxBitrate);
+    
+    /**
+     * @brief Gets the current target bitrate.
+     * @return The bitrate in bits per second.
+     */
+    int getBitrate() const;
+    
+    /**
+     * @brief Gets the last estimated queueing delay.
+     * @return The queueing delay in milliseconds.
+     */
+    int getQueueDelay() const;
+
+public slots:
+    /**
+     * @brief Updates the round-trip time.
+     * @param rttMs The round-trip time in milliseconds.
+     */
+    void setRoundTripTime(int rttMs);
+    
+    /**
+     * @brief Updates the number of bytes waiting to be sent.
+     * @param bytes The send backlog in bytes.
+     */
+    void setSendBacklog(qint64 bytes);
+    
+    /**
+     * @brief Processes a loss report from the receiver.
+     * @param framesExpected The number of frames the receiver expected to play.
+     * @param framesLost The number of those frames that were missing.
+     */
+    void processReceiverReport(quint32 framesExpected, quint32 framesLost);
+    
+    /**
+     * @brief Processes audio the sender dropped because it waited too long to be sent.
+     * @param packets The number of packets dropped.
+     */
+    void processSendDrops(int packets);
+
+signals:
+    /**
+     * @brief Signal emitted when the encoder settings should change.
+     * @param bitrate The bitrate in bits per second.
+     * @param fec Whether in-band FEC should be enabled.
+     * @param packetLossPercent The expected packet loss (0-100).
+     * @param frameDurationMs The frame duration in milliseconds.
+     */
+    void encoderSettingsChanged(int bitrate, bool fec, int packetLossPercent, int frameDurationMs);
+
+private slots:
+    /**
+     * @brief Re-evaluates the encoder settings.
+     */
+    void update();
+
+private:
+    QTimer *updateTimer;
+    QElapsedTimer clock;
+    qint64 lastDecreaseMs;
+    qint64 lastIncreaseMs;
+    qint64 sendBacklog;
+    int roundTripTimeMs;
+    int targetQueueDelayMs;
+    int queueDelayMs;
+    int minBitrate;
+    int maxBitrate;
+    int bitrate;
+    int lossPercent;
+    int sendDrops;
+    int frameDurationMs;
+    bool fec;
+};
+
+#endif // RATECONTROLLER_H
@@ -0,0 +1,72 @@
+#ifndef REALFFT_H
+#define REALFFT_H
+
+#include <QtCore/QVector>
+
+/**
+ * @brief The RealFft class transforms real signals to and from the frequency domain.
+ *
+ * A transform of size n runs as a complex radix-2 FFT of size n/2 plus a
+ * twiddle pass, on split real/imaginary arrays. The spectrum holds the bins
+ * 0 to n/2. The forward transform is unscaled and inverse() is its exact
+ * inverse (it scales by 1/n). The butterflies of every stage read their
+ * twiddles from a contiguous table and run four at a time with SSE2 where
+ * available. setSize() allocates; the transforms do not.
+ * An instance keeps scratch buffers, so it must not be shared between threads.
+ */
+class RealFft
+{
+public:
+    /**
+     * @brief Constructor for RealFft.
+     * @param size The transform size (a power of two, at least 4), or 0 for none yet.
+     */
+    explicit RealFft(int size = 0);
+    
+    /**
+     * @brief Sets the transform size and builds the tables.
+     * @param size The transform size (a power of two, at least 4).
+     */
+    void setSize(int size);
+    
+    /**
+     * @brief Gets the transform size.
+     * @return The number of real samples per transform.
+     */
+    int getSize() const;
+    
+    /**
+     * @brief Transforms real samples to a spectrum.
+     * @param input The size real samples.
+     * @param re The real parts of the size / 2 + 1 bins (output).
+     * @param im The imaginary parts of the size / 2 + 1 bins (output).
+     */
+    void forward(const float *input, float *re, float *im);
+    
+    /**
+     * @brief Transforms a spectrum back to real samples.
+     * @param re The real parts of the size / 2 + 1 bins.
+     * @param im The imaginary parts of the size / 2 + 1 bins.
+     * @param output The size real samples (output).
+     */
+    void inverse(const float *re, const float *im, float *output);
+
+private:
+    /**
+     * @brief Runs the in-place complex forward FFT of size / 2 points.
+     * @param re The real parts.
+     * @param im The imaginary parts.
+     */
+    void transform(float *re, float *im) const;
+    
+    int size;
+    QVector<int> bitReverse;
+    QVector<float> stageCos;
+    QVector<float> stageSin;
+    QVector<float> twiddleCos;
+    QVector<float> twiddleSin;
+    QVector<float> workRe;
+    QVector<float> workIm;
+};
+
+#endif // REALFFT_H
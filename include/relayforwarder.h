@@ -0,0 +1,219 @@
+#ifndef RELAYFORWARDER_H
+#define RELAYFORWARDER_H
+
+#include <QtCore/QObject>
+#include <QtCore/QByteArray>
+#include <QtCore/QList>
+#include <QtCore/QTimer>
+#include <QtNetwork/QTcpSocket>
+#include "clocksync.h"
+#include "packetframing.h"
+#include "sessionhandshake.h"
+
+/**
+ * @brief Counters describing a relay.
+ */
+struct RelayStats
+{
+    int downstreams = 0;             ///< Configured downstream receivers
+    int connectedDownstreams = 0;    ///< Downstream receivers currently streaming
+    quint64 forwardedPackets = 0;    ///< Packets received from the sender and passed on
+    quint64 forwardedBytes = 0;      ///< Bytes of those packets
+    quint64 droppedPackets = 0;      ///< Audio packets not sent to a downstream that fell behind
+    double averageHopUs = 0.0;       ///< Average time from receiving a packet to handing it to every downstream
+    qint64 maxHopUs = 0;             ///< Longest such time
+};
+
+/**
+ * @brief The RelayForwarder class passes a sender's stream on to downstream receivers.
+ *
+ * The owning NetworkManager accepts the sender and hands over the stream
+ * packets (audio, comfort noise, format and codec) exactly as they arrived,
+ * header and all; the forwarder writes them to every downstream receiver
+ * without parsing or copying the payloads. Whole runs of packets go out in one
+ * send() per downstream straight from the receive buffer, and only what a
+ * socket cannot take right away is buffered. A downstream that falls behind
+ * loses audio packets, never control packets, and never holds up the others.
+ *
+ * The per-link control traffic is answered here instead of being passed on:
+ * each downstream gets the sender's hello (so it negotiates with the sender's
+ * settings) and the last format and codec packets on connecting, and its pings
+ * are answered with times on the sender's clock, so the forwarded timestamps
+ * stay meaningful end to end.
+ *
+ * The forwarder lives on the network thread.
+ */
+class RelayForwarder : public QObject
+{
+    Q_OBJECT
+
+public:
+    /**
+     * @brief Constructor for RelayForwarder.
+     * @param parent The parent object.
+     */
+    explicit RelayForwarder(QObject *parent = nullptr);
+    
+    /**
+     * @brief Destructor for RelayForwarder.
+     */
+    ~RelayForwarder();
+    
+    /**
+     * @brief Checks if packets of a type are passed on to the downstream receivers.
+     * @param type The packet type.
+     * @return True for the packets of the stream, false for per-link control packets.
+     */
+    static bool isForwarded(char type);
+    
+    /**
+     * @brief Adds a downstream receiver and connects to it (reconnecting whenever the link drops).
+     * @param address The receiver's address.
+     * @param port The receiver's port.
+     */
+    void addDownstream(const QString &address, int port);
+    
+    /**
+     * @brief Sets the hello the sender sent, which is passed on to every downstream.
+     * @param payload The hello payload (empty while there is no sender).
+     */
+    void setUpstreamHello(const QByteArray &payload);
+    
+    /**
+     * @brief Sets the estimate of the sender's clock, used to answer the downstream pings.
+     * @param estimate The estimate.
+     */
+    void setUpstreamClock(const ClockEstimate &estimate);
+    
+    /**
+     * @brief Forgets the sender's stream (a new sender starts its own).
+     */
+    void resetStream();
+    
+    /**
+     * @brief Passes packets on to every streaming downstream receiver.
+     * @param data One or more complete packets of forwarded types, as they arrived.
+     * @param size The size in bytes.
+     * @param receiveUs When the packets arrived, on the ClockSync::now() clock.
+     */
+    void forward(const char *data, int size, qint64 receiveUs);
+    
+    /**
+     * @brief Passes on a packet that is no longer in its wire form (re-framed with its stamp).
+     * @param packet The packet.
+     * @param receiveUs When the packet arrived, on the ClockSync::now() clock.
+     */
+    void forwardPacket(const PacketView &packet, qint64 receiveUs);
+    
+    /**
+     * @brief Gets the relay counters.
+     * @return The statistics since construction.
+     */
+    RelayStats getStats() const;
+
+signals:
+    /**
+     * @brief Signal emitted when a downstream receiver announces its format.
+     * @param payload The format packet payload.
+     */
+    void downstreamFormatReceived(const QByteArray &payload);
+    
+    /**
+     * @brief Signal emitted when a downstream link fails.
+     * @param message The error message.
+     */
+    void error(const QString &message);
+
+private slots:
+    /**
+     * @brief Reconnects the downstream receivers that are not connected.
+     */
+    void reconnectDownstreams();
+    
+    /**
+     * @brief Logs the counters if anything was forwarded since the last report.
+     */
+    void reportStats();
+
+private:
+    /**
+     * @brief A downstream receiver and its link.
+     */
+    struct Downstream
+    {
+        QString address;                ///< Address of the receiver
+        int port = 0;                   ///< Port of the receiver
+        QTcpSocket *socket = nullptr;   ///< Link to the receiver, null while disconnected
+        QByteArray receiveBuffer;       ///< Bytes received from the receiver, not yet parsed
+        QByteArray hello;               ///< The receiver's hello payload on this link
+        quint64 sessionToken = 0;       ///< Token presented on every connection, so the receiver resumes
+        bool streaming = false;         ///< Whether the receiver got the hello and takes the stream
+        bool incompatible = false;      ///< Whether the receiver refused the sender's settings
+    };
+    
+    /**
+     * @brief Opens the link to a downstream receiver.
+     * @param downstream The receiver.
+     */
+    void connectDownstream(Downstream *downstream);
+    
+    /**
+     * @brief Closes the link to a downstream receiver.
+     * @param downstream The receiver.
+     */
+    void closeDownstream(Downstream *downstream);
+    
+    /**
+     * @brief Sends the hello and the stream state to a receiver and starts streaming to it.
+     * @param downstream The receiver (connected).
+     */
+    void startStreaming(Downstream *downstream);
+    
+    /**
+     * @brief Parses and answers what a downstream receiver sent.
+     * @param downstream The receiver.
+     */
+    void readDownstream(Downstream *downstream);
+    
+    /**
+     * @brief Checks the receiver's hello against the sender's settings.
+     * @param downstream The receiver.
+     * @param payload The receiver's hello payload.
+     * @return True if the receiver can play the sender's stream, false otherwise.
+     */
+    bool checkDownstreamHello(Downstream *downstream, const QByteArray &payload);
+    
+    /**
+     * @brief Writes packets to a receiver, dropping audio if it fell behind.
+     * @param downstream The receiver.
+     * @param data One or more complete packets.
+     * @param size The size in bytes.
+     */
+    void writeDownstream(Downstream *downstream, const char *data, int size);
+    
+    /**
+     * @brief Writes a control packet of the relay's own to a receiver.
+     * @param downstream The receiver.
+     * @param type The packet type.
+     * @param payload The payload.
+     */
+    void writeControl(Downstream *downstream, char type, const QByteArray &payload);
+    
+    QList<Downstream*> downstreams;
+    QTimer *reconnectTimer;
+    QTimer *reportTimer;
+    
+    // The sender's side of the stream, replayed to receivers that connect later
+    QByteArray upstreamHello;
+    SessionCapabilities upstreamCapabilities;
+    QByteArray lastFormatPacket;
+    QByteArray lastCodecPacket;
+    ClockEstimate upstreamClock;
+    
+    RelayStats stats;
+    double hopSumUs;
+    quint64 hops;
+    RelayStats reportedStats;
+};
+
+#endif // RELAYFORWARDER_H
@@ -0,0 +1,176 @@
+#ifndef RINGBUFFER_H
+#define RINGBUFFER_H
+
+#include <QtCore/QtGlobal>
+#include <atomic>
+#include <vector>
+#include <cstring>
+
+/**
+ * @brief A lock-free single-producer/single-consumer ring buffer.
+ *
+ * One thread may write and one (other) thread may read concurrently without
+ * locks or allocation, which makes it safe to use from the PortAudio callbacks.
+ * The capacity is rounded up to a power of two. reset() allocates and must not
+ * race with readers or writers.
+ */
+template<typename T>
+class SpscRingBuffer
+{
+public:
+    /**
+     * @brief Constructor for SpscRingBuffer.
+     * @param capacity The minimum number of elements the buffer can hold.
+     */
+    explicit SpscRingBuffer(int capacity = 0)
+        : mask(0)
+        , readIndex(0)
+        , writeIndex(0)
+    {
+        reset(capacity);
+    }
+    
+    /**
+     * @brief Reallocates the buffer and discards its contents.
+     * @param capacity The minimum number of elements the buffer can hold.
+     */
+    void reset(int capacity)
+    {
+        int size = 1;
+        while (size < capacity) {
+            size <<= 1;
+        }
+        
+        buffer.assign(capacity > 0 ? size : 0, T());
+        mask = capacity > 0 ? static_cast<quint64>(size - 1) : 0;
+        readIndex.store(0, std::memory_order_relaxed);
+        writeIndex.store(0, std::memory_order_relaxed);
+    }
+    
+    /**
+     * @brief Gets the number of elements the buffer can hold.
+     * @return The capacity.
+     */
+    int capacity() const
+    {
+        return static_cast<int>(buffer.size());
+    }
+    
+    /**
+     * @brief Gets the number of elements read or skipped since the last reset (consumer side).
+     * @return The read position.
+     */
+    quint64 readPosition() const
+    {
+        return readIndex.load(std::memory_order_relaxed);
+    }
+    
+    /**
+     * @brief Gets the number of elements written since the last reset (producer side).
+     * @return The write position.
+     */
+    quint64 writePosition() const
+    {
+        return writeIndex.load(std::memory_order_relaxed);
+    }
+    
+    /**
+     * @brief Gets the number of elements available for reading.
+     * @return The number of readable elements.
+     */
+    int availableToRead() const
+    {
+        return static_cast<int>(writeIndex.load(std::memory_order_acquire) -
+                                readIndex.load(std::memory_order_acquire));
+    }
+    
+    /**
+     * @brief Gets the number of elements that can be written.
+     * @return The number of free slots.
+     */
+    int availableToWrite() const
+    {
+        return capacity() - availableToRead();
+    }
+    
+    /**
+     * @brief Writes elements (producer side).
+     * @param data The elements to write.
+     * @param count The number of elements to write.
+     * @return The number of elements written, less than count if the buffer is full.
+     */
+    int write(const T *data, int count)
+    {
+        quint64 write = writeIndex.load(std::memory_order_relaxed);
+        quint64 read = readIndex.load(std::memory_order_acquire);
+        int free = capacity() - static_cast<int>(write - read);
+        count = qMin(count, free);
+        if (count <= 0) {
+            return 0;
+        }
+        
+        // Copy in up to two contiguous parts
+        int start = static_cast<int>(write & mask);
+        int first = qMin(count, capacity() - start);
+        memcpy(&buffer[start], data, first * sizeof(T));
+        if (count > first) {
+            memcpy(&buffer[0], data + first, (count - first) * sizeof(T));
+        }
+        
+        writeIndex.store(write + count, std::memory_order_release);
+        return count;
+    }
+    
+    /**
+     * @brief Reads elements (consumer side).
+     * @param data The destination for the elements.
+     * @param count The maximum number of elements to read.
+     * @return The number of elements read.
+     */
+    int read(T *data, int count)
+    {
+        quint64 read = readIndex.load(std::memory_order_relaxed);
+        quint64 write = writeIndex.load(std::memory_order_acquire);
+        count = qMin(count, static_cast<int>(write - read));
+        if (count <= 0) {
+            return 0;
+        }
+        
+        // Copy out up to two contiguous parts
+        int start = static_cast<int>(read & mask);
+        int first = qMin(count, capacity() - start);
+        memcpy(data, &buffer[start], first * sizeof(T));
+        if (count > first) {
+            memcpy(data + first, &buffer[0], (count - first) * sizeof(T));
+        }
+        
+        readIndex.store(read + count, std::memory_order_release);
+        return count;
+    }
+    
+    /**
+     * @brief Discards elements without reading them (consumer side).
+     * @param count The maximum number of elements to discard.
+     * @return The number of elements discarded.
+     */
+    int skip(int count)
+    {
+        quint64 read = readIndex.load(std::memory_order_relaxed);
+        quint64 write = writeIndex.load(std::memory_order_acquire);
+        count = qMin(count, static_cast<int>(write - read));
+        if (count <= 0) {
+            return 0;
+        }
+        
+        readIndex.store(read + count, std::memory_order_release);
+        return count;
+    }
+
+private:
+    std::vector<T> buffer;
+    quint64 mask;
+    alignas(64) std::atomic<quint64> readIndex;
+    alignas(64) std::atomic<quint64> writeIndex;
+};
+
+#endif // RINGBUFFER_H
@@ -0,0 +1,130 @@
+#ifndef RTCHECK_H
+#define RTCHECK_H
+
+#include <QtCore/QtGlobal>
+
+/**
+ * @brief Flags calls that must not happen on the real-time audio threads.
+ *
+ * In a build configured with AUDIOBRIDGE_RT_CHECK (Linux with glibc and
+ * Qt 5), the process interposes malloc() and its relatives, free(),
+ * pthread_mutex_lock(), syscall(), the blocking I/O calls read(), write()
+ * and poll(), and Qt's QMutex::lock(), QMutex::tryLock() with a timeout,
+ * QReadWriteLock::lockForRead() and QReadWriteLock::lockForWrite(). An
+ * uncontended QMutex never gets as far as a system call, so its lock calls
+ * are checked themselves; QMutexLocker locks through them too. A call made
+ * while the calling thread is inside a Scope counts as a violation and is
+ * reported on stderr with a stack trace; the first reports of each run are
+ * printed in full, the rest only counted. A summary is printed at exit.
+ *
+ * The environment variable AUDIOBRIDGE_RT_CHECK selects what a violation
+ * does: "report" (the default) or "abort", which ends the process on the
+ * first one so a soak run (for instance a --replay) fails when the hot path
+ * regresses. "off" disables the checks.
+ *
+ * A Waiver exempts a block inside a Scope, for hand-offs that are known to
+ * allocate or lock and are left as they are on purpose. QMutex::tryLock()
+ * without a timeout never blocks and std::atomic operations never reach the
+ * kernel; neither is flagged.
+ *
+ * Without AUDIOBRIDGE_RT_CHECK every part of this class compiles to nothing.
+ */
+class RtCheck
+{
+public:
+    /**
+     * @brief Marks the calling thread as real-time until it is destroyed.
+     */
+    class Scope
+    {
+    public:
+        /**
+         * @brief Constructor for Scope.
+         */
+        Scope()
+        {
+            RtCheck::enter();
+        }
+        
+        /**
+         * @brief Destructor for Scope.
+         */
+        ~Scope()
+        {
+            RtCheck::leave();
+        }
+        
+        Scope(const Scope &) = delete;
+        Scope &operator=(const Scope &) = delete;
+    };
+    
+    /**
+     * @brief Exempts the calling thread from the checks until it is destroyed.
+     */
+    class Waiver
+    {
+    public:
+        /**
+         * @brief Constructor for Waiver.
+         */
+        Waiver()
+        {
+            RtCheck::waive();
+        }
+        
+        /**
+         * @brief Destructor for Waiver.
+         */
+        ~Waiver()
+        {
+            RtCheck::unwaive();
+        }
+        
+        Waiver(const Waiver &) = delete;
+        Waiver &operator=(const Waiver &) = delete;
+    };
+    
+    /**
+     * @brief Checks if the checks are compiled in and enabled.
+     * @return True if violations are detected, false otherwise.
+     */
+    static bool isEnabled();
+    
+    /**
+     * @brief Gets the number of violations so far.
+     * @return The number of flagged calls since the process started.
+     */
+    static quint64 getViolations();
+
+private:
+    /**
+     * @brief Enters a real-time section on the calling thread.
+     */
+    static void enter();
+    
+    /**
+     * @brief Leaves a real-time section on the calling thread.
+     */
+    static void leave();
+    
+    /**
+     * @brief Enters a waived section on the calling thread.
+     */
+    static void waive();
+    
+    /**
+     * @brief Leaves a waived section on the calling thread.
+     */
+    static void unwaive();
+};
+
+#ifndef AUDIOBRIDGE_RT_CHECK
+inline bool RtCheck::isEnabled() { return false; }
+inline quint64 RtCheck::getViolations() { return 0; }
+inline void RtCheck::enter() {}
+inline void RtCheck::leave() {}
+inline void RtCheck::waive() {}
+inline void RtCheck::unwaive() {}
+#endif
+
+#endif // RTCHECK_H
@@ -0,0 +1,97 @@
+#ifndef SESSIONHANDSHAKE_H
+#define SESSIONHANDSHAKE_H
+
+#include <QtCore/QByteArray>
+#include <QtCore/QMetaType>
+#include <QtCore/QString>
+#include "audioformat.h"
+
+// Sample formats of raw audio (bit mask)
+const quint8 SAMPLE_FORMAT_FLOAT32 = 0x01;
+
+/**
+ * @brief What one side of a connection can do and is set up for.
+ */
+struct SessionCapabilities
+{
+    quint8 codecs = 0;                                        ///< Supported codecs (bit 1 << PACKET_CODEC_*)
+    quint8 sampleFormats = SAMPLE_FORMAT_FLOAT32;             ///< Supported raw sample formats
+    TransmissionMode preferredMode = TransmissionMode::Raw;   ///< Transmission mode chosen by the user
+    quint32 sampleRate = 0;                                   ///< Sample rate of the audio devices
+    quint16 bufferFrames = 0;                                 ///< Frames per device buffer
+};
+
+/**
+ * @brief What both sides of a connection agreed on.
+ */
+struct NegotiatedSession
+{
+    TransmissionMode mode = TransmissionMode::Raw;   ///< Transmission mode of both directions
+    int sampleRate = 0;                              ///< Common sample rate
+    int frameSize = 0;                               ///< Frames per packet worth sending (the larger buffer)
+};
+
+Q_DECLARE_METATYPE(NegotiatedSession)
+
+/**
+ * @brief The SessionHandshake class builds, parses and negotiates the hello packets.
+ *
+ * Both sides send a hello (PACKET_TYPE_HELLO) right after connecting. Its
+ * payload is, in network byte order: the codec mask (1 byte), the preferred
+ * codec (1), the sample format mask (1), a reserved byte, the sample rate (4)
+ * and the device buffer size in frames (2). Longer payloads are accepted, so
+ * later versions can append fields.
+ *
+ * Both sides run negotiate() on the same two hellos and reach the same result:
+ * the codec both prefer, or else the cheapest one on the wire both support;
+ * the sample rate, which has to match; and the larger buffer size as the
+ * packet size worth sending. Anything that cannot be agreed on fails the
+ * connection with a message saying which setting differs.
+ */
+class SessionHandshake
+{
+public:
+    /**
+     * @brief Gets the capabilities of this build for the given device settings.
+     * @param sampleRate The sample rate.
+     * @param bufferFrames The frames per device buffer.
+     * @param preferredMode The transmission mode chosen by the user.
+     * @return The capabilities.
+     */
+    static SessionCapabilities localCapabilities(int sampleRate, int bufferFrames, TransmissionMode preferredMode);
+    
+    /**
+     * @brief Builds the payload of a hello packet.
+     * @param capabilities The capabilities to announce.
+     * @return The payload.
+     */
+    static QByteArray encode(const SessionCapabilities &capabilities);
+    
+    /**
+     * @brief Parses the payload of a hello packet.
+     * @param payload The payload.
+     * @param capabilities The announced capabilities (output).
+     * @return True if the payload was well formed, false otherwise.
+     */
+    static bool decode(const QByteArray &payload, SessionCapabilities &capabilities);
+    
+    /**
+     * @brief Agrees on the session settings.
+     * @param local Our capabilities.
+     * @param peer The peer's capabilities.
+     * @param session The agreed settings (output).
+     * @param errorMessage Receives which setting differs if there is no agreement (optional).
+     * @return True if both sides are compatible, false otherwise.
+     */
+    static bool negotiate(const SessionCapabilities &local, const SessionCapabilities &peer,
+                          NegotiatedSession &session, QString *errorMessage = nullptr);
+    
+    /**
+     * @brief Gets the packet codec id of a transmission mode.
+     * @param mode The transmission mode.
+     * @return The PACKET_CODEC_* id.
+     */
+    static quint8 codecId(TransmissionMode mode);
+};
+
+#endif // SESSIONHANDSHAKE_H
@@ -0,0 +1,131 @@
+#ifndef SESSIONMANAGER_H
+#define SESSIONMANAGER_H
+
+#include <QtCore/QObject>
+#include <QtCore/QThread>
+#include <QtCore/QTimer>
+#include <QtCore/QVector>
+#include "bridgesession.h"
+
+/**
+ * @brief The SessionManager class runs many independent bridges in one process.
+ *
+ * The sessions come from an INI file with one group per session (see
+ * SessionConfig::parse()), each with its own devices and port. Their network
+ * sides, which also carry the receive path, are spread over a pool of worker
+ * threads sized to the core count: each session goes to the worker with the
+ * least packets per second so far. The audio callbacks already run on the
+ * threads PortAudio creates for each stream; what they capture is processed
+ * and encoded on a work-stealing pool of the same size, so a burst of
+ * encoding spreads over every core instead of queueing behind one stream's
+ * capture thread. The sessions themselves live on the manager's thread, which
+ * only runs their timers and the reports.
+ *
+ * All sessions share the process' Qt runtime and PortAudio instance, whose
+ * devices are probed once in the background as the manager is created. A report
+ * with the CPU load and the buffer memory of every session is logged at a
+ * fixed interval and emitted through statsUpdated().
+ */
+class SessionManager : public QObject
+{
+    Q_OBJECT
+
+public:
+    /**
+     * @brief Constructor for SessionManager.
+     * @param parent The parent object.
+     */
+    explicit SessionManager(QObject *parent = nullptr);
+    
+    /**
+     * @brief Destructor for SessionManager.
+     */
+    ~SessionManager();
+    
+    /**
+     * @brief Reads the sessions from a file and checks their routing.
+     *
+     * Two receivers cannot listen on the same port. Devices opened by several
+     * sessions are only warned about, since some host APIs share them.
+     *
+     * @param filePath The path of the sessions file.
+     * @param errorMessage Receives the reason if the file is invalid (optional).
+     * @return True if every session was valid, false otherwise.
+     */
+    bool loadSessions(const QString &filePath, QString *errorMessage = nullptr);
+    
+    /**
+     * @brief Sets the number of worker threads (takes effect on start()).
+     * @param count The number of workers (0 for one per core).
+     */
+    void setWorkerCount(int count);
+    
+    /**
+     * @brief Sets the interval of the logged report.
+     * @param milliseconds The interval (0 disables the report).
+     */
+    void setReportInterval(int milliseconds);
+    
+    /**
+     * @brief Starts the workers and every session.
+     * @return The number of sessions that started.
+     */
+    int start();
+    
+    /**
+     * @brief Stops every session and the workers.
+     */
+    void stop();
+    
+    /**
+     * @brief Takes a snapshot of every session.
+     * @return The statistics, in the order of the sessions file.
+     */
+    QVector<SessionStats> sampleStats();
+    
+    /**
+     * @brief Gets the resident memory of the process.
+     * @return The size in bytes, 0 where it cannot be read.
+     */
+    static qint64 processMemory();
+
+signals:
+    /**
+     * @brief Signal emitted with every report.
+     * @param stats The statistics of every session.
+     */
+    void statsUpdated(const QVector<SessionStats> &stats);
+    
+    /**
+     * @brief Signal emitted when a session reports an error.
+     * @param session The name of the session.
+     * @param message The error message.
+     */
+    void error(const QString &session, const QString &message);
+
+private slots:
+    /**
+     * @brief Logs and emits the statistics of every session.
+     */
+    void reportStats();
+
+private:
+    /**
+     * @brief Picks the worker with the least load for a session.
+     * @param config The session.
+     * @return The index of the worker.
+     */
+    int pickWorker(const SessionConfig &config);
+    
+    QVector<SessionConfig> configs;
+    QVector<BridgeSession*> sessions;
+    QVector<int> sessionWorkers;
+    QVector<QThread*> workers;
+    QVector<double> workerLoads;
+    WorkerPool *encodePool;
+    DeviceRegistry *deviceRegistry;
+    QTimer *reportTimer;
+    int workerCount;
+};
+
+#endif // SESSIONMANAGER_H
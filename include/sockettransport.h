@@ -0,0 +1,192 @@
+#ifndef SOCKETTRANSPORT_H
+#define SOCKETTRANSPORT_H
+
+#include "streamtransport.h"
+#include <QtCore/QQueue>
+
+class QSocketNotifier;
+
+/**
+ * @brief The SocketTransport class moves the bytes of a connected TCP socket with recvmsg() and sendmsg(), with kernel timestamps.
+ *
+ * Available on Linux. Elsewhere open() fails and the caller keeps using its
+ * Qt socket.
+ *
+ * QTcpSocket reads with plain read() calls, which drop the timestamps the
+ * kernel attaches to received data, so a connection that wants them hands
+ * its socket to this transport. The socket is switched to SO_TIMESTAMPING
+ * software timestamps: every receive carries the time the newest of its
+ * bytes went through the kernel's receive path, and requestTransmitTimestamp()
+ * asks for the time a written byte left through the driver. Both are
+ * reported on the ClockSync::now() clock, so they mix with the application's
+ * own times. Software timestamps work on every interface, loopback included.
+ *
+ * Writes are buffered and go out with flush(); what the socket cannot take
+ * waits until it is writable again. The transport is used from the thread
+ * that opened it only.
+ */
+class SocketTransport : public StreamTransport
+{
+    Q_OBJECT
+
+public:
+    /**
+     * @brief Constructor for SocketTransport.
+     * @param parent The parent object.
+     */
+    explicit SocketTransport(QObject *parent = nullptr);
+    
+    /**
+     * @brief Destructor for SocketTransport.
+     */
+    ~SocketTransport();
+    
+    /**
+     * @brief Checks if socket transports can be used on this platform.
+     * @return True if available, false otherwise.
+     */
+    static bool isAvailable();
+    
+    /**
+     * @brief Takes over a connected socket and enables its timestamps.
+     * @param socketDescriptor The socket descriptor; the transport owns it from now on,
+     *                         also if opening fails.
+     * @param errorMessage Receives the reason of a failure (optional).
+     * @return True if the transport is ready, false otherwise.
+     */
+    bool open(int socketDescriptor, QString *errorMessage = nullptr) override;
+    
+    /**
+     * @brief Stops watching the socket, drops the unsent bytes and closes the socket.
+     */
+    void close() override;
+    
+    /**
+     * @brief Checks if the transport is open.
+     * @return True if open, false otherwise.
+     */
+    bool isOpen() const override;
+    
+    /**
+     * @brief Gets the socket descriptor.
+     * @return The descriptor, or -1 if the transport is closed.
+     */
+    int socketDescriptor() const override;
+    
+    /**
+     * @brief Gets the number of received bytes waiting to be read.
+     * @return The number of bytes.
+     */
+    qint64 bytesAvailable() const override;
+    
+    /**
+     * @brief Appends all received bytes to a buffer.
+     * @param buffer The buffer to append to.
+     * @return The number of bytes appended.
+     */
+    qint64 read(QByteArray &buffer) override;
+    
+    /**
+     * @brief Buffers bytes; they go out with the next flush().
+     * @param data The bytes.
+     * @param size The number of bytes.
+     */
+    void write(const char *data, qint64 size) override;
+    
+    /**
+     * @brief Hands as many written bytes to the kernel as the socket takes.
+     */
+    void flush() override;
+    
+    /**
+     * @brief Gets the number of bytes written but not yet taken by the kernel.
+     * @return The number of bytes.
+     */
+    qint64 bytesToWrite() const override;
+    
+    /**
+     * @brief Gets the description of the last error.
+     * @return The error description.
+     */
+    QString errorString() const override;
+    
+    /**
+     * @brief Gets when the kernel received the newest bytes returned by the last read().
+     * @return The time on the ClockSync::now() clock in microseconds, 0 if unknown.
+     */
+    qint64 getReceiveTimestamp() const override;
+    
+    /**
+     * @brief Asks for the time the kernel sends the last byte written so far.
+     *
+     * The send call that carries the byte ends with it, so the kernel stamps
+     * exactly that byte. Must be called before the byte is flushed.
+     *
+     * @return The id the timestamp will carry, -1 if send timestamps are not available.
+     */
+    qint64 requestTransmitTimestamp() override;
+
+private slots:
+    /**
+     * @brief Collects the send timestamps and the received bytes.
+     */
+    void handleReadable();
+    
+    /**
+     * @brief Sends the bytes the socket could not take before.
+     */
+    void handleWritable();
+
+private:
+    /**
+     * @brief Enables the receive and send timestamps and finds the base of the send keys.
+     * @return True if the receive timestamps are enabled, false otherwise (errno is set).
+     */
+    bool enableTimestamps();
+    
+    /**
+     * @brief Sends the buffered bytes until they are gone or the socket is full.
+     * @return The number of bytes the kernel took.
+     */
+    qint64 sendPending();
+    
+    /**
+     * @brief Receives until the socket is empty.
+     * @param closed Set to true if the peer closed the connection.
+     * @return The number of bytes received, -1 on an error.
+     */
+    qint64 receive(bool &closed);
+    
+    /**
+     * @brief Reads the send timestamps from the socket's error queue.
+     */
+    void readTransmitTimestamps();
+    
+    /**
+     * @brief Fails the connection.
+     * @param message The error description.
+     */
+    void fail(const QString &message);
+    
+    QSocketNotifier *readNotifier;
+    QSocketNotifier *writeNotifier;
+    QByteArray received;
+    QByteArray pending;
+    QString lastError;
+    
+    // Stream offsets (bytes written since open()) of the bytes to stamp, by
+    // how far they are: not yet handed to the kernel, then not yet stamped
+    QQueue<qint64> stampsToSend;
+    QQueue<qint64> stampsToReceive;
+    
+    int descriptor;
+    int pendingOffset;
+    qint64 sentBytes;
+    qint64 transmitKeyBase;
+    qint64 newestReceiveUs;
+    qint64 receiveTimestampUs;
+    bool receiveTimestamps;
+    bool transmitTimestamps;
+};
+
+#endif // SOCKETTRANSPORT_H
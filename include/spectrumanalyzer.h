@@ -0,0 +1,137 @@
+#ifndef SPECTRUMANALYZER_H
+#define SPECTRUMANALYZER_H
+
+#include <QtCore/QObject>
+#include <QtCore/QThread>
+#include <QtCore/QVector>
+#include <QtCore/QMetaType>
+#include <atomic>
+#include "realfft.h"
+#include "ringbuffer.h"
+
+/**
+ * @brief Which audio the spectrum analyzer looks at.
+ */
+enum class SpectrumSource : quint8 {
+    Off,        ///< No analysis
+    Capture,    ///< The captured input (after echo cancellation)
+    Playout     ///< What is played (after the playout processing chain)
+};
+
+/**
+ * @brief One analysed frame of the spectrum.
+ */
+struct SpectrumFrame
+{
+    QVector<float> levels;   ///< Smoothed level per band in dBFS, lowest band first
+    QVector<float> peaks;    ///< Held peak level per band in dBFS
+    float minFrequency;      ///< Lower edge of the first band in Hz
+    float maxFrequency;      ///< Upper edge of the last band in Hz
+    bool clipped;            ///< Whether a sample reached full scale since the last frame
+};
+
+Q_DECLARE_METATYPE(SpectrumFrame)
+
+/**
+ * @brief The SpectrumAnalyzer class computes a live spectrum of the audio in the background.
+ *
+ * The audio thread hands buffers to push(), which downmixes them to mono into
+ * a lock-free ring and notes clipping; it never allocates or blocks. A
+ * low-priority analysis thread wakes at the frame rate, applies a Hann window
+ * to the latest FFT size samples and transforms them with RealFft. The bin
+ * powers are gathered into log-spaced bands (the loudest bin of a band
+ * counts, so hum lines stay visible), smoothed with an instant attack and a
+ * fixed release, and published with spectrumReady().
+ */
+class SpectrumAnalyzer : public QObject
+{
+    Q_OBJECT
+
+public:
+    /**
+     * @brief Samples per transform.
+     */
+    static const int FftSize = 4096;
+    
+    /**
+     * @brief Number of bands per frame.
+     */
+    static const int BandCount = 160;
+    
+    /**
+     * @brief Constructor for SpectrumAnalyzer.
+     * @param parent The parent object.
+     */
+    explicit SpectrumAnalyzer(QObject *parent = nullptr);
+    
+    /**
+     * @brief Destructor for SpectrumAnalyzer.
+     */
+    ~SpectrumAnalyzer();
+    
+    /**
+     * @brief Starts the analysis thread.
+     * @param sampleRate The sample rate of the pushed audio.
+     */
+    void start(int sampleRate);
+    
+    /**
+     * @brief Stops the analysis thread.
+     */
+    void stop();
+    
+    /**
+     * @brief Sets how many frames per second are analysed (capped at 60).
+     * @param framesPerSecond The frame rate.
+     */
+    void setFrameRate(int framesPerSecond);
+    
+    /**
+     * @brief Queues interleaved frames for analysis (audio thread, lock-free).
+     * @param samples The interleaved samples.
+     * @param frames The number of frames.
+     * @param channels The number of interleaved channels.
+     */
+    void push(const float *samples, int frames, int channels);
+
+signals:
+    /**
+     * @brief Signal emitted for every analysed frame (from the analysis thread).
+     * @param frame The spectrum.
+     */
+    void spectrumReady(const SpectrumFrame &frame);
+
+private:
+    /**
+     * @brief Body of the analysis thread.
+     */
+    void analysisLoop();
+    
+    /**
+     * @brief Analyses the latest samples and publishes the frame.
+     * @param elapsedSeconds The time since the previous frame.
+     */
+    void analyse(float elapsedSeconds);
+    
+    QThread *analysisThread;
+    RealFft fft;
+    SpscRingBuffer<float> ring;
+    QVector<float> pushScratch;
+    QVector<float> history;
+    QVector<float> window;
+    QVector<float> windowed;
+    QVector<float> spectrumRe;
+    QVector<float> spectrumIm;
+    QVector<int> bandFirstBin;
+    QVector<int> bandLastBin;
+    QVector<float> peakHoldSeconds;
+    SpectrumFrame frame;
+    int sampleRate;
+    std::atomic<int> frameIntervalMs;
+    std::atomic<bool> running;
+    std::atomic<bool> stopRequested;
+    std::atomic<int> activeWriters;
+    std::atomic<bool> clipped;
+};
+
+#endif // SPECTRUMANALYZER_H
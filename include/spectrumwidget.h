@@ -0,0 +1,117 @@
+#ifndef SPECTRUMWIDGET_H
+#define SPECTRUMWIDGET_H
+
+#include <QtWidgets/QWidget>
+#include <QtGui/QImage>
+#include <QtCore/QVector>
+#include "spectrumanalyzer.h"
+
+/**
+ * @brief The SpectrumWidget class shows the live spectrum as bars over a scrolling spectrogram.
+ *
+ * The upper part draws one bar per band with its held peak, the lower part is
+ * a sweeping spectrogram: every frame paints one column of a fixed-size image
+ * through a color lookup table and the cursor moves on. setFrame() only
+ * invalidates what changed - the bars whose height moved, the new spectrogram
+ * column and the clip indicator - and paintEvent() only redraws inside the
+ * invalidated rectangle, so a frame costs a few narrow blits instead of a
+ * full repaint.
+ */
+class SpectrumWidget : public QWidget
+{
+    Q_OBJECT
+
+public:
+    /**
+     * @brief Number of frames the spectrogram shows.
+     */
+    static const int HistoryColumns = 300;
+    
+    /**
+     * @brief Constructor for SpectrumWidget.
+     * @param parent The parent widget.
+     */
+    explicit SpectrumWidget(QWidget *parent = nullptr);
+    
+    /**
+     * @brief Gets the preferred size of the widget.
+     * @return The size hint.
+     */
+    QSize sizeHint() const override;
+
+public slots:
+    /**
+     * @brief Shows a new spectrum frame.
+     * @param frame The spectrum.
+     */
+    void setFrame(const SpectrumFrame &frame);
+    
+    /**
+     * @brief Clears the bars and the spectrogram.
+     */
+    void clear();
+
+protected:
+    /**
+     * @brief Paints the invalidated part of the widget.
+     * @param event The paint event.
+     */
+    void paintEvent(QPaintEvent *event) override;
+    
+    /**
+     * @brief Forgets the drawn bar heights, the whole widget is repainted after a resize.
+     * @param event The resize event.
+     */
+    void resizeEvent(QResizeEvent *event) override;
+
+private:
+    /**
+     * @brief Gets the area of the bars.
+     * @return The rectangle in widget coordinates.
+     */
+    QRect barArea() const;
+    
+    /**
+     * @brief Gets the area of the spectrogram.
+     * @return The rectangle in widget coordinates.
+     */
+    QRect spectrogramArea() const;
+    
+    /**
+     * @brief Gets the area of the clip indicator.
+     * @return The rectangle in widget coordinates.
+     */
+    QRect clipArea() const;
+    
+    /**
+     * @brief Gets the left edge of a bar (BandCount gives the right edge of the last bar).
+     * @param band The band index.
+     * @return The x coordinate.
+     */
+    int barLeft(int band) const;
+    
+    /**
+     * @brief Gets the left edge of a spectrogram column (HistoryColumns gives the right edge).
+     * @param column The column index.
+     * @return The x coordinate.
+     */
+    int columnLeft(int column) const;
+    
+    /**
+     * @brief Converts a level to a bar height.
+     * @param levelDb The level in dBFS.
+     * @return The height in pixels within the bar area.
+     */
+    int barHeight(float levelDb) const;
+    
+    QVector<float> levels;
+    QVector<float> peaks;
+    QVector<int> drawnLevelHeights;
+    QVector<int> drawnPeakHeights;
+    QImage spectrogram;
+    QVector<QRgb> colorTable;
+    int writeColumn;
+    int clipHoldFrames;
+};
+
+#endif // SPECTRUMWIDGET_H
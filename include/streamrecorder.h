@@ -0,0 +1,131 @@
+#ifndef STREAMRECORDER_H
+#define STREAMRECORDER_H
+
+#include <QtCore/QObject>
+#include <QtCore/QFile>
+#include <QtCore/QThread>
+#include <atomic>
+#include "audioformat.h"
+#include "ringbuffer.h"
+
+/**
+ * @brief The StreamRecorder class records audio to a WAV/RF64 file in the background.
+ *
+ * The audio thread hands frames to write(), which only copies them into a
+ * lock-free ring. A dedicated writer thread drains the ring into a large
+ * page-aligned buffer and writes it in aligned blocks behind a 4 KiB header,
+ * preallocating the file ahead of the data. The header is rewritten
+ * periodically, so a recording interrupted by a crash or power loss stays
+ * playable; when the data outgrows 4 GiB the file is switched to RF64.
+ */
+class StreamRecorder : public QObject
+{
+    Q_OBJECT
+
+public:
+    /**
+     * @brief Constructor for StreamRecorder.
+     * @param parent The parent object.
+     */
+    explicit StreamRecorder(QObject *parent = nullptr);
+    
+    /**
+     * @brief Destructor for StreamRecorder.
+     */
+    ~StreamRecorder();
+    
+    /**
+     * @brief Starts recording to a new file.
+     * @param filePath The path of the file to create.
+     * @param sampleRate The sample rate.
+     * @param channelMap The channel map of the recorded audio.
+     * @return True if recording started, false otherwise.
+     */
+    bool start(const QString &filePath, int sampleRate, const ChannelMap &channelMap);
+    
+    /**
+     * @brief Stops recording and finalizes the file.
+     */
+    void stop();
+    
+    /**
+     * @brief Checks if a recording is running.
+     * @return True if recording, false otherwise.
+     */
+    bool isRecording() const;
+    
+    /**
+     * @brief Queues interleaved frames for recording (audio thread, lock-free).
+     * @param samples The interleaved samples.
+     * @param frames The number of frames.
+     */
+    void write(const float *samples, int frames);
+    
+    /**
+     * @brief Gets the number of frames written to the file.
+     * @return The number of frames.
+     */
+    quint64 getFramesWritten() const;
+    
+    /**
+     * @brief Gets the number of frames lost because the writer fell behind.
+     * @return The number of frames.
+     */
+    quint64 getDroppedFrames() const;
+
+signals:
+    /**
+     * @brief Signal emitted when an error occurs (from the writer thread).
+     * @param errorMessage The error message.
+     */
+    void error(const QString &errorMessage);
+
+private:
+    /**
+     * @brief Body of the writer thread.
+     */
+    void writerLoop();
+    
+    /**
+     * @brief Moves everything queued in the ring into the file.
+     * @return True if successful, false on a write error.
+     */
+    bool drain();
+    
+    /**
+     * @brief Writes the filled part of the write buffer to the file.
+     * @return True if successful, false on a write error.
+     */
+    bool flushWriteBuffer();
+    
+    /**
+     * @brief Makes sure the file has space reserved beyond the given size.
+     * @param size The number of bytes about to be in use.
+     */
+    void preallocate(qint64 size);
+    
+    /**
+     * @brief Rewrites the header with the current data size.
+     * @return True if successful, false on a write error.
+     */
+    bool writeHeader();
+    
+    QFile file;
+    QThread *writerThread;
+    SpscRingBuffer<float> ring;
+    char *writeBuffer;
+    int writeBufferFill;
+    qint64 dataBytes;
+    qint64 allocatedBytes;
+    qint64 syncedBytes;
+    ChannelMap channelMap;
+    int sampleRate;
+    int channels;
+    std::atomic<bool> recording;
+    std::atomic<bool> stopRequested;
+    std::atomic<int> activeWriters;
+    std::atomic<quint64> framesWritten;
+    std::atomic<quint64> droppedFrames;
+};
+
+#endif // STREAMRECORDER_H
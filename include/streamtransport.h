@@ -0,0 +1,140 @@
+#ifndef STREAMTRANSPORT_H
+#define STREAMTRANSPORT_H
+
+#include <QtCore/QObject>
+#include <QtCore/QByteArray>
+#include <QtCore/QString>
+
+/**
+ * @brief The StreamTransport class is the interface of the transports that take over a connected TCP socket.
+ *
+ * NetworkManager hands the descriptor of its QTcpSocket to a transport when
+ * it needs more control over the I/O than Qt offers: UringTransport batches
+ * it through io_uring, SocketTransport reads the kernel's timestamps. A
+ * transport is used from the thread that opened it only.
+ */
+class StreamTransport : public QObject
+{
+    Q_OBJECT
+
+public:
+    /**
+     * @brief Constructor for StreamTransport.
+     * @param parent The parent object.
+     */
+    explicit StreamTransport(QObject *parent = nullptr)
+        : QObject(parent)
+    {
+    }
+    
+    /**
+     * @brief Takes over a connected socket.
+     * @param socketDescriptor The socket descriptor; the transport owns it from now on,
+     *                         also if opening fails.
+     * @param errorMessage Receives the reason of a failure (optional).
+     * @return True if the transport is ready, false otherwise.
+     */
+    virtual bool open(int socketDescriptor, QString *errorMessage = nullptr) = 0;
+    
+    /**
+     * @brief Stops the I/O and closes the socket.
+     */
+    virtual void close() = 0;
+    
+    /**
+     * @brief Checks if the transport is open.
+     * @return True if open, false otherwise.
+     */
+    virtual bool isOpen() const = 0;
+    
+    /**
+     * @brief Gets the socket descriptor.
+     * @return The descriptor, or -1 if the transport is closed.
+     */
+    virtual int socketDescriptor() const = 0;
+    
+    /**
+     * @brief Gets the number of received bytes waiting to be read.
+     * @return The number of bytes.
+     */
+    virtual qint64 bytesAvailable() const = 0;
+    
+    /**
+     * @brief Appends all received bytes to a buffer.
+     * @param buffer The buffer to append to.
+     * @return The number of bytes appended.
+     */
+    virtual qint64 read(QByteArray &buffer) = 0;
+    
+    /**
+     * @brief Buffers bytes; they go out with the next flush().
+     * @param data The bytes.
+     * @param size The number of bytes.
+     */
+    virtual void write(const char *data, qint64 size) = 0;
+    
+    /**
+     * @brief Hands the written bytes to the kernel.
+     */
+    virtual void flush() = 0;
+    
+    /**
+     * @brief Gets the number of bytes written but not yet taken by the kernel.
+     * @return The number of bytes.
+     */
+    virtual qint64 bytesToWrite() const = 0;
+    
+    /**
+     * @brief Gets the description of the last error.
+     * @return The error description.
+     */
+    virtual QString errorString() const = 0;
+    
+    /**
+     * @brief Gets when the kernel received the newest bytes returned by the last read().
+     * @return The time on the ClockSync::now() clock in microseconds, 0 if unknown.
+     */
+    virtual qint64 getReceiveTimestamp() const
+    {
+        return 0;
+    }
+    
+    /**
+     * @brief Asks for the time the kernel sends the last byte written so far.
+     *
+     * Must be called before that byte is flushed. The time is reported
+     * through transmitTimestamp().
+     *
+     * @return The id the timestamp will carry, -1 if the transport has no send timestamps.
+     */
+    virtual qint64 requestTransmitTimestamp()
+    {
+        return -1;
+    }
+
+signals:
+    /**
+     * @brief Signal emitted when received bytes are ready to be read.
+     */
+    void readyRead();
+    
+    /**
+     * @brief Signal emitted when the kernel took written bytes.
+     * @param bytes The number of bytes.
+     */
+    void bytesWritten(qint64 bytes);
+    
+    /**
+     * @brief Signal emitted when the peer closed the connection or it failed.
+     */
+    void disconnected();
+    
+    /**
+     * @brief Signal emitted when the kernel sent a byte whose send time was requested.
+     * @param id The id returned by requestTransmitTimestamp().
+     * @param timeUs The send time on the ClockSync::now() clock in microseconds.
+     */
+    void transmitTimestamp(qint64 id, qint64 timeUs);
+};
+
+#endif // STREAMTRANSPORT_H
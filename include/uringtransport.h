@@ -0,0 +1,186 @@
+#ifndef URINGTRANSPORT_H
+#define URINGTRANSPORT_H
+
+#include "streamtransport.h"
+#include <QtCore/QQueue>
+#include <QtCore/QVector>
+
+class QSocketNotifier;
+struct io_uring;
+struct io_uring_buf_ring;
+
+/**
+ * @brief The UringTransport class moves the bytes of a connected TCP socket through io_uring.
+ *
+ * Available on Linux when AudioBridge is built with liburing
+ * (AUDIOBRIDGE_HAVE_URING) and the kernel supports multishot receive (6.0).
+ * Elsewhere open() fails and the caller keeps using its Qt socket.
+ *
+ * The transport takes over a socket descriptor. All I/O memory comes from one
+ * packet pool allocated in open(): the send slots are registered buffers that
+ * outgoing bytes are packed into, the receive buffers are provided to the
+ * kernel through a buffer ring. A single multishot receive stays armed for
+ * the lifetime of the connection, so receiving costs no syscall per packet.
+ * Writes only fill send slots; flush() submits all filled slots as one linked
+ * chain with a single syscall. Completions are signalled through an eventfd
+ * watched by the event loop of the thread that opened the transport, which
+ * must also be the only thread calling it.
+ */
+class UringTransport : public StreamTransport
+{
+    Q_OBJECT
+
+public:
+    /**
+     * @brief Bytes per send slot and per receive buffer of the packet pool.
+     */
+    static const int SlotSize = 16 * 1024;
+    
+    /**
+     * @brief Constructor for UringTransport.
+     * @param parent The parent object.
+     */
+    explicit UringTransport(QObject *parent = nullptr);
+    
+    /**
+     * @brief Destructor for UringTransport.
+     */
+    ~UringTransport();
+    
+    /**
+     * @brief Checks if io_uring transports can be used (built in and supported by the kernel).
+     * @return True if available, false otherwise.
+     */
+    static bool isAvailable();
+    
+    /**
+     * @brief Takes over a connected socket and arms the receive.
+     * @param socketDescriptor The socket descriptor; the transport owns it from now on,
+     *                         also if opening fails.
+     * @param errorMessage Receives the reason of a failure (optional).
+     * @return True if the transport is ready, false otherwise.
+     */
+    bool open(int socketDescriptor, QString *errorMessage = nullptr) override;
+    
+    /**
+     * @brief Cancels the outstanding operations, frees the pool and closes the socket.
+     */
+    void close() override;
+    
+    /**
+     * @brief Checks if the transport is open.
+     * @return True if open, false otherwise.
+     */
+    bool isOpen() const override;
+    
+    /**
+     * @brief Gets the socket descriptor.
+     * @return The descriptor, or -1 if the transport is closed.
+     */
+    int socketDescriptor() const override;
+    
+    /**
+     * @brief Gets the number of received bytes waiting to be read.
+     * @return The number of bytes.
+     */
+    qint64 bytesAvailable() const override;
+    
+    /**
+     * @brief Appends all received bytes to a buffer and recycles their receive buffers.
+     * @param buffer The buffer to append to.
+     * @return The number of bytes appended.
+     */
+    qint64 read(QByteArray &buffer) override;
+    
+    /**
+     * @brief Packs bytes into the send slots; they go out with the next flush().
+     * @param data The bytes.
+     * @param size The number of bytes.
+     */
+    void write(const char *data, qint64 size) override;
+    
+    /**
+     * @brief Submits the written bytes to the kernel with one syscall.
+     */
+    void flush() override;
+    
+    /**
+     * @brief Gets the number of bytes written but not yet taken by the kernel.
+     * @return The number of bytes.
+     */
+    qint64 bytesToWrite() const override;
+    
+    /**
+     * @brief Gets the description of the last error.
+     * @return The error description.
+     */
+    QString errorString() const override;
+
+private slots:
+    /**
+     * @brief Processes the completions signalled through the eventfd.
+     */
+    void processCompletions();
+
+private:
+    /**
+     * @brief State of one send slot.
+     */
+    struct SendSlot
+    {
+        int index;      ///< Registered buffer index
+        int size;       ///< Bytes packed into the slot
+        int offset;     ///< Bytes of the slot the kernel already took
+    };
+    
+    /**
+     * @brief A receive buffer the kernel filled.
+     */
+    struct ReceivedBuffer
+    {
+        int id;         ///< Buffer id in the buffer ring
+        int size;       ///< Bytes received into it
+    };
+    
+    /**
+     * @brief Arms the multishot receive.
+     * @return True if it was queued, false otherwise.
+     */
+    bool armReceive();
+    
+    /**
+     * @brief Submits every queued slot as one linked chain of writes.
+     */
+    void submitSlots();
+    
+    /**
+     * @brief Gets the slot to pack bytes into.
+     * @return The slot, or nullptr if every slot is in use.
+     */
+    SendSlot *writableSlot();
+    
+    /**
+     * @brief Fails the connection.
+     * @param message The error description.
+     */
+    void fail(const QString &message);
+    
+    io_uring *ring;
+    io_uring_buf_ring *bufferRing;
+    QSocketNotifier *notifier;
+    char *pool;
+    QVector<int> freeSlots;
+    QQueue<SendSlot> sendQueue;
+    QQueue<ReceivedBuffer> received;
+    QByteArray overflow;
+    QString lastError;
+    qint64 receivedBytes;
+    qint64 queuedBytes;
+    int descriptor;
+    int eventDescriptor;
+    int submittedSlots;
+    int inflightWrites;
+    bool receiveArmed;
+};
+
+#endif // URINGTRANSPORT_H
@@ -0,0 +1,238 @@
+#ifndef WORKERPOOL_H
+#define WORKERPOOL_H
+
+#include <QtCore/QObject>
+#include <QtCore/QMutex>
+#include <QtCore/QSemaphore>
+#include <QtCore/QThread>
+#include <atomic>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <vector>
+
+class WorkerPool;
+
+/**
+ * @brief A unit of work the pool runs.
+ *
+ * Tasks are not owned by the pool; whoever submits one keeps it alive until
+ * it has run.
+ */
+class PoolTask
+{
+public:
+    /**
+     * @brief Destructor for PoolTask.
+     */
+    virtual ~PoolTask() = default;
+    
+    /**
+     * @brief Does the work (on a worker thread).
+     */
+    virtual void run() = 0;
+};
+
+/**
+ * @brief Runs one stream's jobs on a pool, in order and one at a time.
+ *
+ * schedule() asks for the job to run; requests made while it is queued or
+ * running are folded into one more run, so the job should drain whatever
+ * work its stream has queued. A strand that keeps getting work is queued
+ * again after each run through WorkerPool::requeue(), behind every task
+ * already waiting, so each other busy stream gets a run before it runs again.
+ * A strand never keeps a worker to itself.
+ */
+class WorkerStrand : public PoolTask
+{
+public:
+    /**
+     * @brief Constructor for WorkerStrand.
+     * @param pool The pool that runs the job.
+     * @param job The job, which drains the stream's queued work.
+     */
+    WorkerStrand(WorkerPool *pool, const std::function<void()> &job);
+    
+    /**
+     * @brief Asks for the job to run (lock-free, allocation-free).
+     *
+     * Only one thread may schedule a strand at a time.
+     *
+     * @return True if the job will run, false if the pool is saturated.
+     */
+    bool schedule();
+    
+    /**
+     * @brief Waits until the job is neither queued nor running.
+     *
+     * Yields a few times, then polls with sleeps growing to a millisecond;
+     * not for the audio callbacks.
+     */
+    void waitUntilIdle();
+    
+    /**
+     * @brief Runs the job (on a worker thread).
+     */
+    void run() override;
+
+private:
+    WorkerPool *pool;
+    std::function<void()> job;
+    
+    // Requests not yet covered by a run, 0 when idle
+    std::atomic<int> pending;
+};
+
+/**
+ * @brief Statistics of a worker pool.
+ */
+struct WorkerPoolStats
+{
+    int threads = 0;                ///< Worker threads
+    quint64 tasksRun = 0;           ///< Tasks run since the pool started
+    quint64 tasksStolen = 0;        ///< Tasks a worker took from another worker's queue
+    quint64 submitsRejected = 0;    ///< Submissions refused because the shared queue was full
+};
+
+/**
+ * @brief The WorkerPool class runs tasks on a fixed set of threads.
+ *
+ * Each worker has a queue of its own, which receives the tasks submitted
+ * from that worker and which it serves oldest first. Tasks submitted from
+ * any other thread, the audio callbacks included, go through a bounded
+ * lock-free queue shared by all workers. A worker with nothing left to do
+ * takes the oldest task from another worker's queue before it goes to sleep,
+ * so a burst that lands on one worker spreads over the others. Every queue
+ * is served in order, and tasks that queue themselves again go to the back
+ * of the shared queue, so one busy strand cannot starve the others.
+ *
+ * Submitting from outside the pool never locks or allocates. Waking a
+ * sleeping worker is one semaphore release, which is a futex wake that never
+ * blocks; workers sleep only when every queue is empty.
+ */
+class WorkerPool : public QObject
+{
+    Q_OBJECT
+
+public:
+    /**
+     * @brief Constructor for WorkerPool. Starts the workers.
+     * @param threadCount The number of workers (0 for one per core).
+     * @param parent The parent object.
+     */
+    explicit WorkerPool(int threadCount = 0, QObject *parent = nullptr);
+    
+    /**
+     * @brief Destructor for WorkerPool. Runs the queued tasks and stops the workers.
+     */
+    ~WorkerPool();
+    
+    /**
+     * @brief Gets the number of workers.
+     * @return The number of threads.
+     */
+    int getThreadCount() const;
+    
+    /**
+     * @brief Queues a task (lock-free and allocation-free from outside the pool).
+     * @param task The task, which must stay alive until it has run.
+     * @return True if the task was queued, false if the shared queue is full.
+     */
+    bool submit(PoolTask *task);
+    
+    /**
+     * @brief Queues a task that just ran again, behind every task already queued.
+     *
+     * Goes through the shared queue also from a worker, so a task that keeps
+     * requeueing itself cannot hold on to its worker while the shared queue
+     * waits. If the shared queue is full the task goes to the back of the
+     * worker's own queue instead; it is never dropped.
+     *
+     * @param task The task, which must stay alive until it has run.
+     */
+    void requeue(PoolTask *task);
+    
+    /**
+     * @brief Queues a function (allocates; not for the audio callbacks).
+     * @param function The function to run.
+     */
+    void post(const std::function<void()> &function);
+    
+    /**
+     * @brief Gets the statistics of the pool.
+     * @return The statistics since the pool started.
+     */
+    WorkerPoolStats getStats() const;
+
+private:
+    /**
+     * @brief A worker thread and its own queue.
+     */
+    struct Worker
+    {
+        QThread *thread = nullptr;
+        QMutex mutex;
+        std::deque<PoolTask*> tasks;
+    };
+    
+    /**
+     * @brief A slot of the shared queue.
+     */
+    struct Slot
+    {
+        std::atomic<quint64> sequence;
+        PoolTask *task;
+    };
+    
+    /**
+     * @brief Runs tasks until the pool stops (worker thread).
+     * @param index The index of the worker.
+     */
+    void runWorker(int index);
+    
+    /**
+     * @brief Takes the next task for a worker: its own, shared, then stolen.
+     * @param index The index of the worker.
+     * @return The task, nullptr if every queue is empty.
+     */
+    PoolTask *takeTask(int index);
+    
+    /**
+     * @brief Adds a task to the shared queue.
+     * @param task The task.
+     * @return True if queued, false if the queue is full.
+     */
+    bool pushShared(PoolTask *task);
+    
+    /**
+     * @brief Takes the oldest task from the shared queue.
+     * @return The task, nullptr if the queue is empty.
+     */
+    PoolTask *popShared();
+    
+    /**
+     * @brief Wakes a sleeping worker, if any.
+     */
+    void wakeWorker();
+    
+    friend class PoolThread;
+    
+    std::vector<std::unique_ptr<Worker>> workers;
+    
+    // Bounded multi-producer/multi-consumer queue of the submitted tasks
+    std::unique_ptr<Slot[]> sharedSlots;
+    quint64 sharedMask;
+    alignas(64) std::atomic<quint64> sharedHead;
+    alignas(64) std::atomic<quint64> sharedTail;
+    
+    QSemaphore wakeup;
+    std::atomic<int> sleepingWorkers;
+    std::atomic<bool> stopping;
+    std::atomic<int> nextWorker;
+    
+    std::atomic<quint64> tasksRun;
+    std::atomic<quint64> tasksStolen;
+    std::atomic<quint64> submitsRejected;
+};
+
+#endif // WORKERPOOL_H
@@ -34,6 +34,9 @@ apt install -y qtbase5-dev qtmultimedia5-dev libqt5multimedia5-plugins || error_
 echo "Installing PortAudio development libraries..."
 apt install -y portaudio19-dev || error_exit "Failed to install PortAudio libraries."
 
+echo "Installing Opus development libraries..."
+apt install -y libopus-dev || error_exit "Failed to install Opus libraries."
+
 echo "Installing ImageMagick (for placeholder icons)..."
 apt install -y imagemagick || error_exit "Failed to install ImageMagick."
 
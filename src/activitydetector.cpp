@@ -0,0 +1,104 @@
+#include "../include/activitydetector.h"
+#include <cmath>
+
+// Weight of a new buffer in the background noise estimate
+const float NOISE_SMOOTHING = 0.1f;
+
+/**
+ * @brief Constructor for ActivityDetector.
+ */
+ActivityDetector::ActivityDetector()
+    : threshold(std::pow(10.0f, -70.0f / 20.0f))
+    , hangoverMs(300)
+    , hangoverFrames(48000 * 300 / 1000)
+    , framesSinceActivity(0)
+    , noiseLevel(0.0f)
+    , active(true)
+{
+}
+
+/**
+ * @brief Sets the level above which a buffer counts as active.
+ * @param thresholdDb The threshold in dBFS.
+ */
+void ActivityDetector::setThreshold(float thresholdDb)
+{
+    threshold = std::pow(10.0f, thresholdDb / 20.0f);
+}
+
+/**
+ * @brief Sets how long the detector stays active after the last active buffer.
+ * @param milliseconds The hangover in milliseconds.
+ */
+void ActivityDetector::setHangover(int milliseconds)
+{
+    hangoverMs = qMax(0, milliseconds);
+}
+
+/**
+ * @brief Prepares the detector for a stream and starts in the active state.
+ * @param sampleRate The sample rate.
+ */
+void ActivityDetector::reset(int sampleRate)
+{
+    hangoverFrames = sampleRate * hangoverMs / 1000;
+    framesSinceActivity = 0;
+    noiseLevel = 0.0f;
+    active = true;
+}
+
+/**
+ * @brief Analyzes a buffer of interleaved samples.
+ * @param samples The interleaved samples.
+ * @param frames The number of frames.
+ * @param channels The number of channels.
+ * @return True if the buffer should be transmitted, false if it is silence.
+ */
+bool ActivityDetector::process(const float *samples, int frames, int channels)
+{
+    int count = frames * channels;
+    if (count <= 0) {
+        return active;
+    }
+    
+    // Compare energies instead of levels to avoid the square root per buffer
+    float sum = 0.0f;
+    for (int i = 0; i < count; i++) {
+        sum += samples[i] * samples[i];
+    }
+    float energy = sum / count;
+    
+    if (energy > threshold * threshold) {
+        framesSinceActivity = 0;
+        active = true;
+        return true;
+    }
+    
+    // Below the threshold: hold on for the hangover, then go idle
+    framesSinceActivity += frames;
+    if (framesSinceActivity <= hangoverFrames) {
+        return active;
+    }
+    
+    active = false;
+    noiseLevel += NOISE_SMOOTHING * (std::sqrt(energy) - noiseLevel);
+    return false;
+}
+
+/**
+ * @brief Checks if the detector is currently active.
+ * @return True if active (including hangover), false otherwise.
+ */
+bool ActivityDetector::isActive() const
+{
+    return active;
+}
+
+/**
+ * @brief Gets the estimated background noise level.
+ * @return The noise RMS level (linear, 0 for digital silence).
+ */
+float ActivityDetector::getNoiseLevel() const
+{
+    return noiseLevel;
+}
@@ -0,0 +1,144 @@
+#include "../include/audioformat.h"
+#include <QtCore/QStringList>
+
+// Names of the speaker positions, indexed by ChannelPosition
+const char *const POSITION_NAMES[] = { "L", "R", "C", "LFE", "BL", "BR", "SL", "SR", "BC" };
+const int POSITION_NAME_COUNT = sizeof(POSITION_NAMES) / sizeof(POSITION_NAMES[0]);
+
+/**
+ * @brief Gets the conventional channel map for a channel count.
+ * @param channels The number of channels (1 to MAX_CHANNELS).
+ * @return The channel map.
+ */
+ChannelMap AudioFormat::defaultChannelMap(int channels)
+{
+    ChannelMap map;
+    
+    switch (channels) {
+        case 1:
+            map << FrontCenter;
+            break;
+        case 2:
+            map << FrontLeft << FrontRight;
+            break;
+        case 3:
+            map << FrontLeft << FrontRight << FrontCenter;
+            break;
+        case 4:
+            map << FrontLeft << FrontRight << BackLeft << BackRight;
+            break;
+        case 5:
+            map << FrontLeft << FrontRight << FrontCenter << BackLeft << BackRight;
+            break;
+        case 6:
+            map << FrontLeft << FrontRight << FrontCenter << LowFrequency << BackLeft << BackRight;
+            break;
+        case 7:
+            map << FrontLeft << FrontRight << FrontCenter << LowFrequency << BackCenter << SideLeft << SideRight;
+            break;
+        case 8:
+            map << FrontLeft << FrontRight << FrontCenter << LowFrequency
+                << BackLeft << BackRight << SideLeft << SideRight;
+            break;
+        default:
+            break;
+    }
+    
+    return map;
+}
+
+/**
+ * @brief Parses a channel map such as "L,R,C,LFE,BL,BR" or "AUX0,AUX1".
+ * @param text The comma-separated channel names.
+ * @return The channel map, or an empty map if the text is invalid.
+ */
+ChannelMap AudioFormat::parseChannelMap(const QString &text)
+{
+    ChannelMap map;
+    
+    const QStringList names = text.split(',', QString::SkipEmptyParts);
+    for (const QString &entry : names) {
+        QString name = entry.trimmed().toUpper();
+        
+        int position = -1;
+        for (int i = 0; i < POSITION_NAME_COUNT; i++) {
+            if (name == POSITION_NAMES[i]) {
+                position = i;
+                break;
+            }
+        }
+        
+        if (position < 0 && name.startsWith("AUX")) {
+            bool ok = false;
+            int index = name.mid(3).toInt(&ok);
+            if (ok && index >= 0 && index < MAX_CHANNELS) {
+                position = Aux0 + index;
+            }
+        }
+        
+        if (position < 0) {
+            return ChannelMap();
+        }
+        map.append(static_cast<ChannelPosition>(position));
+    }
+    
+    return isValidChannelMap(map) ? map : ChannelMap();
+}
+
+/**
+ * @brief Formats a channel map as comma-separated channel names.
+ * @param map The channel map.
+ * @return The channel names.
+ */
+QString AudioFormat::channelMapToString(const ChannelMap &map)
+{
+    QStringList names;
+    for (ChannelPosition position : map) {
+        if (position < POSITION_NAME_COUNT) {
+            names.append(POSITION_NAMES[position]);
+        } else {
+            names.append(QString("AUX%1").arg(position - Aux0));
+        }
+    }
+    return names.join(',');
+}
+
+/**
+ * @brief Checks if a channel map can be streamed.
+ * @param map The channel map.
+ * @return True if it has 1 to MAX_CHANNELS distinct channels, false otherwise.
+ */
+bool AudioFormat::isValidChannelMap(const ChannelMap &map)
+{
+    if (map.isEmpty() || map.size() > MAX_CHANNELS) {
+        return false;
+    }
+    
+    for (int i = 0; i < map.size(); i++) {
+        if (map.at(i) >= POSITION_NAME_COUNT && (map.at(i) < Aux0 || map.at(i) >= Aux0 + MAX_CHANNELS)) {
+            return false;
+        }
+        for (int j = 0; j < i; j++) {
+            if (map.at(i) == map.at(j)) {
+                return false;
+            }
+        }
+    }
+    
+    return true;
+}
+
+/**
+ * @brief Determines the layout of a stream between two peers.
+ * @param senderCapture The channel map of the sender's input device.
+ * @param receiverPlayback The channel map of the receiver's output device.
+ * @return The channel map of the stream.
+ */
+ChannelMap AudioFormat::negotiateStreamMap(const ChannelMap &senderCapture, const ChannelMap &receiverPlayback)
+{
+    if (!isValidChannelMap(senderCapture) || !isValidChannelMap(receiverPlayback)) {
+        return ChannelMap();
+    }
+    
+    return senderCapture.size() <= receiverPlayback.size() ? senderCapture : receiverPlayback;
+}
@@ -1,7 +1,41 @@
 #include "../include/audiomanager.h"
+#include "../include/clocksync.h"
 #include <QtCore/QDebug>
+#include <QtCore/QElapsedTimer>
 #include <cmath>
 #include <algorithm>
+#ifdef Q_OS_UNIX
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+// Buffers of audio collected before playout (re)starts
+const int PLAYOUT_PRIME_BUFFERS = 2;
+
+// Buffers of audio beyond which the oldest queued audio is dropped
+const int PLAYOUT_MAX_BUFFERS = 8;
+
+// Capture time marks the playout FIFO can hold (one per received packet)
+const int PLAYOUT_MARK_CAPACITY = 1024;
+
+// Deviation from the playout schedule beyond which playout jumps instead of slewing
+const int SCHEDULE_JUMP_MS = 5;
+
+// Capture buffers queued for the worker pool before new ones are dropped
+const int CAPTURE_QUEUE_BUFFERS = 8;
+
+// Packet bytes and entries queued for the network thread before new ones are
+// dropped (twice the largest raw packet, 4096 frames of MAX_CHANNELS channels)
+const int SEND_QUEUE_BYTES = 256 * 1024;
+const int SEND_QUEUE_BLOCKS = 256;
+
+// Payloads the network thread cycles through. Several aggregates of 8 frames
+// fit, so a sent aggregate's are free again by their turn; a payload still
+// held when its turn comes is replaced by a new one.
+const int SEND_PACKET_BUFFERS = 32;
+
+// Interval of the input level updates
+const int LEVEL_INTERVAL_MS = 100;
 
 /**
  * @brief Constructor for AudioManager.
@@ -13,13 +47,96 @@ AudioManager::AudioManager(QObject *parent)
     , outputStream(nullptr)
     , sampleRate(48000)
     , bufferSize(256)
-    , channels(2)
+    , inputChannels(2)
+    , outputChannels(2)
     , transmissionMode(TransmissionMode::Raw)
-    , isInitialized(false)
+    , deviceRegistry(nullptr)
     , isRunning(false)
-    , opusEncoder(nullptr)
-    , opusDecoder(nullptr)
+    , inputMap(AudioFormat::defaultChannelMap(2))
+    , outputMap(AudioFormat::defaultChannelMap(2))
+    , sendChannels(2)
+    , sendEnabled(false)
+    , sendMode(TransmissionMode::Raw)
+    , receiveMode(TransmissionMode::Raw)
+    , pendingTransmissionMode(TransmissionMode::Raw)
+    , transmissionModePending(false)
+    , codecAnnouncePending(false)
+    , sendFormatPending(false)
+    , playoutPrimed(false)
+    , playoutStarted(false)
+    , framesPlayed(0)
+    , underrunFrames(0)
+    , overflowFrames(0)
+    , silentFrames(0)
+    , playoutAnchor({ 0, 0 })
+    , nextPlayoutMark({ 0, 0 })
+    , nextPlayoutMarkPending(false)
+    , playoutDelayUs(0)
+    , lastPacketCaptureUs(0)
+    , nextCaptureUs(0)
+    , inputLatencyUs(0)
+    , outputLatencyUs(0)
+    , lateFrames(0)
+    , endToEndDelayUs(0)
+    , silenceSuppression(true)
+    , comfortNoiseIntervalMs(500)
+    , framesSinceComfortNoise(0)
+    , peerSilent(false)
+    , comfortNoiseLevel(0.0f)
+    , noiseSeed(1)
+    , recorder(new StreamRecorder(this))
+    , spectrumAnalyzer(new SpectrumAnalyzer(this))
+    , spectrumSource(SpectrumSource::Off)
+    , echoCancellation(false)
+    , pendingBitrate(64000)
+    , pendingPacketLossPercent(0)
+    , pendingFrameDurationMs(10)
+    , pendingFec(false)
+    , encoderSettingsPending(false)
+    , workerPool(nullptr)
+    , encodeStrand(nullptr)
+    , droppedCaptureFrames(0)
+    , sendQueue(SEND_QUEUE_BYTES)
+    , sendBlocks(SEND_QUEUE_BLOCKS)
+    , sendWakePending(false)
+    , sendPacketBuffers(SEND_PACKET_BUFFERS)
+    , nextSendPacketBuffer(0)
+    , audioLevel(0)
+    , reportedLevel(-1)
+    , levelTimer(new QTimer(this))
 {
+    // codecChanged() may be connected across threads
+    qRegisterMetaType<TransmissionMode>();
+    
+    // Neither end may block: the send path never waits, the network thread
+    // reads whatever is there
+    sendWakeDescriptors[0] = -1;
+    sendWakeDescriptors[1] = -1;
+#ifdef Q_OS_UNIX
+    if (::pipe(sendWakeDescriptors) == 0) {
+        for (int descriptor : sendWakeDescriptors) {
+            ::fcntl(descriptor, F_SETFL, ::fcntl(descriptor, F_GETFL) | O_NONBLOCK);
+            ::fcntl(descriptor, F_SETFD, FD_CLOEXEC);
+        }
+    } else {
+        sendWakeDescriptors[0] = -1;
+        sendWakeDescriptors[1] = -1;
+    }
+#endif
+    
+    connect(recorder, &StreamRecorder::error, this, &AudioManager::error);
+    connect(spectrumAnalyzer, &SpectrumAnalyzer::spectrumReady, this, &AudioManager::spectrumReady);
+    
+    // The capture callback only stores the level, signals are sent from here
+    levelTimer->setInterval(LEVEL_INTERVAL_MS);
+    connect(levelTimer, &QTimer::timeout, this, [this]() {
+        int level = audioLevel.load(std::memory_order_relaxed);
+        if (level != reportedLevel) {
+            reportedLevel = level;
+            emit audioLevelChanged(level);
+        }
+    });
+    levelTimer->start();
 }
 
 /**
@@ -27,12 +144,21 @@ AudioManager::AudioManager(QObject *parent)
  */
 AudioManager::~AudioManager()
 {
+    // A start queued on our own registry's probe thread must not outlive us;
+    // PortAudio itself belongs to the registry
+    if (deviceRegistry && deviceRegistry->parent() == this) {
+        deviceRegistry->stopProbeThread();
+    }
     stop();
-    
-    if (isInitialized) {
-        Pa_Terminate();
-        isInitialized = false;
+    delete encodeStrand;
+
+#ifdef Q_OS_UNIX
+    for (int descriptor : sendWakeDescriptors) {
+        if (descriptor >= 0) {
+            ::close(descriptor);
+        }
     }
+#endif
 }
 
 /**
@@ -41,24 +167,48 @@ AudioManager::~AudioManager()
  */
 bool AudioManager::initialize()
 {
-    if (isInitialized) {
-        return true;
-    }
-    
-    PaError err = Pa_Initialize();
-    if (err != paNoError) {
-        emit error(tr("PortAudio initialization failed: %1").arg(Pa_GetErrorText(err)));
+    if (!getDeviceRegistry()->waitUntilReady()) {
+        emit error(deviceRegistry->getErrorString());
         return false;
     }
     
-    isInitialized = true;
     return true;
 }
 
+/**
+ * @brief Shares a device registry with other managers (before the first use).
+ * @param registry The device registry.
+ */
+void AudioManager::setDeviceRegistry(DeviceRegistry *registry)
+{
+    deviceRegistry = registry;
+}
+
+/**
+ * @brief Gets the device registry, creating one if none was set.
+ * @return The device registry.
+ */
+DeviceRegistry *AudioManager::getDeviceRegistry()
+{
+    if (!deviceRegistry) {
+        deviceRegistry = new DeviceRegistry(this);
+    }
+    return deviceRegistry;
+}
+
+/**
+ * @brief Runs the send path on a worker pool (takes effect on start()).
+ * @param pool The worker pool, nullptr to encode in the capture callback.
+ */
+void AudioManager::setWorkerPool(WorkerPool *pool)
+{
+    workerPool = pool;
+}
+
 /**
  * @brief Starts audio capture and playback.
- * @param inputDeviceName The name of the input device.
- * @param outputDeviceName The name of the output device.
+ * @param inputDeviceName The identifier or the name of the input device.
+ * @param outputDeviceName The identifier or the name of the output device.
  * @param sampleRate The sample rate to use.
  * @param bufferSize The buffer size to use.
  * @param mode The transmission mode (Raw or Opus).
@@ -71,49 +221,54 @@ bool AudioManager::start(const QString &inputDeviceName, const QString &outputDe
         stop();
     }
     
-    if (!isInitialized && !initialize()) {
+    if (!initialize()) {
         return false;
     }
     
-    this->sampleRate = sampleRate;
-    this->bufferSize = bufferSize;
-    this->transmissionMode = mode;
+    QElapsedTimer startTimer;
+    startTimer.start();
     
-    // Find input device
-    int inputDeviceIndex = Pa_GetDefaultInputDevice();
-    int numDevices = Pa_GetDeviceCount();
-    for (int i = 0; i < numDevices; i++) {
-        const PaDeviceInfo *deviceInfo = Pa_GetDeviceInfo(i);
-        if (deviceInfo && QString(deviceInfo->name) == inputDeviceName && deviceInfo->maxInputChannels > 0) {
-            inputDeviceIndex = i;
-            break;
-        }
+    // Other managers may be opening their streams, and the registry must not
+    // enumerate again (which renumbers the devices) until ours are open
+    QMutexLocker portAudioLocker(deviceRegistry->lock());
+    
+    // Find the devices in the registry's cache (the defaults if the names are unknown)
+    AudioDeviceInfo inputDevice = deviceRegistry->findInputDevice(inputDeviceName);
+    AudioDeviceInfo outputDevice = deviceRegistry->findOutputDevice(outputDeviceName);
+    if (inputDevice.index < 0 || outputDevice.index < 0) {
+        emit error(tr("No %1 device available.").arg(inputDevice.index < 0 ? tr("input") : tr("output")));
+        return false;
     }
     
-    // Find output device
-    int outputDeviceIndex = Pa_GetDefaultOutputDevice();
-    for (int i = 0; i < numDevices; i++) {
-        const PaDeviceInfo *deviceInfo = Pa_GetDeviceInfo(i);
-        if (deviceInfo && QString(deviceInfo->name) == outputDeviceName && deviceInfo->maxOutputChannels > 0) {
-            outputDeviceIndex = i;
-            break;
-        }
+    // Fall back to the device's widest default layout if it has fewer channels
+    int maxInputChannels = qMin(MAX_CHANNELS, inputDevice.maxInputChannels);
+    if (inputMap.size() > maxInputChannels) {
+        inputMap = AudioFormat::defaultChannelMap(maxInputChannels);
+    }
+    int maxOutputChannels = qMin(MAX_CHANNELS, outputDevice.maxOutputChannels);
+    if (outputMap.size() > maxOutputChannels) {
+        outputMap = AudioFormat::defaultChannelMap(maxOutputChannels);
+    }
+    
+    // Allocate everything the callbacks use before they can run
+    if (!prepareStreams(sampleRate, bufferSize, mode)) {
+        return false;
     }
     
     // Set up input stream parameters
     PaStreamParameters inputParams;
-    inputParams.device = inputDeviceIndex;
-    inputParams.channelCount = channels;
+    inputParams.device = inputDevice.index;
+    inputParams.channelCount = inputChannels;
     inputParams.sampleFormat = paFloat32;
-    inputParams.suggestedLatency = Pa_GetDeviceInfo(inputDeviceIndex)->defaultLowInputLatency;
+    inputParams.suggestedLatency = inputDevice.defaultLowInputLatency;
     inputParams.hostApiSpecificStreamInfo = nullptr;
     
     // Set up output stream parameters
     PaStreamParameters outputParams;
-    outputParams.device = outputDeviceIndex;
-    outputParams.channelCount = channels;
+    outputParams.device = outputDevice.index;
+    outputParams.channelCount = outputChannels;
     outputParams.sampleFormat = paFloat32;
-    outputParams.suggestedLatency = Pa_GetDeviceInfo(outputDeviceIndex)->defaultLowOutputLatency;
+    outputParams.suggestedLatency = outputDevice.defaultLowOutputLatency;
     outputParams.hostApiSpecificStreamInfo = nullptr;
     
     // Open input stream
@@ -130,6 +285,7 @@ bool AudioManager::start(const QString &inputDeviceName, const QString &outputDe
         emit error(tr("Failed to open input stream: %1").arg(Pa_GetErrorText(err)));
         return false;
     }
+    deviceRegistry->streamOpened();
     
     // Open output stream
     err = Pa_OpenStream(&outputStream,
@@ -144,9 +300,17 @@ bool AudioManager::start(const QString &inputDeviceName, const QString &outputDe
     if (err != paNoError) {
         Pa_CloseStream(inputStream);
         inputStream = nullptr;
+        deviceRegistry->streamClosed();
         emit error(tr("Failed to open output stream: %1").arg(Pa_GetErrorText(err)));
         return false;
     }
+    deviceRegistry->streamOpened();
+    
+    // Device latencies, for callbacks whose host API reports no ADC/DAC times
+    const PaStreamInfo *inputInfo = Pa_GetStreamInfo(inputStream);
+    const PaStreamInfo *outputInfo = Pa_GetStreamInfo(outputStream);
+    inputLatencyUs = inputInfo ? qRound64(inputInfo->inputLatency * 1e6) : 0;
+    outputLatencyUs = outputInfo ? qRound64(outputInfo->outputLatency * 1e6) : 0;
     
     // Start streams
     err = Pa_StartStream(inputStream);
@@ -155,6 +319,8 @@ bool AudioManager::start(const QString &inputDeviceName, const QString &outputDe
         Pa_CloseStream(outputStream);
         inputStream = nullptr;
         outputStream = nullptr;
+        deviceRegistry->streamClosed();
+        deviceRegistry->streamClosed();
         emit error(tr("Failed to start input stream: %1").arg(Pa_GetErrorText(err)));
         return false;
     }
@@ -166,22 +332,133 @@ bool AudioManager::start(const QString &inputDeviceName, const QString &outputDe
         Pa_CloseStream(outputStream);
         inputStream = nullptr;
         outputStream = nullptr;
+        deviceRegistry->streamClosed();
+        deviceRegistry->streamClosed();
         emit error(tr("Failed to start output stream: %1").arg(Pa_GetErrorText(err)));
         return false;
     }
+    portAudioLocker.unlock();
+    
+    qDebug() << "Audio streams started in" << startTimer.elapsed() << "ms";
     
-    // Initialize Opus codec if needed
-    if (transmissionMode == TransmissionMode::Opus) {
-        // In a real implementation, we would initialize the Opus encoder and decoder here
-        // For this example, we'll just simulate it
-        opusEncoder = (void*)1; // Placeholder
-        opusDecoder = (void*)1; // Placeholder
+    // The analysis thread starts before the callbacks can feed it
+    if (spectrumSource.load() != SpectrumSource::Off) {
+        spectrumAnalyzer->start(sampleRate);
     }
     
     isRunning = true;
     return true;
 }
 
+/**
+ * @brief Sets up the buffers and the state of the callbacks for the channel maps.
+ * @param sampleRate The sample rate to use.
+ * @param bufferSize The buffer size to use.
+ * @param mode The transmission mode (Raw or Opus).
+ * @return True if successful, false otherwise.
+ */
+bool AudioManager::prepareStreams(int sampleRate, int bufferSize, TransmissionMode mode)
+{
+    this->sampleRate = sampleRate;
+    this->bufferSize = bufferSize;
+    this->transmissionMode = mode;
+    inputChannels = inputMap.size();
+    outputChannels = outputMap.size();
+    
+    // Set up the playout FIFO (half a second of audio on top of the scheduled
+    // delay) and the decode buffer
+    int playoutDelayFrames = static_cast<int>(playoutDelayUs * sampleRate / 1000000);
+    playoutBuffer.reset((sampleRate / 2 + playoutDelayFrames) * outputChannels);
+    decodeBuffer.resize(sampleRate * 120 / 1000 * MAX_CHANNELS);
+    playoutPrimed = false;
+    playoutStarted = false;
+    framesPlayed = 0;
+    underrunFrames = 0;
+    overflowFrames = 0;
+    silentFrames = 0;
+    
+    // Nothing received has a capture time yet
+    playoutMarks.reset(PLAYOUT_MARK_CAPACITY);
+    playoutAnchor = { 0, 0 };
+    nextPlayoutMarkPending = false;
+    lastPacketCaptureUs = 0;
+    nextCaptureUs = 0;
+    lateFrames = 0;
+    endToEndDelayUs = 0;
+    
+    // Reset silence suppression on both sides
+    activityDetector.reset(sampleRate);
+    framesSinceComfortNoise = 0;
+    peerSilent = false;
+    comfortNoiseLevel = 0.0f;
+    
+    // Open the Opus codec whatever the mode, so either direction can switch to
+    // it while running without allocating. The peer learns our mode in-band,
+    // until then we assume it sends what we send.
+    QString errorMessage;
+    if (!opusCodec.open(sampleRate, &errorMessage) && transmissionMode == TransmissionMode::Opus) {
+        emit error(errorMessage);
+        return false;
+    }
+    encoderSettingsPending = true;
+    sendMode = transmissionMode;
+    receiveMode = transmissionMode;
+    transmissionModePending = false;
+    codecAnnouncePending = false;
+    
+    // Set up channel mixing. Nothing is sent until the peer's format is known;
+    // a format received before a restart is applied again right away.
+    captureMixer.prepare(bufferSize);
+    playoutMixer.prepare(bufferSize);
+    captureMixBuffer.resize(bufferSize * MAX_CHANNELS);
+    
+    // Prepare the processing chains for the device layouts
+    captureGraph.prepare(sampleRate, inputChannels, bufferSize);
+    playoutGraph.prepare(sampleRate, outputChannels, bufferSize);
+    captureDspBuffer.resize(bufferSize * inputChannels);
+    echoCanceller.prepare(sampleRate, inputChannels, outputChannels, bufferSize);
+    sendEnabled = false;
+    
+    // Hand the send path to the pool through a queue of whole buffers (the
+    // strand of the last run is idle since stop())
+    delete encodeStrand;
+    encodeStrand = nullptr;
+    if (workerPool) {
+        captureQueue.reset(CAPTURE_QUEUE_BUFFERS * bufferSize * inputChannels);
+        captureBlocks.reset(CAPTURE_QUEUE_BUFFERS);
+        encodeInputBuffer.resize(bufferSize * inputChannels);
+        encodeStrand = new WorkerStrand(workerPool, [this]() {
+            drainCapture();
+        });
+    }
+    droppedCaptureFrames = 0;
+    
+    if (peerInputMap.isEmpty()) {
+        clearPeerFormat();
+    } else {
+        setPeerFormat(peerInputMap, peerOutputMap);
+    }
+    
+    return true;
+}
+
+/**
+ * @brief Starts audio capture and playback on the device registry's probe thread.
+ * @param inputDeviceName The identifier or the name of the input device.
+ * @param outputDeviceName The identifier or the name of the output device.
+ * @param sampleRate The sample rate to use.
+ * @param bufferSize The buffer size to use.
+ * @param mode The transmission mode (Raw or Opus).
+ */
+void AudioManager::startAsync(const QString &inputDeviceName, const QString &outputDeviceName,
+                              int sampleRate, int bufferSize, TransmissionMode mode)
+{
+    // Queued behind the probe, so the devices are known when it runs
+    getDeviceRegistry()->runOnProbeThread([=]() {
+        emit startFinished(start(inputDeviceName, outputDeviceName, sampleRate, bufferSize, mode));
+    });
+}
+
 /**
  * @brief Stops audio capture and playback.
  */
@@ -192,100 +469,372 @@ void AudioManager::stop()
     }
     
     // Stop and close streams
+    QMutexLocker portAudioLocker(deviceRegistry->lock());
     if (inputStream) {
         Pa_StopStream(inputStream);
         Pa_CloseStream(inputStream);
         inputStream = nullptr;
+        deviceRegistry->streamClosed();
     }
     
     if (outputStream) {
         Pa_StopStream(outputStream);
         Pa_CloseStream(outputStream);
         outputStream = nullptr;
+        deviceRegistry->streamClosed();
     }
+    portAudioLocker.unlock();
     
-    // Clean up Opus codec if needed
-    if (transmissionMode == TransmissionMode::Opus) {
-        // In a real implementation, we would clean up the Opus encoder and decoder here
-        opusEncoder = nullptr;
-        opusDecoder = nullptr;
+    spectrumAnalyzer->stop();
+    
+    // The last buffers may still be encoding on the pool
+    if (encodeStrand) {
+        encodeStrand->waitUntilIdle();
     }
     
+    // Clean up Opus codec
+    opusCodec.close();
+    
     isRunning = false;
 }
 
 /**
- * @brief Gets a list of available input devices.
+ * @brief Starts recording what is played to a WAV/RF64 file.
+ * @param filePath The path of the file to create.
+ * @return True if recording started, false otherwise.
+ */
+bool AudioManager::startRecording(const QString &filePath)
+{
+    if (!isRunning) {
+        return false;
+    }
+    
+    return recorder->start(filePath, sampleRate, outputMap);
+}
+
+/**
+ * @brief Stops recording and finalizes the file.
+ */
+void AudioManager::stopRecording()
+{
+    recorder->stop();
+}
+
+/**
+ * @brief Checks if a recording is running.
+ * @return True if recording, false otherwise.
+ */
+bool AudioManager::isRecording() const
+{
+    return recorder->isRecording();
+}
+
+/**
+ * @brief Selects the audio the spectrum analyzer looks at.
+ *
+ * The analysis runs on its own low-priority thread while audio is running;
+ * the callbacks only copy the selected audio into its ring.
+ *
+ * @param source The audio to analyse, or SpectrumSource::Off.
+ */
+void AudioManager::setSpectrumSource(SpectrumSource source)
+{
+    SpectrumSource previous = spectrumSource.exchange(source);
+    if (!isRunning || previous == source) {
+        return;
+    }
+    
+    // Restart so the new source does not continue the old one's history
+    spectrumAnalyzer->stop();
+    if (source != SpectrumSource::Off) {
+        spectrumAnalyzer->start(sampleRate);
+    }
+}
+
+/**
+ * @brief Sets how many spectrum frames per second are computed.
+ * @param framesPerSecond The frame rate.
+ */
+void AudioManager::setSpectrumFrameRate(int framesPerSecond)
+{
+    spectrumAnalyzer->setFrameRate(framesPerSecond);
+}
+
+/**
+ * @brief Replaces the processing chain applied to captured audio before it is sent.
+ *
+ * The chain runs in the input callback at the input device's layout and
+ * may be changed while audio is running.
+ *
+ * @param description The chain description (see DspGraph::parseChain(), empty for none).
+ * @return True if the description was valid, false otherwise.
+ */
+bool AudioManager::setCaptureProcessing(const QString &description)
+{
+    QString errorMessage;
+    if (!captureGraph.setChain(description, &errorMessage)) {
+        emit error(tr("Invalid capture processing chain: %1").arg(errorMessage));
+        return false;
+    }
+    return true;
+}
+
+/**
+ * @brief Replaces the processing chain applied to received audio before it is played.
+ *
+ * The chain runs in the output callback at the output device's layout and
+ * may be changed while audio is running.
+ *
+ * @param description The chain description (see DspGraph::parseChain(), empty for none).
+ * @return True if the description was valid, false otherwise.
+ */
+bool AudioManager::setPlayoutProcessing(const QString &description)
+{
+    QString errorMessage;
+    if (!playoutGraph.setChain(description, &errorMessage)) {
+        emit error(tr("Invalid playout processing chain: %1").arg(errorMessage));
+        return false;
+    }
+    return true;
+}
+
+/**
+ * @brief Gets the CPU cost of the capture processing nodes.
+ * @return The statistics, in processing order.
+ */
+QVector<DspNodeStats> AudioManager::getCaptureProcessingStats() const
+{
+    return captureGraph.getStats();
+}
+
+/**
+ * @brief Gets the CPU cost of the playout processing nodes.
+ * @return The statistics, in processing order.
+ */
+QVector<DspNodeStats> AudioManager::getPlayoutProcessingStats() const
+{
+    return playoutGraph.getStats();
+}
+
+/**
+ * @brief Enables or disables cancelling the echo of the playout from the input.
+ * @param enabled Whether echo cancellation is enabled.
+ */
+void AudioManager::setEchoCancellation(bool enabled)
+{
+    echoCancellation = enabled;
+}
+
+/**
+ * @brief Sets the length of the echo path the canceller covers (takes effect on start()).
+ * @param milliseconds The tail length in milliseconds.
+ */
+void AudioManager::setEchoTailLength(int milliseconds)
+{
+    echoCanceller.setTailLength(milliseconds);
+}
+
+/**
+ * @brief Gets the convergence and ERLE metrics of the echo canceller.
+ * @return The echo cancellation metrics.
+ */
+EchoStats AudioManager::getEchoStats() const
+{
+    return echoCanceller.getStats();
+}
+
+/**
+ * @brief Gets a list of available input devices (from the registry's cache).
  * @return A list of input device names.
  */
 QStringList AudioManager::getInputDevices() const
 {
     QStringList devices;
     
-    if (!isInitialized && !const_cast<AudioManager*>(this)->initialize()) {
+    if (!const_cast<AudioManager*>(this)->initialize()) {
         return devices;
     }
     
-    int numDevices = Pa_GetDeviceCount();
-    for (int i = 0; i < numDevices; i++) {
-        const PaDeviceInfo *deviceInfo = Pa_GetDeviceInfo(i);
-        if (deviceInfo && deviceInfo->maxInputChannels > 0) {
-            devices.append(QString(deviceInfo->name));
-        }
+    for (const AudioDeviceInfo &device : deviceRegistry->getInputDevices()) {
+        devices.append(device.name);
     }
     
     return devices;
 }
 
 /**
- * @brief Gets a list of available output devices.
+ * @brief Gets a list of available output devices (from the registry's cache).
  * @return A list of output device names.
  */
 QStringList AudioManager::getOutputDevices() const
 {
     QStringList devices;
     
-    if (!isInitialized && !const_cast<AudioManager*>(this)->initialize()) {
+    if (!const_cast<AudioManager*>(this)->initialize()) {
         return devices;
     }
     
-    int numDevices = Pa_GetDeviceCount();
-    for (int i = 0; i < numDevices; i++) {
-        const PaDeviceInfo *deviceInfo = Pa_GetDeviceInfo(i);
-        if (deviceInfo && deviceInfo->maxOutputChannels > 0) {
-            devices.append(QString(deviceInfo->name));
-        }
+    for (const AudioDeviceInfo &device : deviceRegistry->getOutputDevices()) {
+        devices.append(device.name);
     }
     
     return devices;
 }
 
+/**
+ * @brief Sets the channel maps of the devices (takes effect on start()).
+ * @param inputMap The channel map of the input device.
+ * @param outputMap The channel map of the output device.
+ */
+void AudioManager::setChannelMaps(const ChannelMap &inputMap, const ChannelMap &outputMap)
+{
+    this->inputMap = AudioFormat::isValidChannelMap(inputMap) ? inputMap : AudioFormat::defaultChannelMap(2);
+    this->outputMap = AudioFormat::isValidChannelMap(outputMap) ? outputMap : AudioFormat::defaultChannelMap(2);
+}
+
+/**
+ * @brief Gets the channel map the input device was opened with.
+ * @return The input channel map.
+ */
+ChannelMap AudioManager::getInputChannelMap() const
+{
+    return inputMap;
+}
+
+/**
+ * @brief Gets the channel map the output device was opened with.
+ * @return The output channel map.
+ */
+ChannelMap AudioManager::getOutputChannelMap() const
+{
+    return outputMap;
+}
+
 /**
  * @brief Processes incoming audio data.
  * @param data The audio data to process.
+ * @param captureTimeUs When the peer captured the first frame, on the local ClockSync::now()
+ *                      clock (0 if unknown).
  */
-void AudioManager::processIncomingAudio(const QByteArray &data)
+void AudioManager::processIncomingAudio(const QByteArray &data, qint64 captureTimeUs)
 {
-    if (!isRunning) {
+    // Drop audio until we know the layout of the peer's stream
+    if (!isRunning || receiveMap.isEmpty()) {
         return;
     }
     
-    QByteArray processedData;
+    const float *samples;
+    int frames;
     
     // Decode if needed
-    if (transmissionMode == TransmissionMode::Opus) {
-        processedData = decodeAudio(data);
+    if (receiveMode == TransmissionMode::Opus) {
+        frames = decodeAudio(data);
+        if (frames < 0) {
+            return;
+        }
+        samples = decodeBuffer.constData();
     } else {
-        processedData = data;
+        samples = reinterpret_cast<const float*>(data.constData());
+        frames = data.size() / static_cast<int>(sizeof(float)) / receiveMap.size();
+    }
+    
+    // Mix to the output device's layout
+    if (!playoutMixer.isIdentity()) {
+        if (playoutMixBuffer.size() < frames * outputChannels) {
+            playoutMixBuffer.resize(frames * outputChannels);
+        }
+        playoutMixer.process(samples, frames, playoutMixBuffer.data());
+        samples = playoutMixBuffer.constData();
+    }
+    
+    // The peer is talking again
+    peerSilent.store(false, std::memory_order_release);
+    
+    // The frames of a batch share its capture time and follow each other
+    qint64 frameCaptureUs = captureTimeUs;
+    if (captureTimeUs != 0 && captureTimeUs == lastPacketCaptureUs) {
+        frameCaptureUs = nextCaptureUs;
+    }
+    lastPacketCaptureUs = captureTimeUs;
+    nextCaptureUs = frameCaptureUs + frames * 1000000LL / sampleRate;
+    
+    // Tell the output callback when the frames about to be queued were captured
+    if (playoutDelayUs > 0 && frameCaptureUs != 0) {
+        PlayoutMark mark = { playoutBuffer.writePosition() / outputChannels, frameCaptureUs };
+        playoutMarks.write(&mark, 1);
     }
     
-    // Add to output buffer
-    QMutexLocker locker(&outputMutex);
-    outputBuffer = processedData;
+    // Queue for playout. The incoming data references the network receive
+    // buffer and is only valid for the duration of this call.
+    int sampleCount = frames * outputChannels;
+    int written = playoutBuffer.write(samples, sampleCount);
+    if (written < sampleCount) {
+        overflowFrames += (sampleCount - written) / outputChannels;
+    }
+}
+
+/**
+ * @brief Processes a comfort noise update from the peer.
+ * @param noiseLevel The RMS level of the peer's background noise.
+ */
+void AudioManager::processComfortNoise(float noiseLevel)
+{
+    if (!isRunning) {
+        return;
+    }
+    
+    // Queued audio still plays out, the noise only fills what comes after it
+    comfortNoiseLevel.store(qBound(0.0f, noiseLevel, 1.0f), std::memory_order_relaxed);
+    peerSilent.store(true, std::memory_order_release);
+}
+
+/**
+ * @brief Covers a dropped link until the peer's audio arrives again.
+ */
+void AudioManager::concealLinkLoss()
+{
+    if (!isRunning) {
+        return;
+    }
+    
+    // Same as an idle peer: the level of its last update (if any) is kept
+    peerSilent.store(true, std::memory_order_release);
+}
+
+/**
+ * @brief Applies the peer's device layouts and derives both stream layouts.
+ * @param peerInputMap The channel map of the peer's input device.
+ * @param peerOutputMap The channel map of the peer's output device.
+ */
+void AudioManager::setPeerFormat(const ChannelMap &peerInputMap, const ChannelMap &peerOutputMap)
+{
+    this->peerInputMap = peerInputMap;
+    this->peerOutputMap = peerOutputMap;
+    
+    // Both peers derive the same layouts, so no further exchange is needed
+    setReceiveFormat(AudioFormat::negotiateStreamMap(peerInputMap, outputMap));
+    
+    QMutexLocker locker(&sendFormatMutex);
+    pendingSendMap = AudioFormat::negotiateStreamMap(inputMap, peerOutputMap);
+    sendFormatPending.store(true, std::memory_order_release);
+}
+
+/**
+ * @brief Forgets the peer's format (stops sending until the next one arrives).
+ */
+void AudioManager::clearPeerFormat()
+{
+    peerInputMap.clear();
+    peerOutputMap.clear();
+    setReceiveFormat(ChannelMap());
+    
+    QMutexLocker locker(&sendFormatMutex);
+    pendingSendMap.clear();
+    sendFormatPending.store(true, std::memory_order_release);
 }
 
 /**
- * @brief Sets the transmission mode.
+ * @brief Sets the transmission mode of the stream we send.
  * @param mode The transmission mode to use.
  */
 void AudioManager::setTransmissionMode(TransmissionMode mode)
@@ -294,17 +843,326 @@ void AudioManager::setTransmissionMode(TransmissionMode mode)
         return;
     }
     
+    if (isRunning && mode == TransmissionMode::Opus && !opusCodec.isOpen()) {
+        emit error(tr("The Opus codec is not available."));
+        return;
+    }
+    
+    // The send path switches at its next buffer, the streams keep running
     transmissionMode = mode;
+    pendingTransmissionMode.store(mode, std::memory_order_relaxed);
+    transmissionModePending.store(true, std::memory_order_release);
+}
+
+/**
+ * @brief Switches the decoding of the received stream to the peer's format.
+ * @param mode The transmission mode of the peer's stream.
+ */
+void AudioManager::setReceiveTransmissionMode(TransmissionMode mode)
+{
+    if (!isRunning || receiveMode == mode) {
+        return;
+    }
     
-    // If running, restart with new mode
-    if (isRunning) {
-        QString inputDevice = getInputDevices().at(0); // Just use default for this example
-        QString outputDevice = getOutputDevices().at(0); // Just use default for this example
-        stop();
-        start(inputDevice, outputDevice, sampleRate, bufferSize, mode);
+    if (mode == TransmissionMode::Opus && !opusCodec.isOpen()) {
+        emit error(tr("The peer sends Opus audio, but the Opus codec is not available."));
+        return;
+    }
+    
+    // Start decoding from a clean state with the first packet in the new format
+    receiveMode = mode;
+    if (receiveMode == TransmissionMode::Opus && !receiveMap.isEmpty()) {
+        opusCodec.setDecoderChannelMap(receiveMap);
     }
 }
 
+/**
+ * @brief Gets the playout counters.
+ * @return The playout statistics since start().
+ */
+PlayoutStats AudioManager::getPlayoutStats() const
+{
+    PlayoutStats stats;
+    stats.framesPlayed = framesPlayed.load(std::memory_order_relaxed);
+    stats.underrunFrames = underrunFrames.load(std::memory_order_relaxed);
+    stats.overflowFrames = overflowFrames.load(std::memory_order_relaxed);
+    stats.silentFrames = silentFrames.load(std::memory_order_relaxed);
+    stats.lateFrames = lateFrames.load(std::memory_order_relaxed);
+    stats.endToEndDelayUs = endToEndDelayUs.load(std::memory_order_relaxed);
+    return stats;
+}
+
+/**
+ * @brief Gets the time spent in the audio callbacks and on the send path.
+ * @return The time in nanoseconds since construction (compare two reads for a load).
+ */
+qint64 AudioManager::getBusyTime() const
+{
+    return loadMeter.getBusyTime();
+}
+
+/**
+ * @brief Gets the captured frames the worker pool or the network thread fell too far behind to send.
+ * @return The number of frames since start().
+ */
+quint64 AudioManager::getDroppedCaptureFrames() const
+{
+    return droppedCaptureFrames.load(std::memory_order_relaxed);
+}
+
+/**
+ * @brief Gets the memory held by the capture and playout buffers (control thread).
+ * @return The size in bytes, as allocated by the last start().
+ */
+qint64 AudioManager::getBufferMemory() const
+{
+    // The buffers start() sizes and the send queue; the others are small or grow on demand
+    return static_cast<qint64>(playoutBuffer.capacity()) * sizeof(float) +
+           static_cast<qint64>(playoutMarks.capacity()) * sizeof(PlayoutMark) +
+           static_cast<qint64>(decodeBuffer.capacity() + captureMixBuffer.capacity() +
+                               captureDspBuffer.capacity() + captureQueue.capacity() +
+                               encodeInputBuffer.capacity()) * sizeof(float) +
+           sendQueue.capacity() + static_cast<qint64>(sendBlocks.capacity()) * sizeof(SendBlock);
+}
+
+/**
+ * @brief Gets a descriptor that turns readable when the send path queues packets.
+ * @return The descriptor, -1 if the platform has none (poll instead).
+ */
+int AudioManager::getSendQueueDescriptor() const
+{
+    return sendWakeDescriptors[0];
+}
+
+/**
+ * @brief Enables or disables silence suppression (takes effect on start()).
+ * @param enabled Whether silent input is replaced by comfort noise updates.
+ */
+void AudioManager::setSilenceSuppression(bool enabled)
+{
+    silenceSuppression = enabled;
+}
+
+/**
+ * @brief Sets the input level below which audio counts as silence.
+ * @param thresholdDb The threshold in dBFS.
+ */
+void AudioManager::setActivityThreshold(float thresholdDb)
+{
+    activityDetector.setThreshold(thresholdDb);
+}
+
+/**
+ * @brief Sets how long audio keeps being sent after the input fell silent.
+ * @param milliseconds The hangover in milliseconds.
+ */
+void AudioManager::setActivityHangover(int milliseconds)
+{
+    activityDetector.setHangover(milliseconds);
+}
+
+/**
+ * @brief Sets the interval of comfort noise updates while the input is silent.
+ * @param milliseconds The interval in milliseconds.
+ */
+void AudioManager::setComfortNoiseInterval(int milliseconds)
+{
+    comfortNoiseIntervalMs = qMax(10, milliseconds);
+}
+
+/**
+ * @brief Sets the fixed end-to-end delay playout is scheduled to (takes effect on start()).
+ * @param milliseconds The delay from the peer's ADC to our DAC, 0 to play audio as it arrives.
+ */
+void AudioManager::setPlayoutDelay(int milliseconds)
+{
+    playoutDelayUs = qBound(0, milliseconds, 2000) * 1000LL;
+}
+
+/**
+ * @brief Changes the Opus encoder settings without restarting the streams.
+ * @param bitrate The bitrate in bits per second.
+ * @param fec Whether in-band FEC is enabled.
+ * @param packetLossPercent The expected packet loss (0-100).
+ * @param frameDurationMs The frame duration in milliseconds.
+ */
+void AudioManager::setEncoderSettings(int bitrate, bool fec, int packetLossPercent, int frameDurationMs)
+{
+    pendingBitrate = bitrate;
+    pendingFec = fec;
+    pendingPacketLossPercent = packetLossPercent;
+    pendingFrameDurationMs = frameDurationMs;
+    encoderSettingsPending.store(true, std::memory_order_release);
+}
+
+/**
+ * @brief Applies encoder settings queued by setEncoderSettings() (send path).
+ */
+void AudioManager::applyPendingEncoderSettings()
+{
+    if (!encoderSettingsPending.exchange(false, std::memory_order_acquire)) {
+        return;
+    }
+    
+    // The peer is told about bitrate changes, they are part of the stream's format
+    if (opusCodec.getBitrate() != pendingBitrate) {
+        codecAnnouncePending = true;
+    }
+    
+    opusCodec.setBitrate(pendingBitrate);
+    opusCodec.setFec(pendingFec);
+    opusCodec.setPacketLossPercent(pendingPacketLossPercent);
+    opusCodec.setFrameDuration(pendingFrameDurationMs);
+}
+
+/**
+ * @brief Applies a send stream layout queued by setPeerFormat() (send path).
+ */
+void AudioManager::applyPendingSendFormat()
+{
+    if (!sendFormatPending.load(std::memory_order_acquire)) {
+        return;
+    }
+    
+    // Never block the callback, try again with the next buffer
+    if (!sendFormatMutex.tryLock()) {
+        return;
+    }
+    
+    // Reconfiguring allocates, which only happens when a peer connects
+    RtCheck::Waiver waiver;
+    sendFormatPending.store(false, std::memory_order_relaxed);
+    sendMap = pendingSendMap;
+    sendEnabled = !sendMap.isEmpty();
+    
+    if (sendEnabled) {
+        captureMixer.configure(inputMap, sendMap);
+        sendChannels = sendMap.size();
+        
+        if (sendMode == TransmissionMode::Opus && !opusCodec.setEncoderChannelMap(sendMap)) {
+            sendEnabled = false;
+        }
+        
+        // A new layout means a new peer or connection, which needs our format
+        codecAnnouncePending = true;
+    }
+    
+    sendFormatMutex.unlock();
+}
+
+/**
+ * @brief Applies a transmission mode queued by setTransmissionMode() (send path).
+ */
+void AudioManager::applyPendingTransmissionMode()
+{
+    if (!transmissionModePending.exchange(false, std::memory_order_acquire)) {
+        return;
+    }
+    
+    TransmissionMode mode = pendingTransmissionMode.load(std::memory_order_relaxed);
+    if (mode == sendMode) {
+        return;
+    }
+    
+    // The encoder starts with a fresh frame, so the first packet in the new
+    // format only carries audio from after this buffer boundary. Setting it up
+    // allocates, which only happens on a switch.
+    RtCheck::Waiver waiver;
+    if (mode == TransmissionMode::Opus && !opusCodec.setEncoderChannelMap(sendMap)) {
+        return;
+    }
+    
+    sendMode = mode;
+    codecAnnouncePending = true;
+}
+
+/**
+ * @brief Gets the bitrate of the sent stream (send path).
+ * @return The bitrate in bits per second.
+ */
+int AudioManager::getSendBitrate() const
+{
+    if (sendMode == TransmissionMode::Opus) {
+        return opusCodec.getBitrate();
+    }
+    
+    return sampleRate * sendChannels * static_cast<int>(sizeof(float)) * 8;
+}
+
+/**
+ * @brief Configures the receive side for a stream layout (network thread).
+ * @param map The channel map of the received stream, empty to drop audio.
+ */
+void AudioManager::setReceiveFormat(const ChannelMap &map)
+{
+    receiveMap = map;
+    if (receiveMap.isEmpty()) {
+        return;
+    }
+    
+    playoutMixer.configure(receiveMap, outputMap);
+    
+    // The decoder follows the layout in either mode, the peer may switch to Opus any time
+    if (opusCodec.isOpen() && !opusCodec.setDecoderChannelMap(receiveMap)) {
+        receiveMap.clear();
+        emit error(tr("Failed to set up the Opus decoder for %1 channels.").arg(map.size()));
+    }
+}
+
+/**
+ * @brief Runs silence suppression on a capture buffer (send path).
+ * @param samples The interleaved samples.
+ * @param frames The number of frames.
+ * @return True if the buffer should be sent, false if it was suppressed.
+ */
+bool AudioManager::detectActivity(const float *samples, unsigned long frames)
+{
+    if (!silenceSuppression) {
+        return true;
+    }
+    
+    bool wasActive = activityDetector.isActive();
+    if (activityDetector.process(samples, static_cast<int>(frames), inputChannels)) {
+        return true;
+    }
+    
+    // Tell the peer right away when we fall silent, then keep the link alive
+    framesSinceComfortNoise += static_cast<int>(frames);
+    if (wasActive || framesSinceComfortNoise >= sampleRate / 1000 * comfortNoiseIntervalMs) {
+        framesSinceComfortNoise = 0;
+        
+        // A full queue skips this update, the next one follows within the interval
+        SendBlock block = { SendKind::ComfortNoise, 0, 0, activityDetector.getNoiseLevel(), sendMode, 0 };
+        queueSend(block);
+    }
+    
+    return false;
+}
+
+/**
+ * @brief Fills an output buffer with comfort noise (output thread).
+ * @param out The output buffer.
+ * @param samples The number of samples to fill.
+ */
+void AudioManager::generateComfortNoise(float *out, int samples)
+{
+    float level = comfortNoiseLevel.load(std::memory_order_relaxed);
+    if (level <= 0.0f) {
+        memset(out, 0, samples * sizeof(float));
+        return;
+    }
+    
+    // Uniform white noise from a cheap LCG, scaled to the peer's RMS level
+    // (a uniform distribution in [-1, 1) has an RMS of 1/sqrt(3))
+    float scale = level * 1.7320508f / 2147483648.0f;
+    quint32 seed = noiseSeed;
+    for (int i = 0; i < samples; i++) {
+        seed = seed * 1664525u + 1013904223u;
+        out[i] = static_cast<qint32>(seed) * scale;
+    }
+    noiseSeed = seed;
+}
+
 /**
  * @brief Callback function for PortAudio input stream.
  * @param inputBuffer The input buffer.
@@ -327,26 +1185,243 @@ int AudioManager::inputCallback(const void *inputBuffer, void *outputBuffer,
         return paContinue;
     }
     
-    // Calculate audio level
+    LoadMeter::Scope load(self->loadMeter);
+    RtCheck::Scope realtime;
+    
+    // When the first frame of this buffer reached the ADC
+    qint64 nowUs = ClockSync::now();
+    qint64 captureUs = nowUs - self->inputLatencyUs;
+    if (timeInfo && timeInfo->currentTime > 0.0 && timeInfo->inputBufferAdcTime > 0.0 &&
+        timeInfo->inputBufferAdcTime <= timeInfo->currentTime) {
+        captureUs = nowUs - qRound64((timeInfo->currentTime - timeInfo->inputBufferAdcTime) * 1e6);
+    }
+    
     const float *samples = static_cast<const float*>(inputBuffer);
-    int level = self->calculateAudioLevel(samples, framesPerBuffer * self->channels);
-    emit self->audioLevelChanged(level);
+    float *processed = self->captureDspBuffer.data();
     
-    // Process audio data
-    QByteArray data(reinterpret_cast<const char*>(inputBuffer), 
-                   framesPerBuffer * self->channels * sizeof(float));
+    // Cancel the echo of our own playout (on a copy, the input buffer is read-only)
+    if (self->echoCancellation.load(std::memory_order_relaxed)) {
+        memcpy(processed, samples, framesPerBuffer * self->inputChannels * sizeof(float));
+        self->echoCanceller.process(processed, static_cast<int>(framesPerBuffer));
+        samples = processed;
+    }
     
-    // Encode if needed
-    if (self->transmissionMode == TransmissionMode::Opus) {
-        data = self->encodeAudio(data);
+    // Calculate audio level (reported by the level timer)
+    int level = self->calculateAudioLevel(samples, framesPerBuffer * self->inputChannels);
+    self->audioLevel.store(level, std::memory_order_relaxed);
+    
+    // Tap the capture for the spectrum (copies into its lock-free ring)
+    if (self->spectrumSource.load(std::memory_order_relaxed) == SpectrumSource::Capture) {
+        self->spectrumAnalyzer->push(samples, static_cast<int>(framesPerBuffer), self->inputChannels);
     }
     
-    // Emit audio data ready signal
-    emit self->audioDataReady(data);
+    // Send from here, or leave it to the pool
+    if (!self->encodeStrand) {
+        self->processCapture(samples, framesPerBuffer, captureUs, processed);
+    } else {
+        self->queueCapture(samples, framesPerBuffer, captureUs);
+    }
     
     return paContinue;
 }
 
+/**
+ * @brief Processes, encodes and emits a capture buffer (send path).
+ * @param samples The interleaved samples of the input device.
+ * @param frames The number of frames.
+ * @param captureUs When the first frame was captured, on the ClockSync::now() clock.
+ * @param scratch A buffer for the processing chain (may be samples itself).
+ */
+void AudioManager::processCapture(const float *samples, unsigned long frames, qint64 captureUs, float *scratch)
+{
+    // Pick up a newly negotiated stream layout, send nothing until there is one
+    applyPendingSendFormat();
+    if (!sendEnabled) {
+        return;
+    }
+    
+    // Pick up a new wire format and new encoder settings at this buffer boundary
+    applyPendingTransmissionMode();
+    if (sendMode == TransmissionMode::Opus) {
+        applyPendingEncoderSettings();
+    }
+    
+    // Announce the format ahead of the first packet that uses it; no audio
+    // may overtake the announcement, so the buffer waits for it
+    if (codecAnnouncePending) {
+        SendBlock block = { SendKind::Codec, 0, 0, 0.0f, sendMode, getSendBitrate() };
+        if (!queueSend(block)) {
+            droppedCaptureFrames.fetch_add(frames, std::memory_order_relaxed);
+            return;
+        }
+        codecAnnouncePending = false;
+    }
+    
+    // Run the capture processing chain (ahead of the activity detector, so a
+    // noise gate also helps silence suppression)
+    if (!captureGraph.isIdentity()) {
+        if (samples != scratch) {
+            memcpy(scratch, samples, frames * inputChannels * sizeof(float));
+        }
+        captureGraph.process(scratch, static_cast<int>(frames));
+        samples = scratch;
+    }
+    
+    // Suppress silent buffers (only comfort noise updates are sent)
+    if (!detectActivity(samples, frames)) {
+        return;
+    }
+    
+    // Mix to the layout of the send stream
+    if (!captureMixer.isIdentity()) {
+        captureMixer.process(samples, static_cast<int>(frames), captureMixBuffer.data());
+        samples = captureMixBuffer.constData();
+    }
+    
+    // Encode if needed
+    if (sendMode == TransmissionMode::Opus) {
+        // The encoder completes zero or several packets per buffer. A packet
+        // ends at the frames consumed so far and may start with frames it held
+        // back from earlier buffers.
+        int consumed = 0;
+        while (consumed < static_cast<int>(frames)) {
+            EncodedPacket packet;
+            consumed += opusCodec.encode(samples + consumed * sendChannels, static_cast<int>(frames) - consumed,
+                                         packet);
+            if (packet.size == 0) {
+                continue;
+            }
+            
+            qint64 offsetFrames = consumed - packet.frames;
+            SendBlock block = { SendKind::Audio, captureUs + offsetFrames * 1000000 / sampleRate, packet.size,
+                                0.0f, sendMode, 0 };
+            if (!queueSend(block, packet.data)) {
+                droppedCaptureFrames.fetch_add(packet.frames, std::memory_order_relaxed);
+            }
+        }
+        return;
+    }
+    
+    // Raw audio goes out as it is
+    SendBlock block = { SendKind::Audio, captureUs, static_cast<int>(frames * sendChannels * sizeof(float)),
+                        0.0f, sendMode, 0 };
+    if (!queueSend(block, reinterpret_cast<const char*>(samples))) {
+        droppedCaptureFrames.fetch_add(frames, std::memory_order_relaxed);
+    }
+}
+
+/**
+ * @brief Queues an entry for drainSendQueue() (send path).
+ * @param block The entry.
+ * @param data The bytes of an Audio entry's packet.
+ * @return True if queued, false if the queue is full.
+ */
+bool AudioManager::queueSend(const SendBlock &block, const char *data)
+{
+    // Whole packets only: the bytes go first, the block makes them visible
+    int bytes = block.kind == SendKind::Audio ? block.bytes : 0;
+    if (sendBlocks.availableToWrite() < 1 || sendQueue.availableToWrite() < bytes) {
+        return false;
+    }
+    
+    sendQueue.write(data, bytes);
+    sendBlocks.write(&block, 1);
+    
+    // Only the first entry after a drain wakes the network thread. Pairs with
+    // the fence in drainSendQueue(): either it sees this entry, or this sees
+    // the flag it cleared.
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    if (!sendWakePending.exchange(true, std::memory_order_relaxed) && sendWakeDescriptors[1] >= 0) {
+#ifdef Q_OS_UNIX
+        // One byte into a non-blocking pipe, which never waits
+        RtCheck::Waiver waiver;
+        char byte = 0;
+        ssize_t written = ::write(sendWakeDescriptors[1], &byte, 1);
+        Q_UNUSED(written);
+#endif
+    }
+    return true;
+}
+
+/**
+ * @brief Emits what the send path queued since the last call (network thread).
+ */
+void AudioManager::drainSendQueue()
+{
+    // Take the wakeup first: entries queued from here on wake us again
+#ifdef Q_OS_UNIX
+    if (sendWakeDescriptors[0] >= 0) {
+        char bytes[16];
+        while (::read(sendWakeDescriptors[0], bytes, sizeof(bytes)) > 0) {
+        }
+    }
+#endif
+    sendWakePending.store(false, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    
+    SendBlock block;
+    while (sendBlocks.read(&block, 1) == 1) {
+        switch (block.kind) {
+            case SendKind::Audio: {
+                // A buffer still queued or being aggregated is left to the
+                // network side; a free one keeps its allocation
+                QByteArray &data = sendPacketBuffers[nextSendPacketBuffer];
+                nextSendPacketBuffer = (nextSendPacketBuffer + 1) % sendPacketBuffers.size();
+                if (!data.isDetached()) {
+                    data = QByteArray();
+                }
+                data.resize(block.bytes);
+                sendQueue.read(data.data(), block.bytes);
+                emit audioDataReady(data, block.captureUs);
+                break;
+            }
+            case SendKind::ComfortNoise:
+                emit comfortNoiseReady(block.noiseLevel);
+                break;
+            case SendKind::Codec:
+                emit codecChanged(block.mode, block.bitrate);
+                break;
+        }
+    }
+}
+
+/**
+ * @brief Queues a capture buffer for the encode strand (capture thread).
+ * @param samples The interleaved samples of the input device.
+ * @param frames The number of frames.
+ * @param captureUs When the first frame was captured, on the ClockSync::now() clock.
+ */
+void AudioManager::queueCapture(const float *samples, unsigned long frames, qint64 captureUs)
+{
+    // Whole buffers only: the samples go first, the block makes them visible
+    int count = static_cast<int>(frames) * inputChannels;
+    if (captureBlocks.availableToWrite() < 1 || captureQueue.availableToWrite() < count) {
+        droppedCaptureFrames.fetch_add(frames, std::memory_order_relaxed);
+    } else {
+        captureQueue.write(samples, count);
+        CaptureBlock block = { captureUs, static_cast<int>(frames) };
+        captureBlocks.write(&block, 1);
+    }
+    
+    // A saturated pool is asked again with the next buffer
+    encodeStrand->schedule();
+}
+
+/**
+ * @brief Runs the send path on the queued capture buffers (encode strand).
+ */
+void AudioManager::drainCapture()
+{
+    LoadMeter::Scope load(loadMeter);
+    
+    CaptureBlock block;
+    while (captureBlocks.read(&block, 1) == 1) {
+        float *samples = encodeInputBuffer.data();
+        captureQueue.read(samples, block.frames * inputChannels);
+        processCapture(samples, static_cast<unsigned long>(block.frames), block.captureUs, samples);
+    }
+}
+
 /**
  * @brief Callback function for PortAudio output stream.
  * @param inputBuffer The input buffer.
@@ -369,25 +1444,201 @@ int AudioManager::outputCallback(const void *inputBuffer, void *outputBuffer,
         return paContinue;
     }
     
-    // Get output data
-    QMutexLocker locker(&self->outputMutex);
+    LoadMeter::Scope load(self->loadMeter);
+    RtCheck::Scope realtime;
+    
+    // When the first frame of this buffer reaches the DAC
+    qint64 nowUs = ClockSync::now();
+    qint64 presentationUs = nowUs + self->outputLatencyUs;
+    if (timeInfo && timeInfo->currentTime > 0.0 && timeInfo->outputBufferDacTime >= timeInfo->currentTime) {
+        presentationUs = nowUs + qRound64((timeInfo->outputBufferDacTime - timeInfo->currentTime) * 1e6);
+    }
     
-    // Fill output buffer
     float *out = static_cast<float*>(outputBuffer);
-    size_t bytesPerFrame = self->channels * sizeof(float);
-    size_t bytesToCopy = framesPerBuffer * bytesPerFrame;
+    self->renderOutput(out, framesPerBuffer, presentationUs);
     
-    if (self->outputBuffer.size() >= bytesToCopy) {
-        // Copy data from output buffer
-        memcpy(out, self->outputBuffer.constData(), bytesToCopy);
-    } else {
-        // Fill with silence
-        memset(out, 0, bytesToCopy);
+    // Run the playout processing chain
+    if (!self->playoutGraph.isIdentity()) {
+        self->playoutGraph.process(out, static_cast<int>(framesPerBuffer));
+    }
+    
+    // What is played is the reference of the echo canceller
+    if (self->echoCancellation.load(std::memory_order_relaxed)) {
+        self->echoCanceller.pushReference(out, static_cast<int>(framesPerBuffer));
+    }
+    
+    // Tap what is played for the recorder (copies into its lock-free ring)
+    if (self->recorder->isRecording()) {
+        self->recorder->write(out, static_cast<int>(framesPerBuffer));
+    }
+    
+    // Tap what is played for the spectrum
+    if (self->spectrumSource.load(std::memory_order_relaxed) == SpectrumSource::Playout) {
+        self->spectrumAnalyzer->push(out, static_cast<int>(framesPerBuffer), self->outputChannels);
     }
     
     return paContinue;
 }
 
+/**
+ * @brief Fills an output buffer from the playout FIFO (output thread).
+ * @param out The output buffer.
+ * @param framesPerBuffer The number of frames to fill.
+ * @param presentationUs When the buffer reaches the DAC, on the ClockSync::now() clock.
+ */
+void AudioManager::renderOutput(float *out, unsigned long framesPerBuffer, qint64 presentationUs)
+{
+    int channels = outputChannels;
+    int samplesNeeded = static_cast<int>(framesPerBuffer) * channels;
+    int available = playoutBuffer.availableToRead();
+    
+    framesPlayed.fetch_add(framesPerBuffer, std::memory_order_relaxed);
+    
+    // The peer is idle: play what is left, then comfort noise. This is not an
+    // underrun, and playout re-primes quietly once the peer resumes.
+    if (peerSilent.load(std::memory_order_acquire) && available < samplesNeeded) {
+        int samplesRead = playoutBuffer.read(out, samplesNeeded);
+        generateComfortNoise(out + samplesRead, samplesNeeded - samplesRead);
+        silentFrames.fetch_add((samplesNeeded - samplesRead) / channels, std::memory_order_relaxed);
+        playoutPrimed = false;
+        playoutStarted = false;
+        return;
+    }
+    
+    // Play each frame the scheduled delay after its capture, once it has a capture time
+    qint64 headCaptureUs = playoutDelayUs > 0 ? playoutHeadCaptureTime() : 0;
+    if (headCaptureUs != 0) {
+        int frames = static_cast<int>(framesPerBuffer);
+        int jumpFrames = sampleRate * SCHEDULE_JUMP_MS / 1000;
+        
+        // Positive when the head of the FIFO should already be playing
+        qint64 lateFrameCount = (presentationUs - playoutDelayUs - headCaptureUs) * sampleRate / 1000000;
+        int leadFrames = 0;
+        int slew = 0;
+        if (lateFrameCount > jumpFrames) {
+            // Too late to catch up smoothly: drop what missed its time
+            int skipped = playoutBuffer.skip(static_cast<int>(qMin<qint64>(lateFrameCount, available / channels)) * channels);
+            lateFrames.fetch_add(skipped / channels, std::memory_order_relaxed);
+            headCaptureUs = playoutHeadCaptureTime();
+        } else if (lateFrameCount < -jumpFrames) {
+            // Not due yet: silence until it is
+            leadFrames = static_cast<int>(qMin<qint64>(-lateFrameCount, frames));
+            memset(out, 0, leadFrames * channels * sizeof(float));
+        } else if (lateFrameCount != 0) {
+            // Drift: drop or repeat a single frame per buffer
+            slew = lateFrameCount > 0 ? 1 : -1;
+        }
+        
+        int samplesRead = readPlayout(out + leadFrames * channels, frames - leadFrames, slew);
+        if (samplesRead > 0) {
+            playoutStarted = true;
+            endToEndDelayUs.store(presentationUs + leadFrames * 1000000LL / sampleRate - headCaptureUs,
+                                  std::memory_order_relaxed);
+        }
+        
+        // Silence on underrun; what arrives later than its time is dropped then
+        int samplesFilled = leadFrames * channels + samplesRead;
+        if (samplesFilled < samplesNeeded) {
+            memset(out + samplesFilled, 0, (samplesNeeded - samplesFilled) * sizeof(float));
+            if (playoutStarted) {
+                underrunFrames.fetch_add((samplesNeeded - samplesFilled) / channels, std::memory_order_relaxed);
+            }
+        }
+        return;
+    }
+    
+    // Collect a small cushion before (re)starting playout
+    if (!playoutPrimed) {
+        if (available < PLAYOUT_PRIME_BUFFERS * bufferSize * channels) {
+            memset(out, 0, samplesNeeded * sizeof(float));
+            
+            // Silence while re-buffering after an underrun is lost audio
+            if (playoutStarted) {
+                underrunFrames.fetch_add(framesPerBuffer, std::memory_order_relaxed);
+            }
+            return;
+        }
+        playoutPrimed = true;
+        playoutStarted = true;
+    }
+    
+    // Drop the oldest audio if the FIFO keeps growing (sender clock is faster)
+    int excess = available - PLAYOUT_MAX_BUFFERS * bufferSize * channels;
+    if (excess > 0) {
+        playoutBuffer.skip(excess - excess % channels);
+    }
+    
+    // Fill output buffer, padding with silence on underrun
+    int samplesRead = playoutBuffer.read(out, samplesNeeded);
+    if (samplesRead < samplesNeeded) {
+        memset(out + samplesRead, 0, (samplesNeeded - samplesRead) * sizeof(float));
+        underrunFrames.fetch_add((samplesNeeded - samplesRead) / channels, std::memory_order_relaxed);
+        playoutPrimed = false;
+    }
+}
+
+/**
+ * @brief Gets the capture time of the next frame in the playout FIFO (output thread).
+ * @return The capture time on the ClockSync::now() clock, 0 if unknown.
+ */
+qint64 AudioManager::playoutHeadCaptureTime()
+{
+    quint64 headFrame = playoutBuffer.readPosition() / outputChannels;
+    
+    // The newest mark at or before the head is the anchor, later frames follow it
+    for (;;) {
+        if (!nextPlayoutMarkPending) {
+            nextPlayoutMarkPending = playoutMarks.read(&nextPlayoutMark, 1) == 1;
+        }
+        if (!nextPlayoutMarkPending || nextPlayoutMark.frame > headFrame) {
+            break;
+        }
+        playoutAnchor = nextPlayoutMark;
+        nextPlayoutMarkPending = false;
+    }
+    
+    if (playoutAnchor.captureUs == 0) {
+        return 0;
+    }
+    return playoutAnchor.captureUs + static_cast<qint64>(headFrame - playoutAnchor.frame) * 1000000 / sampleRate;
+}
+
+/**
+ * @brief Reads from the playout FIFO, slewing by one frame to stay on schedule (output thread).
+ * @param out The output buffer.
+ * @param frames The number of frames to fill.
+ * @param slew 1 to drop a frame, -1 to repeat one, 0 to read as is.
+ * @return The number of samples filled.
+ */
+int AudioManager::readPlayout(float *out, int frames, int slew)
+{
+    int channels = outputChannels;
+    if (slew == 0 || frames < 2) {
+        return playoutBuffer.read(out, frames * channels);
+    }
+    
+    if (slew > 0) {
+        // Drop a frame: the last two frames read are averaged into one
+        int samplesRead = playoutBuffer.read(out, frames * channels);
+        float extra[MAX_CHANNELS];
+        if (samplesRead == frames * channels && playoutBuffer.read(extra, channels) == channels) {
+            float *last = out + (frames - 1) * channels;
+            for (int c = 0; c < channels; c++) {
+                last[c] = 0.5f * (last[c] + extra[c]);
+            }
+        }
+        return samplesRead;
+    }
+    
+    // Repeat a frame: the last frame read is played twice
+    int samplesRead = playoutBuffer.read(out, (frames - 1) * channels);
+    if (samplesRead == (frames - 1) * channels) {
+        memcpy(out + samplesRead, out + samplesRead - channels, channels * sizeof(float));
+        samplesRead += channels;
+    }
+    return samplesRead;
+}
+
 /**
  * @brief Calculates the audio level from raw audio data.
  * @param data The audio data.
@@ -419,41 +1670,12 @@ int AudioManager::calculateAudioLevel(const float *data, unsigned long size) con
     return std::max(0, std::min(100, level));
 }
 
-/**
- * @brief Encodes raw audio data using Opus.
- * @param rawData The raw audio data.
- * @return The encoded audio data.
- */
-QByteArray AudioManager::encodeAudio(const QByteArray &rawData)
-{
-    // In a real implementation, we would use the Opus encoder here
-    // For this example, we'll just return the raw data
-    // This is a placeholder for actual Opus encoding
-    
-    // Simulate compression (just to show the concept)
-    QByteArray encodedData;
-    encodedData.append("OPUS"); // Add a marker
-    encodedData.append(rawData); // In reality, this would be compressed
-    
-    return encodedData;
-}
-
 /**
  * @brief Decodes Opus-encoded audio data.
  * @param encodedData The encoded audio data.
- * @return The decoded audio data.
+ * @return The number of decoded frames in decodeBuffer, or -1 on error.
  */
-QByteArray AudioManager::decodeAudio(const QByteArray &encodedData)
+int AudioManager::decodeAudio(const QByteArray &encodedData)
 {
-    // In a real implementation, we would use the Opus decoder here
-    // For this example, we'll just check for our marker and return the raw data
-    // This is a placeholder for actual Opus decoding
-    
-    if (encodedData.startsWith("OPUS")) {
-        // Remove our marker
-        return encodedData.mid(4);
-    }
-    
-    // If not Opus encoded, return as is
-    return encodedData;
+    return opusCodec.decode(encodedData, decodeBuffer);
 }
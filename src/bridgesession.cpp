@@ -0,0 +1,373 @@
+#include "../include/bridgesession.h"
+#include <QtCore/QDebug>
+
+// Interval of the receiver reports sent to the peer
+const int REPORT_INTERVAL_MS = 1000;
+
+/**
+ * @brief Reads a session from its group in a sessions file.
+ * @param settings The sessions file.
+ * @param name The name of the session's group.
+ * @param config The session (output).
+ * @param errorMessage Receives the reason if the session is invalid (optional).
+ * @return True if the session was valid, false otherwise.
+ */
+bool SessionConfig::parse(const QSettings &settings, const QString &name, SessionConfig &config,
+                          QString *errorMessage)
+{
+    SessionConfig parsed;
+    parsed.name = name;
+    
+    auto value = [&](const char *key, const QVariant &defaultValue) {
+        return settings.value(name + "/" + key, defaultValue);
+    };
+    auto fail = [&](const QString &message) {
+        if (errorMessage) {
+            *errorMessage = QString("Session \"%1\": %2").arg(name, message);
+        }
+        return false;
+    };
+    
+    QString role = value("role", "sender").toString().toLower();
+    if (role != "sender" && role != "receiver") {
+        return fail(QString("Invalid role \"%1\"").arg(role));
+    }
+    parsed.sender = role == "sender";
+    
+    parsed.host = value("host", QString()).toString();
+    if (parsed.sender && parsed.host.isEmpty()) {
+        return fail("A sender needs a host");
+    }
+    
+    parsed.port = value("port", parsed.port).toInt();
+    if (parsed.port < 1 || parsed.port > 65535) {
+        return fail(QString("Invalid port %1").arg(parsed.port));
+    }
+    
+    parsed.inputDevice = value("inputDevice", QString()).toString();
+    parsed.outputDevice = value("outputDevice", QString()).toString();
+    
+    parsed.sampleRate = value("sampleRate", parsed.sampleRate).toInt();
+    if (parsed.sampleRate != 44100 && parsed.sampleRate != 48000) {
+        return fail(QString("Unsupported sample rate %1").arg(parsed.sampleRate));
+    }
+    
+    parsed.bufferSize = value("bufferSize", parsed.bufferSize).toInt();
+    if (parsed.bufferSize < 32 || parsed.bufferSize > 4096) {
+        return fail(QString("Invalid buffer size %1").arg(parsed.bufferSize));
+    }
+    
+    QString mode = value("mode", "raw").toString().toLower();
+    if (mode != "raw" && mode != "opus") {
+        return fail(QString("Invalid mode \"%1\"").arg(mode));
+    }
+    parsed.mode = mode == "opus" ? TransmissionMode::Opus : TransmissionMode::Raw;
+    
+    QString transport = value("transport", "qt").toString().toLower();
+    if (transport != "qt" && transport != "uring") {
+        return fail(QString("Invalid transport \"%1\"").arg(transport));
+    }
+    parsed.transport = transport == "uring" ? TransportBackend::Uring : TransportBackend::Qt;
+    parsed.kernelTimestamps = value("kernelTimestamps", parsed.kernelTimestamps).toBool();
+    
+    parsed.opusBitrate = value("opusBitrate", parsed.opusBitrate).toInt();
+    parsed.playoutDelayMs = value("playoutDelayMs", parsed.playoutDelayMs).toInt();
+    parsed.framesPerPacket = value("framesPerPacket", parsed.framesPerPacket).toInt();
+    parsed.maxQueueDelayMs = value("maxQueueDelayMs", parsed.maxQueueDelayMs).toInt();
+    parsed.silenceSuppression = value("silenceSuppression", parsed.silenceSuppression).toBool();
+    
+    config = parsed;
+    return true;
+}
+
+/**
+ * @brief Constructor for BridgeSession.
+ * @param config The settings of the session.
+ * @param worker The thread the network side runs on (must be running).
+ * @param devices The device registry shared by the sessions (must outlive the session).
+ * @param encoders The pool the send path runs on (must outlive the session), nullptr for the capture thread.
+ * @param parent The parent object.
+ */
+BridgeSession::BridgeSession(const SessionConfig &config, QThread *worker, DeviceRegistry *devices, WorkerPool *encoders,
+                             QObject *parent)
+    : QObject(parent)
+    , config(config)
+    , audioManager(new AudioManager(this))
+    , networkManager(new NetworkManager)
+    , rateController(new RateController(this))
+    , reportTimer(new QTimer(this))
+    , lastPlayoutStats()
+    , sendMode(config.mode)
+    , running(false)
+    , connected(false)
+    , latencyMs(0)
+    , queueingMs(-1)
+    , lastStatsNs(0)
+    , lastBusyNs(0)
+{
+    // PortAudio and the device list are probed once for all sessions
+    audioManager->setDeviceRegistry(devices);
+    
+    // Encoding spreads over the pool's cores instead of the capture threads
+    audioManager->setWorkerPool(encoders);
+    
+    // The network side shares the worker's event loop with other sessions
+    networkManager->moveToThread(worker);
+    
+    connect(audioManager, &AudioManager::error, this, &BridgeSession::error);
+    connect(networkManager, &NetworkManager::error, this, &BridgeSession::error);
+    connect(networkManager, &NetworkManager::connectionStatusChanged, this,
+            [this](bool isConnected, const QString &message) {
+        connected = isConnected;
+        emit connectionStatusChanged(isConnected, message);
+    });
+    connect(networkManager, &NetworkManager::latencyChanged, this, [this](int latency) {
+        latencyMs = latency;
+    });
+    connect(networkManager, &NetworkManager::latencyStatsChanged, this, [this](const LatencyStats &stats) {
+        queueingMs = stats.kernelTimestamps
+                     ? static_cast<int>((stats.localQueueingUs + stats.peerQueueingUs + 500) / 1000) : -1;
+    });
+    
+    // The receive path (decode and playout buffer insert) runs directly on the worker
+    connect(networkManager, &NetworkManager::audioDataReceived, audioManager, &AudioManager::processIncomingAudio,
+            Qt::DirectConnection);
+    connect(networkManager, &NetworkManager::comfortNoiseReceived, audioManager, &AudioManager::processComfortNoise,
+            Qt::DirectConnection);
+    connect(networkManager, &NetworkManager::peerFormatReceived, audioManager, &AudioManager::setPeerFormat,
+            Qt::DirectConnection);
+    connect(networkManager, &NetworkManager::peerCodecReceived, audioManager,
+            &AudioManager::setReceiveTransmissionMode, Qt::DirectConnection);
+    connect(networkManager, &NetworkManager::connectionStatusChanged, networkManager, [this](bool connected) {
+        // Cover the gap until the link is back
+        if (!connected) {
+            audioManager->concealLinkLoss();
+        }
+    });
+    connect(networkManager, &NetworkManager::sessionEnded, networkManager, [this]() {
+        // The next peer announces its own format
+        audioManager->clearPeerFormat();
+    });
+    connect(networkManager, &NetworkManager::sessionNegotiated, this, [this](const NegotiatedSession &session) {
+        // Send what the handshake agreed on
+        if (running && session.mode != sendMode) {
+            sendMode = session.mode;
+            audioManager->setTransmissionMode(sendMode);
+            updateRateControl(sendMode);
+        }
+    });
+    
+    // The send path queues its packets; the network thread collects and sends them
+    connect(networkManager, &NetworkManager::readyForAudio, audioManager, &AudioManager::drainSendQueue,
+            Qt::DirectConnection);
+    connect(audioManager, &AudioManager::audioDataReady, networkManager, &NetworkManager::sendAudioData,
+            Qt::DirectConnection);
+    connect(audioManager, &AudioManager::comfortNoiseReady, networkManager, &NetworkManager::sendComfortNoise,
+            Qt::DirectConnection);
+    connect(audioManager, &AudioManager::codecChanged, networkManager, &NetworkManager::sendCodec,
+            Qt::DirectConnection);
+    runOnNetworkThread([this]() {
+        networkManager->watchAudioQueue(audioManager->getSendQueueDescriptor());
+    });
+    
+    // Adapt the encoder to the network conditions
+    connect(networkManager, &NetworkManager::latencyChanged, rateController, &RateController::setRoundTripTime);
+    connect(networkManager, &NetworkManager::sendBacklogChanged, rateController, &RateController::setSendBacklog);
+    connect(networkManager, &NetworkManager::receiverReportReceived,
+            rateController, &RateController::processReceiverReport);
+    connect(networkManager, &NetworkManager::sendQueueOverflowed, rateController, &RateController::processSendDrops);
+    connect(rateController, &RateController::encoderSettingsChanged, audioManager, &AudioManager::setEncoderSettings);
+    
+    reportTimer->setInterval(REPORT_INTERVAL_MS);
+    connect(reportTimer, &QTimer::timeout, this, &BridgeSession::sendReceiverReport);
+    
+    statsClock.start();
+}
+
+/**
+ * @brief Destructor for BridgeSession.
+ */
+BridgeSession::~BridgeSession()
+{
+    stop();
+    
+    // Nothing may reach the session once it is gone; the worker outlives the
+    // session and deletes the network manager from its own event loop
+    runOnNetworkThread([this]() {
+        QObject::disconnect(networkManager, nullptr, nullptr, nullptr);
+        networkManager->deleteLater();
+    });
+}
+
+/**
+ * @brief Starts the audio devices and the connection.
+ * @return True if started successfully, false otherwise.
+ */
+bool BridgeSession::start()
+{
+    if (running) {
+        return true;
+    }
+    
+    if (!audioManager->initialize()) {
+        return false;
+    }
+    
+    audioManager->setSilenceSuppression(config.silenceSuppression);
+    audioManager->setPlayoutDelay(config.playoutDelayMs);
+    
+    // Start audio before the network, so that received audio never meets a stream being opened
+    if (!audioManager->start(config.inputDevice, config.outputDevice, config.sampleRate, config.bufferSize,
+                             config.mode)) {
+        return false;
+    }
+    
+    bool networkStarted = false;
+    runOnNetworkThread([&]() {
+        networkManager->setFramesPerPacket(config.framesPerPacket);
+        networkManager->setSendQueueLimit(config.maxQueueDelayMs, DropPolicy::DropOldest);
+        networkManager->setTransportBackend(config.transport);
+        networkManager->setKernelTimestamps(config.kernelTimestamps);
+        networkManager->setLocalCapabilities(SessionHandshake::localCapabilities(config.sampleRate,
+                                                                                 config.bufferSize, config.mode));
+        networkStarted = config.sender ? networkManager->connectToServer(config.host, config.port)
+                                       : networkManager->startServer(config.port);
+    });
+    
+    if (!networkStarted) {
+        audioManager->stop();
+        return false;
+    }
+    
+    // Announce our layouts to the peer
+    ChannelMap inputMap = audioManager->getInputChannelMap();
+    ChannelMap outputMap = audioManager->getOutputChannelMap();
+    runOnNetworkThread([&]() {
+        networkManager->setLocalFormat(inputMap, outputMap);
+    });
+    
+    sendMode = config.mode;
+    updateRateControl(sendMode);
+    lastPlayoutStats = audioManager->getPlayoutStats();
+    reportTimer->start();
+    
+    running = true;
+    return true;
+}
+
+/**
+ * @brief Stops the connection and the audio devices.
+ */
+void BridgeSession::stop()
+{
+    if (!running) {
+        return;
+    }
+    
+    rateController->stop();
+    reportTimer->stop();
+    
+    // Stop the network first, so that nothing is received into a stopping stream
+    runOnNetworkThread([this]() {
+        networkManager->disconnect();
+    });
+    audioManager->stop();
+    
+    running = false;
+    connected = false;
+    latencyMs = 0;
+    queueingMs = -1;
+}
+
+/**
+ * @brief Checks if the session is started.
+ * @return True if it is, false otherwise.
+ */
+bool BridgeSession::isRunning() const
+{
+    return running;
+}
+
+/**
+ * @brief Gets the settings of the session.
+ * @return The settings.
+ */
+SessionConfig BridgeSession::getConfig() const
+{
+    return config;
+}
+
+/**
+ * @brief Takes a snapshot of the session's state.
+ * @return The statistics (worker is left for the owner to fill in).
+ */
+SessionStats BridgeSession::sampleStats()
+{
+    SessionStats stats;
+    stats.name = config.name;
+    stats.running = running;
+    stats.connected = connected;
+    stats.latencyMs = latencyMs;
+    stats.queueingMs = queueingMs;
+    
+    // Busy time of the callbacks and of the worker on our behalf, over wall time
+    qint64 nowNs = statsClock.nsecsElapsed();
+    qint64 busyNs = audioManager->getBusyTime() + networkManager->getBusyTime();
+    if (nowNs > lastStatsNs) {
+        stats.cpuLoad = static_cast<double>(busyNs - lastBusyNs) / (nowNs - lastStatsNs);
+    }
+    lastStatsNs = nowNs;
+    lastBusyNs = busyNs;
+    
+    stats.memoryBytes = audioManager->getBufferMemory() + networkManager->getBufferMemory();
+    
+    PlayoutStats playout = audioManager->getPlayoutStats();
+    stats.lostFrames = playout.underrunFrames + playout.lateFrames;
+    stats.droppedPackets = networkManager->getSendQueueStats().droppedPackets;
+    stats.droppedCaptureFrames = audioManager->getDroppedCaptureFrames();
+    return stats;
+}
+
+/**
+ * @brief Sends the playout loss since the last report to the peer.
+ */
+void BridgeSession::sendReceiverReport()
+{
+    PlayoutStats stats = audioManager->getPlayoutStats();
+    
+    // Comfort noise while the peer is idle is not expected audio
+    quint32 framesExpected = static_cast<quint32>((stats.framesPlayed - stats.silentFrames) -
+                                                  (lastPlayoutStats.framesPlayed - lastPlayoutStats.silentFrames));
+    quint32 framesLost = static_cast<quint32>((stats.underrunFrames + stats.lateFrames) -
+                                              (lastPlayoutStats.underrunFrames + lastPlayoutStats.lateFrames));
+    lastPlayoutStats = stats;
+    
+    // Runs before the network manager's deferred delete, even if the session is gone by then
+    NetworkManager *network = networkManager;
+    QMetaObject::invokeMethod(network, [network, framesExpected, framesLost]() {
+        network->sendReceiverReport(framesExpected, framesLost);
+    }, Qt::QueuedConnection);
+}
+
+/**
+ * @brief Starts or stops the rate controller for the given transmission mode.
+ * @param mode The active transmission mode.
+ */
+void BridgeSession::updateRateControl(TransmissionMode mode)
+{
+    if (mode != TransmissionMode::Opus) {
+        rateController->stop();
+        return;
+    }
+    
+    rateController->start(config.opusBitrate);
+}
+
+/**
+ * @brief Runs a function on the worker thread and waits for it to return.
+ * @param function The function to run.
+ */
+void BridgeSession::runOnNetworkThread(const std::function<void()> &function)
+{
+    QMetaObject::invokeMethod(networkManager, function, Qt::BlockingQueuedConnection);
+}
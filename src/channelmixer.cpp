@@ -0,0 +1,401 @@
+#include "../include/channelmixer.h"
+#include <cstring>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+// Gain of a channel folded into two neighbours (-3 dB, constant power)
+const float FOLD_GAIN = 0.70710678f;
+
+/**
+ * @brief Splits interleaved samples with a compile-time channel count.
+ *
+ * The constant stride lets the compiler turn the gathers into vector shuffles.
+ */
+template<int Channels>
+static void deinterleaveFixed(const float *input, int frames, float *const *planes)
+{
+    for (int c = 0; c < Channels; c++) {
+        float *plane = planes[c];
+        const float *source = input + c;
+        for (int f = 0; f < frames; f++) {
+            plane[f] = source[f * Channels];
+        }
+    }
+}
+
+/**
+ * @brief Merges planes into interleaved samples with a compile-time channel count.
+ */
+template<int Channels>
+static void interleaveFixed(const float *const *planes, int frames, float *output)
+{
+    for (int c = 0; c < Channels; c++) {
+        const float *plane = planes[c];
+        float *target = output + c;
+        for (int f = 0; f < frames; f++) {
+            target[f * Channels] = plane[f];
+        }
+    }
+}
+
+/**
+ * @brief Splits stereo samples into left and right.
+ */
+static void deinterleaveStereo(const float *input, int frames, float *left, float *right)
+{
+    int f = 0;
+
+#if defined(__SSE2__)
+    for (; f + 4 <= frames; f += 4) {
+        __m128 a = _mm_loadu_ps(input + 2 * f);       // L0 R0 L1 R1
+        __m128 b = _mm_loadu_ps(input + 2 * f + 4);   // L2 R2 L3 R3
+        _mm_storeu_ps(left + f, _mm_shuffle_ps(a, b, _MM_SHUFFLE(2, 0, 2, 0)));
+        _mm_storeu_ps(right + f, _mm_shuffle_ps(a, b, _MM_SHUFFLE(3, 1, 3, 1)));
+    }
+#endif
+    
+    for (; f < frames; f++) {
+        left[f] = input[2 * f];
+        right[f] = input[2 * f + 1];
+    }
+}
+
+/**
+ * @brief Merges left and right into stereo samples.
+ */
+static void interleaveStereo(const float *left, const float *right, int frames, float *output)
+{
+    int f = 0;
+
+#if defined(__SSE2__)
+    for (; f + 4 <= frames; f += 4) {
+        __m128 l = _mm_loadu_ps(left + f);
+        __m128 r = _mm_loadu_ps(right + f);
+        _mm_storeu_ps(output + 2 * f, _mm_unpacklo_ps(l, r));       // L0 R0 L1 R1
+        _mm_storeu_ps(output + 2 * f + 4, _mm_unpackhi_ps(l, r));   // L2 R2 L3 R3
+    }
+#endif
+    
+    for (; f < frames; f++) {
+        output[2 * f] = left[f];
+        output[2 * f + 1] = right[f];
+    }
+}
+
+/**
+ * @brief Averages stereo samples into mono.
+ */
+static void downmixStereo(const float *input, int frames, float *output)
+{
+    int f = 0;
+
+#if defined(__SSE2__)
+    const __m128 half = _mm_set1_ps(0.5f);
+    for (; f + 4 <= frames; f += 4) {
+        __m128 a = _mm_loadu_ps(input + 2 * f);
+        __m128 b = _mm_loadu_ps(input + 2 * f + 4);
+        __m128 left = _mm_shuffle_ps(a, b, _MM_SHUFFLE(2, 0, 2, 0));
+        __m128 right = _mm_shuffle_ps(a, b, _MM_SHUFFLE(3, 1, 3, 1));
+        _mm_storeu_ps(output + f, _mm_mul_ps(_mm_add_ps(left, right), half));
+    }
+#endif
+    
+    for (; f < frames; f++) {
+        output[f] = (input[2 * f] + input[2 * f + 1]) * 0.5f;
+    }
+}
+
+/**
+ * @brief Constructor for ChannelMixer.
+ */
+ChannelMixer::ChannelMixer()
+    : mode(Mode::Identity)
+    , inputChannels(2)
+    , outputChannels(2)
+    , blockFrames(0)
+{
+    memset(gains, 0, sizeof(gains));
+}
+
+/**
+ * @brief Allocates the scratch buffers.
+ * @param maxFrames The largest number of frames passed to process() in one block.
+ */
+void ChannelMixer::prepare(int maxFrames)
+{
+    blockFrames = qMax(1, maxFrames);
+    inputPlanes.resize(blockFrames * MAX_CHANNELS);
+    outputPlanes.resize(blockFrames * MAX_CHANNELS);
+}
+
+/**
+ * @brief Builds the mix matrix for a conversion.
+ * @param inputMap The channel map of the input.
+ * @param outputMap The channel map of the output.
+ */
+void ChannelMixer::configure(const ChannelMap &inputMap, const ChannelMap &outputMap)
+{
+    inputChannels = qBound(1, inputMap.size(), MAX_CHANNELS);
+    outputChannels = qBound(1, outputMap.size(), MAX_CHANNELS);
+    memset(gains, 0, sizeof(gains));
+    
+    if (inputMap == outputMap) {
+        mode = Mode::Identity;
+        return;
+    }
+    
+    bool stereoOutput = outputMap.size() == 2 && outputMap.at(0) == FrontLeft && outputMap.at(1) == FrontRight;
+    bool stereoInput = inputMap.size() == 2 && inputMap.at(0) == FrontLeft && inputMap.at(1) == FrontRight;
+    
+    if (inputMap.size() == 1 && stereoOutput) {
+        mode = Mode::MonoToStereo;
+        return;
+    }
+    if (stereoInput && outputMap.size() == 1) {
+        mode = Mode::StereoToMono;
+        return;
+    }
+    
+    mode = Mode::Matrix;
+    
+    // A single channel is a mono source, whatever its position
+    if (inputMap.size() == 1 && outputMap.contains(FrontLeft) && outputMap.contains(FrontRight)) {
+        route(outputMap, FrontLeft, 0, 1.0f);
+        route(outputMap, FrontRight, 0, 1.0f);
+        return;
+    }
+    
+    for (int i = 0; i < inputChannels; i++) {
+        route(outputMap, inputMap.at(i), i, 1.0f);
+    }
+}
+
+/**
+ * @brief Checks if the conversion leaves the audio unchanged.
+ * @return True if the input can be used as output directly, false otherwise.
+ */
+bool ChannelMixer::isIdentity() const
+{
+    return mode == Mode::Identity;
+}
+
+/**
+ * @brief Gets the number of input channels.
+ * @return The input channel count.
+ */
+int ChannelMixer::getInputChannels() const
+{
+    return inputChannels;
+}
+
+/**
+ * @brief Gets the number of output channels.
+ * @return The output channel count.
+ */
+int ChannelMixer::getOutputChannels() const
+{
+    return outputChannels;
+}
+
+/**
+ * @brief Converts interleaved audio.
+ * @param input The interleaved input samples.
+ * @param frames The number of frames.
+ * @param output The interleaved output samples (must not overlap the input).
+ */
+void ChannelMixer::process(const float *input, int frames, float *output)
+{
+    switch (mode) {
+        case Mode::Identity:
+            memcpy(output, input, frames * inputChannels * sizeof(float));
+            break;
+        case Mode::MonoToStereo:
+            interleaveStereo(input, input, frames, output);
+            break;
+        case Mode::StereoToMono:
+            downmixStereo(input, frames, output);
+            break;
+        case Mode::Matrix:
+            if (blockFrames == 0) {
+                memset(output, 0, frames * outputChannels * sizeof(float));
+                break;
+            }
+            for (int offset = 0; offset < frames; offset += blockFrames) {
+                int count = qMin(blockFrames, frames - offset);
+                processMatrix(input + offset * inputChannels, count, output + offset * outputChannels);
+            }
+            break;
+    }
+}
+
+/**
+ * @brief Splits interleaved samples into one buffer per channel.
+ * @param input The interleaved samples.
+ * @param frames The number of frames.
+ * @param channels The number of channels.
+ * @param planes The per-channel output buffers.
+ */
+void ChannelMixer::deinterleave(const float *input, int frames, int channels, float *const *planes)
+{
+    switch (channels) {
+        case 1: memcpy(planes[0], input, frames * sizeof(float)); break;
+        case 2: deinterleaveStereo(input, frames, planes[0], planes[1]); break;
+        case 3: deinterleaveFixed<3>(input, frames, planes); break;
+        case 4: deinterleaveFixed<4>(input, frames, planes); break;
+        case 5: deinterleaveFixed<5>(input, frames, planes); break;
+        case 6: deinterleaveFixed<6>(input, frames, planes); break;
+        case 7: deinterleaveFixed<7>(input, frames, planes); break;
+        case 8: deinterleaveFixed<8>(input, frames, planes); break;
+        default:
+            for (int c = 0; c < channels; c++) {
+                for (int f = 0; f < frames; f++) {
+                    planes[c][f] = input[f * channels + c];
+                }
+            }
+            break;
+    }
+}
+
+/**
+ * @brief Merges one buffer per channel into interleaved samples.
+ * @param planes The per-channel input buffers.
+ * @param frames The number of frames.
+ * @param channels The number of channels.
+ * @param output The interleaved samples.
+ */
+void ChannelMixer::interleave(const float *const *planes, int frames, int channels, float *output)
+{
+    switch (channels) {
+        case 1: memcpy(output, planes[0], frames * sizeof(float)); break;
+        case 2: interleaveStereo(planes[0], planes[1], frames, output); break;
+        case 3: interleaveFixed<3>(planes, frames, output); break;
+        case 4: interleaveFixed<4>(planes, frames, output); break;
+        case 5: interleaveFixed<5>(planes, frames, output); break;
+        case 6: interleaveFixed<6>(planes, frames, output); break;
+        case 7: interleaveFixed<7>(planes, frames, output); break;
+        case 8: interleaveFixed<8>(planes, frames, output); break;
+        default:
+            for (int c = 0; c < channels; c++) {
+                for (int f = 0; f < frames; f++) {
+                    output[f * channels + c] = planes[c][f];
+                }
+            }
+            break;
+    }
+}
+
+/**
+ * @brief Adds an input channel to the output, folding missing positions.
+ * @param outputMap The channel map of the output.
+ * @param position The position the input channel is routed to.
+ * @param input The input channel index.
+ * @param gain The gain of the route.
+ */
+void ChannelMixer::route(const ChannelMap &outputMap, ChannelPosition position, int input, float gain)
+{
+    int index = outputMap.indexOf(position);
+    if (index >= 0) {
+        gains[index][input] += gain;
+        return;
+    }
+    
+    bool hasFront = outputMap.contains(FrontLeft) && outputMap.contains(FrontRight);
+    
+    // Fold the missing position into its neighbours, moving towards the front
+    switch (position) {
+        case FrontCenter:
+            if (hasFront) {
+                route(outputMap, FrontLeft, input, gain * FOLD_GAIN);
+                route(outputMap, FrontRight, input, gain * FOLD_GAIN);
+            }
+            break;
+        case FrontLeft:
+        case FrontRight:
+            if (outputMap.contains(FrontCenter)) {
+                route(outputMap, FrontCenter, input, gain * FOLD_GAIN);
+            }
+            break;
+        case BackLeft:
+            if (outputMap.contains(SideLeft)) {
+                route(outputMap, SideLeft, input, gain);
+            } else {
+                route(outputMap, FrontLeft, input, gain * FOLD_GAIN);
+            }
+            break;
+        case BackRight:
+            if (outputMap.contains(SideRight)) {
+                route(outputMap, SideRight, input, gain);
+            } else {
+                route(outputMap, FrontRight, input, gain * FOLD_GAIN);
+            }
+            break;
+        case SideLeft:
+            if (outputMap.contains(BackLeft)) {
+                route(outputMap, BackLeft, input, gain);
+            } else {
+                route(outputMap, FrontLeft, input, gain * FOLD_GAIN);
+            }
+            break;
+        case SideRight:
+            if (outputMap.contains(BackRight)) {
+                route(outputMap, BackRight, input, gain);
+            } else {
+                route(outputMap, FrontRight, input, gain * FOLD_GAIN);
+            }
+            break;
+        case BackCenter:
+            if (outputMap.contains(BackLeft) && outputMap.contains(BackRight)) {
+                route(outputMap, BackLeft, input, gain * FOLD_GAIN);
+                route(outputMap, BackRight, input, gain * FOLD_GAIN);
+            } else if (outputMap.contains(SideLeft) && outputMap.contains(SideRight)) {
+                route(outputMap, SideLeft, input, gain * FOLD_GAIN);
+                route(outputMap, SideRight, input, gain * FOLD_GAIN);
+            } else {
+                route(outputMap, FrontLeft, input, gain * 0.5f);
+                route(outputMap, FrontRight, input, gain * 0.5f);
+            }
+            break;
+        default:
+            // LFE and discrete channels without a counterpart are dropped
+            break;
+    }
+}
+
+/**
+ * @brief Mixes one block of at most blockFrames frames through the matrix.
+ * @param input The interleaved input samples.
+ * @param frames The number of frames.
+ * @param output The interleaved output samples.
+ */
+void ChannelMixer::processMatrix(const float *input, int frames, float *output)
+{
+    float *inputPlane[MAX_CHANNELS];
+    float *outputPlane[MAX_CHANNELS];
+    for (int c = 0; c < MAX_CHANNELS; c++) {
+        inputPlane[c] = inputPlanes.data() + c * blockFrames;
+        outputPlane[c] = outputPlanes.data() + c * blockFrames;
+    }
+    
+    deinterleave(input, frames, inputChannels, inputPlane);
+    
+    // One multiply-add pass per non-zero coefficient
+    for (int o = 0; o < outputChannels; o++) {
+        float *target = outputPlane[o];
+        memset(target, 0, frames * sizeof(float));
+        
+        for (int i = 0; i < inputChannels; i++) {
+            float gain = gains[o][i];
+            if (gain == 0.0f) {
+                continue;
+            }
+            const float *source = inputPlane[i];
+            for (int f = 0; f < frames; f++) {
+                target[f] += gain * source[f];
+            }
+        }
+    }
+    
+    interleave(outputPlane, frames, outputChannels, output);
+}
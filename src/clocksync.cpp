@@ -0,0 +1,207 @@
+#include "../include/clocksync.h"
+#include <chrono>
+#include <cmath>
+
+// Exchanges kept in the filter window (about a minute at one per second)
+const int WINDOW_SIZE = 64;
+
+// Exchanges needed before the estimate counts as synchronized
+const int MIN_EXCHANGES = 4;
+
+// Round trip above the window's smallest one that an exchange may take and still be trusted
+const qint64 TRUST_MARGIN_US = 100;
+
+// Time the trusted exchanges must span before the skew is fitted
+const qint64 MIN_SKEW_SPAN_US = 5000000;
+
+// Largest skew believed (crystals are specified to +-100 ppm)
+const double MAX_SKEW = 500e-6;
+
+// Longest plausible round trip
+const qint64 MAX_ROUND_TRIP_US = 10000000;
+
+/**
+ * @brief Converts a local time to the peer's clock.
+ * @param localUs The local time in microseconds.
+ * @return The peer's clock at that moment.
+ */
+qint64 ClockEstimate::toPeer(qint64 localUs) const
+{
+    return localUs + qRound64(offsetUs + skew * static_cast<double>(localUs - referenceUs));
+}
+
+/**
+ * @brief Converts a time on the peer's clock to the local clock.
+ * @param peerUs The peer's time in microseconds.
+ * @return The local clock at that moment.
+ */
+qint64 ClockEstimate::toLocal(qint64 peerUs) const
+{
+    // Solves peer = local + offset + skew * (local - reference) for local
+    double sinceReference = static_cast<double>(peerUs - referenceUs) - offsetUs;
+    return referenceUs + qRound64(sinceReference / (1.0 + skew));
+}
+
+/**
+ * @brief Extends a 32-bit packet timestamp to the peer's full clock.
+ * @param timestamp The packet timestamp.
+ * @param localUs The local time the packet is looked at.
+ * @return The peer's time in microseconds.
+ */
+qint64 ClockEstimate::unwrapPeerTime(quint32 timestamp, qint64 localUs) const
+{
+    qint64 predicted = toPeer(localUs);
+    qint32 difference = static_cast<qint32>(timestamp - static_cast<quint32>(predicted));
+    return predicted + difference;
+}
+
+/**
+ * @brief Constructor for ClockSync.
+ */
+ClockSync::ClockSync()
+{
+    exchanges.reserve(WINDOW_SIZE);
+}
+
+/**
+ * @brief Gets the local monotonic clock the estimates refer to.
+ * @return The time in microseconds (same clock on every thread).
+ */
+qint64 ClockSync::now()
+{
+    return std::chrono::duration_cast<std::chrono::microseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+/**
+ * @brief Forgets every exchange (a new peer, or a new connection).
+ */
+void ClockSync::reset()
+{
+    exchanges.clear();
+    estimate = ClockEstimate();
+}
+
+/**
+ * @brief Adds an exchange and updates the estimate.
+ * @param t1 When we sent the request (local clock).
+ * @param t2 When the peer received it (peer clock).
+ * @param t3 When the peer sent the reply (peer clock).
+ * @param t4 When the reply arrived (local clock).
+ * @return True if the exchange was plausible and taken into account, false otherwise.
+ */
+bool ClockSync::addExchange(qint64 t1, qint64 t2, qint64 t3, qint64 t4)
+{
+    // The peer's processing time does not count towards the round trip
+    qint64 roundTripUs = (t4 - t1) - (t3 - t2);
+    if (t4 < t1 || t3 < t2 || roundTripUs < 0 || roundTripUs > MAX_ROUND_TRIP_US) {
+        return false;
+    }
+    
+    Exchange exchange;
+    exchange.localUs = t1 + (t4 - t1) / 2;
+    exchange.offsetUs = (static_cast<double>(t2 - t1) + static_cast<double>(t3 - t4)) / 2.0;
+    exchange.roundTripUs = roundTripUs;
+    
+    if (exchanges.size() >= WINDOW_SIZE) {
+        exchanges.removeFirst();
+    }
+    exchanges.append(exchange);
+    
+    updateEstimate();
+    return true;
+}
+
+/**
+ * @brief Gets the number of exchanges in the filter window.
+ * @return The number of exchanges.
+ */
+int ClockSync::getExchangeCount() const
+{
+    return exchanges.size();
+}
+
+/**
+ * @brief Gets the current estimate.
+ * @return The estimate (not synchronized until a few exchanges were made).
+ */
+ClockEstimate ClockSync::getEstimate() const
+{
+    return estimate;
+}
+
+/**
+ * @brief Fits the offset and skew to the trusted exchanges.
+ */
+void ClockSync::updateEstimate()
+{
+    qint64 minRoundTripUs = MAX_ROUND_TRIP_US;
+    for (const Exchange &exchange : exchanges) {
+        minRoundTripUs = qMin(minRoundTripUs, exchange.roundTripUs);
+    }
+    
+    // An exchange that queued somewhere is asymmetric by up to its extra round
+    // trip; a quarter of the round trip is allowed on slow links
+    qint64 thresholdUs = minRoundTripUs + qMax(TRUST_MARGIN_US, minRoundTripUs / 4);
+    
+    // Trusted exchanges relative to the first one, which keeps the sums small;
+    // the faster an exchange, the more it counts
+    QVector<FitPoint> points;
+    points.reserve(exchanges.size());
+    qint64 originUs = 0;
+    for (const Exchange &exchange : exchanges) {
+        if (exchange.roundTripUs > thresholdUs) {
+            continue;
+        }
+        if (points.isEmpty()) {
+            originUs = exchange.localUs;
+        }
+        double excess = static_cast<double>(exchange.roundTripUs - minRoundTripUs) / TRUST_MARGIN_US;
+        points.append({ static_cast<double>(exchange.localUs - originUs), exchange.offsetUs,
+                        1.0 / (1.0 + excess * excess) });
+    }
+    
+    if (points.isEmpty()) {
+        return;
+    }
+    
+    double weightSum = 0.0;
+    double timeSum = 0.0;
+    double offsetSum = 0.0;
+    for (const FitPoint &point : points) {
+        weightSum += point.weight;
+        timeSum += point.weight * point.time;
+        offsetSum += point.weight * point.offset;
+    }
+    double meanTime = timeSum / weightSum;
+    double meanOffset = offsetSum / weightSum;
+    
+    // Without a long enough baseline the skew is noise; keep the last fit
+    double skew = estimate.skew;
+    if (points.last().time >= MIN_SKEW_SPAN_US) {
+        double covariance = 0.0;
+        double variance = 0.0;
+        for (const FitPoint &point : points) {
+            double time = point.time - meanTime;
+            covariance += point.weight * time * (point.offset - meanOffset);
+            variance += point.weight * time * time;
+        }
+        if (variance > 0.0) {
+            skew = qBound(-MAX_SKEW, covariance / variance, MAX_SKEW);
+        }
+    }
+    
+    // How far the trusted offsets stray from the line
+    double residualSum = 0.0;
+    for (const FitPoint &point : points) {
+        double residual = point.offset - (meanOffset + skew * (point.time - meanTime));
+        residualSum += point.weight * residual * residual;
+    }
+    
+    estimate.referenceUs = originUs + qRound64(meanTime);
+    estimate.offsetUs = meanOffset;
+    estimate.skew = skew;
+    estimate.roundTripUs = minRoundTripUs;
+    estimate.errorUs = std::sqrt(residualSum / weightSum);
+    estimate.synchronized = exchanges.size() >= MIN_EXCHANGES;
+}
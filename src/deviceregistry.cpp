@@ -0,0 +1,327 @@
+#include "../include/deviceregistry.h"
+#include <QtCore/QDebug>
+#include <QtCore/QElapsedTimer>
+#include <QtCore/QFileSystemWatcher>
+#include <QtCore/QHash>
+#include <portaudio.h>
+
+// Quiet time after a hot-plug event before enumerating (a device adds several nodes)
+const int HOTPLUG_SETTLE_MS = 1000;
+
+/**
+ * @brief Constructor for DeviceRegistry. Starts probing the devices.
+ * @param parent The parent object.
+ */
+DeviceRegistry::DeviceRegistry(QObject *parent)
+    : QObject(parent)
+    , probeThread(new QThread(this))
+    , probeContext(new QObject)
+    , refreshTimer(new QTimer(this))
+    , deviceWatcher(nullptr)
+    , openStreams(0)
+    , refreshPending(false)
+    , initialized(false)
+    , ready(false)
+{
+    // The probe runs right away, anything queued later runs after it
+    probeThread->setObjectName("DeviceProbe");
+    probeContext->moveToThread(probeThread);
+    probeThread->start();
+    runOnProbeThread([this]() {
+        enumerate();
+    });
+    
+    // Hot-plug: the ALSA device nodes come and go with the devices
+    refreshTimer->setSingleShot(true);
+    refreshTimer->setInterval(HOTPLUG_SETTLE_MS);
+    connect(refreshTimer, &QTimer::timeout, this, &DeviceRegistry::refresh);
+#ifdef Q_OS_LINUX
+    deviceWatcher = new QFileSystemWatcher(this);
+    if (deviceWatcher->addPath("/dev/snd")) {
+        connect(deviceWatcher, &QFileSystemWatcher::directoryChanged, refreshTimer,
+                static_cast<void (QTimer::*)()>(&QTimer::start));
+    }
+#endif
+}
+
+/**
+ * @brief Destructor for DeviceRegistry. Terminates PortAudio.
+ */
+DeviceRegistry::~DeviceRegistry()
+{
+    stopProbeThread();
+    delete probeContext;
+    
+    QMutexLocker locker(&portAudioMutex);
+    if (initialized) {
+        Pa_Terminate();
+        initialized = false;
+    }
+}
+
+/**
+ * @brief Checks if the first enumeration finished.
+ * @return True once the devices are known, false while probing.
+ */
+bool DeviceRegistry::isReady() const
+{
+    QMutexLocker locker(&cacheMutex);
+    return ready;
+}
+
+/**
+ * @brief Waits for the first enumeration to finish.
+ * @return True if PortAudio is available, false otherwise.
+ */
+bool DeviceRegistry::waitUntilReady()
+{
+    QMutexLocker locker(&cacheMutex);
+    while (!ready) {
+        readyCondition.wait(&cacheMutex);
+    }
+    return errorString.isEmpty();
+}
+
+/**
+ * @brief Gets the reason PortAudio is not available.
+ * @return The error message, empty if it is available.
+ */
+QString DeviceRegistry::getErrorString() const
+{
+    QMutexLocker locker(&cacheMutex);
+    return errorString;
+}
+
+/**
+ * @brief Gets every known device.
+ * @return The devices in enumeration order (empty while probing).
+ */
+QVector<AudioDeviceInfo> DeviceRegistry::getDevices() const
+{
+    QMutexLocker locker(&cacheMutex);
+    return devices;
+}
+
+/**
+ * @brief Gets the devices that can capture.
+ * @return The input devices in enumeration order.
+ */
+QVector<AudioDeviceInfo> DeviceRegistry::getInputDevices() const
+{
+    QVector<AudioDeviceInfo> inputs;
+    for (const AudioDeviceInfo &device : getDevices()) {
+        if (device.maxInputChannels > 0) {
+            inputs.append(device);
+        }
+    }
+    return inputs;
+}
+
+/**
+ * @brief Gets the devices that can play.
+ * @return The output devices in enumeration order.
+ */
+QVector<AudioDeviceInfo> DeviceRegistry::getOutputDevices() const
+{
+    QVector<AudioDeviceInfo> outputs;
+    for (const AudioDeviceInfo &device : getDevices()) {
+        if (device.maxOutputChannels > 0) {
+            outputs.append(device);
+        }
+    }
+    return outputs;
+}
+
+/**
+ * @brief Looks up an input device.
+ * @param device The identifier or the name of the device.
+ * @return The device, or the default input device if none matches (index -1 if there is none).
+ */
+AudioDeviceInfo DeviceRegistry::findInputDevice(const QString &device) const
+{
+    return findDevice(device, true);
+}
+
+/**
+ * @brief Looks up an output device.
+ * @param device The identifier or the name of the device.
+ * @return The device, or the default output device if none matches (index -1 if there is none).
+ */
+AudioDeviceInfo DeviceRegistry::findOutputDevice(const QString &device) const
+{
+    return findDevice(device, false);
+}
+
+/**
+ * @brief Enumerates the devices again (as soon as no stream is open).
+ */
+void DeviceRegistry::refresh()
+{
+    runOnProbeThread([this]() {
+        enumerate();
+    });
+}
+
+/**
+ * @brief Runs a function on the probe thread, after any enumeration in progress.
+ * @param function The function to run.
+ */
+void DeviceRegistry::runOnProbeThread(const std::function<void()> &function)
+{
+    QMetaObject::invokeMethod(probeContext, function, Qt::QueuedConnection);
+}
+
+/**
+ * @brief Runs the queued work and stops the probe thread (before the owner goes away).
+ */
+void DeviceRegistry::stopProbeThread()
+{
+    probeThread->quit();
+    probeThread->wait();
+}
+
+/**
+ * @brief Gets the lock every PortAudio call outside the callbacks must hold.
+ * @return The lock.
+ */
+QMutex *DeviceRegistry::lock()
+{
+    return &portAudioMutex;
+}
+
+/**
+ * @brief Records that a stream was opened (PortAudio lock held).
+ */
+void DeviceRegistry::streamOpened()
+{
+    openStreams++;
+}
+
+/**
+ * @brief Records that a stream was closed (PortAudio lock held).
+ */
+void DeviceRegistry::streamClosed()
+{
+    openStreams = qMax(0, openStreams - 1);
+    
+    // A device came or went while the streams were open
+    if (openStreams == 0 && refreshPending) {
+        refresh();
+    }
+}
+
+/**
+ * @brief Initializes PortAudio (again) and reads the devices (probe thread).
+ */
+void DeviceRegistry::enumerate()
+{
+    QMutexLocker locker(&portAudioMutex);
+    
+    // Terminating PortAudio would close the open streams
+    if (openStreams > 0) {
+        refreshPending = true;
+        return;
+    }
+    refreshPending = false;
+    
+    QElapsedTimer probeTimer;
+    probeTimer.start();
+    emit probeProgress(tr("Probing audio devices..."));
+    
+    if (initialized) {
+        Pa_Terminate();
+        initialized = false;
+    }
+    
+    QVector<AudioDeviceInfo> found;
+    QString message;
+    PaError err = Pa_Initialize();
+    if (err != paNoError) {
+        message = tr("PortAudio initialization failed: %1").arg(Pa_GetErrorText(err));
+    } else {
+        initialized = true;
+        
+        int defaultInput = Pa_GetDefaultInputDevice();
+        int defaultOutput = Pa_GetDefaultOutputDevice();
+        QHash<QString, int> seen;
+        int numDevices = Pa_GetDeviceCount();
+        for (int i = 0; i < numDevices; i++) {
+            const PaDeviceInfo *deviceInfo = Pa_GetDeviceInfo(i);
+            if (!deviceInfo) {
+                continue;
+            }
+            
+            AudioDeviceInfo device;
+            device.name = QString(deviceInfo->name);
+            const PaHostApiInfo *hostApiInfo = Pa_GetHostApiInfo(deviceInfo->hostApi);
+            device.hostApi = hostApiInfo ? QString(hostApiInfo->name) : QString();
+            device.index = i;
+            device.maxInputChannels = deviceInfo->maxInputChannels;
+            device.maxOutputChannels = deviceInfo->maxOutputChannels;
+            device.defaultSampleRate = deviceInfo->defaultSampleRate;
+            device.defaultLowInputLatency = deviceInfo->defaultLowInputLatency;
+            device.defaultLowOutputLatency = deviceInfo->defaultLowOutputLatency;
+            device.defaultInput = i == defaultInput;
+            device.defaultOutput = i == defaultOutput;
+            
+            // Identical devices are told apart by their order
+            device.id = device.hostApi + "/" + device.name;
+            int count = ++seen[device.id];
+            if (count > 1) {
+                device.id += QString("#%1").arg(count);
+            }
+            
+            found.append(device);
+        }
+    }
+    bool available = initialized;
+    
+    // Updated before PortAudio is released, so no stream is opened by a stale index
+    {
+        QMutexLocker cacheLocker(&cacheMutex);
+        devices = found;
+        errorString = message;
+        ready = true;
+        readyCondition.wakeAll();
+    }
+    locker.unlock();
+    
+    if (available) {
+        qDebug() << "Found" << found.size() << "audio devices in" << probeTimer.elapsed() << "ms";
+        emit probeProgress(tr("Found %1 audio devices").arg(found.size()));
+    } else {
+        emit probeProgress(message);
+    }
+    emit devicesChanged(available);
+}
+
+/**
+ * @brief Looks up a device by identifier, then by name.
+ * @param device The identifier or the name of the device.
+ * @param input Whether an input device is wanted (an output device otherwise).
+ * @return The device, the default one if none matches.
+ */
+AudioDeviceInfo DeviceRegistry::findDevice(const QString &device, bool input) const
+{
+    const QVector<AudioDeviceInfo> candidates = input ? getInputDevices() : getOutputDevices();
+    
+    if (!device.isEmpty()) {
+        for (const AudioDeviceInfo &candidate : candidates) {
+            if (candidate.id == device) {
+                return candidate;
+            }
+        }
+        for (const AudioDeviceInfo &candidate : candidates) {
+            if (candidate.name == device) {
+                return candidate;
+            }
+        }
+    }
+    
+    for (const AudioDeviceInfo &candidate : candidates) {
+        if (input ? candidate.defaultInput : candidate.defaultOutput) {
+            return candidate;
+        }
+    }
+    return candidates.isEmpty() ? AudioDeviceInfo() : candidates.first();
+}
@@ -0,0 +1,317 @@
+#include "../include/dspgraph.h"
+#include "../include/dspnodes.h"
+#include <QtCore/QObject>
+#include <QtCore/QStringList>
+#include <cstring>
+
+/**
+ * @brief Destructor for a chain, deleting its nodes.
+ */
+DspGraph::Chain::~Chain()
+{
+    qDeleteAll(nodes);
+}
+
+/**
+ * @brief Constructor for DspGraph.
+ */
+DspGraph::DspGraph()
+    : published(new Chain)
+    , acknowledged(nullptr)
+    , current(nullptr)
+    , sampleRate(48000)
+    , channels(2)
+    , maxFrames(256)
+{
+    current = published.load();
+    acknowledged = current;
+    crossfadeBuffer.resize(maxFrames * channels);
+    clock.start();
+}
+
+/**
+ * @brief Destructor for DspGraph.
+ */
+DspGraph::~DspGraph()
+{
+    collectRetired(true);
+    delete published.load();
+}
+
+/**
+ * @brief Prepares the graph and its nodes for a stream format.
+ *
+ * Must not be called while process() may run (e.g. while the stream is stopped).
+ *
+ * @param sampleRate The sample rate.
+ * @param channels The number of interleaved channels.
+ * @param maxFrames The largest number of frames passed to process().
+ */
+void DspGraph::prepare(int sampleRate, int channels, int maxFrames)
+{
+    this->sampleRate = sampleRate;
+    this->channels = channels;
+    this->maxFrames = qMax(1, maxFrames);
+    crossfadeBuffer.resize(this->maxFrames * channels);
+    
+    // Nothing is processing, so the latest chain becomes current right away
+    current = published.load();
+    acknowledged = current;
+    collectRetired(true);
+    
+    for (DspNode *node : current->nodes) {
+        node->prepare(sampleRate, channels, this->maxFrames);
+    }
+}
+
+/**
+ * @brief Replaces the chain of nodes.
+ * @param nodes The new nodes in processing order; the graph takes ownership.
+ */
+void DspGraph::setNodes(const QList<DspNode*> &nodes)
+{
+    // Everything that allocates happens here, before the audio thread sees the chain
+    Chain *chain = new Chain;
+    chain->nodes = nodes.toVector();
+    for (DspNode *node : chain->nodes) {
+        node->prepare(sampleRate, channels, maxFrames);
+    }
+    
+    retired.append(published.exchange(chain, std::memory_order_acq_rel));
+    collectRetired(false);
+}
+
+/**
+ * @brief Replaces the chain of nodes from a description.
+ * @param description The chain description (see parseChain()).
+ * @param errorMessage Receives the reason of a failure (optional).
+ * @return True if the description was valid, false otherwise (the chain is unchanged).
+ */
+bool DspGraph::setChain(const QString &description, QString *errorMessage)
+{
+    QList<DspNode*> nodes;
+    if (!parseChain(description, nodes, errorMessage)) {
+        return false;
+    }
+    
+    setNodes(nodes);
+    return true;
+}
+
+/**
+ * @brief Gets the number of nodes in the chain (control thread).
+ * @return The number of nodes.
+ */
+int DspGraph::getNodeCount() const
+{
+    return published.load()->nodes.size();
+}
+
+/**
+ * @brief Gets a node of the chain, e.g. to change its parameters (control thread).
+ * @param index The position of the node in the chain.
+ * @return The node, or nullptr if the index is out of range.
+ */
+DspNode *DspGraph::getNode(int index) const
+{
+    const QVector<DspNode*> &nodes = published.load()->nodes;
+    return index >= 0 && index < nodes.size() ? nodes.at(index) : nullptr;
+}
+
+/**
+ * @brief Gets the CPU cost of every node in the chain (control thread).
+ * @return The statistics, in processing order.
+ */
+QVector<DspNodeStats> DspGraph::getStats() const
+{
+    QVector<DspNodeStats> stats;
+    
+    for (const DspNode *node : published.load()->nodes) {
+        DspNodeStats entry;
+        entry.name = node->name();
+        entry.averageMicroseconds = 0.0;
+        entry.load = 0.0;
+        
+        qint64 blocks = node->getProcessedBlocks();
+        qint64 frames = node->getProcessedFrames();
+        if (blocks > 0 && frames > 0) {
+            double nanoseconds = static_cast<double>(node->getProcessingTime());
+            entry.averageMicroseconds = nanoseconds / blocks / 1000.0;
+            entry.load = nanoseconds / (frames * 1.0e9 / sampleRate);
+        }
+        stats.append(entry);
+    }
+    
+    return stats;
+}
+
+/**
+ * @brief Checks if processing would leave the audio unchanged (audio thread).
+ * @return True if the chain is empty and no switch is pending, false otherwise.
+ */
+bool DspGraph::isIdentity() const
+{
+    return current->nodes.isEmpty() && published.load(std::memory_order_acquire) == current;
+}
+
+/**
+ * @brief Runs a block of interleaved samples through the chain in place (audio thread).
+ * @param samples The interleaved samples.
+ * @param frames The number of frames.
+ */
+void DspGraph::process(float *samples, int frames)
+{
+    Chain *latest = published.load(std::memory_order_acquire);
+    
+    for (int offset = 0; offset < frames; offset += maxFrames) {
+        int block = qMin(frames - offset, maxFrames);
+        float *data = samples + offset * channels;
+        
+        if (latest == current) {
+            runChain(current, data, block);
+            continue;
+        }
+        
+        // Run the old and the new chain side by side for one block and fade
+        // from one to the other
+        int count = block * channels;
+        memcpy(crossfadeBuffer.data(), data, count * sizeof(float));
+        runChain(current, crossfadeBuffer.data(), block);
+        runChain(latest, data, block);
+        
+        const float *old = crossfadeBuffer.constData();
+        float step = 1.0f / block;
+        for (int f = 0; f < block; f++) {
+            float weight = (f + 1) * step;
+            for (int c = 0; c < channels; c++) {
+                int i = f * channels + c;
+                data[i] = old[i] + weight * (data[i] - old[i]);
+            }
+        }
+        
+        current = latest;
+    }
+    
+    // The control thread may now free the chains replaced before this one
+    acknowledged.store(current, std::memory_order_release);
+}
+
+/**
+ * @brief Builds nodes from a chain description.
+ * @param description The chain description.
+ * @param nodes The new nodes (output); the caller takes ownership.
+ * @param errorMessage Receives the reason of a failure (optional).
+ * @return True if the description was valid, false otherwise.
+ */
+bool DspGraph::parseChain(const QString &description, QList<DspNode*> &nodes, QString *errorMessage)
+{
+    QList<DspNode*> parsed;
+    QString failure;
+    
+    const QStringList entries = description.split(';', QString::SkipEmptyParts);
+    for (const QString &rawEntry : entries) {
+        QString entry = rawEntry.trimmed();
+        if (entry.isEmpty()) {
+            continue;
+        }
+        
+        // Split "name(arg, arg, ...)"
+        QString name = entry;
+        QStringList args;
+        int open = entry.indexOf('(');
+        if (open >= 0) {
+            if (!entry.endsWith(')')) {
+                failure = QObject::tr("Missing ')' in \"%1\"").arg(entry);
+                break;
+            }
+            name = entry.left(open);
+            for (const QString &arg : entry.mid(open + 1, entry.size() - open - 2).split(',')) {
+                args.append(arg.trimmed());
+            }
+            if (args.size() == 1 && args.first().isEmpty()) {
+                args.clear();
+            }
+        }
+        name = name.trimmed().toLower();
+        
+        // Numeric argument with a default, from the given position on
+        auto number = [&](int index, float defaultValue) -> float {
+            if (index >= args.size() || args.at(index).isEmpty()) {
+                return defaultValue;
+            }
+            bool ok = false;
+            float value = args.at(index).toFloat(&ok);
+            if (!ok && failure.isEmpty()) {
+                failure = QObject::tr("Invalid number \"%1\" in \"%2\"").arg(args.at(index)).arg(entry);
+            }
+            return value;
+        };
+        
+        DspNode *node = nullptr;
+        if (name == "gain") {
+            node = new GainNode(number(0, 0.0f));
+        } else if (name == "eq") {
+            BiquadNode::Type type = BiquadNode::Type::Peaking;
+            if (!args.isEmpty() && !BiquadNode::parseType(args.first(), type)) {
+                failure = QObject::tr("Unknown filter type \"%1\"").arg(args.first());
+                break;
+            }
+            node = new BiquadNode(type, number(1, 1000.0f), number(2, 0.0f), number(3, 0.707f));
+        } else if (name == "compressor") {
+            node = new CompressorNode(number(0, -20.0f), number(1, 4.0f), number(2, 5.0f),
+                                      number(3, 100.0f), number(4, 0.0f));
+        } else if (name == "limiter") {
+            node = new LimiterNode(number(0, -1.0f), number(1, 50.0f));
+        } else if (name == "gate") {
+            node = new NoiseGateNode(number(0, -50.0f), number(1, 1.0f), number(2, 50.0f),
+                                     number(3, 100.0f), number(4, -80.0f));
+        } else {
+            failure = QObject::tr("Unknown processing node \"%1\"").arg(name);
+            break;
+        }
+        
+        parsed.append(node);
+        if (!failure.isEmpty()) {
+            break;
+        }
+    }
+    
+    if (!failure.isEmpty()) {
+        qDeleteAll(parsed);
+        if (errorMessage) {
+            *errorMessage = failure;
+        }
+        return false;
+    }
+    
+    nodes = parsed;
+    return true;
+}
+
+/**
+ * @brief Runs a block through the nodes of a chain, accounting their time.
+ * @param chain The chain.
+ * @param samples The interleaved samples.
+ * @param frames The number of frames.
+ */
+void DspGraph::runChain(Chain *chain, float *samples, int frames)
+{
+    for (DspNode *node : chain->nodes) {
+        qint64 start = clock.nsecsElapsed();
+        node->process(samples, frames);
+        node->addProcessingTime(clock.nsecsElapsed() - start, frames);
+    }
+}
+
+/**
+ * @brief Frees the replaced chains the audio thread no longer uses.
+ * @param force Whether to free them regardless (the audio thread is stopped).
+ */
+void DspGraph::collectRetired(bool force)
+{
+    // Once the audio thread runs the latest chain it never touches an older one
+    if (force || acknowledged.load(std::memory_order_acquire) == published.load()) {
+        qDeleteAll(retired);
+        retired.clear();
+    }
+}
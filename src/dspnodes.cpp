@@ -0,0 +1,575 @@
+#include "../include/dspnodes.h"
+#include <QtCore/QtMath>
+#include <cmath>
+#include <cstring>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+/**
+ * @brief Converts a level in dB to a linear gain.
+ * @param db The level in dB.
+ * @return The linear gain.
+ */
+static float dbToGain(float db)
+{
+    return std::pow(10.0f, db / 20.0f);
+}
+
+/**
+ * @brief Gets the one-pole smoothing coefficient of a time constant.
+ * @param milliseconds The time constant in milliseconds (0 for instant).
+ * @param sampleRate The rate the smoother runs at.
+ * @return The coefficient.
+ */
+static float timeCoefficient(float milliseconds, int sampleRate)
+{
+    if (milliseconds <= 0.0f) {
+        return 0.0f;
+    }
+    return std::exp(-1000.0f / (milliseconds * sampleRate));
+}
+
+/**
+ * @brief Gets the peak of a frame across its channels.
+ * @param frame The interleaved samples of the frame.
+ * @param channels The number of channels.
+ * @return The largest absolute sample.
+ */
+static inline float framePeak(const float *frame, int channels)
+{
+    float peak = 0.0f;
+    for (int c = 0; c < channels; c++) {
+        peak = qMax(peak, std::fabs(frame[c]));
+    }
+    return peak;
+}
+
+/**
+ * @brief Constructor for DspNode.
+ */
+DspNode::DspNode()
+    : sampleRate(48000)
+    , channels(2)
+    , maxFrames(256)
+    , processingTime(0)
+    , processedFrames(0)
+    , processedBlocks(0)
+{
+}
+
+/**
+ * @brief Destructor for DspNode.
+ */
+DspNode::~DspNode()
+{
+}
+
+/**
+ * @brief Prepares the node for a stream format (control thread).
+ * @param sampleRate The sample rate.
+ * @param channels The number of interleaved channels.
+ * @param maxFrames The largest number of frames passed to process().
+ */
+void DspNode::prepare(int sampleRate, int channels, int maxFrames)
+{
+    this->sampleRate = sampleRate;
+    this->channels = qBound(1, channels, MAX_CHANNELS);
+    this->maxFrames = maxFrames;
+}
+
+/**
+ * @brief Adds the cost of a processed block to the node's statistics.
+ * @param nanoseconds The time process() took.
+ * @param frames The number of frames processed.
+ */
+void DspNode::addProcessingTime(qint64 nanoseconds, int frames)
+{
+    processingTime.fetch_add(nanoseconds, std::memory_order_relaxed);
+    processedFrames.fetch_add(frames, std::memory_order_relaxed);
+    processedBlocks.fetch_add(1, std::memory_order_relaxed);
+}
+
+/**
+ * @brief Gets the total time spent in process().
+ * @return The time in nanoseconds.
+ */
+qint64 DspNode::getProcessingTime() const
+{
+    return processingTime.load(std::memory_order_relaxed);
+}
+
+/**
+ * @brief Gets the total number of frames processed.
+ * @return The number of frames.
+ */
+qint64 DspNode::getProcessedFrames() const
+{
+    return processedFrames.load(std::memory_order_relaxed);
+}
+
+/**
+ * @brief Gets the number of blocks processed.
+ * @return The number of blocks.
+ */
+qint64 DspNode::getProcessedBlocks() const
+{
+    return processedBlocks.load(std::memory_order_relaxed);
+}
+
+/**
+ * @brief Constructor for GainNode.
+ * @param gainDb The gain in dB.
+ */
+GainNode::GainNode(float gainDb)
+    : targetGain(dbToGain(gainDb))
+    , currentGain(dbToGain(gainDb))
+{
+}
+
+/**
+ * @brief Gets the name of the node type.
+ * @return "gain".
+ */
+QString GainNode::name() const
+{
+    return "gain";
+}
+
+/**
+ * @brief Sets the gain.
+ * @param gainDb The gain in dB.
+ */
+void GainNode::setGain(float gainDb)
+{
+    targetGain.store(dbToGain(gainDb), std::memory_order_relaxed);
+}
+
+/**
+ * @brief Processes a block of interleaved samples in place (audio thread).
+ * @param samples The interleaved samples.
+ * @param frames The number of frames.
+ */
+void GainNode::process(float *samples, int frames)
+{
+    float target = targetGain.load(std::memory_order_relaxed);
+    
+    // Ramp to a new gain across the block, so the change does not click
+    if (target != currentGain) {
+        float step = (target - currentGain) / frames;
+        for (int f = 0; f < frames; f++) {
+            float gain = currentGain + step * (f + 1);
+            for (int c = 0; c < channels; c++) {
+                samples[f * channels + c] *= gain;
+            }
+        }
+        currentGain = target;
+        return;
+    }
+    
+    if (target == 1.0f) {
+        return;
+    }
+    
+    int count = frames * channels;
+    int i = 0;
+
+#if defined(__SSE2__)
+    __m128 gain = _mm_set1_ps(target);
+    for (; i + 8 <= count; i += 8) {
+        _mm_storeu_ps(samples + i, _mm_mul_ps(_mm_loadu_ps(samples + i), gain));
+        _mm_storeu_ps(samples + i + 4, _mm_mul_ps(_mm_loadu_ps(samples + i + 4), gain));
+    }
+#endif
+    
+    for (; i < count; i++) {
+        samples[i] *= target;
+    }
+}
+
+/**
+ * @brief Constructor for BiquadNode.
+ * @param type The filter response.
+ * @param frequency The center or corner frequency in Hz.
+ * @param gainDb The gain in dB (peaking and shelf filters only).
+ * @param q The quality factor.
+ */
+BiquadNode::BiquadNode(Type type, float frequency, float gainDb, float q)
+    : type(static_cast<int>(type))
+    , frequency(frequency)
+    , gainDb(gainDb)
+    , q(q)
+    , parametersChanged(true)
+    , b0(1.0f)
+    , b1(0.0f)
+    , b2(0.0f)
+    , a1(0.0f)
+    , a2(0.0f)
+{
+    memset(z1, 0, sizeof(z1));
+    memset(z2, 0, sizeof(z2));
+}
+
+/**
+ * @brief Gets the name of the node type.
+ * @return "eq".
+ */
+QString BiquadNode::name() const
+{
+    return "eq";
+}
+
+/**
+ * @brief Changes the filter.
+ * @param type The filter response.
+ * @param frequency The center or corner frequency in Hz.
+ * @param gainDb The gain in dB (peaking and shelf filters only).
+ * @param q The quality factor.
+ */
+void BiquadNode::setParameters(Type type, float frequency, float gainDb, float q)
+{
+    this->type.store(static_cast<int>(type), std::memory_order_relaxed);
+    this->frequency.store(frequency, std::memory_order_relaxed);
+    this->gainDb.store(gainDb, std::memory_order_relaxed);
+    this->q.store(q, std::memory_order_relaxed);
+    parametersChanged.store(true, std::memory_order_release);
+}
+
+/**
+ * @brief Prepares the node for a stream format (control thread).
+ * @param sampleRate The sample rate.
+ * @param channels The number of interleaved channels.
+ * @param maxFrames The largest number of frames passed to process().
+ */
+void BiquadNode::prepare(int sampleRate, int channels, int maxFrames)
+{
+    DspNode::prepare(sampleRate, channels, maxFrames);
+    
+    memset(z1, 0, sizeof(z1));
+    memset(z2, 0, sizeof(z2));
+    parametersChanged = true;
+}
+
+/**
+ * @brief Processes a block of interleaved samples in place (audio thread).
+ * @param samples The interleaved samples.
+ * @param frames The number of frames.
+ */
+void BiquadNode::process(float *samples, int frames)
+{
+    if (parametersChanged.exchange(false, std::memory_order_acquire)) {
+        updateCoefficients();
+    }
+    
+    for (int c = 0; c < channels; c++) {
+        float s1 = z1[c];
+        float s2 = z2[c];
+        float *x = samples + c;
+        
+        for (int f = 0; f < frames; f++, x += channels) {
+            float in = *x;
+            float out = b0 * in + s1;
+            s1 = b1 * in - a1 * out + s2;
+            s2 = b2 * in - a2 * out;
+            *x = out;
+        }
+        
+        z1[c] = s1;
+        z2[c] = s2;
+    }
+}
+
+/**
+ * @brief Parses a filter type name such as "peaking" or "lowshelf".
+ * @param text The type name.
+ * @param type The filter type (output).
+ * @return True if the name is known, false otherwise.
+ */
+bool BiquadNode::parseType(const QString &text, Type &type)
+{
+    static const struct { const char *name; Type type; } TYPES[] = {
+        { "lowpass", Type::LowPass },
+        { "highpass", Type::HighPass },
+        { "bandpass", Type::BandPass },
+        { "notch", Type::Notch },
+        { "peaking", Type::Peaking },
+        { "lowshelf", Type::LowShelf },
+        { "highshelf", Type::HighShelf }
+    };
+    
+    QString name = text.trimmed().toLower();
+    for (const auto &entry : TYPES) {
+        if (name == entry.name) {
+            type = entry.type;
+            return true;
+        }
+    }
+    
+    return false;
+}
+
+/**
+ * @brief Computes the coefficients from the current parameters.
+ */
+void BiquadNode::updateCoefficients()
+{
+    float f0 = qBound(10.0f, frequency.load(std::memory_order_relaxed), 0.49f * sampleRate);
+    float quality = qMax(0.05f, q.load(std::memory_order_relaxed));
+    float A = std::pow(10.0f, gainDb.load(std::memory_order_relaxed) / 40.0f);
+    float w0 = 2.0f * static_cast<float>(M_PI) * f0 / sampleRate;
+    float cosw = std::cos(w0);
+    float alpha = std::sin(w0) / (2.0f * quality);
+    float shelf = 2.0f * std::sqrt(A) * alpha;
+    
+    float n0, n1, n2, d0, d1, d2;
+    switch (static_cast<Type>(type.load(std::memory_order_relaxed))) {
+        case Type::LowPass:
+            n0 = (1.0f - cosw) / 2.0f; n1 = 1.0f - cosw; n2 = n0;
+            d0 = 1.0f + alpha; d1 = -2.0f * cosw; d2 = 1.0f - alpha;
+            break;
+        case Type::HighPass:
+            n0 = (1.0f + cosw) / 2.0f; n1 = -(1.0f + cosw); n2 = n0;
+            d0 = 1.0f + alpha; d1 = -2.0f * cosw; d2 = 1.0f - alpha;
+            break;
+        case Type::BandPass:
+            n0 = alpha; n1 = 0.0f; n2 = -alpha;
+            d0 = 1.0f + alpha; d1 = -2.0f * cosw; d2 = 1.0f - alpha;
+            break;
+        case Type::Notch:
+            n0 = 1.0f; n1 = -2.0f * cosw; n2 = 1.0f;
+            d0 = 1.0f + alpha; d1 = -2.0f * cosw; d2 = 1.0f - alpha;
+            break;
+        case Type::Peaking:
+            n0 = 1.0f + alpha * A; n1 = -2.0f * cosw; n2 = 1.0f - alpha * A;
+            d0 = 1.0f + alpha / A; d1 = -2.0f * cosw; d2 = 1.0f - alpha / A;
+            break;
+        case Type::LowShelf:
+            n0 = A * ((A + 1.0f) - (A - 1.0f) * cosw + shelf);
+            n1 = 2.0f * A * ((A - 1.0f) - (A + 1.0f) * cosw);
+            n2 = A * ((A + 1.0f) - (A - 1.0f) * cosw - shelf);
+            d0 = (A + 1.0f) + (A - 1.0f) * cosw + shelf;
+            d1 = -2.0f * ((A - 1.0f) + (A + 1.0f) * cosw);
+            d2 = (A + 1.0f) + (A - 1.0f) * cosw - shelf;
+            break;
+        case Type::HighShelf:
+        default:
+            n0 = A * ((A + 1.0f) + (A - 1.0f) * cosw + shelf);
+            n1 = -2.0f * A * ((A - 1.0f) + (A + 1.0f) * cosw);
+            n2 = A * ((A + 1.0f) + (A - 1.0f) * cosw - shelf);
+            d0 = (A + 1.0f) - (A - 1.0f) * cosw + shelf;
+            d1 = 2.0f * ((A - 1.0f) - (A + 1.0f) * cosw);
+            d2 = (A + 1.0f) - (A - 1.0f) * cosw - shelf;
+            break;
+    }
+    
+    b0 = n0 / d0;
+    b1 = n1 / d0;
+    b2 = n2 / d0;
+    a1 = d1 / d0;
+    a2 = d2 / d0;
+}
+
+/**
+ * @brief Constructor for CompressorNode.
+ * @param thresholdDb The threshold in dBFS.
+ * @param ratio The compression ratio (e.g. 4 for 4:1).
+ * @param attackMs The attack time in milliseconds.
+ * @param releaseMs The release time in milliseconds.
+ * @param makeupDb The make-up gain in dB.
+ */
+CompressorNode::CompressorNode(float thresholdDb, float ratio, float attackMs, float releaseMs, float makeupDb)
+    : thresholdDb(thresholdDb)
+    , ratio(ratio)
+    , attackMs(attackMs)
+    , releaseMs(releaseMs)
+    , makeupDb(makeupDb)
+    , envelope(0.0f)
+{
+}
+
+/**
+ * @brief Gets the name of the node type.
+ * @return "compressor".
+ */
+QString CompressorNode::name() const
+{
+    return "compressor";
+}
+
+/**
+ * @brief Changes the compressor settings.
+ * @param thresholdDb The threshold in dBFS.
+ * @param ratio The compression ratio.
+ * @param attackMs The attack time in milliseconds.
+ * @param releaseMs The release time in milliseconds.
+ * @param makeupDb The make-up gain in dB.
+ */
+void CompressorNode::setParameters(float thresholdDb, float ratio, float attackMs, float releaseMs, float makeupDb)
+{
+    this->thresholdDb.store(thresholdDb, std::memory_order_relaxed);
+    this->ratio.store(ratio, std::memory_order_relaxed);
+    this->attackMs.store(attackMs, std::memory_order_relaxed);
+    this->releaseMs.store(releaseMs, std::memory_order_relaxed);
+    this->makeupDb.store(makeupDb, std::memory_order_relaxed);
+}
+
+/**
+ * @brief Prepares the node for a stream format (control thread).
+ * @param sampleRate The sample rate.
+ * @param channels The number of interleaved channels.
+ * @param maxFrames The largest number of frames passed to process().
+ */
+void CompressorNode::prepare(int sampleRate, int channels, int maxFrames)
+{
+    DspNode::prepare(sampleRate, channels, maxFrames);
+    envelope = 0.0f;
+}
+
+/**
+ * @brief Processes a block of interleaved samples in place (audio thread).
+ * @param samples The interleaved samples.
+ * @param frames The number of frames.
+ */
+void CompressorNode::process(float *samples, int frames)
+{
+    // The settings are picked up once per block
+    float threshold = dbToGain(thresholdDb.load(std::memory_order_relaxed));
+    float slope = 1.0f - 1.0f / qMax(1.0f, ratio.load(std::memory_order_relaxed));
+    float attack = timeCoefficient(attackMs.load(std::memory_order_relaxed), sampleRate);
+    float release = timeCoefficient(releaseMs.load(std::memory_order_relaxed), sampleRate);
+    float makeup = dbToGain(makeupDb.load(std::memory_order_relaxed));
+    
+    for (int f = 0; f < frames; f++) {
+        float *frame = samples + f * channels;
+        float peak = framePeak(frame, channels);
+        
+        float coefficient = peak > envelope ? attack : release;
+        envelope = peak + coefficient * (envelope - peak);
+        
+        // Reduce the level above the threshold by the ratio
+        float gain = makeup;
+        if (envelope > threshold) {
+            gain *= std::pow(envelope / threshold, -slope);
+        }
+        
+        for (int c = 0; c < channels; c++) {
+            frame[c] *= gain;
+        }
+    }
+}
+
+/**
+ * @brief Constructor for LimiterNode.
+ * @param ceilingDb The ceiling in dBFS.
+ * @param releaseMs The release time in milliseconds.
+ */
+LimiterNode::LimiterNode(float ceilingDb, float releaseMs)
+    : CompressorNode(ceilingDb, 1000.0f, 0.0f, releaseMs, 0.0f)
+{
+}
+
+/**
+ * @brief Gets the name of the node type.
+ * @return "limiter".
+ */
+QString LimiterNode::name() const
+{
+    return "limiter";
+}
+
+/**
+ * @brief Constructor for NoiseGateNode.
+ * @param thresholdDb The threshold in dBFS.
+ * @param attackMs The attack time in milliseconds.
+ * @param holdMs The hold time in milliseconds.
+ * @param releaseMs The release time in milliseconds.
+ * @param rangeDb The attenuation of the closed gate in dB (negative).
+ */
+NoiseGateNode::NoiseGateNode(float thresholdDb, float attackMs, float holdMs, float releaseMs, float rangeDb)
+    : thresholdDb(thresholdDb)
+    , attackMs(attackMs)
+    , holdMs(holdMs)
+    , releaseMs(releaseMs)
+    , rangeDb(rangeDb)
+    , gain(1.0f)
+    , holdRemaining(0)
+{
+}
+
+/**
+ * @brief Gets the name of the node type.
+ * @return "gate".
+ */
+QString NoiseGateNode::name() const
+{
+    return "gate";
+}
+
+/**
+ * @brief Changes the gate settings.
+ * @param thresholdDb The threshold in dBFS.
+ * @param attackMs The attack time in milliseconds.
+ * @param holdMs The hold time in milliseconds.
+ * @param releaseMs The release time in milliseconds.
+ * @param rangeDb The attenuation of the closed gate in dB (negative).
+ */
+void NoiseGateNode::setParameters(float thresholdDb, float attackMs, float holdMs, float releaseMs, float rangeDb)
+{
+    this->thresholdDb.store(thresholdDb, std::memory_order_relaxed);
+    this->attackMs.store(attackMs, std::memory_order_relaxed);
+    this->holdMs.store(holdMs, std::memory_order_relaxed);
+    this->releaseMs.store(releaseMs, std::memory_order_relaxed);
+    this->rangeDb.store(rangeDb, std::memory_order_relaxed);
+}
+
+/**
+ * @brief Prepares the node for a stream format (control thread).
+ * @param sampleRate The sample rate.
+ * @param channels The number of interleaved channels.
+ * @param maxFrames The largest number of frames passed to process().
+ */
+void NoiseGateNode::prepare(int sampleRate, int channels, int maxFrames)
+{
+    DspNode::prepare(sampleRate, channels, maxFrames);
+    gain = 1.0f;
+    holdRemaining = 0;
+}
+
+/**
+ * @brief Processes a block of interleaved samples in place (audio thread).
+ * @param samples The interleaved samples.
+ * @param frames The number of frames.
+ */
+void NoiseGateNode::process(float *samples, int frames)
+{
+    // The settings are picked up once per block
+    float threshold = dbToGain(thresholdDb.load(std::memory_order_relaxed));
+    float attack = timeCoefficient(attackMs.load(std::memory_order_relaxed), sampleRate);
+    float release = timeCoefficient(releaseMs.load(std::memory_order_relaxed), sampleRate);
+    int holdFrames = static_cast<int>(holdMs.load(std::memory_order_relaxed) * sampleRate / 1000.0f);
+    float floor = dbToGain(qMin(0.0f, rangeDb.load(std::memory_order_relaxed)));
+    
+    for (int f = 0; f < frames; f++) {
+        float *frame = samples + f * channels;
+        
+        // Open on any frame above the threshold, close once the hold time ran out
+        float target;
+        if (framePeak(frame, channels) > threshold) {
+            holdRemaining = holdFrames;
+            target = 1.0f;
+        } else if (holdRemaining > 0) {
+            holdRemaining--;
+            target = 1.0f;
+        } else {
+            target = floor;
+        }
+        
+        float coefficient = target > gain ? attack : release;
+        gain = target + coefficient * (gain - target);
+        
+        for (int c = 0; c < channels; c++) {
+            frame[c] *= gain;
+        }
+    }
+}
@@ -0,0 +1,431 @@
+#include "../include/echocanceller.h"
+#include <cmath>
+#include <cstring>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+// Adaptation step size of the NLMS filter
+const float STEP_SIZE = 0.5f;
+
+// Smoothing of the reference power per bin
+const float POWER_SMOOTHING = 0.9f;
+
+// Reference power (per sample) below which the far end counts as silent (-60 dBFS)
+const float REFERENCE_SILENCE = 1.0e-6f;
+
+// Geigel detector: near-end speech if the mic peak exceeds this share of the reference peak
+const float GEIGEL_THRESHOLD = 0.5f;
+
+// Time adaptation stays frozen after near-end speech was detected
+const int DOUBLE_TALK_HOLD_MS = 30;
+
+// Time constant of the ERLE/ERL estimates
+const float STATS_TIME_CONSTANT_S = 0.5f;
+
+// ERLE from which the filter counts as converged
+const float CONVERGED_ERLE_DB = 6.0f;
+
+/**
+ * @brief Multiplies two complex vectors and adds the product (c += a * b).
+ * @param ar The real parts of a.
+ * @param ai The imaginary parts of a.
+ * @param br The real parts of b.
+ * @param bi The imaginary parts of b.
+ * @param cr The real parts of c.
+ * @param ci The imaginary parts of c.
+ * @param n The number of elements.
+ */
+static void multiplyAccumulate(const float *ar, const float *ai, const float *br, const float *bi,
+                               float *cr, float *ci, int n)
+{
+    int k = 0;
+
+#if defined(__SSE2__)
+    for (; k + 4 <= n; k += 4) {
+        __m128 xr = _mm_loadu_ps(ar + k);
+        __m128 xi = _mm_loadu_ps(ai + k);
+        __m128 yr = _mm_loadu_ps(br + k);
+        __m128 yi = _mm_loadu_ps(bi + k);
+        __m128 re = _mm_sub_ps(_mm_mul_ps(xr, yr), _mm_mul_ps(xi, yi));
+        __m128 im = _mm_add_ps(_mm_mul_ps(xr, yi), _mm_mul_ps(xi, yr));
+        _mm_storeu_ps(cr + k, _mm_add_ps(_mm_loadu_ps(cr + k), re));
+        _mm_storeu_ps(ci + k, _mm_add_ps(_mm_loadu_ps(ci + k), im));
+    }
+#endif
+    
+    for (; k < n; k++) {
+        cr[k] += ar[k] * br[k] - ai[k] * bi[k];
+        ci[k] += ar[k] * bi[k] + ai[k] * br[k];
+    }
+}
+
+/**
+ * @brief Multiplies the conjugate of a complex vector with another and adds the product (c += conj(a) * b).
+ * @param ar The real parts of a.
+ * @param ai The imaginary parts of a.
+ * @param br The real parts of b.
+ * @param bi The imaginary parts of b.
+ * @param cr The real parts of c.
+ * @param ci The imaginary parts of c.
+ * @param n The number of elements.
+ */
+static void conjugateMultiplyAccumulate(const float *ar, const float *ai, const float *br, const float *bi,
+                                        float *cr, float *ci, int n)
+{
+    int k = 0;
+
+#if defined(__SSE2__)
+    for (; k + 4 <= n; k += 4) {
+        __m128 xr = _mm_loadu_ps(ar + k);
+        __m128 xi = _mm_loadu_ps(ai + k);
+        __m128 yr = _mm_loadu_ps(br + k);
+        __m128 yi = _mm_loadu_ps(bi + k);
+        __m128 re = _mm_add_ps(_mm_mul_ps(xr, yr), _mm_mul_ps(xi, yi));
+        __m128 im = _mm_sub_ps(_mm_mul_ps(xr, yi), _mm_mul_ps(xi, yr));
+        _mm_storeu_ps(cr + k, _mm_add_ps(_mm_loadu_ps(cr + k), re));
+        _mm_storeu_ps(ci + k, _mm_add_ps(_mm_loadu_ps(ci + k), im));
+    }
+#endif
+    
+    for (; k < n; k++) {
+        cr[k] += ar[k] * br[k] + ai[k] * bi[k];
+        ci[k] += ar[k] * bi[k] - ai[k] * br[k];
+    }
+}
+
+/**
+ * @brief Constructor for EchoCanceller.
+ */
+EchoCanceller::EchoCanceller()
+    : sampleRate(48000)
+    , micChannels(0)
+    , referenceChannels(0)
+    , tailMs(128)
+    , partitions(0)
+    , bins(BlockSize + 1)
+    , historyHead(0)
+    , constraintPartition(0)
+    , doubleTalkHold(0)
+    , smoothedMicPower(0.0f)
+    , smoothedErrorPower(0.0f)
+    , smoothedReferencePower(0.0f)
+    , erleDb(0.0f)
+    , erlDb(0.0f)
+    , doubleTalk(false)
+    , adaptedBlocks(0)
+{
+}
+
+/**
+ * @brief Sets the length of the echo path the filter covers (applied by prepare()).
+ * @param milliseconds The tail length in milliseconds.
+ */
+void EchoCanceller::setTailLength(int milliseconds)
+{
+    tailMs = qBound(10, milliseconds, 1000);
+}
+
+/**
+ * @brief Allocates the filters and resets the adaptation.
+ * @param sampleRate The sample rate.
+ * @param micChannels The number of captured channels.
+ * @param referenceChannels The number of playout channels.
+ * @param maxFrames The largest number of frames per call.
+ */
+void EchoCanceller::prepare(int sampleRate, int micChannels, int referenceChannels, int maxFrames)
+{
+    this->sampleRate = sampleRate;
+    this->micChannels = micChannels;
+    this->referenceChannels = referenceChannels;
+    
+    // One partition per block of the echo tail
+    int tailFrames = sampleRate * tailMs / 1000;
+    partitions = qMax(1, (tailFrames + BlockSize - 1) / BlockSize);
+    bins = BlockSize + 1;
+    fft.setSize(2 * BlockSize);
+    
+    // The reference waits at most a few buffers for the captured audio
+    referenceRing.reset(qMax(4 * maxFrames, sampleRate / 10));
+    referenceScratch.resize(maxFrames);
+    referenceBlock.fill(0.0f, 2 * BlockSize);
+    historyRe.fill(0.0f, partitions * bins);
+    historyIm.fill(0.0f, partitions * bins);
+    referencePower.fill(0.0f, bins);
+    blockPeaks.fill(0.0f, partitions);
+    
+    micBlock.resize(BlockSize);
+    timeBuffer.resize(2 * BlockSize);
+    spectrumRe.resize(bins);
+    spectrumIm.resize(bins);
+    gainRe.resize(bins);
+    gainIm.resize(bins);
+    
+    filters.resize(micChannels);
+    for (ChannelFilter &filter : filters) {
+        filter.weightsRe.fill(0.0f, partitions * bins);
+        filter.weightsIm.fill(0.0f, partitions * bins);
+    }
+    
+    historyHead = 0;
+    constraintPartition = 0;
+    doubleTalkHold = 0;
+    smoothedMicPower = 0.0f;
+    smoothedErrorPower = 0.0f;
+    smoothedReferencePower = 0.0f;
+    erleDb = 0.0f;
+    erlDb = 0.0f;
+    doubleTalk = false;
+    adaptedBlocks = 0;
+}
+
+/**
+ * @brief Queues played audio as the echo reference (output thread).
+ * @param samples The interleaved playout samples.
+ * @param frames The number of frames.
+ */
+void EchoCanceller::pushReference(const float *samples, int frames)
+{
+    if (referenceChannels <= 0) {
+        return;
+    }
+    
+    float scale = 1.0f / referenceChannels;
+    float *mono = referenceScratch.data();
+    
+    while (frames > 0) {
+        int count = qMin(frames, referenceScratch.size());
+        for (int f = 0; f < count; f++) {
+            float sum = 0.0f;
+            for (int c = 0; c < referenceChannels; c++) {
+                sum += samples[f * referenceChannels + c];
+            }
+            mono[f] = sum * scale;
+        }
+        referenceRing.write(mono, count);
+        
+        samples += count * referenceChannels;
+        frames -= count;
+    }
+}
+
+/**
+ * @brief Removes the echo from captured audio in place (input thread).
+ *
+ * Frames beyond the last whole block pass through unprocessed, so the
+ * buffer size should be a multiple of BlockSize.
+ *
+ * @param samples The interleaved captured samples.
+ * @param frames The number of frames.
+ */
+void EchoCanceller::process(float *samples, int frames)
+{
+    if (filters.isEmpty()) {
+        return;
+    }
+    
+    int blocks = frames / BlockSize;
+    
+    // Keep the reference aligned: a backlog beyond one buffer means the output
+    // ran ahead (e.g. while priming), and would only lengthen the echo path
+    int excess = referenceRing.availableToRead() - blocks * BlockSize - referenceScratch.size();
+    if (excess > 0) {
+        referenceRing.skip(excess);
+    }
+    
+    int holdBlocks = DOUBLE_TALK_HOLD_MS * sampleRate / 1000 / BlockSize + 1;
+    
+    for (int b = 0; b < blocks; b++) {
+        float *block = samples + b * BlockSize * micChannels;
+        
+        // Slide the reference window by one block (zeros if the playout fell behind)
+        float *reference = referenceBlock.data();
+        memmove(reference, reference + BlockSize, BlockSize * sizeof(float));
+        int read = referenceRing.read(reference + BlockSize, BlockSize);
+        memset(reference + BlockSize + read, 0, (BlockSize - read) * sizeof(float));
+        
+        // Spectrum of the window becomes the newest partition of the history
+        historyHead = (historyHead + 1) % partitions;
+        float *xr = historyRe.data() + historyHead * bins;
+        float *xi = historyIm.data() + historyHead * bins;
+        fft.forward(reference, xr, xi);
+        
+        float *power = referencePower.data();
+        for (int k = 0; k < bins; k++) {
+            float magnitude = xr[k] * xr[k] + xi[k] * xi[k];
+            power[k] = POWER_SMOOTHING * power[k] + (1.0f - POWER_SMOOTHING) * partitions * magnitude;
+        }
+        
+        // Level of the new reference block and its peak over the echo tail
+        float referencePeak = 0.0f;
+        float blockReferencePower = 0.0f;
+        for (int i = BlockSize; i < 2 * BlockSize; i++) {
+            referencePeak = qMax(referencePeak, std::fabs(reference[i]));
+            blockReferencePower += reference[i] * reference[i];
+        }
+        blockReferencePower /= BlockSize;
+        blockPeaks[historyHead] = referencePeak;
+        float tailPeak = 0.0f;
+        for (float peak : blockPeaks) {
+            tailPeak = qMax(tailPeak, peak);
+        }
+        
+        // Geigel double-talk detection on the captured block
+        float micPeak = 0.0f;
+        float micPower = 0.0f;
+        for (int i = 0; i < BlockSize * micChannels; i++) {
+            micPeak = qMax(micPeak, std::fabs(block[i]));
+            micPower += block[i] * block[i];
+        }
+        micPower /= BlockSize;
+        if (micPeak > GEIGEL_THRESHOLD * tailPeak) {
+            doubleTalkHold = holdBlocks;
+        } else if (doubleTalkHold > 0) {
+            doubleTalkHold--;
+        }
+        doubleTalk.store(doubleTalkHold > 0 && blockReferencePower > REFERENCE_SILENCE, std::memory_order_relaxed);
+        
+        // Only a far end that is talking alone teaches the filter the echo path
+        bool adapt = blockReferencePower > REFERENCE_SILENCE && doubleTalkHold == 0;
+        
+        float errorPower = 0.0f;
+        for (int c = 0; c < micChannels; c++) {
+            float *mic = micBlock.data();
+            for (int i = 0; i < BlockSize; i++) {
+                mic[i] = block[i * micChannels + c];
+            }
+            
+            processChannel(filters[c], mic, adapt);
+            
+            for (int i = 0; i < BlockSize; i++) {
+                block[i * micChannels + c] = mic[i];
+                errorPower += mic[i] * mic[i];
+            }
+            
+            if (adapt) {
+                constrainPartition(filters[c], constraintPartition);
+            }
+        }
+        errorPower /= BlockSize;
+        
+        if (adapt) {
+            constraintPartition = (constraintPartition + 1) % partitions;
+            adaptedBlocks.fetch_add(1, std::memory_order_relaxed);
+            updateStats(blockReferencePower, micPower, errorPower);
+        }
+    }
+}
+
+/**
+ * @brief Gets the current metrics.
+ * @return The echo cancellation metrics.
+ */
+EchoStats EchoCanceller::getStats() const
+{
+    EchoStats stats;
+    stats.erleDb = erleDb.load(std::memory_order_relaxed);
+    stats.erlDb = erlDb.load(std::memory_order_relaxed);
+    stats.converged = stats.erleDb >= CONVERGED_ERLE_DB;
+    stats.doubleTalk = doubleTalk.load(std::memory_order_relaxed);
+    stats.adaptedBlocks = adaptedBlocks.load(std::memory_order_relaxed);
+    return stats;
+}
+
+/**
+ * @brief Processes one block of one channel.
+ * @param filter The channel's filter.
+ * @param mic The block of mic samples, replaced by the echo-free signal.
+ * @param adapt Whether the filter may adapt on this block.
+ */
+void EchoCanceller::processChannel(ChannelFilter &filter, float *mic, bool adapt)
+{
+    float *sr = spectrumRe.data();
+    float *si = spectrumIm.data();
+    float *time = timeBuffer.data();
+    
+    // Echo estimate: every partition filters the reference block of its delay
+    memset(sr, 0, bins * sizeof(float));
+    memset(si, 0, bins * sizeof(float));
+    for (int p = 0; p < partitions; p++) {
+        int index = (historyHead - p + partitions) % partitions;
+        multiplyAccumulate(filter.weightsRe.constData() + p * bins, filter.weightsIm.constData() + p * bins,
+                           historyRe.constData() + index * bins, historyIm.constData() + index * bins,
+                           sr, si, bins);
+    }
+    fft.inverse(sr, si, time);
+    
+    // Overlap-save: the second half of the window is the linear convolution
+    for (int i = 0; i < BlockSize; i++) {
+        mic[i] -= time[BlockSize + i];
+    }
+    
+    if (!adapt) {
+        return;
+    }
+    
+    // Spectrum of the error, padded in front to the window length
+    memset(time, 0, BlockSize * sizeof(float));
+    memcpy(time + BlockSize, mic, BlockSize * sizeof(float));
+    fft.forward(time, sr, si);
+    
+    // Normalized step per bin
+    float regularization = partitions * 2.0f * BlockSize * REFERENCE_SILENCE * 0.1f;
+    const float *power = referencePower.constData();
+    float *gr = gainRe.data();
+    float *gi = gainIm.data();
+    for (int k = 0; k < bins; k++) {
+        float step = STEP_SIZE / (power[k] + regularization);
+        gr[k] = sr[k] * step;
+        gi[k] = si[k] * step;
+    }
+    
+    // Correlate the error with the reference of every partition
+    for (int p = 0; p < partitions; p++) {
+        int index = (historyHead - p + partitions) % partitions;
+        conjugateMultiplyAccumulate(historyRe.constData() + index * bins, historyIm.constData() + index * bins,
+                                    gr, gi, filter.weightsRe.data() + p * bins, filter.weightsIm.data() + p * bins,
+                                    bins);
+    }
+}
+
+/**
+ * @brief Applies the gradient constraint to one partition of a filter.
+ * @param filter The channel's filter.
+ * @param partition The partition index.
+ */
+void EchoCanceller::constrainPartition(ChannelFilter &filter, int partition)
+{
+    float *wr = filter.weightsRe.data() + partition * bins;
+    float *wi = filter.weightsIm.data() + partition * bins;
+    float *time = timeBuffer.data();
+    
+    // Keep the impulse response to one block, so the overlap-save output stays linear
+    fft.inverse(wr, wi, time);
+    memset(time + BlockSize, 0, BlockSize * sizeof(float));
+    fft.forward(time, wr, wi);
+}
+
+/**
+ * @brief Updates the metrics from one block that was adapted on.
+ * @param referencePower The power of the reference block.
+ * @param micPower The power of the captured block.
+ * @param errorPower The power of the block after cancellation.
+ */
+void EchoCanceller::updateStats(float referencePower, float micPower, float errorPower)
+{
+    // Start from the first block instead of ramping up from zero
+    float alpha = static_cast<float>(BlockSize) / (STATS_TIME_CONSTANT_S * sampleRate);
+    if (adaptedBlocks.load(std::memory_order_relaxed) == 1) {
+        alpha = 1.0f;
+    }
+    smoothedReferencePower += alpha * (referencePower - smoothedReferencePower);
+    smoothedMicPower += alpha * (micPower - smoothedMicPower);
+    smoothedErrorPower += alpha * (errorPower - smoothedErrorPower);
+    
+    const float floor = 1.0e-12f;
+    erleDb.store(10.0f * std::log10((smoothedMicPower + floor) / (smoothedErrorPower + floor)),
+                 std::memory_order_relaxed);
+    erlDb.store(10.0f * std::log10((smoothedReferencePower * micChannels + floor) / (smoothedMicPower + floor)),
+                std::memory_order_relaxed);
+}
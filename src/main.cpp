@@ -1,7 +1,12 @@
 #include <QtWidgets/QApplication>
 #include <QtCore/QFile>
 #include <QtCore/QTextStream>
+#include <QtCore/QCommandLineParser>
+#include <QtCore/QDebug>
+#include <QtCore/QScopedPointer>
 #include "../include/mainwindow.h"
+#include "../include/networkmanager.h"
+#include "../include/sessionmanager.h"
 
 /**
  * @brief Loads and applies a style sheet from a file.
@@ -24,6 +29,25 @@ bool loadStyleSheet(QApplication &app, const QString &path)
     return true;
 }
 
+/**
+ * @brief Checks if the command line asks for a headless mode.
+ * @param argc Command line argument count.
+ * @param argv Command line arguments.
+ * @return True if --sessions or --relay is given, false otherwise.
+ */
+bool isHeadless(int argc, char *argv[])
+{
+    // Decided before the application exists, since a server has no display for QApplication
+    for (int i = 1; i < argc; i++) {
+        QByteArray argument(argv[i]);
+        if (argument == "--sessions" || argument.startsWith("--sessions=") ||
+            argument == "--relay" || argument.startsWith("--relay=")) {
+            return true;
+        }
+    }
+    return false;
+}
+
 /**
  * @brief Application entry point.
  * @param argc Command line argument count.
@@ -32,22 +56,101 @@ bool loadStyleSheet(QApplication &app, const QString &path)
  */
 int main(int argc, char *argv[])
 {
-    // Create the application
-    QApplication app(argc, argv);
+    // Create the application (without widgets when running sessions headless)
+    QScopedPointer<QCoreApplication> app(isHeadless(argc, argv) ? new QCoreApplication(argc, argv)
+                                                                 : new QApplication(argc, argv));
     
     // Set application information
-    app.setApplicationName("AudioBridge");
-    app.setApplicationVersion("0.1.0");
-    app.setOrganizationName("AudioBridge");
-    app.setOrganizationDomain("audiobridge.example.com");
+    app->setApplicationName("AudioBridge");
+    app->setApplicationVersion("0.1.0");
+    app->setOrganizationName("AudioBridge");
+    app->setOrganizationDomain("audiobridge.example.com");
+    
+    // Parse the command line
+    QCommandLineParser parser;
+    parser.setApplicationDescription("Low-latency audio bridge");
+    parser.addHelpOption();
+    parser.addVersionOption();
+    
+    QCommandLineOption captureOption("capture", "Capture every received packet to <file>.", "file");
+    QCommandLineOption replayOption("replay", "Replay <file> through the receive pipeline instead of connecting.", "file");
+    QCommandLineOption replayFastOption("replay-fast", "Replay as fast as possible instead of at the recorded timing.");
+    QCommandLineOption impairOption("impair",
+                                    "Impair received packets, e.g. \"loss=1,burst=2:30,delay=40,jitter=10,"
+                                    "reorder=1,duplicate=0.5,rate=512,queue=200,seed=7\".", "profile");
+    QCommandLineOption sessionsOption("sessions",
+                                      "Run the bridges defined in <file> without a window, one per group.", "file");
+    QCommandLineOption workersOption("workers", "Worker threads of --sessions (default: one per core).", "count");
+    QCommandLineOption statsIntervalOption("stats-interval",
+                                           "Seconds between the --sessions reports (default 10, 0 disables).",
+                                           "seconds");
+    QCommandLineOption relayOption("relay",
+                                   "Accept a sender on <port> and pass its stream on to the --downstream "
+                                   "receivers without a window or audio devices.", "port");
+    QCommandLineOption downstreamOption("downstream", "A receiver of --relay as <host:port> (repeatable).",
+                                        "host:port");
+    parser.addOption(captureOption);
+    parser.addOption(replayOption);
+    parser.addOption(replayFastOption);
+    parser.addOption(impairOption);
+    parser.addOption(sessionsOption);
+    parser.addOption(workersOption);
+    parser.addOption(statsIntervalOption);
+    parser.addOption(relayOption);
+    parser.addOption(downstreamOption);
+    parser.process(*app);
+    
+    ImpairmentProfile impairment;
+    QString impairmentError;
+    if (!ImpairmentProfile::parse(parser.value(impairOption), impairment, &impairmentError)) {
+        qCritical().noquote() << "Invalid --impair profile:" << impairmentError;
+        return 1;
+    }
+    
+    // Many bridges in this process instead of the window
+    if (parser.isSet(sessionsOption)) {
+        SessionManager sessionManager;
+        QString sessionsError;
+        if (!sessionManager.loadSessions(parser.value(sessionsOption), &sessionsError)) {
+            qCritical().noquote() << "Invalid --sessions file:" << sessionsError;
+            return 1;
+        }
+        sessionManager.setWorkerCount(parser.value(workersOption).toInt());
+        sessionManager.setReportInterval(parser.isSet(statsIntervalOption)
+                                         ? parser.value(statsIntervalOption).toInt() * 1000 : 10000);
+        if (sessionManager.start() == 0) {
+            qCritical().noquote() << "No session could be started";
+            return 1;
+        }
+        return app->exec();
+    }
+    
+    // A relay between a sender and its receivers instead of the window
+    if (parser.isSet(relayOption)) {
+        NetworkManager relay;
+        QObject::connect(&relay, &NetworkManager::error, [](const QString &message) {
+            qWarning().noquote() << message;
+        });
+        QObject::connect(&relay, &NetworkManager::connectionStatusChanged, [](bool, const QString &message) {
+            qInfo().noquote() << message;
+        });
+        relay.setImpairment(impairment);
+        if (!relay.startRelay(parser.value(relayOption).toInt(), parser.values(downstreamOption))) {
+            return 1;
+        }
+        return app->exec();
+    }
     
     // Load the default light style sheet
-    loadStyleSheet(app, ":/styles/light_style.qss");
+    loadStyleSheet(*static_cast<QApplication*>(app.data()), ":/styles/light_style.qss");
     
     // Create and show the main window
     MainWindow mainWindow;
+    mainWindow.setCaptureFile(parser.value(captureOption));
+    mainWindow.setReplayFile(parser.value(replayOption), !parser.isSet(replayFastOption));
+    mainWindow.setImpairment(impairment);
     mainWindow.show();
     
     // Enter the application event loop
-    return app.exec();
+    return app->exec();
 }
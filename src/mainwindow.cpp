@@ -4,6 +4,8 @@
 #include <QtCore/QStandardPaths>
 #include <QtCore/QDir>
 #include <QtCore/QFileInfo>
+#include <QtCore/QDateTime>
+#include <functional>
 
 /**
  * @brief Constructor for MainWindow.
@@ -13,10 +15,19 @@ MainWindow::MainWindow(QWidget *parent)
     : QMainWindow(parent)
     , ui(new Ui::MainWindow)
     , audioManager(new AudioManager(this))
-    , networkManager(new NetworkManager(this))
+    , networkManager(new NetworkManager)
+    , networkThread(new QThread(this))
+    , rateController(new RateController(this))
     , settings(new QSettings(this))
     , audioLevelTimer(new QTimer(this))
+    , reportTimer(new QTimer(this))
+    , spectrumWidget(new SpectrumWidget(this))
+    , lastPlayoutStats()
+    , latencyStats()
+    , sendMode(TransmissionMode::Raw)
+    , replayRealtime(true)
     , isRunning(false)
+    , isStarting(false)
     , isSenderMode(true)
 {
     // Set up the UI
@@ -26,24 +37,93 @@ MainWindow::MainWindow(QWidget *parent)
     // Load settings
     loadSettings();
     
-    // Populate audio devices
-    populateAudioDevices();
+    // Probe the audio devices in the background; the lists fill in when it is
+    // done and again whenever a device comes or goes
+    DeviceRegistry *deviceRegistry = audioManager->getDeviceRegistry();
+    connect(deviceRegistry, &DeviceRegistry::probeProgress, this, [this](const QString &message) {
+        if (!isRunning && !isStarting) {
+            ui->statusLabel->setText(message);
+        }
+    });
+    connect(deviceRegistry, &DeviceRegistry::devicesChanged, this, &MainWindow::populateAudioDevices);
+    if (deviceRegistry->isReady()) {
+        populateAudioDevices();
+    }
+    
+    // Run the network and the receive path on their own event loop, away from painting
+    networkManager->moveToThread(networkThread);
+    connect(networkThread, &QThread::finished, networkManager, &QObject::deleteLater);
+    networkThread->start(QThread::HighestPriority);
     
     // Connect signals and slots
     connect(ui->senderRadioButton, &QRadioButton::toggled, this, &MainWindow::onModeChanged);
     connect(audioManager, &AudioManager::audioLevelChanged, this, &MainWindow::updateAudioLevel);
-    connect(audioManager, &AudioManager::error, [this](const QString &errorMessage) {
+    connect(audioManager, &AudioManager::spectrumReady, spectrumWidget, &SpectrumWidget::setFrame);
+    connect(audioManager, &AudioManager::error, this, [this](const QString &errorMessage) {
         QMessageBox::critical(this, tr("Audio Error"), errorMessage);
     });
     
     connect(networkManager, &NetworkManager::connectionStatusChanged, this, &MainWindow::updateConnectionStatus);
+    connect(networkManager, &NetworkManager::latencyStatsChanged, this, [this](const LatencyStats &stats) {
+        latencyStats = stats;
+    });
     connect(networkManager, &NetworkManager::latencyChanged, this, &MainWindow::updateLatency);
-    connect(networkManager, &NetworkManager::audioDataReceived, audioManager, &AudioManager::processIncomingAudio);
-    connect(networkManager, &NetworkManager::error, [this](const QString &errorMessage) {
+    
+    // The receive path (decode and playout buffer insert) runs directly on the network thread
+    connect(networkManager, &NetworkManager::audioDataReceived, audioManager, &AudioManager::processIncomingAudio,
+            Qt::DirectConnection);
+    connect(networkManager, &NetworkManager::comfortNoiseReceived, audioManager, &AudioManager::processComfortNoise,
+            Qt::DirectConnection);
+    connect(networkManager, &NetworkManager::peerFormatReceived, audioManager, &AudioManager::setPeerFormat,
+            Qt::DirectConnection);
+    connect(networkManager, &NetworkManager::peerCodecReceived, audioManager,
+            &AudioManager::setReceiveTransmissionMode, Qt::DirectConnection);
+    connect(networkManager, &NetworkManager::connectionStatusChanged, networkManager, [this](bool connected) {
+        // Cover the gap until the link is back
+        if (!connected) {
+            audioManager->concealLinkLoss();
+        }
+    });
+    connect(networkManager, &NetworkManager::sessionEnded, networkManager, [this]() {
+        // The next peer announces its own format
+        audioManager->clearPeerFormat();
+    });
+    connect(networkManager, &NetworkManager::sessionNegotiated, this, [this](const NegotiatedSession &session) {
+        // Send what the handshake agreed on, even if another mode was selected
+        if (isRunning && session.mode != sendMode) {
+            sendMode = session.mode;
+            audioManager->setTransmissionMode(sendMode);
+            updateRateControl(sendMode);
+        }
+    });
+    connect(networkManager, &NetworkManager::error, this, [this](const QString &errorMessage) {
         QMessageBox::critical(this, tr("Network Error"), errorMessage);
     });
     
-    connect(audioManager, &AudioManager::audioDataReady, networkManager, &NetworkManager::sendAudioData);
+    // The send path queues its packets; the network thread collects and sends them
+    connect(networkManager, &NetworkManager::readyForAudio, audioManager, &AudioManager::drainSendQueue,
+            Qt::DirectConnection);
+    connect(audioManager, &AudioManager::audioDataReady, networkManager, &NetworkManager::sendAudioData,
+            Qt::DirectConnection);
+    connect(audioManager, &AudioManager::comfortNoiseReady, networkManager, &NetworkManager::sendComfortNoise,
+            Qt::DirectConnection);
+    connect(audioManager, &AudioManager::codecChanged, networkManager, &NetworkManager::sendCodec,
+            Qt::DirectConnection);
+    runOnNetworkThread([this]() {
+        networkManager->watchAudioQueue(audioManager->getSendQueueDescriptor());
+    });
+    
+    // Adapt the encoder to the network conditions
+    connect(networkManager, &NetworkManager::latencyChanged, rateController, &RateController::setRoundTripTime);
+    connect(networkManager, &NetworkManager::sendBacklogChanged, rateController, &RateController::setSendBacklog);
+    connect(networkManager, &NetworkManager::receiverReportReceived,
+            rateController, &RateController::processReceiverReport);
+    connect(networkManager, &NetworkManager::sendQueueOverflowed, rateController, &RateController::processSendDrops);
+    connect(rateController, &RateController::encoderSettingsChanged, audioManager, &AudioManager::setEncoderSettings);
+    
+    // Report our playout loss to the peer once a second
+    reportTimer->setInterval(1000);
+    connect(reportTimer, &QTimer::timeout, this, &MainWindow::sendReceiverReport);
     
     // Set up audio level timer
     audioLevelTimer->setInterval(100);
@@ -71,15 +151,52 @@ MainWindow::~MainWindow()
         stopBridge();
     }
     
+    // Stop the network thread, which deletes the network manager
+    networkThread->quit();
+    networkThread->wait();
+    
     // Clean up
     delete ui;
 }
 
+/**
+ * @brief Sets a file that received packets are captured to while the bridge runs.
+ * @param filePath The path of the capture file (empty disables capturing).
+ */
+void MainWindow::setCaptureFile(const QString &filePath)
+{
+    captureFile = filePath;
+}
+
+/**
+ * @brief Sets a capture file that is replayed instead of connecting to a peer.
+ * @param filePath The path of the capture file (empty disables replay).
+ * @param realtime Whether to reproduce the recorded timing.
+ */
+void MainWindow::setReplayFile(const QString &filePath, bool realtime)
+{
+    replayFile = filePath;
+    replayRealtime = realtime;
+}
+
+/**
+ * @brief Sets the network conditions simulated on received packets while the bridge runs.
+ * @param profile The network conditions (a profile without impairments disables it).
+ */
+void MainWindow::setImpairment(const ImpairmentProfile &profile)
+{
+    impairmentProfile = profile;
+}
+
 /**
  * @brief Handles the start/stop button click.
  */
 void MainWindow::on_startStopButton_clicked()
 {
+    if (isStarting) {
+        return;
+    }
+    
     if (isRunning) {
         stopBridge();
     } else {
@@ -127,7 +244,25 @@ void MainWindow::updateAudioLevel(int level)
  */
 void MainWindow::updateLatency(int latencyMs)
 {
-    ui->latencyLabel->setText(tr("Latency: %1 ms").arg(latencyMs));
+    // With kernel timestamps the latency is the network's, the rest of the
+    // round trip waited in the applications
+    QStringList details;
+    if (latencyMs > 0 && latencyStats.kernelTimestamps) {
+        qint64 queueingUs = latencyStats.localQueueingUs + latencyStats.peerQueueingUs;
+        details << tr("queueing %1 ms").arg((queueingUs + 500) / 1000);
+    }
+    
+    // With scheduled playout the delay from microphone to speaker is known too
+    qint64 endToEndDelayUs = audioManager->getPlayoutStats().endToEndDelayUs;
+    if (endToEndDelayUs > 0) {
+        details << tr("end-to-end %1 ms").arg((endToEndDelayUs + 500) / 1000);
+    }
+    
+    if (details.isEmpty()) {
+        ui->latencyLabel->setText(tr("Latency: %1 ms").arg(latencyMs));
+    } else {
+        ui->latencyLabel->setText(tr("Latency: %1 ms (%2)").arg(latencyMs).arg(details.join(", ")));
+    }
 }
 
 /**
@@ -148,6 +283,11 @@ void MainWindow::on_transmissionModeComboBox_currentIndexChanged(int index)
 {
     TransmissionMode mode = (index == 0) ? TransmissionMode::Raw : TransmissionMode::Opus;
     audioManager->setTransmissionMode(mode);
+    sendMode = mode;
+    
+    if (isRunning) {
+        updateRateControl(mode);
+    }
 }
 
 /**
@@ -184,6 +324,9 @@ void MainWindow::setupUi()
     
     // Set minimum window size
     setMinimumSize(640, 480);
+    
+    // Show the spectrum above the level meter
+    ui->verticalLayout->insertWidget(ui->verticalLayout->indexOf(ui->footerFrame), spectrumWidget);
 }
 
 /**
@@ -230,6 +373,14 @@ void MainWindow::saveSettings()
     settings->setValue("audio/bufferSize", ui->bufferSizeComboBox->currentIndex());
     settings->setValue("audio/transmissionMode", ui->transmissionModeComboBox->currentIndex());
     
+    // Save the devices by identifier, which tells apart devices of the same name
+    if (ui->inputDeviceComboBox->count() > 0) {
+        settings->setValue("audio/inputDevice", ui->inputDeviceComboBox->currentData().toString());
+    }
+    if (ui->outputDeviceComboBox->count() > 0) {
+        settings->setValue("audio/outputDevice", ui->outputDeviceComboBox->currentData().toString());
+    }
+    
     // Save theme
     settings->setValue("appearance/theme", ui->themeComboBox->currentIndex());
     
@@ -238,30 +389,39 @@ void MainWindow::saveSettings()
 }
 
 /**
- * @brief Populates the audio device combo boxes.
+ * @brief Populates the audio device combo boxes from the device registry.
  */
 void MainWindow::populateAudioDevices()
 {
-    // Get input devices
-    QStringList inputDevices = audioManager->getInputDevices();
-    ui->inputDeviceComboBox->clear();
-    ui->inputDeviceComboBox->addItems(inputDevices);
-    
-    // Get output devices
-    QStringList outputDevices = audioManager->getOutputDevices();
-    ui->outputDeviceComboBox->clear();
-    ui->outputDeviceComboBox->addItems(outputDevices);
-    
-    // Select default devices
-    QString defaultInputDevice = settings->value("audio/inputDevice", "").toString();
-    if (!defaultInputDevice.isEmpty() && inputDevices.contains(defaultInputDevice)) {
-        ui->inputDeviceComboBox->setCurrentText(defaultInputDevice);
-    }
+    DeviceRegistry *deviceRegistry = audioManager->getDeviceRegistry();
     
-    QString defaultOutputDevice = settings->value("audio/outputDevice", "").toString();
-    if (!defaultOutputDevice.isEmpty() && outputDevices.contains(defaultOutputDevice)) {
-        ui->outputDeviceComboBox->setCurrentText(defaultOutputDevice);
+    // Keep the current selection, or select the saved devices on the first fill
+    QString inputDevice = ui->inputDeviceComboBox->currentData().toString();
+    if (inputDevice.isEmpty()) {
+        inputDevice = settings->value("audio/inputDevice", "").toString();
+    }
+    QString outputDevice = ui->outputDeviceComboBox->currentData().toString();
+    if (outputDevice.isEmpty()) {
+        outputDevice = settings->value("audio/outputDevice", "").toString();
     }
+    
+    auto fill = [](QComboBox *comboBox, const QVector<AudioDeviceInfo> &devices, const QString &selected) {
+        comboBox->clear();
+        for (const AudioDeviceInfo &device : devices) {
+            comboBox->addItem(device.name, device.id);
+        }
+        
+        // Settings from before the identifiers hold the name
+        int index = comboBox->findData(selected);
+        if (index < 0) {
+            index = comboBox->findText(selected);
+        }
+        if (index >= 0) {
+            comboBox->setCurrentIndex(index);
+        }
+    };
+    fill(ui->inputDeviceComboBox, deviceRegistry->getInputDevices(), inputDevice);
+    fill(ui->outputDeviceComboBox, deviceRegistry->getOutputDevices(), outputDevice);
 }
 
 /**
@@ -308,10 +468,8 @@ void MainWindow::updateUiForMode()
 void MainWindow::startBridge()
 {
     // Get settings
-    QString ipAddress = ui->ipAddressLineEdit->text();
-    int port = ui->portSpinBox->value();
-    QString inputDevice = ui->inputDeviceComboBox->currentText();
-    QString outputDevice = ui->outputDeviceComboBox->currentText();
+    QString inputDevice = ui->inputDeviceComboBox->currentData().toString();
+    QString outputDevice = ui->outputDeviceComboBox->currentData().toString();
     
     int sampleRate = (ui->sampleRateComboBox->currentIndex() == 0) ? 44100 : 48000;
     
@@ -328,33 +486,148 @@ void MainWindow::startBridge()
                             ? TransmissionMode::Raw 
                             : TransmissionMode::Opus;
     
-    // Initialize audio
-    if (!audioManager->initialize()) {
-        QMessageBox::critical(this, tr("Error"), tr("Failed to initialize audio system."));
-        return;
+    // Apply the channel layouts of the devices
+    audioManager->setChannelMaps(channelMapSetting("audio/inputChannels", "audio/inputChannelMap"),
+                                 channelMapSetting("audio/outputChannels", "audio/outputChannelMap"));
+    
+    // Apply silence suppression settings
+    audioManager->setSilenceSuppression(settings->value("audio/silenceSuppression", true).toBool());
+    audioManager->setActivityThreshold(settings->value("audio/activityThresholdDb", -70.0).toFloat());
+    audioManager->setActivityHangover(settings->value("audio/activityHangoverMs", 300).toInt());
+    audioManager->setComfortNoiseInterval(settings->value("audio/comfortNoiseIntervalMs", 500).toInt());
+    
+    // Apply echo cancellation and the processing chains
+    audioManager->setEchoCancellation(settings->value("audio/echoCancellation", false).toBool());
+    audioManager->setEchoTailLength(settings->value("audio/echoTailMs", 128).toInt());
+    audioManager->setCaptureProcessing(settings->value("dsp/captureChain").toString());
+    audioManager->setPlayoutProcessing(settings->value("dsp/playoutChain").toString());
+    
+    // Analyse what we send, or what we play when receiving
+    QString spectrumSource = settings->value("spectrum/source", "auto").toString();
+    if (spectrumSource == "auto") {
+        spectrumSource = isSenderMode ? "capture" : "playout";
     }
+    audioManager->setSpectrumSource(spectrumSource == "capture" ? SpectrumSource::Capture
+                                    : spectrumSource == "playout" ? SpectrumSource::Playout
+                                    : SpectrumSource::Off);
+    audioManager->setSpectrumFrameRate(settings->value("spectrum/frameRate", 30).toInt());
+    spectrumWidget->clear();
+    spectrumWidget->setVisible(spectrumSource == "capture" || spectrumSource == "playout");
+    
+    // Fixed mouth-to-ear delay the received audio is scheduled to (0 plays it as it arrives)
+    audioManager->setPlayoutDelay(settings->value("audio/playoutDelayMs", 0).toInt());
+    
+    // Start audio before the network, so that received audio never meets a stream
+    // being opened. Opening the devices can take a while, so it runs on the device
+    // probe thread and the network starts when it is done.
+    isStarting = true;
+    ui->startStopButton->setEnabled(false);
+    ui->tabWidget->setEnabled(false);
+    ui->modeGroupBox->setEnabled(false);
+    updateConnectionStatus(false, tr("Opening audio devices..."));
+    
+    audioStartConnection = connect(audioManager, &AudioManager::startFinished, this,
+                                   [this, sampleRate, bufferSize, mode](bool started) {
+        QObject::disconnect(audioStartConnection);
+        isStarting = false;
+        ui->startStopButton->setEnabled(true);
+        
+        if (!started) {
+            ui->tabWidget->setEnabled(true);
+            ui->modeGroupBox->setEnabled(true);
+            updateConnectionStatus(false, tr("Disconnected"));
+            QMessageBox::critical(this, tr("Error"), tr("Failed to start audio system."));
+            return;
+        }
+        
+        startNetwork(sampleRate, bufferSize, mode);
+    });
+    audioManager->startAsync(inputDevice, outputDevice, sampleRate, bufferSize, mode);
+}
+
+/**
+ * @brief Starts the network side once the audio streams are running.
+ * @param sampleRate The sample rate of the streams.
+ * @param bufferSize The buffer size of the streams.
+ * @param mode The transmission mode.
+ */
+void MainWindow::startNetwork(int sampleRate, int bufferSize, TransmissionMode mode)
+{
+    QString ipAddress = ui->ipAddressLineEdit->text();
+    int port = ui->portSpinBox->value();
     
-    // Start network
-    bool networkStarted;
-    if (isSenderMode) {
-        networkStarted = networkManager->connectToServer(ipAddress, port);
-    } else {
-        networkStarted = networkManager->startServer(port);
-    }
+    // Read the advanced network settings here, the network thread does not touch them
+    int framesPerPacket = settings->value("network/framesPerPacket", 1).toInt();
+    int maxAggregationDelay = settings->value("network/maxAggregationDelayMs", 5).toInt();
+    bool autoReconnect = settings->value("network/autoReconnect", true).toBool();
+    int maxQueueDelay = settings->value("network/maxQueueDelayMs", 150).toInt();
+    DropPolicy dropPolicy = settings->value("network/dropPolicy", "oldest").toString() == "keyframe"
+                            ? DropPolicy::DropToKeyframe : DropPolicy::DropOldest;
+    TransportBackend transport = settings->value("network/transport", "qt").toString() == "uring"
+                                 ? TransportBackend::Uring : TransportBackend::Qt;
+    bool kernelTimestamps = settings->value("network/kernelTimestamps", false).toBool();
+    
+    // Start network (or replay a capture in its place), capturing what we receive if requested
+    bool networkStarted = false;
+    runOnNetworkThread([&]() {
+        networkManager->setFramesPerPacket(framesPerPacket);
+        networkManager->setMaxAggregationDelay(maxAggregationDelay);
+        networkManager->setAutoReconnect(autoReconnect);
+        networkManager->setSendQueueLimit(maxQueueDelay, dropPolicy);
+        networkManager->setTransportBackend(transport);
+        networkManager->setKernelTimestamps(kernelTimestamps);
+        networkManager->setImpairment(impairmentProfile);
+        networkManager->setLocalCapabilities(SessionHandshake::localCapabilities(sampleRate, bufferSize, mode));
+        
+        if (!captureFile.isEmpty()) {
+            networkManager->startCapture(captureFile);
+        }
+        
+        if (!replayFile.isEmpty()) {
+            networkStarted = networkManager->startReplay(replayFile, replayRealtime);
+        } else if (isSenderMode) {
+            networkStarted = networkManager->connectToServer(ipAddress, port);
+        } else {
+            networkStarted = networkManager->startServer(port);
+        }
+        
+        if (!networkStarted) {
+            networkManager->stopCapture();
+        }
+    });
     
     if (!networkStarted) {
+        audioManager->stop();
+        ui->tabWidget->setEnabled(true);
+        ui->modeGroupBox->setEnabled(true);
+        updateConnectionStatus(false, tr("Disconnected"));
         QMessageBox::critical(this, tr("Error"), 
-                             tr("Failed to %1.").arg(isSenderMode ? "connect to server" : "start server"));
+                             tr("Failed to %1.").arg(!replayFile.isEmpty() ? "replay capture"
+                                                     : isSenderMode ? "connect to server" : "start server"));
         return;
     }
     
-    // Start audio
-    if (!audioManager->start(inputDevice, outputDevice, sampleRate, bufferSize, mode)) {
-        networkManager->disconnect();
-        QMessageBox::critical(this, tr("Error"), tr("Failed to start audio system."));
-        return;
+    // Archive what we play if requested
+    if (settings->value("recording/enabled", false).toBool()) {
+        QString directory = settings->value("recording/directory",
+                                            QStandardPaths::writableLocation(QStandardPaths::MusicLocation)).toString();
+        QString fileName = QString("AudioBridge-%1.wav").arg(QDateTime::currentDateTime().toString("yyyyMMdd-HHmmss"));
+        audioManager->startRecording(QDir(directory).filePath(fileName));
     }
     
+    // Announce our layouts to the peer
+    ChannelMap inputMap = audioManager->getInputChannelMap();
+    ChannelMap outputMap = audioManager->getOutputChannelMap();
+    runOnNetworkThread([&]() {
+        networkManager->setLocalFormat(inputMap, outputMap);
+    });
+    
+    // Start adapting the encoder and reporting playout loss
+    sendMode = mode;
+    updateRateControl(mode);
+    lastPlayoutStats = audioManager->getPlayoutStats();
+    reportTimer->start();
+    
     // Update UI
     isRunning = true;
     ui->startStopButton->setText(tr("Stop"));
@@ -367,11 +640,19 @@ void MainWindow::startBridge()
  */
 void MainWindow::stopBridge()
 {
-    // Stop audio
-    audioManager->stop();
+    // Stop rate control and reports
+    rateController->stop();
+    reportTimer->stop();
     
-    // Stop network
-    networkManager->disconnect();
+    // Stop network and close the capture first, so that nothing is received into a stopping stream
+    runOnNetworkThread([this]() {
+        networkManager->disconnect();
+        networkManager->stopCapture();
+    });
+    
+    // Stop audio and finalize the recording
+    audioManager->stop();
+    audioManager->stopRecording();
     
     // Update UI
     isRunning = false;
@@ -381,5 +662,67 @@ void MainWindow::stopBridge()
     
     // Reset status
     updateConnectionStatus(false, tr("Disconnected"));
+    latencyStats = LatencyStats();
     updateLatency(0);
 }
+
+/**
+ * @brief Starts or stops the rate controller for the given transmission mode.
+ * @param mode The active transmission mode.
+ */
+void MainWindow::updateRateControl(TransmissionMode mode)
+{
+    if (mode != TransmissionMode::Opus) {
+        rateController->stop();
+        return;
+    }
+    
+    rateController->setTargetQueueDelay(settings->value("network/targetQueueDelayMs", 40).toInt());
+    rateController->setBitrateRange(settings->value("audio/opusMinBitrate", 12000).toInt(),
+                                    settings->value("audio/opusMaxBitrate", 128000).toInt());
+    rateController->start(settings->value("audio/opusBitrate", 64000).toInt());
+}
+
+/**
+ * @brief Sends the playout loss since the last report to the peer.
+ */
+void MainWindow::sendReceiverReport()
+{
+    PlayoutStats stats = audioManager->getPlayoutStats();
+    
+    // Comfort noise while the peer is idle is not expected audio
+    quint32 framesExpected = static_cast<quint32>((stats.framesPlayed - stats.silentFrames) -
+                                                  (lastPlayoutStats.framesPlayed - lastPlayoutStats.silentFrames));
+    // Frames skipped for arriving after their playout time are as lost as the missing ones
+    quint32 framesLost = static_cast<quint32>((stats.underrunFrames + stats.lateFrames) -
+                                              (lastPlayoutStats.underrunFrames + lastPlayoutStats.lateFrames));
+    lastPlayoutStats = stats;
+    
+    QMetaObject::invokeMethod(networkManager, [this, framesExpected, framesLost]() {
+        networkManager->sendReceiverReport(framesExpected, framesLost);
+    }, Qt::QueuedConnection);
+}
+
+/**
+ * @brief Runs a function on the network thread and waits for it to return.
+ * @param function The function to run.
+ */
+void MainWindow::runOnNetworkThread(const std::function<void()> &function)
+{
+    QMetaObject::invokeMethod(networkManager, function, Qt::BlockingQueuedConnection);
+}
+
+/**
+ * @brief Reads a device channel map from the settings.
+ * @param countKey The key of the channel count.
+ * @param mapKey The key of the explicit channel map (takes precedence).
+ * @return The channel map.
+ */
+ChannelMap MainWindow::channelMapSetting(const QString &countKey, const QString &mapKey) const
+{
+    ChannelMap map = AudioFormat::parseChannelMap(settings->value(mapKey).toString());
+    if (map.isEmpty()) {
+        map = AudioFormat::defaultChannelMap(qBound(1, settings->value(countKey, 2).toInt(), MAX_CHANNELS));
+    }
+    return map;
+}
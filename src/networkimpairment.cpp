@@ -0,0 +1,311 @@
+#include "../include/networkimpairment.h"
+#include <QtCore/QStringList>
+#include <algorithm>
+
+/**
+ * @brief Parses a percentage.
+ * @param text The number.
+ * @param value The percentage (output).
+ * @return True if it is a number from 0 to 100, false otherwise.
+ */
+static bool parsePercent(const QString &text, double &value)
+{
+    bool ok = false;
+    value = text.toDouble(&ok);
+    return ok && value >= 0.0 && value <= 100.0;
+}
+
+/**
+ * @brief Parses a non-negative integer.
+ * @param text The number.
+ * @param value The integer (output).
+ * @return True if it is a non-negative integer, false otherwise.
+ */
+static bool parseCount(const QString &text, int &value)
+{
+    bool ok = false;
+    value = text.toInt(&ok);
+    return ok && value >= 0;
+}
+
+/**
+ * @brief Checks if the profile changes anything.
+ * @return True if any impairment is configured, false otherwise.
+ */
+bool ImpairmentProfile::isEnabled() const
+{
+    return lossPercent > 0.0 || burstEnterPercent > 0.0 || delayMs > 0 || jitterMs > 0 ||
+           reorderPercent > 0.0 || duplicatePercent > 0.0 || rateKbps > 0;
+}
+
+/**
+ * @brief Parses a profile such as "loss=1,burst=2:30,delay=40,jitter=10,rate=512,seed=7".
+ *
+ * Keys: loss, burst (enter:exit[:loss] in percent), delay, jitter,
+ * reorder, duplicate, rate (kbit/s), queue (ms) and seed.
+ *
+ * @param text The profile description.
+ * @param profile The parsed profile (output).
+ * @param errorMessage Receives the reason if the description is invalid (optional).
+ * @return True if the description was valid, false otherwise.
+ */
+bool ImpairmentProfile::parse(const QString &text, ImpairmentProfile &profile, QString *errorMessage)
+{
+    ImpairmentProfile parsed;
+    
+    const QStringList items = text.split(',', QString::SkipEmptyParts);
+    for (const QString &item : items) {
+        QString key = item.section('=', 0, 0).trimmed().toLower();
+        QString value = item.section('=', 1).trimmed();
+        bool valid = false;
+        
+        if (key == "loss") {
+            valid = parsePercent(value, parsed.lossPercent);
+        } else if (key == "burst") {
+            QStringList parts = value.split(':');
+            valid = (parts.size() == 2 || parts.size() == 3) &&
+                    parsePercent(parts.at(0), parsed.burstEnterPercent) &&
+                    parsePercent(parts.at(1), parsed.burstExitPercent) &&
+                    (parts.size() == 2 || parsePercent(parts.at(2), parsed.burstLossPercent));
+        } else if (key == "delay") {
+            valid = parseCount(value, parsed.delayMs);
+        } else if (key == "jitter") {
+            valid = parseCount(value, parsed.jitterMs);
+        } else if (key == "reorder") {
+            valid = parsePercent(value, parsed.reorderPercent);
+        } else if (key == "duplicate") {
+            valid = parsePercent(value, parsed.duplicatePercent);
+        } else if (key == "rate") {
+            valid = parseCount(value, parsed.rateKbps);
+        } else if (key == "queue") {
+            valid = parseCount(value, parsed.queueMs) && parsed.queueMs > 0;
+        } else if (key == "seed") {
+            parsed.seed = value.toUInt(&valid);
+        } else {
+            if (errorMessage) {
+                *errorMessage = QString("Unknown impairment \"%1\"").arg(key);
+            }
+            return false;
+        }
+        
+        if (!valid) {
+            if (errorMessage) {
+                *errorMessage = QString("Invalid value for %1: \"%2\"").arg(key, value);
+            }
+            return false;
+        }
+    }
+    
+    profile = parsed;
+    return true;
+}
+
+/**
+ * @brief Describes the profile in the syntax parse() accepts.
+ * @return The description.
+ */
+QString ImpairmentProfile::toString() const
+{
+    return QString("loss=%1,burst=%2:%3:%4,delay=%5,jitter=%6,reorder=%7,duplicate=%8,rate=%9,queue=%10,seed=%11")
+        .arg(lossPercent).arg(burstEnterPercent).arg(burstExitPercent).arg(burstLossPercent)
+        .arg(delayMs).arg(jitterMs).arg(reorderPercent).arg(duplicatePercent)
+        .arg(rateKbps).arg(queueMs).arg(seed);
+}
+
+/**
+ * @brief Constructor for NetworkImpairment.
+ * @param parent The parent object.
+ */
+NetworkImpairment::NetworkImpairment(QObject *parent)
+    : QObject(parent)
+    , releaseTimer(new QTimer(this))
+    , linkFreeUs(0)
+    , lastInOrderReleaseUs(0)
+    , burstState(false)
+{
+    // Precise, since the timer reproduces delay and jitter
+    releaseTimer->setSingleShot(true);
+    releaseTimer->setTimerType(Qt::PreciseTimer);
+    connect(releaseTimer, &QTimer::timeout, this, &NetworkImpairment::releasePackets);
+    
+    clock.start();
+}
+
+/**
+ * @brief Sets the impairments and starts over with the profile's seed.
+ * @param profile The network conditions.
+ */
+void NetworkImpairment::setProfile(const ImpairmentProfile &profile)
+{
+    this->profile = profile;
+    stats = ImpairmentStats();
+    reset();
+}
+
+/**
+ * @brief Gets the impairments.
+ * @return The network conditions.
+ */
+ImpairmentProfile NetworkImpairment::getProfile() const
+{
+    return profile;
+}
+
+/**
+ * @brief Checks if packets are impaired.
+ * @return True if a profile with impairments is set, false otherwise.
+ */
+bool NetworkImpairment::isEnabled() const
+{
+    return profile.isEnabled();
+}
+
+/**
+ * @brief Impairs a packet; it comes back through packetReleased() unless it is lost.
+ * @param packet The packet (copied).
+ */
+void NetworkImpairment::submit(const PacketView &packet)
+{
+    qint64 nowUs = clock.nsecsElapsed() / 1000;
+    bool media = packet.type == PACKET_TYPE_AUDIO || packet.type == PACKET_TYPE_AUDIO_BATCH ||
+                 packet.type == PACKET_TYPE_COMFORT_NOISE;
+    stats.packets++;
+    
+    // Gilbert-Elliott loss: decide with the current state, then move on
+    if (media) {
+        bool lost = chance(burstState ? profile.burstLossPercent : profile.lossPercent);
+        burstState = burstState ? !chance(profile.burstExitPercent) : chance(profile.burstEnterPercent);
+        if (lost) {
+            stats.lost++;
+            return;
+        }
+    }
+    
+    // Bottleneck: the packet leaves once the link has sent everything before it
+    qint64 departureUs = nowUs;
+    if (profile.rateKbps > 0) {
+        qint64 wireBytes = PacketFraming::HeaderSize + packet.size;
+        qint64 transmitUs = wireBytes * 8 * 1000 / profile.rateKbps;
+        qint64 startUs = qMax(nowUs, linkFreeUs);
+        if (media && startUs - nowUs > profile.queueMs * 1000LL) {
+            stats.queueDropped++;
+            return;
+        }
+        linkFreeUs = startUs + transmitUs;
+        departureUs = linkFreeUs;
+    }
+    
+    HeldPacket held;
+    held.type = packet.type;
+    held.stamp = packet.stamp;
+    held.payload = QByteArray(packet.data, packet.size);
+    
+    // A reordered packet skips the delay and overtakes the packets in flight;
+    // the others keep their order whatever their jitter
+    if (media && chance(profile.reorderPercent)) {
+        held.releaseUs = departureUs;
+        stats.reordered++;
+    } else {
+        qint64 jitterUs = 0;
+        if (profile.jitterMs > 0) {
+            std::uniform_int_distribution<qint64> distribution(-profile.jitterMs * 1000LL, profile.jitterMs * 1000LL);
+            jitterUs = distribution(random);
+        }
+        held.releaseUs = qMax(departureUs + qMax<qint64>(0, profile.delayMs * 1000LL + jitterUs),
+                              lastInOrderReleaseUs);
+        lastInOrderReleaseUs = held.releaseUs;
+    }
+    hold(held);
+    
+    if (media && chance(profile.duplicatePercent)) {
+        stats.duplicated++;
+        hold(held);
+    }
+    
+    scheduleRelease();
+}
+
+/**
+ * @brief Drops every held packet and restarts the bottleneck and the loss model.
+ */
+void NetworkImpairment::reset()
+{
+    releaseTimer->stop();
+    heldPackets.clear();
+    random.seed(profile.seed);
+    linkFreeUs = 0;
+    lastInOrderReleaseUs = 0;
+    burstState = false;
+}
+
+/**
+ * @brief Gets the counters since the profile was set.
+ * @return The statistics.
+ */
+ImpairmentStats NetworkImpairment::getStats() const
+{
+    return stats;
+}
+
+/**
+ * @brief Releases the held packets that are due.
+ */
+void NetworkImpairment::releasePackets()
+{
+    qint64 nowUs = clock.nsecsElapsed() / 1000;
+    
+    // Take each packet out before handing it over: a handler may reset()
+    while (!heldPackets.isEmpty() && heldPackets.first().releaseUs <= nowUs) {
+        HeldPacket held = heldPackets.takeFirst();
+        PacketView view;
+        view.type = held.type;
+        view.stamp = held.stamp;
+        view.data = held.payload.constData();
+        view.size = held.payload.size();
+        emit packetReleased(view);
+    }
+    
+    scheduleRelease();
+}
+
+/**
+ * @brief Draws a random decision.
+ * @param percent The probability in percent.
+ * @return True with the given probability.
+ */
+bool NetworkImpairment::chance(double percent)
+{
+    if (percent <= 0.0) {
+        return false;
+    }
+    std::uniform_real_distribution<double> distribution(0.0, 100.0);
+    return distribution(random) < percent;
+}
+
+/**
+ * @brief Queues a packet for release, keeping the hold queue sorted.
+ * @param packet The packet.
+ */
+void NetworkImpairment::hold(const HeldPacket &packet)
+{
+    // After the packets due at the same time, so equal times keep their order
+    auto position = std::upper_bound(heldPackets.constBegin(), heldPackets.constEnd(), packet.releaseUs,
+                                     [](qint64 releaseUs, const HeldPacket &held) {
+                                         return releaseUs < held.releaseUs;
+                                     });
+    heldPackets.insert(static_cast<int>(position - heldPackets.constBegin()), packet);
+}
+
+/**
+ * @brief Starts the release timer for the earliest held packet.
+ */
+void NetworkImpairment::scheduleRelease()
+{
+    if (heldPackets.isEmpty()) {
+        releaseTimer->stop();
+        return;
+    }
+    
+    qint64 waitUs = heldPackets.first().releaseUs - clock.nsecsElapsed() / 1000;
+    releaseTimer->start(static_cast<int>(qMax<qint64>(0, (waitUs + 999) / 1000)));
+}
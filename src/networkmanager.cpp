@@ -1,12 +1,60 @@
 #include "../include/networkmanager.h"
-#include <QtCore/QDateTime>
+#include "../include/sockettransport.h"
+#include "../include/uringtransport.h"
 #include <QtCore/QDebug>
-#include <QtCore/QDataStream>
+#include <QtCore/QRandomGenerator>
+#include <QtCore/QtEndian>
 
-// Packet types
-const char PACKET_TYPE_AUDIO = 'A';
-const char PACKET_TYPE_PING = 'P';
-const char PACKET_TYPE_PONG = 'O';
+#ifdef Q_OS_UNIX
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <unistd.h>
+#include <errno.h>
+#endif
+
+#ifdef Q_OS_LINUX
+#include <sys/ioctl.h>
+#endif
+
+// Initial capacity of the receive buffer
+const int RECEIVE_BUFFER_CAPACITY = 64 * 1024;
+
+// IP type of service used for audio traffic (DSCP EF)
+const int AUDIO_TYPE_OF_SERVICE = 0xB8;
+
+// Packets a fast replay dispatches per event loop iteration
+const int REPLAY_BATCH_SIZE = 256;
+
+// Reconnect backoff: the first retry comes quickly, later ones at most this far apart
+const int RECONNECT_INITIAL_DELAY_MS = 50;
+const int RECONNECT_MAX_DELAY_MS = 800;
+
+// Pings go out this often; the first few exchanges come quicker, so the clocks sync fast
+const int PING_INTERVAL_MS = 1000;
+const int FAST_PING_INTERVAL_MS = 100;
+const int FAST_PING_EXCHANGES = 8;
+
+// How often the send path's audio is collected while connected, where the
+// audio queue has no descriptor to wake the network thread
+const int AUDIO_POLL_INTERVAL_MS = 1;
+
+// A link that received nothing for this long is dead (both peers ping every second)
+const int LINK_TIMEOUT_MS = 2500;
+
+// How long the kernel send time of a ping is kept for its pong (a link that
+// stays quiet for longer is dropped anyway)
+const qint64 TIMESTAMP_EXPIRY_US = 2 * LINK_TIMEOUT_MS * 1000LL;
+
+// How long a pong waits for the follow-up with its kernel send time before
+// the exchange counts with the application times (the follow-up leaves the
+// peer right after the pong, so this only covers jitter between the two)
+const qint64 FOLLOW_UP_TIMEOUT_US = 50000;
+
+// How long the server keeps a session open for the client to come back
+const int SESSION_RESUME_TIMEOUT_MS = 10000;
 
 /**
  * @brief Constructor for NetworkManager.
@@ -16,22 +64,107 @@ NetworkManager::NetworkManager(QObject *parent)
     : QObject(parent)
     , server(new QTcpServer(this))
     , clientSocket(nullptr)
+    , transport(nullptr)
+    , impairment(new NetworkImpairment(this))
+    , relay(nullptr)
     , pingTimer(new QTimer(this))
     , sendQueueTimer(new QTimer(this))
+    , aggregationTimer(new QTimer(this))
+    , statsTimer(new QTimer(this))
+    , replayTimer(new QTimer(this))
+    , reconnectTimer(new QTimer(this))
+    , sessionTimer(new QTimer(this))
+    , audioPollTimer(new QTimer(this))
+    , audioNotifier(nullptr)
+    , resumeSocket(nullptr)
+    , pendingCaptureUs(0)
+    , sendQueueBytes(0)
+    , pendingFrameBytes(0)
+    , droppedPackets(0)
+    , droppedBytes(0)
+    , maxQueueDelayMs(150)
+    , dropPolicy(DropPolicy::DropOldest)
+    , transportBackend(TransportBackend::Qt)
+    , kernelTimestamps(false)
+    , replayedPackets(0)
+    , replayRecordPending(false)
+    , replayRealtime(true)
+    , receiveTimeUs(0)
+    , receiveTimestampUs(0)
+    , sendSequence(0)
+    , sendCodecId(PACKET_CODEC_RAW)
+    , framesPerPacket(1)
+    , negotiatedFramesPerPacket(1)
+    , maxAggregationDelayMs(5)
     , currentLatency(0)
+    , serverPort(0)
+    , sessionToken(0)
+    , reconnectAttempts(0)
+    , autoReconnect(true)
+    , sessionEstablished(false)
+    , disconnectPending(false)
     , isServer(false)
     , connected(false)
 {
     // Set up ping timer
-    pingTimer->setInterval(1000); // Send ping every second
+    pingTimer->setInterval(PING_INTERVAL_MS);
     connect(pingTimer, &QTimer::timeout, this, &NetworkManager::sendPing);
     
-    // Set up send queue timer
-    sendQueueTimer->setInterval(10); // Process send queue every 10ms
+    // Set up send queue timer. It fires once the event loop has delivered every
+    // frame queued since the last wakeup, so the whole batch goes out together.
+    sendQueueTimer->setSingleShot(true);
+    sendQueueTimer->setInterval(0);
     connect(sendQueueTimer, &QTimer::timeout, this, &NetworkManager::processSendQueue);
     
+    // Set up aggregation timer (caps the latency added by frame aggregation)
+    aggregationTimer->setSingleShot(true);
+    aggregationTimer->setInterval(maxAggregationDelayMs);
+    connect(aggregationTimer, &QTimer::timeout, this, &NetworkManager::flushPendingFrames);
+    
+    // Set up the audio poll timer, for platforms without a queue descriptor
+    // (precise, it runs a buffer period at most)
+    audioPollTimer->setTimerType(Qt::PreciseTimer);
+    audioPollTimer->setInterval(AUDIO_POLL_INTERVAL_MS);
+    connect(audioPollTimer, &QTimer::timeout, this, &NetworkManager::readyForAudio);
+    
+    // Set up statistics timer
+    statsTimer->setInterval(100);
+    connect(statsTimer, &QTimer::timeout, this, &NetworkManager::updateStatistics);
+    
+    // Set up replay timer (precise, since it reproduces packet arrival times)
+    replayTimer->setSingleShot(true);
+    replayTimer->setTimerType(Qt::PreciseTimer);
+    connect(replayTimer, &QTimer::timeout, this, &NetworkManager::replayPackets);
+    
+    // Impaired packets reach the handlers when the simulator releases them,
+    // which is when they arrive as far as the clock exchange is concerned
+    connect(impairment, &NetworkImpairment::packetReleased, this, [this](const PacketView &packet) {
+        LoadMeter::Scope load(loadMeter);
+        receiveTimeUs = ClockSync::now();
+        receiveTimestampUs = 0;
+        dispatchPacket(packet);
+    });
+    
+    // Set up reconnect and session timers
+    reconnectTimer->setSingleShot(true);
+    connect(reconnectTimer, &QTimer::timeout, this, &NetworkManager::reconnect);
+    sessionTimer->setSingleShot(true);
+    sessionTimer->setInterval(SESSION_RESUME_TIMEOUT_MS);
+    connect(sessionTimer, &QTimer::timeout, this, &NetworkManager::endSession);
+    
+    // Queued packets are timestamped against this clock
+    queueClock.start();
+    
+    // Packets are parsed in place, so keep the receive buffer allocated
+    receiveBuffer.reserve(RECEIVE_BUFFER_CAPACITY);
+    
     // Connect server signals
     connect(server, &QTcpServer::newConnection, this, &NetworkManager::handleNewConnection);
+    
+    // The handshake result, the clock estimate and the latency are handled on other threads
+    qRegisterMetaType<NegotiatedSession>();
+    qRegisterMetaType<ClockEstimate>();
+    qRegisterMetaType<LatencyStats>();
 }
 
 /**
@@ -40,6 +173,7 @@ NetworkManager::NetworkManager(QObject *parent)
 NetworkManager::~NetworkManager()
 {
     disconnect();
+    stopCapture();
 }
 
 /**
@@ -75,30 +209,139 @@ bool NetworkManager::connectToServer(const QString &address, int port)
     // Stop any existing connections
     disconnect();
     
+    // A new session; reconnects present its token so the server resumes it
+    serverAddress = address;
+    serverPort = port;
+    do {
+        sessionToken = QRandomGenerator::global()->generate64();
+    } while (sessionToken == 0);
+    reconnectAttempts = 0;
+    isServer = false;
+    
+    openConnection();
+    emit connectionStatusChanged(false, tr("Connecting to %1:%2...").arg(address).arg(port));
+    
+    return true;
+}
+
+/**
+ * @brief Starts a relay: accepts a sender and passes its stream on to downstream receivers.
+ * @param port The port to listen on for the sender.
+ * @param downstreams The downstream receivers as "host:port".
+ * @return True if the relay started, false otherwise.
+ */
+bool NetworkManager::startRelay(int port, const QStringList &downstreams)
+{
+    // Check every address before opening anything
+    QList<QPair<QString, int>> targets;
+    for (const QString &downstream : downstreams) {
+        int separator = downstream.lastIndexOf(':');
+        bool ok = false;
+        int downstreamPort = separator > 0 ? downstream.mid(separator + 1).toInt(&ok) : 0;
+        if (!ok || downstreamPort <= 0 || downstreamPort > 65535) {
+            emit error(tr("Invalid downstream \"%1\", expected host:port").arg(downstream));
+            return false;
+        }
+        targets.append(qMakePair(downstream.left(separator), downstreamPort));
+    }
+    if (targets.isEmpty()) {
+        emit error(tr("A relay needs at least one downstream"));
+        return false;
+    }
+    
+    if (!startServer(port)) {
+        return false;
+    }
+    
+    relay = new RelayForwarder(this);
+    connect(relay, &RelayForwarder::error, this, &NetworkManager::error);
+    connect(this, &NetworkManager::clockEstimateChanged, relay, &RelayForwarder::setUpstreamClock);
+    connect(this, &NetworkManager::sessionEnded, relay, &RelayForwarder::resetStream);
+    
+    // The sender adapts its stream to the layout we announce, so announce a
+    // receiver's (they are expected to share one)
+    connect(relay, &RelayForwarder::downstreamFormatReceived, this, [this](const QByteArray &payload) {
+        ChannelMap inputMap;
+        ChannelMap outputMap;
+        if (!decodeFormat(payload, inputMap, outputMap) ||
+            !AudioFormat::isValidChannelMap(inputMap) || !AudioFormat::isValidChannelMap(outputMap)) {
+            qDebug() << "Ignoring an unsupported downstream format";
+            return;
+        }
+        if (inputMap != localInputMap || outputMap != localOutputMap) {
+            setLocalFormat(inputMap, outputMap);
+        }
+    });
+    
+    for (const auto &target : targets) {
+        relay->addDownstream(target.first, target.second);
+    }
+    
+    emit connectionStatusChanged(false, tr("Relaying port %1 to %2 downstreams...").arg(port).arg(targets.size()));
+    return true;
+}
+
+/**
+ * @brief Checks if this manager relays a stream instead of playing it.
+ * @return True if relaying, false otherwise.
+ */
+bool NetworkManager::isRelaying() const
+{
+    return relay != nullptr;
+}
+
+/**
+ * @brief Gets the relay counters.
+ * @return The statistics of the relay, all zero if not relaying.
+ */
+RelayStats NetworkManager::getRelayStats() const
+{
+    return relay ? relay->getStats() : RelayStats();
+}
+
+/**
+ * @brief Starts a connection attempt to the server.
+ */
+void NetworkManager::openConnection()
+{
     // Create new socket
     clientSocket = new QTcpSocket(this);
     
     // Connect socket signals
-    connect(clientSocket, &QTcpSocket::connected, [this]() {
+    connect(clientSocket, &QTcpSocket::connected, this, [this]() {
+        configureSocket();
+        startTransport();
         connected = true;
-        emit connectionStatusChanged(true, tr("Connected to server"));
-        pingTimer->start();
-        sendQueueTimer->start();
+        receiveClock.start();
+        
+        // The session goes first, so the server knows whether to resume
+        sendSession();
+        sendHello();
+        sendFormat();
+        emit connectionStatusChanged(true, reconnectAttempts > 0 ? tr("Reconnected to server")
+                                                                 : tr("Connected to server"));
+        reconnectAttempts = 0;
+        sessionEstablished = true;
+        pingTimer->start(FAST_PING_INTERVAL_MS);
+        statsTimer->start();
+        if (!audioNotifier) {
+            audioPollTimer->start();
+        }
     });
     
-    connect(clientSocket, &QTcpSocket::disconnected, this, &NetworkManager::handleDisconnect);
-    connect(clientSocket, QOverload<QAbstractSocket::SocketError>::of(&QTcpSocket::error),
-            this, &NetworkManager::handleSocketError);
-    connect(clientSocket, &QTcpSocket::stateChanged, this, &NetworkManager::handleSocketStateChange);
-    connect(clientSocket, &QTcpSocket::readyRead, this, &NetworkManager::readData);
+    connectSocketSignals();
     
     // Connect to server
-    clientSocket->connectToHost(address, port);
-    
-    isServer = false;
-    emit connectionStatusChanged(false, tr("Connecting to %1:%2...").arg(address).arg(port));
-    
-    return true;
+    clientSocket->connectToHost(serverAddress, serverPort);
+}
+
+/**
+ * @brief Enables or disables reconnecting automatically after the link drops.
+ * @param enabled Whether to reconnect automatically.
+ */
+void NetworkManager::setAutoReconnect(bool enabled)
+{
+    autoReconnect = enabled;
 }
 
 /**
@@ -106,53 +349,142 @@ bool NetworkManager::connectToServer(const QString &address, int port)
  */
 void NetworkManager::disconnect()
 {
+    // Closing the socket must not look like a dropped link
+    connected = false;
+    sessionEstablished = false;
+    disconnectPending = false;
+    
     // Stop timers
     pingTimer->stop();
     sendQueueTimer->stop();
+    aggregationTimer->stop();
+    statsTimer->stop();
+    reconnectTimer->stop();
+    audioPollTimer->stop();
+    stopReplay();
+    
+    if (impairment->isEnabled()) {
+        ImpairmentStats stats = impairment->getStats();
+        qDebug() << "Impairment:" << stats.packets << "packets," << stats.lost << "lost,"
+                 << stats.queueDropped << "dropped at the bottleneck," << stats.duplicated << "duplicated,"
+                 << stats.reordered << "reordered";
+    }
+    impairment->reset();
+    
+    // We may be called from one of the relay's signals
+    if (relay) {
+        QObject::disconnect(relay, nullptr, this, nullptr);
+        QObject::disconnect(this, nullptr, relay, nullptr);
+        relay->deleteLater();
+        relay = nullptr;
+    }
+    
+    if (resumeSocket) {
+        resumeSocket->abort();
+        resumeSocket->deleteLater();
+        resumeSocket = nullptr;
+    }
     
-    // Clear send queue
+    // Clear send queue, pending frames and the drop counters
     QMutexLocker locker(&sendQueueMutex);
     sendQueue.clear();
+    sendQueueBytes = 0;
+    pendingFrames.clear();
+    pendingFrameBytes = 0;
+    droppedPackets = 0;
+    droppedBytes = 0;
+    sendSequence = 0;
+    negotiatedFramesPerPacket = 1;
+    receiveBuffer.resize(0); // keeps the reserved capacity
+    closeTransport();
+    locker.unlock();
     
+    // Our handlers must not see the socket close: disconnectFromHost() emits
+    // disconnected() right away when nothing is left to write
+    if (clientSocket) {
+        QObject::disconnect(clientSocket, nullptr, this, nullptr);
+        clientSocket->disconnectFromHost();
+        clientSocket->deleteLater();
+        clientSocket = nullptr;
+    }
+    
+    // Stop server
     if (isServer) {
-        // Stop server
-        if (clientSocket) {
-            clientSocket->disconnectFromHost();
-            clientSocket->deleteLater();
-            clientSocket = nullptr;
-        }
-        
         server->close();
-    } else {
-        // Disconnect from server
-        if (clientSocket) {
-            clientSocket->disconnectFromHost();
-            clientSocket->deleteLater();
-            clientSocket = nullptr;
-        }
     }
     
-    connected = false;
     emit connectionStatusChanged(false, tr("Disconnected"));
+    endSession();
 }
 
 /**
  * @brief Sends audio data to the connected peer.
  * @param data The audio data to send.
+ * @param captureTimeUs When the first frame was captured, on the ClockSync::now() clock
+ *                      (0 for the send time).
  * @return True if data was queued for sending, false otherwise.
  */
-bool NetworkManager::sendAudioData(const QByteArray &data)
+bool NetworkManager::sendAudioData(const QByteArray &data, qint64 captureTimeUs)
+{
+    if (!connected || !clientSocket) {
+        return false;
+    }
+    
+    LoadMeter::Scope load(loadMeter);
+    QMutexLocker locker(&sendQueueMutex);
+    
+    // The peer plays larger buffers than ours, so packing as many frames costs it nothing
+    int frames = qMax(framesPerPacket, negotiatedFramesPerPacket);
+    
+    if (frames <= 1) {
+        // No aggregation, queue the frame as its own packet
+        enqueuePacket(PacketFraming::frame(PACKET_TYPE_AUDIO, data, mediaStamp(captureTimeUs)));
+    } else {
+        // Add the frame to the pending aggregate (shared, not copied); the
+        // aggregate is stamped with the capture time of its first frame
+        if (pendingFrames.isEmpty()) {
+            pendingCaptureUs = captureTimeUs;
+        }
+        pendingFrames.append(data);
+        pendingFrameBytes += data.size();
+        
+        if (pendingFrames.size() >= frames) {
+            locker.unlock();
+            flushPendingFrames();
+            return true;
+        }
+        
+        // Start the latency cap with the first frame of the aggregate
+        if (pendingFrames.size() == 1) {
+            aggregationTimer->start();
+        }
+    }
+    
+    return true;
+}
+
+/**
+ * @brief Tells the peer that the input is silent (instead of sending audio).
+ * @param noiseLevel The RMS level of the background noise.
+ * @return True if the update was queued for sending, false otherwise.
+ */
+bool NetworkManager::sendComfortNoise(float noiseLevel)
 {
     if (!connected || !clientSocket) {
         return false;
     }
     
-    // Create audio packet
-    QByteArray packet = createPacket(PACKET_TYPE_AUDIO, data);
+    // Audio still waiting for aggregation must go out first
+    flushPendingFrames();
+    
+    // The level as the bits of an IEEE float in network byte order
+    quint32 levelBits;
+    memcpy(&levelBits, &noiseLevel, sizeof(levelBits));
+    QByteArray payload(sizeof(levelBits), '\0');
+    qToBigEndian<quint32>(levelBits, payload.data());
     
-    // Add to send queue
     QMutexLocker locker(&sendQueueMutex);
-    sendQueue.enqueue(packet);
+    enqueuePacket(PacketFraming::frame(PACKET_TYPE_COMFORT_NOISE, payload, mediaStamp()));
     
     return true;
 }
@@ -166,6 +498,15 @@ int NetworkManager::getLatency() const
     return currentLatency;
 }
 
+/**
+ * @brief Gets the breakdown of the last measured round trip.
+ * @return The latency statistics.
+ */
+LatencyStats NetworkManager::getLatencyStats() const
+{
+    return latencyStats;
+}
+
 /**
  * @brief Checks if connected to a peer.
  * @return True if connected, false otherwise.
@@ -176,282 +517,1756 @@ bool NetworkManager::isConnected() const
 }
 
 /**
- * @brief Handles a new incoming connection.
+ * @brief Sets how many audio frames are aggregated into one packet.
+ * @param frames The number of frames per packet (1 disables aggregation).
  */
-void NetworkManager::handleNewConnection()
+void NetworkManager::setFramesPerPacket(int frames)
 {
-    // Accept only one connection
-    if (clientSocket) {
-        QTcpSocket *socket = server->nextPendingConnection();
-        socket->disconnectFromHost();
-        socket->deleteLater();
+    frames = qMax(1, frames);
+    if (frames == framesPerPacket) {
         return;
     }
     
-    // Get the client socket
-    clientSocket = server->nextPendingConnection();
-    
-    // Connect socket signals
-    connect(clientSocket, &QTcpSocket::disconnected, this, &NetworkManager::handleDisconnect);
-    connect(clientSocket, QOverload<QAbstractSocket::SocketError>::of(&QTcpSocket::error),
-            this, &NetworkManager::handleSocketError);
-    connect(clientSocket, &QTcpSocket::stateChanged, this, &NetworkManager::handleSocketStateChange);
-    connect(clientSocket, &QTcpSocket::readyRead, this, &NetworkManager::readData);
-    
-    // Update status
-    connected = true;
-    emit connectionStatusChanged(true, tr("Client connected from %1").arg(clientSocket->peerAddress().toString()));
-    
-    // Start timers
-    pingTimer->start();
-    sendQueueTimer->start();
+    // Don't hold frames back under the old setting
+    flushPendingFrames();
+    framesPerPacket = frames;
 }
 
 /**
- * @brief Handles socket disconnection.
+ * @brief Gets the number of audio frames aggregated into one packet.
+ * @return The number of frames per packet.
  */
-void NetworkManager::handleDisconnect()
+int NetworkManager::getFramesPerPacket() const
 {
-    // Stop timers
-    pingTimer->stop();
-    sendQueueTimer->stop();
-    
-    // Clean up
-    if (clientSocket) {
-        clientSocket->deleteLater();
-        clientSocket = nullptr;
-    }
-    
-    // Update status
-    connected = false;
-    emit connectionStatusChanged(false, isServer ? tr("Client disconnected") : tr("Disconnected from server"));
-    
-    // Clear send queue
-    QMutexLocker locker(&sendQueueMutex);
-    sendQueue.clear();
+    return framesPerPacket;
 }
 
 /**
- * @brief Handles socket errors.
- * @param socketError The socket error.
+ * @brief Sets the maximum time a frame may wait for aggregation.
+ * @param delayMs The latency cap in milliseconds.
  */
-void NetworkManager::handleSocketError(QAbstractSocket::SocketError socketError)
+void NetworkManager::setMaxAggregationDelay(int delayMs)
 {
-    if (!clientSocket) {
-        return;
-    }
-    
-    emit error(tr("Network error: %1").arg(clientSocket->errorString()));
-    
-    // Disconnect on error
-    if (connected) {
-        handleDisconnect();
-    }
+    maxAggregationDelayMs = qMax(0, delayMs);
+    aggregationTimer->setInterval(maxAggregationDelayMs);
 }
 
 /**
- * @brief Handles socket state changes.
- * @param state The new socket state.
+ * @brief Gets the maximum time a frame may wait for aggregation.
+ * @return The latency cap in milliseconds.
  */
-void NetworkManager::handleSocketStateChange(QAbstractSocket::SocketState state)
+int NetworkManager::getMaxAggregationDelay() const
 {
-    if (!clientSocket) {
-        return;
-    }
-    
-    switch (state) {
-        case QAbstractSocket::ConnectingState:
-            emit connectionStatusChanged(false, tr("Connecting..."));
-            break;
-        case QAbstractSocket::ConnectedState:
-            emit connectionStatusChanged(true, tr("Connected"));
-            break;
-        case QAbstractSocket::ClosingState:
-            emit connectionStatusChanged(false, tr("Disconnecting..."));
-            break;
-        case QAbstractSocket::UnconnectedState:
-            if (connected) {
-                handleDisconnect();
-            }
-            break;
-        default:
-            break;
-    }
+    return maxAggregationDelayMs;
 }
 
 /**
- * @brief Reads data from the socket.
+ * @brief Sets how long audio may wait in the send queue before it is dropped.
+ * @param delayMs The maximum queueing delay in milliseconds.
+ * @param policy What to drop once queued audio is older than that.
  */
-void NetworkManager::readData()
+void NetworkManager::setSendQueueLimit(int delayMs, DropPolicy policy)
 {
-    if (!clientSocket) {
-        return;
-    }
-    
-    // Read all available data
-    QByteArray data = clientSocket->readAll();
-    
-    // Process data
-    char type;
-    QByteArray payload;
-    
-    if (parsePacket(data, type, payload)) {
-        switch (type) {
-            case PACKET_TYPE_AUDIO:
-                handleAudioPacket(payload);
-                break;
-            case PACKET_TYPE_PING:
-                handlePingPacket(payload);
-                break;
-            case PACKET_TYPE_PONG:
-                handlePongPacket(payload);
-                break;
-            default:
-                qDebug() << "Unknown packet type:" << type;
-                break;
-        }
-    }
+    QMutexLocker locker(&sendQueueMutex);
+    maxQueueDelayMs = qMax(1, delayMs);
+    dropPolicy = policy;
 }
 
 /**
- * @brief Sends a ping to measure latency.
+ * @brief Sets the transport used by the next connection.
+ * @param backend The transport backend.
  */
-void NetworkManager::sendPing()
+void NetworkManager::setTransportBackend(TransportBackend backend)
 {
-    if (!connected || !clientSocket) {
-        return;
-    }
-    
-    // Create ping packet with current timestamp
-    QByteArray payload;
-    QDataStream stream(&payload, QIODevice::WriteOnly);
-    stream << QDateTime::currentMSecsSinceEpoch();
-    
-    // Send ping packet
-    QByteArray packet = createPacket(PACKET_TYPE_PING, payload);
-    clientSocket->write(packet);
-    
-    // Start latency timer
-    latencyTimer.restart();
+    transportBackend = backend;
 }
 
 /**
- * @brief Processes the send queue.
+ * @brief Checks if the current connection runs on the io_uring transport.
+ * @return True if it does, false otherwise.
  */
-void NetworkManager::processSendQueue()
+bool NetworkManager::isUsingUring() const
 {
-    if (!connected || !clientSocket) {
-        return;
-    }
-    
-    // Process up to 10 packets at a time
-    QMutexLocker locker(&sendQueueMutex);
-    int count = qMin(10, sendQueue.size());
-    
-    for (int i = 0; i < count; i++) {
-        if (sendQueue.isEmpty()) {
-            break;
-        }
-        
-        QByteArray packet = sendQueue.dequeue();
-        clientSocket->write(packet);
-    }
+    return qobject_cast<UringTransport *>(transport) != nullptr;
 }
 
 /**
- * @brief Handles a ping packet.
- * @param data The ping packet data.
+ * @brief Sets whether the next connection measures its latency with kernel timestamps.
+ * @param enabled True to use kernel timestamps, false otherwise.
  */
-void NetworkManager::handlePingPacket(const QByteArray &data)
+void NetworkManager::setKernelTimestamps(bool enabled)
 {
-    // Send pong packet with the same data
-    QByteArray packet = createPacket(PACKET_TYPE_PONG, data);
-    clientSocket->write(packet);
+    kernelTimestamps = enabled;
 }
 
 /**
- * @brief Handles a pong packet.
- * @param data The pong packet data.
+ * @brief Checks if the current connection has kernel timestamps.
+ * @return True if it does, false otherwise.
  */
-void NetworkManager::handlePongPacket(const QByteArray &data)
+bool NetworkManager::isUsingKernelTimestamps() const
 {
-    // Extract timestamp
-    QDataStream stream(data);
-    qint64 timestamp;
-    stream >> timestamp;
-    
-    // Calculate latency
-    qint64 now = QDateTime::currentMSecsSinceEpoch();
-    int latency = static_cast<int>(now - timestamp);
-    
-    // Update latency
-    if (latency > 0) {
-        currentLatency = latency;
-        emit latencyChanged(currentLatency);
-    }
+    return qobject_cast<SocketTransport *>(transport) != nullptr;
 }
 
 /**
- * @brief Handles an audio packet.
- * @param data The audio packet data.
+ * @brief Emits readyForAudio() whenever a descriptor turns readable.
+ * @param descriptor The descriptor to watch, -1 to poll.
  */
-void NetworkManager::handleAudioPacket(const QByteArray &data)
+void NetworkManager::watchAudioQueue(int descriptor)
 {
-    // Emit audio data received signal
-    emit audioDataReceived(data);
+    delete audioNotifier;
+    audioNotifier = nullptr;
+    if (descriptor < 0) {
+        if (connected) {
+            audioPollTimer->start();
+        }
+        return;
+    }
+    
+    audioPollTimer->stop();
+    audioNotifier = new QSocketNotifier(descriptor, QSocketNotifier::Read, this);
+    connect(audioNotifier, &QSocketNotifier::activated, this, &NetworkManager::readyForAudio);
 }
 
 /**
- * @brief Creates a packet with the specified type and data.
- * @param type The packet type.
- * @param data The packet data.
- * @return The complete packet.
+ * @brief Impairs received packets like a bad network would (for soak tests).
+ *
+ * Applies to the live connection and to replayed captures; the simulator
+ * starts over with the profile's seed whenever a connection ends.
+ *
+ * @param profile The network conditions (a profile without impairments disables it).
  */
-QByteArray NetworkManager::createPacket(char type, const QByteArray &data) const
+void NetworkManager::setImpairment(const ImpairmentProfile &profile)
 {
-    QByteArray packet;
-    
-    // Add packet type
-    packet.append(type);
-    
-    // Add data size (4 bytes)
-    quint32 size = data.size();
-    packet.append(reinterpret_cast<const char*>(&size), sizeof(size));
-    
-    // Add data
-    packet.append(data);
+    impairment->setProfile(profile);
+    if (profile.isEnabled()) {
+        qDebug() << "Impairing received packets:" << profile.toString();
+    }
+}
+
+/**
+ * @brief Gets the counters of the impairment simulator.
+ * @return The statistics since the impairment was set.
+ */
+ImpairmentStats NetworkManager::getImpairmentStats() const
+{
+    return impairment->getStats();
+}
+
+/**
+ * @brief Gets the send queue counters.
+ * @return The send queue statistics since startServer() or connectToServer().
+ */
+SendQueueStats NetworkManager::getSendQueueStats() const
+{
+    QMutexLocker locker(&sendQueueMutex);
+    
+    SendQueueStats stats;
+    stats.queuedPackets = sendQueue.size();
+    stats.queuedBytes = sendQueueBytes;
+    stats.queueDelayMs = sendQueue.isEmpty() ? 0
+                         : static_cast<int>(queueClock.elapsed() - sendQueue.head().queuedAtMs);
+    stats.droppedPackets = droppedPackets;
+    stats.droppedBytes = droppedBytes;
+    return stats;
+}
+
+/**
+ * @brief Gets the time spent receiving, dispatching and sending packets.
+ * @return The time in nanoseconds since construction (compare two reads for a load).
+ */
+qint64 NetworkManager::getBusyTime() const
+{
+    return loadMeter.getBusyTime();
+}
+
+/**
+ * @brief Gets the memory held by the receive buffer and the packets waiting to be sent.
+ * @return The size in bytes (approximate).
+ */
+qint64 NetworkManager::getBufferMemory() const
+{
+    // The receive buffer belongs to the network thread; its reserve is what it normally holds
+    QMutexLocker locker(&sendQueueMutex);
+    return RECEIVE_BUFFER_CAPACITY + sendQueueBytes + pendingFrameBytes;
+}
+
+/**
+ * @brief Sets the local device layouts announced to the peer.
+ * @param inputMap The channel map of the input device.
+ * @param outputMap The channel map of the output device.
+ */
+void NetworkManager::setLocalFormat(const ChannelMap &inputMap, const ChannelMap &outputMap)
+{
+    localInputMap = inputMap;
+    localOutputMap = outputMap;
+    
+    if (connected) {
+        sendFormat();
+    }
+}
+
+/**
+ * @brief Sets the capabilities announced to the peer in the handshake.
+ * @param capabilities The local capabilities.
+ */
+void NetworkManager::setLocalCapabilities(const SessionCapabilities &capabilities)
+{
+    localCapabilities = capabilities;
+    
+    QMutexLocker locker(&sendQueueMutex);
+    sendCodecId = SessionHandshake::codecId(capabilities.preferredMode);
+}
+
+/**
+ * @brief Gets the number of bytes waiting to be sent.
+ * @return The send backlog in bytes.
+ */
+qint64 NetworkManager::getSendBacklog() const
+{
+    qint64 backlog;
+    {
+        QMutexLocker locker(&sendQueueMutex);
+        backlog = sendQueueBytes + pendingFrameBytes;
+    }
+    
+    if (!clientSocket) {
+        return backlog;
+    }
     
-    return packet;
+    backlog += transport ? transport->bytesToWrite() : clientSocket->bytesToWrite();
+
+#ifdef Q_OS_LINUX
+    // Bytes the kernel has not yet had acknowledged
+    int fd = transport ? transport->socketDescriptor() : static_cast<int>(clientSocket->socketDescriptor());
+    int kernelQueued = 0;
+    if (::ioctl(fd, TIOCOUTQ, &kernelQueued) == 0) {
+        backlog += kernelQueued;
+    }
+#endif
+    
+    return backlog;
+}
+
+/**
+ * @brief Starts logging every received packet to a capture file.
+ * @param filePath The path of the capture file to create.
+ * @return True if the capture file was created, false otherwise.
+ */
+bool NetworkManager::startCapture(const QString &filePath)
+{
+    QString errorMessage;
+    if (!captureWriter.open(filePath, &errorMessage)) {
+        emit error(tr("Failed to create capture file %1: %2").arg(filePath).arg(errorMessage));
+        return false;
+    }
+    
+    return true;
+}
+
+/**
+ * @brief Stops logging received packets and closes the capture file.
+ */
+void NetworkManager::stopCapture()
+{
+    captureWriter.close();
 }
 
 /**
- * @brief Parses a packet.
- * @param packet The packet to parse.
- * @param type The packet type (output).
- * @param data The packet data (output).
- * @return True if parsing was successful, false otherwise.
+ * @brief Feeds a capture file through the receive pipeline instead of a peer.
+ *
+ * Packets are dispatched at their recorded arrival times, or back to back
+ * (a batch per event loop iteration) when realtime is false. Ping and pong
+ * packets belong to the recorded connection and are skipped. Call
+ * disconnect() to abort the replay.
+ *
+ * @param filePath The path of the capture file.
+ * @param realtime Whether to reproduce the recorded timing.
+ * @return True if the replay started, false otherwise.
  */
-bool NetworkManager::parsePacket(const QByteArray &packet, char &type, QByteArray &data) const
+bool NetworkManager::startReplay(const QString &filePath, bool realtime)
 {
-    // Check minimum packet size
-    if (packet.size() < 5) {
+    if (clientSocket || server->isListening()) {
+        emit error(tr("Cannot replay while connected."));
+        return false;
+    }
+    
+    QString errorMessage;
+    if (!captureReader.open(filePath, &errorMessage)) {
+        emit error(tr("Failed to open capture file %1: %2").arg(filePath).arg(errorMessage));
         return false;
     }
     
-    // Extract packet type
-    type = packet.at(0);
+    replayRealtime = realtime;
+    replayRecordPending = false;
+    replayedPackets = 0;
+    replayClock.start();
+    replayTimer->start(0);
+    
+    emit connectionStatusChanged(true, tr("Replaying %1").arg(filePath));
+    
+    return true;
+}
+
+/**
+ * @brief Checks if a capture file is being replayed.
+ * @return True if replaying, false otherwise.
+ */
+bool NetworkManager::isReplaying() const
+{
+    return captureReader.isOpen();
+}
+
+/**
+ * @brief Gets the estimated relation between the peer's clock and ours.
+ * @return The estimate; not synchronized until a few exchanges were made.
+ */
+ClockEstimate NetworkManager::getClockEstimate() const
+{
+    return clockSync.getEstimate();
+}
+
+/**
+ * @brief Sends a playout loss report to the peer.
+ * @param framesExpected The number of frames the output device requested.
+ * @param framesLost The number of those frames that had no audio.
+ */
+void NetworkManager::sendReceiverReport(quint32 framesExpected, quint32 framesLost)
+{
+    if (!connected || !clientSocket) {
+        return;
+    }
     
-    // Extract data size
-    quint32 size;
-    memcpy(&size, packet.constData() + 1, sizeof(size));
+    QByteArray payload(2 * sizeof(quint32), '\0');
+    qToBigEndian<quint32>(framesExpected, payload.data());
+    qToBigEndian<quint32>(framesLost, payload.data() + sizeof(quint32));
     
-    // Check packet size
-    if (packet.size() < static_cast<int>(5 + size)) {
+    writePackets(QList<OutgoingPacket>() << PacketFraming::frame(PACKET_TYPE_REPORT, payload, controlStamp()));
+}
+
+/**
+ * @brief Announces the format of the audio we send from now on.
+ * @param mode The transmission mode of the stream.
+ * @param bitrate The bitrate of the stream in bits per second.
+ * @return True if the announcement was queued for sending, false otherwise.
+ */
+bool NetworkManager::sendCodec(TransmissionMode mode, int bitrate)
+{
+    if (!connected || !clientSocket) {
         return false;
     }
     
-    // Extract data
-    data = packet.mid(5, size);
+    // Audio in the old format still waiting for aggregation must go out first
+    flushPendingFrames();
+    
+    QByteArray payload(1 + sizeof(qint32), '\0');
+    payload[0] = static_cast<char>(mode);
+    qToBigEndian<qint32>(bitrate, payload.data() + 1);
+    
+    // Queued in order with the audio, so it takes a sequence number like audio;
+    // the audio behind it is stamped with the new codec
+    QMutexLocker locker(&sendQueueMutex);
+    enqueuePacket(PacketFraming::frame(PACKET_TYPE_CODEC, payload, mediaStamp()));
+    sendCodecId = SessionHandshake::codecId(mode);
     
     return true;
 }
+
+/**
+ * @brief Handles a new incoming connection.
+ */
+void NetworkManager::handleNewConnection()
+{
+    QTcpSocket *socket = server->nextPendingConnection();
+    
+    // Accept only one connection. While we have one, a second may still be our
+    // client coming back before we noticed that its old connection died; it
+    // takes over if it presents the session token.
+    if (clientSocket) {
+        if (resumeSocket || sessionToken == 0) {
+            socket->disconnectFromHost();
+            socket->deleteLater();
+            return;
+        }
+        
+        resumeSocket = socket;
+        connect(resumeSocket, &QTcpSocket::readyRead, this, &NetworkManager::readResumeRequest);
+        connect(resumeSocket, &QTcpSocket::disconnected, [this, socket]() {
+            if (resumeSocket == socket) {
+                resumeSocket->deleteLater();
+                resumeSocket = nullptr;
+            }
+        });
+        return;
+    }
+    
+    acceptClient(socket, tr("Client connected from %1").arg(socket->peerAddress().toString()));
+}
+
+/**
+ * @brief Makes a connected socket the client socket (server side).
+ * @param socket The connected socket.
+ * @param message The connection status message.
+ */
+void NetworkManager::acceptClient(QTcpSocket *socket, const QString &message)
+{
+    clientSocket = socket;
+    
+    // Connect socket signals
+    connectSocketSignals();
+    configureSocket();
+    startTransport();
+    
+    // Update status. The session continues until the client's session packet
+    // says otherwise.
+    connected = true;
+    receiveClock.start();
+    sessionTimer->stop();
+    
+    // A relay answers the sender's hello with the sender's own settings
+    if (!relay) {
+        sendHello();
+    }
+    sendFormat();
+    emit connectionStatusChanged(true, message);
+    
+    // Start timers
+    pingTimer->start(FAST_PING_INTERVAL_MS);
+    statsTimer->start();
+    if (!audioNotifier) {
+        audioPollTimer->start();
+    }
+}
+
+/**
+ * @brief Reads the session packet of a connection that may take over the current one.
+ */
+void NetworkManager::readResumeRequest()
+{
+    if (!resumeSocket) {
+        return;
+    }
+    
+    // The session packet is the first thing a client sends
+    const int requestSize = PacketFraming::HeaderSize + static_cast<int>(sizeof(quint64));
+    if (resumeSocket->bytesAvailable() < requestSize) {
+        return;
+    }
+    
+    QByteArray request = resumeSocket->read(requestSize);
+    QTcpSocket *socket = resumeSocket;
+    resumeSocket = nullptr;
+    QObject::disconnect(socket, nullptr, this, nullptr);
+    
+    PacketView packet;
+    quint64 token = 0;
+    if (PacketFraming::parse(request.constData(), request.size(), packet) &&
+        packet.type == PACKET_TYPE_SESSION && packet.size == static_cast<int>(sizeof(token))) {
+        token = qFromBigEndian<quint64>(packet.data);
+    }
+    
+    if (token == 0 || token != sessionToken) {
+        socket->disconnectFromHost();
+        socket->deleteLater();
+        return;
+    }
+    
+    // Drop the stale connection without ending the session
+    QTcpSocket *staleSocket = clientSocket;
+    clientSocket = nullptr;
+    connected = false;
+    QObject::disconnect(staleSocket, nullptr, this, nullptr);
+    staleSocket->abort();
+    staleSocket->deleteLater();
+    closeTransport();
+    
+    {
+        QMutexLocker locker(&sendQueueMutex);
+        sendQueue.clear();
+        sendQueueBytes = 0;
+        pendingFrames.clear();
+        pendingFrameBytes = 0;
+        receiveBuffer.resize(0);
+    }
+    
+    acceptClient(socket, tr("Client resumed the session from %1").arg(socket->peerAddress().toString()));
+    
+    // The rest of the connection is regular traffic
+    if (clientSocket->bytesAvailable() > 0) {
+        readData();
+    }
+}
+
+/**
+ * @brief Schedules the next reconnect attempt.
+ */
+void NetworkManager::scheduleReconnect()
+{
+    // Exponential backoff with jitter, so a flapping link is not hammered and
+    // clients that lost the same server do not retry in lockstep
+    int delay = qMin(RECONNECT_MAX_DELAY_MS, RECONNECT_INITIAL_DELAY_MS << qMin(reconnectAttempts, 8));
+    delay = delay / 2 + QRandomGenerator::global()->bounded(delay / 2 + 1);
+    reconnectAttempts++;
+    
+    reconnectTimer->start(delay);
+    emit connectionStatusChanged(false, tr("Connection lost, reconnecting (attempt %1)...").arg(reconnectAttempts));
+}
+
+/**
+ * @brief Opens a new connection to the server for the current session.
+ */
+void NetworkManager::reconnect()
+{
+    closeTransport();
+    if (clientSocket) {
+        QObject::disconnect(clientSocket, nullptr, this, nullptr);
+        clientSocket->abort();
+        clientSocket->deleteLater();
+        clientSocket = nullptr;
+    }
+    
+    openConnection();
+}
+
+/**
+ * @brief Ends the session (the peer did not come back in time, or another client took over).
+ */
+void NetworkManager::endSession()
+{
+    sessionTimer->stop();
+    sessionToken = 0;
+    clockSync.reset();
+    emit sessionEnded();
+}
+
+/**
+ * @brief Handles socket disconnection.
+ */
+void NetworkManager::handleDisconnect()
+{
+    // Stop timers
+    pingTimer->stop();
+    sendQueueTimer->stop();
+    aggregationTimer->stop();
+    statsTimer->stop();
+    audioPollTimer->stop();
+    
+    // Clean up; packets still held by the simulator were lost with the link
+    closeTransport();
+    impairment->reset();
+    if (clientSocket) {
+        QObject::disconnect(clientSocket, nullptr, this, nullptr);
+        clientSocket->deleteLater();
+        clientSocket = nullptr;
+    }
+    
+    // Clear send queue and pending frames. Audio queued for the dead link
+    // would only add latency once the link is back.
+    {
+        QMutexLocker locker(&sendQueueMutex);
+        sendQueue.clear();
+        sendQueueBytes = 0;
+        pendingFrames.clear();
+        pendingFrameBytes = 0;
+        receiveBuffer.resize(0); // keeps the reserved capacity
+    }
+    
+    // Update status
+    connected = false;
+    emit connectionStatusChanged(false, isServer ? tr("Client disconnected") : tr("Disconnected from server"));
+    
+    // Get the session back: the client reconnects, the server waits for it
+    if (!autoReconnect) {
+        endSession();
+    } else if (isServer) {
+        sessionTimer->start();
+    } else {
+        scheduleReconnect();
+    }
+}
+
+/**
+ * @brief Ends the session from inside a handler of the connection.
+ */
+void NetworkManager::dropConnection()
+{
+    if (disconnectPending) {
+        return;
+    }
+    
+    // Nothing more is read or sent; the teardown waits until the handler and
+    // the read loop that called it have returned. A disconnect() that runs
+    // first (a new session) cancels it.
+    disconnectPending = true;
+    connected = false;
+    QMetaObject::invokeMethod(this, [this]() {
+        if (disconnectPending) {
+            disconnect();
+        }
+    }, Qt::QueuedConnection);
+}
+
+/**
+ * @brief Handles socket errors.
+ * @param socketError The socket error.
+ */
+void NetworkManager::handleSocketError(QAbstractSocket::SocketError socketError)
+{
+    if (!clientSocket) {
+        return;
+    }
+    
+    // Once a session is established, errors only mean the link is down for now
+    if (!isServer && autoReconnect && sessionEstablished) {
+        if (connected) {
+            handleDisconnect();
+        } else {
+            scheduleReconnect();
+        }
+        return;
+    }
+    
+    emit error(tr("Network error: %1").arg(clientSocket->errorString()));
+    
+    // Disconnect on error
+    if (connected) {
+        handleDisconnect();
+    }
+}
+
+/**
+ * @brief Handles socket state changes.
+ * @param state The new socket state.
+ */
+void NetworkManager::handleSocketStateChange(QAbstractSocket::SocketState state)
+{
+    if (!clientSocket) {
+        return;
+    }
+    
+    switch (state) {
+        case QAbstractSocket::ConnectingState:
+            emit connectionStatusChanged(false, tr("Connecting..."));
+            break;
+        case QAbstractSocket::ConnectedState:
+            emit connectionStatusChanged(true, tr("Connected"));
+            break;
+        case QAbstractSocket::ClosingState:
+            emit connectionStatusChanged(false, tr("Disconnecting..."));
+            break;
+        case QAbstractSocket::UnconnectedState:
+            if (connected) {
+                handleDisconnect();
+            }
+            break;
+        default:
+            break;
+    }
+}
+
+/**
+ * @brief Reads data from the socket.
+ */
+void NetworkManager::readData()
+{
+    if (!clientSocket || disconnectPending) {
+        return;
+    }
+    
+    LoadMeter::Scope load(loadMeter);
+    
+    // Every packet of this read arrived now, and went through the kernel
+    // when the transport says (if it keeps timestamps)
+    receiveTimeUs = ClockSync::now();
+    receiveTimestampUs = 0;
+    
+    // Read straight into the tail of the receive buffer. A single read may
+    // carry several packets (the sender batches its writes) or end in the
+    // middle of one.
+    qint64 available = transport ? 0 : clientSocket->bytesAvailable();
+    if (transport && transport->read(receiveBuffer) > 0) {
+        receiveTimestampUs = transport->getReceiveTimestamp();
+        receiveClock.restart();
+    } else if (available > 0) {
+        int used = receiveBuffer.size();
+        receiveBuffer.resize(used + static_cast<int>(available));
+        qint64 bytesRead = clientSocket->read(receiveBuffer.data() + used, available);
+        receiveBuffer.resize(used + static_cast<int>(qMax<qint64>(0, bytesRead)));
+        receiveClock.restart();
+    }
+    
+    // Process every complete packet in place
+    PacketView packet;
+    PacketError parseError = PacketError::None;
+    int offset = 0;
+    
+    // A relay passes consecutive stream packets on together, as they arrived
+    int runStart = 0;
+    int runSize = 0;
+    auto forwardRun = [&]() {
+        if (runSize > 0) {
+            relay->forward(receiveBuffer.constData() + runStart, runSize, receiveTimeUs);
+            runSize = 0;
+        }
+    };
+    
+    while (PacketFraming::parse(receiveBuffer.constData() + offset,
+                                receiveBuffer.size() - offset, packet, &parseError)) {
+        int packetStart = offset;
+        offset += PacketFraming::HeaderSize + packet.size;
+        
+        if (captureWriter.isOpen() && !captureWriter.write(packet)) {
+            emit error(tr("Failed to write capture file: %1").arg(captureWriter.errorString()));
+            captureWriter.close();
+        }
+        
+        // The simulator copies the packet and dispatches it when it is due
+        if (impairment->isEnabled()) {
+            impairment->submit(packet);
+            continue;
+        }
+        
+        if (relay && RelayForwarder::isForwarded(packet.type)) {
+            if (runSize == 0) {
+                runStart = packetStart;
+            }
+            runSize = offset - runStart;
+            continue;
+        }
+        
+        // Keeps the order of the stream and the control packets
+        if (relay) {
+            forwardRun();
+        }
+        dispatchPacket(packet);
+        
+        // A handler may have torn down the connection
+        if (!clientSocket || disconnectPending) {
+            return;
+        }
+    }
+    
+    if (relay) {
+        forwardRun();
+    }
+    
+    // Past a broken packet the stream cannot be resynchronized
+    if (parseError != PacketError::None) {
+        emit error(PacketFraming::errorString(parseError, receiveBuffer.constData() + offset));
+        dropConnection();
+        return;
+    }
+    
+    // Keep the incomplete tail for the next read
+    receiveBuffer.remove(0, offset);
+}
+
+/**
+ * @brief Dispatches a parsed packet to its handler.
+ * @param packet The packet, referencing the receive buffer.
+ */
+void NetworkManager::dispatchPacket(const PacketView &packet)
+{
+    // Delayed or replayed packets reach a relay here, no longer in their wire form
+    if (relay && RelayForwarder::isForwarded(packet.type)) {
+        relay->forwardPacket(packet, receiveTimeUs);
+        return;
+    }
+    
+    switch (packet.type) {
+        case PACKET_TYPE_AUDIO:
+            handleAudioPacket(packet.payload(), localPacketTime(packet.stamp));
+            break;
+        case PACKET_TYPE_AUDIO_BATCH:
+            handleAudioBatchPacket(packet);
+            break;
+        case PACKET_TYPE_PING:
+            handlePingPacket(packet.payload());
+            break;
+        case PACKET_TYPE_PONG:
+            handlePongPacket(packet.payload());
+            break;
+        case PACKET_TYPE_PONG_FOLLOW_UP:
+            handlePongFollowUpPacket(packet.payload());
+            break;
+        case PACKET_TYPE_REPORT:
+            handleReportPacket(packet.payload());
+            break;
+        case PACKET_TYPE_COMFORT_NOISE:
+            handleComfortNoisePacket(packet.payload());
+            break;
+        case PACKET_TYPE_FORMAT:
+            handleFormatPacket(packet.payload());
+            break;
+        case PACKET_TYPE_CODEC:
+            handleCodecPacket(packet.payload());
+            break;
+        case PACKET_TYPE_SESSION:
+            handleSessionPacket(packet.payload());
+            break;
+        case PACKET_TYPE_HELLO:
+            handleHelloPacket(packet.payload());
+            break;
+        default:
+            qDebug() << "Unknown packet type:" << packet.type;
+            break;
+    }
+}
+
+/**
+ * @brief Sends a ping to measure latency.
+ */
+void NetworkManager::sendPing()
+{
+    if (!connected || !clientSocket) {
+        return;
+    }
+    
+    // Back to the regular rate once the clock estimate has settled
+    if (clockSync.getExchangeCount() >= FAST_PING_EXCHANGES) {
+        pingTimer->setInterval(PING_INTERVAL_MS);
+    }
+    
+    // Exchanges whose follow-up got lost, or whose peer sends none, count with
+    // the application times
+    qint64 sendTimeUs = ClockSync::now();
+    for (auto it = pendingExchanges.begin(); it != pendingExchanges.end();) {
+        if (sendTimeUs - it.value().pongReceiveUs > FOLLOW_UP_TIMEOUT_US) {
+            ClockExchange exchange = it.value();
+            it = pendingExchanges.erase(it);
+            completeClockExchange(exchange, -1);
+        } else {
+            ++it;
+        }
+    }
+    
+    // Forget the kernel times of pings that got no pong
+    for (auto it = pingTransmitTimes.begin(); it != pingTransmitTimes.end();) {
+        if (sendTimeUs - it.key() > TIMESTAMP_EXPIRY_US) {
+            it = pingTransmitTimes.erase(it);
+        } else {
+            ++it;
+        }
+    }
+    for (auto it = pingTimestampIds.begin(); it != pingTimestampIds.end();) {
+        if (sendTimeUs - it.value() > TIMESTAMP_EXPIRY_US) {
+            it = pingTimestampIds.erase(it);
+        } else {
+            ++it;
+        }
+    }
+    
+    // The ping carries its send time (t1), the peer adds its receive and send times
+    QByteArray payload(sizeof(qint64), '\0');
+    qToBigEndian<qint64>(sendTimeUs, payload.data());
+    qint64 timestampId = -1;
+    writePackets(QList<OutgoingPacket>() << PacketFraming::frame(PACKET_TYPE_PING, payload, controlStamp()),
+                 true, &timestampId);
+    if (timestampId >= 0) {
+        pingTimestampIds.insert(timestampId, sendTimeUs);
+    }
+}
+
+/**
+ * @brief Processes the send queue.
+ */
+void NetworkManager::processSendQueue()
+{
+    if (!connected || !clientSocket) {
+        return;
+    }
+    
+    LoadMeter::Scope load(loadMeter);
+    
+    // Drop what waited too long, then offer the rest to the socket
+    QList<OutgoingPacket> packets;
+    int dropped;
+    {
+        QMutexLocker locker(&sendQueueMutex);
+        dropped = dropExpiredPackets();
+        packets = sendQueue;
+    }
+    
+    if (dropped > 0) {
+        emit sendQueueOverflowed(dropped);
+    }
+    
+    if (packets.isEmpty()) {
+        return;
+    }
+    
+    // What the socket cannot take yet waits for its bytesWritten() signal
+    int written = writePackets(packets, false);
+    
+    QMutexLocker locker(&sendQueueMutex);
+    for (int i = 0; i < written && !sendQueue.isEmpty(); i++) {
+        sendQueueBytes -= sendQueue.dequeue().wireSize();
+    }
+}
+
+/**
+ * @brief Moves the pending aggregated frames into the send queue.
+ */
+void NetworkManager::flushPendingFrames()
+{
+    aggregationTimer->stop();
+    
+    QMutexLocker locker(&sendQueueMutex);
+    if (pendingFrames.isEmpty()) {
+        return;
+    }
+    
+    enqueuePacket(PacketFraming::frameBatch(pendingFrames, mediaStamp(pendingCaptureUs)));
+    pendingFrames.clear();
+    pendingFrameBytes = 0;
+}
+
+/**
+ * @brief Appends a packet to the send queue and wakes up the sender (sendQueueMutex held).
+ * @param packet The packet.
+ */
+void NetworkManager::enqueuePacket(OutgoingPacket packet)
+{
+    packet.queuedAtMs = queueClock.elapsed();
+    sendQueueBytes += packet.wireSize();
+    sendQueue.enqueue(packet);
+    
+    // Wake up the sender once the event loop is idle
+    if (!sendQueueTimer->isActive()) {
+        sendQueueTimer->start();
+    }
+}
+
+/**
+ * @brief Applies the drop policy to the send queue (sendQueueMutex held).
+ * @return The number of packets dropped.
+ */
+int NetworkManager::dropExpiredPackets()
+{
+    // The head is the oldest packet, nothing to do while it is on time
+    qint64 deadline = queueClock.elapsed() - maxQueueDelayMs;
+    if (sendQueue.isEmpty() || sendQueue.head().queuedAtMs >= deadline) {
+        return 0;
+    }
+    
+    // Every packet of our codecs decodes on its own, so the newest one is
+    // where the receiver resumes when skipping the whole backlog
+    int resumeIndex = -1;
+    if (dropPolicy == DropPolicy::DropToKeyframe) {
+        for (int i = sendQueue.size() - 1; i >= 0; i--) {
+            if (sendQueue.at(i).isDroppable()) {
+                resumeIndex = i;
+                break;
+            }
+        }
+    }
+    
+    // Control packets keep their place in the stream
+    QQueue<OutgoingPacket> kept;
+    int dropped = 0;
+    for (int i = 0; i < sendQueue.size(); i++) {
+        const OutgoingPacket &packet = sendQueue.at(i);
+        bool expired = dropPolicy == DropPolicy::DropToKeyframe ? i != resumeIndex
+                                                                : packet.queuedAtMs < deadline;
+        if (packet.isDroppable() && expired) {
+            int size = packet.wireSize();
+            sendQueueBytes -= size;
+            droppedBytes += size;
+            dropped++;
+        } else {
+            kept.enqueue(packet);
+        }
+    }
+    
+    sendQueue.swap(kept);
+    droppedPackets += dropped;
+    return dropped;
+}
+
+/**
+ * @brief Publishes the transport statistics.
+ */
+void NetworkManager::updateStatistics()
+{
+    // TCP takes minutes to notice a dead link on its own. Both peers ping
+    // every second, so a link that stays quiet for longer is gone.
+    if (connected && clientSocket && receiveClock.elapsed() > LINK_TIMEOUT_MS) {
+        clientSocket->abort();
+        if (connected) {
+            handleDisconnect();
+        }
+        return;
+    }
+    
+    emit sendBacklogChanged(getSendBacklog());
+}
+
+/**
+ * @brief Dispatches the replayed packets that are due.
+ */
+void NetworkManager::replayPackets()
+{
+    qint64 nowUs = replayClock.nsecsElapsed() / 1000;
+    
+    for (int i = 0; i < REPLAY_BATCH_SIZE; i++) {
+        if (!replayRecordPending && !captureReader.next(replayRecord)) {
+            if (captureReader.isTruncated()) {
+                qDebug() << "Capture file ends in an incomplete packet";
+            }
+            qint64 packets = replayedPackets;
+            stopReplay();
+            emit connectionStatusChanged(false, tr("Replay finished"));
+            emit replayFinished(packets);
+            return;
+        }
+        
+        // Wait for the recorded arrival time of the next packet
+        if (replayRealtime && replayRecord.timestampUs > nowUs) {
+            replayRecordPending = true;
+            replayTimer->start(static_cast<int>((replayRecord.timestampUs - nowUs) / 1000));
+            return;
+        }
+        replayRecordPending = false;
+        
+        if (replayRecord.packet.type != PACKET_TYPE_PING && replayRecord.packet.type != PACKET_TYPE_PONG &&
+            replayRecord.packet.type != PACKET_TYPE_PONG_FOLLOW_UP && replayRecord.packet.type != PACKET_TYPE_SESSION) {
+            if (impairment->isEnabled()) {
+                impairment->submit(replayRecord.packet);
+            } else {
+                dispatchPacket(replayRecord.packet);
+            }
+        }
+        replayedPackets++;
+        
+        // A handler may have aborted the replay
+        if (!captureReader.isOpen()) {
+            return;
+        }
+    }
+    
+    // Yield to the event loop between batches
+    replayTimer->start(0);
+}
+
+/**
+ * @brief Applies low-delay options to the connected socket.
+ */
+void NetworkManager::configureSocket()
+{
+    if (!clientSocket) {
+        return;
+    }
+    
+    // Disable Nagle's algorithm and mark the traffic as low-delay
+    clientSocket->setSocketOption(QAbstractSocket::LowDelayOption, 1);
+    clientSocket->setSocketOption(QAbstractSocket::TypeOfServiceOption, AUDIO_TYPE_OF_SERVICE);
+
+#ifdef Q_OS_LINUX
+    // Queue our packets ahead of bulk traffic on the local interface
+    int priority = 6;
+    ::setsockopt(static_cast<int>(clientSocket->socketDescriptor()), SOL_SOCKET, SO_PRIORITY,
+                 &priority, sizeof(priority));
+#endif
+}
+
+/**
+ * @brief Connects the signals of the current client socket.
+ */
+void NetworkManager::connectSocketSignals()
+{
+    connect(clientSocket, &QTcpSocket::disconnected, this, &NetworkManager::handleDisconnect);
+    connect(clientSocket, QOverload<QAbstractSocket::SocketError>::of(&QTcpSocket::error),
+            this, &NetworkManager::handleSocketError);
+    connect(clientSocket, &QTcpSocket::stateChanged, this, &NetworkManager::handleSocketStateChange);
+    connect(clientSocket, &QTcpSocket::readyRead, this, &NetworkManager::readData);
+    connect(clientSocket, &QTcpSocket::bytesWritten, this, &NetworkManager::processSendQueue);
+}
+
+/**
+ * @brief Moves the connected client socket to the io_uring transport, or
+ *        to the socket transport for kernel timestamps, if selected.
+ */
+void NetworkManager::startTransport()
+{
+    if (!clientSocket) {
+        return;
+    }
+    
+    bool useUring = transportBackend == TransportBackend::Uring;
+    if (useUring && !UringTransport::isAvailable()) {
+        qDebug() << "io_uring transport not available";
+        useUring = false;
+    }
+    if (!useUring && (!kernelTimestamps || !SocketTransport::isAvailable())) {
+        return;
+    }
+
+#ifdef Q_OS_UNIX
+    // The transport gets a duplicate of the descriptor. Closing Qt's copy
+    // below does not end the connection, it only stops Qt from reading.
+    int fd = ::dup(static_cast<int>(clientSocket->socketDescriptor()));
+    if (fd < 0) {
+        qDebug() << "Failed to duplicate the socket, using Qt sockets";
+        return;
+    }
+    
+    if (useUring) {
+        transport = new UringTransport(this);
+    } else {
+        transport = new SocketTransport(this);
+    }
+    QString errorMessage;
+    if (!transport->open(fd, &errorMessage)) {
+        qDebug() << "Failed to open the" << (useUring ? "io_uring" : "socket") << "transport, using Qt sockets:"
+                 << errorMessage;
+        delete transport;
+        transport = nullptr;
+        return;
+    }
+    
+    // Whatever Qt already read is the start of the stream
+    receiveBuffer.append(clientSocket->readAll());
+    QObject::disconnect(clientSocket, nullptr, this, nullptr);
+    clientSocket->abort();
+    
+    connect(transport, &StreamTransport::readyRead, this, &NetworkManager::readData);
+    connect(transport, &StreamTransport::bytesWritten, this, &NetworkManager::processSendQueue);
+    connect(transport, &StreamTransport::transmitTimestamp, this, &NetworkManager::handleTransmitTimestamp);
+    connect(transport, &StreamTransport::disconnected, this, [this]() {
+        if (connected) {
+            handleDisconnect();
+        }
+    });
+    
+    if (!receiveBuffer.isEmpty()) {
+        QMetaObject::invokeMethod(this, &NetworkManager::readData, Qt::QueuedConnection);
+    }
+#endif
+}
+
+/**
+ * @brief Closes the transport of the current connection, if any.
+ */
+void NetworkManager::closeTransport()
+{
+    // Timestamps of this connection mean nothing on the next one
+    pingTimestampIds.clear();
+    pingTransmitTimes.clear();
+    pongTimestampIds.clear();
+    pendingExchanges.clear();
+    
+    if (!transport) {
+        return;
+    }
+    
+    // We may be called from one of its signals
+    QObject::disconnect(transport, nullptr, this, nullptr);
+    transport->close();
+    transport->deleteLater();
+    transport = nullptr;
+}
+
+/**
+ * @brief Sends the session token to the server.
+ */
+void NetworkManager::sendSession()
+{
+    if (!clientSocket || sessionToken == 0) {
+        return;
+    }
+    
+    QByteArray payload(sizeof(sessionToken), '\0');
+    qToBigEndian<quint64>(sessionToken, payload.data());
+    writePackets(QList<OutgoingPacket>() << PacketFraming::frame(PACKET_TYPE_SESSION, payload, controlStamp()));
+}
+
+/**
+ * @brief Sends the local format to the peer.
+ */
+void NetworkManager::sendFormat()
+{
+    if (!clientSocket || localInputMap.isEmpty() || localOutputMap.isEmpty()) {
+        return;
+    }
+    
+    // Channel counts followed by the positions of the input and output channels
+    QByteArray payload;
+    payload.append(static_cast<char>(localInputMap.size()));
+    payload.append(static_cast<char>(localOutputMap.size()));
+    for (ChannelPosition position : localInputMap) {
+        payload.append(static_cast<char>(position));
+    }
+    for (ChannelPosition position : localOutputMap) {
+        payload.append(static_cast<char>(position));
+    }
+    
+    // Written directly, so it goes out ahead of any queued audio
+    writePackets(QList<OutgoingPacket>() << PacketFraming::frame(PACKET_TYPE_FORMAT, payload, controlStamp()));
+}
+
+/**
+ * @brief Sends the local capabilities to the peer.
+ */
+void NetworkManager::sendHello()
+{
+    if (!clientSocket) {
+        return;
+    }
+    
+    // Written directly, so the peer can check us before any audio arrives
+    QByteArray payload = SessionHandshake::encode(localCapabilities);
+    writePackets(QList<OutgoingPacket>() << PacketFraming::frame(PACKET_TYPE_HELLO, payload, controlStamp()));
+}
+
+/**
+ * @brief Stamps an audio packet with the next sequence number (sendQueueMutex held).
+ * @param timeUs The capture time of the audio (0 for the send time).
+ * @return The stamp.
+ */
+PacketStamp NetworkManager::mediaStamp(qint64 timeUs)
+{
+    // Taken in queue order, so a gap at the receiver means the drop policy struck
+    PacketStamp stamp = controlStamp();
+    if (timeUs != 0) {
+        stamp.timestamp = static_cast<quint32>(timeUs);
+    }
+    stamp.sequence = sendSequence++;
+    stamp.codec = sendCodecId;
+    return stamp;
+}
+
+/**
+ * @brief Converts the timestamp of a received packet to our clock.
+ * @param stamp The packet's stamp.
+ * @return The local time, 0 while the clocks are not synchronized.
+ */
+qint64 NetworkManager::localPacketTime(const PacketStamp &stamp) const
+{
+    ClockEstimate estimate = clockSync.getEstimate();
+    if (!estimate.synchronized) {
+        return 0;
+    }
+    return estimate.toLocal(estimate.unwrapPeerTime(stamp.timestamp, receiveTimeUs));
+}
+
+/**
+ * @brief Stamps a control packet, which carries no sequence number.
+ * @return The stamp.
+ */
+PacketStamp NetworkManager::controlStamp() const
+{
+    PacketStamp stamp;
+    stamp.timestamp = static_cast<quint32>(ClockSync::now());
+    return stamp;
+}
+
+/**
+ * @brief Writes a batch of packets to the socket with as few syscalls as possible.
+ * @param packets The packets to write, in order.
+ * @param all Whether every packet must be written.
+ * @param timestampId Receives the id of the kernel send timestamp of the
+ *                    last packet, -1 if there is none (optional).
+ * @return The number of packets written or buffered by Qt.
+ */
+int NetworkManager::writePackets(const QList<OutgoingPacket> &packets, bool all, qint64 *timestampId)
+{
+    if (timestampId) {
+        *timestampId = -1;
+    }
+    
+    if (transport) {
+        // Transports take whole batches; the next one is offered once this one
+        // is gone, so audio waits in the send queue rather than in the transport
+        if (!all && transport->bytesToWrite() > 0) {
+            return 0;
+        }
+        
+        for (const OutgoingPacket &packet : packets) {
+            transport->write(packet.header.constData(), packet.header.size());
+            for (const QByteArray &payload : packet.payloads) {
+                transport->write(payload.constData(), payload.size());
+            }
+        }
+        if (timestampId) {
+            *timestampId = transport->requestTransmitTimestamp();
+        }
+        transport->flush();
+        return packets.size();
+    }
+    
+    // Bytes still buffered by Qt go first, anything more would only queue up behind them
+    if (!all && clientSocket->bytesToWrite() > 0) {
+        return 0;
+    }
+    
+    // Gather the header and payload segments of every packet
+    QList<QByteArray> segments;
+    QVector<int> packetEnds; // index of the first segment after each packet
+    for (const OutgoingPacket &packet : packets) {
+        segments.append(packet.header);
+        segments.append(packet.payloads);
+        packetEnds.append(segments.size());
+    }
+    
+    int index = 0;
+    int offset = 0; // bytes of segments[index] already written
+
+#ifdef Q_OS_UNIX
+    // Hand the whole batch to the kernel with writev() while Qt has nothing
+    // buffered, otherwise we would reorder bytes on the stream.
+    if (clientSocket->bytesToWrite() == 0) {
+        int fd = static_cast<int>(clientSocket->socketDescriptor());
+        
+        while (index < segments.size()) {
+            struct iovec iov[64];
+            int iovCount = qMin(64, segments.size() - index);
+            for (int i = 0; i < iovCount; i++) {
+                const QByteArray &segment = segments.at(index + i);
+                int skip = (i == 0) ? offset : 0;
+                iov[i].iov_base = const_cast<char*>(segment.constData() + skip);
+                iov[i].iov_len = segment.size() - skip;
+            }
+            
+            ssize_t written = ::writev(fd, iov, iovCount);
+            if (written < 0) {
+                if (errno == EINTR) {
+                    continue;
+                }
+                // Let Qt buffer the rest (and report real errors)
+                break;
+            }
+            
+            // Skip the fully written segments
+            int i = 0;
+            while (i < iovCount && written >= static_cast<ssize_t>(iov[i].iov_len)) {
+                written -= iov[i].iov_len;
+                i++;
+            }
+            index += i;
+            offset = (i == 0) ? offset + static_cast<int>(written) : static_cast<int>(written);
+            
+            if (i < iovCount) {
+                // Socket buffer is full, Qt takes over from here
+                break;
+            }
+        }
+    }
+#endif
+    
+    // Hand over the packets the kernel took, the one it stopped in and, if it
+    // stopped at a packet boundary, the next one (so bytesWritten() fires)
+    int count = packets.size();
+    if (!all) {
+        count = 0;
+        while (count < packetEnds.size() && packetEnds.at(count) <= index) {
+            count++;
+        }
+        count = qMin(packets.size(), count + 1);
+    }
+    int end = count > 0 ? packetEnds.at(count - 1) : 0;
+    
+    // Qt appends consecutive writes to the same buffer chunk, so the remainder
+    // still goes out in as few syscalls as the socket allows
+    for (; index < end; index++) {
+        const QByteArray &segment = segments.at(index);
+        clientSocket->write(segment.constData() + offset, segment.size() - offset);
+        offset = 0;
+    }
+    
+    return count;
+}
+
+/**
+ * @brief Handles a ping packet.
+ * @param data The ping packet data.
+ */
+void NetworkManager::handlePingPacket(const QByteArray &data)
+{
+    if (!clientSocket || data.size() < static_cast<int>(sizeof(qint64))) {
+        return;
+    }
+    
+    // Echo the peer's send time with our receive and send times. Peers with
+    // kernel timestamps add the kernel's receive time of the ping (0 if
+    // unknown); older peers read the first three fields only.
+    qint64 pingSendTimeUs = qFromBigEndian<qint64>(data.constData());
+    qint64 sendTimeUs = ClockSync::now();
+    QByteArray payload(4 * sizeof(qint64), '\0');
+    memcpy(payload.data(), data.constData(), sizeof(qint64));
+    qToBigEndian<qint64>(receiveTimeUs, payload.data() + sizeof(qint64));
+    qToBigEndian<qint64>(sendTimeUs, payload.data() + 2 * sizeof(qint64));
+    qToBigEndian<qint64>(receiveTimestampUs, payload.data() + 3 * sizeof(qint64));
+    
+    // Forget the pongs the kernel never stamped
+    for (auto it = pongTimestampIds.begin(); it != pongTimestampIds.end();) {
+        if (sendTimeUs - it.value().second > TIMESTAMP_EXPIRY_US) {
+            it = pongTimestampIds.erase(it);
+        } else {
+            ++it;
+        }
+    }
+    
+    // The kernel's send time of this pong follows in a packet of its own
+    qint64 timestampId = -1;
+    writePackets(QList<OutgoingPacket>() << PacketFraming::frame(PACKET_TYPE_PONG, payload, controlStamp()),
+                 true, &timestampId);
+    if (timestampId >= 0) {
+        pongTimestampIds.insert(timestampId, qMakePair(pingSendTimeUs, sendTimeUs));
+    }
+}
+
+/**
+ * @brief Handles a pong packet.
+ * @param data The pong packet data.
+ */
+void NetworkManager::handlePongPacket(const QByteArray &data)
+{
+    if (data.size() < static_cast<int>(3 * sizeof(qint64))) {
+        return;
+    }
+    
+    ClockExchange exchange;
+    exchange.pingSendUs = qFromBigEndian<qint64>(data.constData());
+    exchange.pingReceiveUs = qFromBigEndian<qint64>(data.constData() + sizeof(qint64));
+    exchange.pongSendUs = qFromBigEndian<qint64>(data.constData() + 2 * sizeof(qint64));
+    exchange.pongReceiveUs = receiveTimeUs;
+    
+    // Three of the four times as the kernels saw them: our ping leaving, the
+    // peer receiving it and ours receiving the pong. The fourth, the pong
+    // leaving, comes in the peer's follow-up.
+    exchange.pingTransmitUs = pingTransmitTimes.take(exchange.pingSendUs);
+    if (data.size() >= static_cast<int>(4 * sizeof(qint64))) {
+        exchange.pingArrivalUs = qFromBigEndian<qint64>(data.constData() + 3 * sizeof(qint64));
+    }
+    exchange.pongArrivalUs = receiveTimestampUs;
+    
+    // Without all three the follow-up would not help
+    if (exchange.pingTransmitUs > 0 && exchange.pingArrivalUs > 0 && exchange.pongArrivalUs > 0) {
+        pendingExchanges.insert(exchange.pingSendUs, exchange);
+        return;
+    }
+    completeClockExchange(exchange, -1);
+}
+
+/**
+ * @brief Handles a pong follow-up packet, which completes a waiting clock exchange.
+ * @param data The follow-up packet data.
+ */
+void NetworkManager::handlePongFollowUpPacket(const QByteArray &data)
+{
+    if (data.size() < static_cast<int>(2 * sizeof(qint64))) {
+        return;
+    }
+    
+    // Keyed by the ping's send time; a follow-up behind its timeout finds nothing
+    qint64 pingSendTimeUs = qFromBigEndian<qint64>(data.constData());
+    qint64 pongTransmitUs = qFromBigEndian<qint64>(data.constData() + sizeof(qint64));
+    auto it = pendingExchanges.find(pingSendTimeUs);
+    if (it == pendingExchanges.end()) {
+        return;
+    }
+    ClockExchange exchange = it.value();
+    pendingExchanges.erase(it);
+    completeClockExchange(exchange, pongTransmitUs);
+}
+
+/**
+ * @brief Feeds a clock exchange to the clock estimate and updates the latency.
+ * @param exchange The exchange.
+ * @param pongTransmitUs The peer's kernel sending the pong (k3), -1 to use the application times.
+ */
+void NetworkManager::completeClockExchange(const ClockExchange &exchange, qint64 pongTransmitUs)
+{
+    qint64 t1 = exchange.pingSendUs;
+    qint64 t2 = exchange.pingReceiveUs;
+    qint64 t3 = exchange.pongSendUs;
+    qint64 t4 = exchange.pongReceiveUs;
+    qint64 k1 = exchange.pingTransmitUs;
+    qint64 k2 = exchange.pingArrivalUs;
+    qint64 k3 = pongTransmitUs;
+    qint64 k4 = exchange.pongArrivalUs;
+    
+    // A stamp on the wrong side of its application time means the realtime clock stepped
+    bool kernel = k1 > 0 && k2 > 0 && k3 > 0 && k4 > 0
+                  && k1 >= t1 && k2 <= t2 && k3 >= t3 && k4 <= t4 && k4 >= k1 && k3 >= k2;
+    
+    // Kernel times leave the queueing in the applications out of the clock exchange
+    bool wasSynchronized = clockSync.getEstimate().synchronized;
+    bool accepted = kernel ? clockSync.addExchange(k1, k2, k3, k4) : clockSync.addExchange(t1, t2, t3, t4);
+    if (!accepted) {
+        return;
+    }
+    
+    ClockEstimate estimate = clockSync.getEstimate();
+    if (estimate.synchronized && !wasSynchronized) {
+        qDebug() << "Clock synchronized with the peer: offset" << qRound64(estimate.offsetUs) << "us, error"
+                 << qRound64(estimate.errorUs) << "us, round trip" << estimate.roundTripUs << "us";
+    }
+    emit clockEstimateChanged(estimate);
+    
+    // The round trip without the peer's processing time, split into the part
+    // between the kernels and the parts spent queueing on either side
+    latencyStats = LatencyStats();
+    latencyStats.kernelTimestamps = kernel;
+    latencyStats.roundTripUs = (t4 - t1) - (t3 - t2);
+    if (kernel) {
+        latencyStats.wireRoundTripUs = qMax<qint64>(0, (k4 - k1) - (k3 - k2));
+        latencyStats.localQueueingUs = (k1 - t1) + (t4 - k4);
+        latencyStats.peerQueueingUs = (t2 - k2) + (k3 - t3);
+    }
+    emit latencyStatsChanged(latencyStats);
+    
+    // The network's share where it is known, rounded up to whole milliseconds
+    qint64 roundTripUs = kernel ? latencyStats.wireRoundTripUs : latencyStats.roundTripUs;
+    currentLatency = static_cast<int>((roundTripUs + 999) / 1000);
+    emit latencyChanged(currentLatency);
+}
+
+/**
+ * @brief Records the kernel send time of a ping, or sends that of a pong to the peer.
+ * @param id The id of the timestamp.
+ * @param timeUs The send time on our clock.
+ */
+void NetworkManager::handleTransmitTimestamp(qint64 id, qint64 timeUs)
+{
+    // A pong's goes to the peer, keyed by the send time of the ping it answered
+    auto pong = pongTimestampIds.find(id);
+    if (pong != pongTimestampIds.end()) {
+        QByteArray payload(2 * sizeof(qint64), '\0');
+        qToBigEndian<qint64>(pong.value().first, payload.data());
+        qToBigEndian<qint64>(timeUs, payload.data() + sizeof(qint64));
+        pongTimestampIds.erase(pong);
+        if (clientSocket) {
+            writePackets(QList<OutgoingPacket>()
+                         << PacketFraming::frame(PACKET_TYPE_PONG_FOLLOW_UP, payload, controlStamp()));
+        }
+        return;
+    }
+    
+    auto it = pingTimestampIds.find(id);
+    if (it != pingTimestampIds.end()) {
+        pingTransmitTimes.insert(it.value(), timeUs);
+        pingTimestampIds.erase(it);
+    }
+}
+
+/**
+ * @brief Handles an audio packet.
+ * @param data The audio packet data.
+ * @param captureTimeUs The capture time on our clock (0 if unknown).
+ */
+void NetworkManager::handleAudioPacket(const QByteArray &data, qint64 captureTimeUs)
+{
+    // Emit audio data received signal
+    emit audioDataReceived(data, captureTimeUs);
+}
+
+/**
+ * @brief Handles a receiver report packet.
+ * @param data The report packet data.
+ */
+void NetworkManager::handleReportPacket(const QByteArray &data)
+{
+    quint32 framesExpected;
+    quint32 framesLost;
+    
+    if (data.size() < static_cast<int>(sizeof(framesExpected) + sizeof(framesLost))) {
+        return;
+    }
+    
+    framesExpected = qFromBigEndian<quint32>(data.constData());
+    framesLost = qFromBigEndian<quint32>(data.constData() + sizeof(framesExpected));
+    
+    emit receiverReportReceived(framesExpected, framesLost);
+}
+
+/**
+ * @brief Handles a comfort noise packet.
+ * @param data The comfort noise packet data.
+ */
+void NetworkManager::handleComfortNoisePacket(const QByteArray &data)
+{
+    float noiseLevel;
+    
+    if (data.size() < static_cast<int>(sizeof(noiseLevel))) {
+        return;
+    }
+    
+    quint32 levelBits = qFromBigEndian<quint32>(data.constData());
+    memcpy(&noiseLevel, &levelBits, sizeof(noiseLevel));
+    
+    emit comfortNoiseReceived(noiseLevel);
+}
+
+/**
+ * @brief Handles a format packet.
+ * @param data The format packet data.
+ */
+void NetworkManager::handleFormatPacket(const QByteArray &data)
+{
+    ChannelMap inputMap;
+    ChannelMap outputMap;
+    if (!decodeFormat(data, inputMap, outputMap)) {
+        qDebug() << "Malformed format packet";
+        return;
+    }
+    
+    if (!AudioFormat::isValidChannelMap(inputMap) || !AudioFormat::isValidChannelMap(outputMap)) {
+        emit error(tr("The peer uses an unsupported channel layout."));
+        return;
+    }
+    
+    emit peerFormatReceived(inputMap, outputMap);
+}
+
+/**
+ * @brief Decodes the payload of a format packet.
+ * @param data The format packet data.
+ * @param inputMap Receives the channel map of the input device.
+ * @param outputMap Receives the channel map of the output device.
+ * @return True if the payload was complete, false otherwise.
+ */
+bool NetworkManager::decodeFormat(const QByteArray &data, ChannelMap &inputMap, ChannelMap &outputMap)
+{
+    if (data.size() < 2) {
+        return false;
+    }
+    
+    int inputChannels = static_cast<quint8>(data.at(0));
+    int outputChannels = static_cast<quint8>(data.at(1));
+    if (data.size() < 2 + inputChannels + outputChannels) {
+        return false;
+    }
+    
+    inputMap.clear();
+    outputMap.clear();
+    for (int i = 0; i < inputChannels; i++) {
+        inputMap.append(static_cast<ChannelPosition>(static_cast<quint8>(data.at(2 + i))));
+    }
+    for (int i = 0; i < outputChannels; i++) {
+        outputMap.append(static_cast<ChannelPosition>(static_cast<quint8>(data.at(2 + inputChannels + i))));
+    }
+    return true;
+}
+
+/**
+ * @brief Handles a codec packet.
+ * @param data The codec packet data.
+ */
+void NetworkManager::handleCodecPacket(const QByteArray &data)
+{
+    qint32 bitrate;
+    
+    if (data.size() < 1 + static_cast<int>(sizeof(bitrate))) {
+        return;
+    }
+    
+    quint8 mode = static_cast<quint8>(data.at(0));
+    if (mode > static_cast<quint8>(TransmissionMode::Opus)) {
+        emit error(tr("The peer uses an unsupported transmission mode."));
+        return;
+    }
+    
+    bitrate = qFromBigEndian<qint32>(data.constData() + 1);
+    
+    emit peerCodecReceived(static_cast<TransmissionMode>(mode), bitrate);
+}
+
+/**
+ * @brief Handles a session packet.
+ * @param data The session packet data.
+ */
+void NetworkManager::handleSessionPacket(const QByteArray &data)
+{
+    quint64 token;
+    
+    if (!isServer || data.size() < static_cast<int>(sizeof(token))) {
+        return;
+    }
+    
+    token = qFromBigEndian<quint64>(data.constData());
+    
+    // The same client resumes; anyone else starts over
+    if (token == sessionToken) {
+        emit connectionStatusChanged(true, tr("Client resumed the session"));
+        return;
+    }
+    
+    // The old session ends here, the new client's clock is another machine's
+    if (sessionToken != 0) {
+        endSession();
+    }
+    sessionToken = token;
+}
+
+/**
+ * @brief Handles an aggregated audio packet carrying several frames.
+ * @param packet The aggregated packet, referencing the receive buffer.
+ */
+void NetworkManager::handleAudioBatchPacket(const PacketView &packet)
+{
+    // Split the aggregate into views of its frames
+    QList<PacketView> frames;
+    if (!PacketFraming::splitBatch(packet, frames)) {
+        qDebug() << "Malformed audio batch packet";
+        return;
+    }
+    
+    // The frames share the batch's capture time, the receiver lines them up
+    qint64 captureTimeUs = localPacketTime(packet.stamp);
+    for (const PacketView &frame : frames) {
+        handleAudioPacket(frame.payload(), captureTimeUs);
+    }
+}
+
+/**
+ * @brief Ends a replay and closes the capture file.
+ */
+void NetworkManager::stopReplay()
+{
+    replayTimer->stop();
+    replayRecordPending = false;
+    captureReader.close();
+}
+
+/**
+ * @brief Handles a hello packet.
+ * @param data The hello packet data.
+ */
+void NetworkManager::handleHelloPacket(const QByteArray &data)
+{
+    SessionCapabilities peerCapabilities;
+    if (!SessionHandshake::decode(data, peerCapabilities)) {
+        emit error(tr("The peer sent a malformed handshake."));
+        dropConnection();
+        return;
+    }
+    
+    // A relay takes whatever the sender offers, the downstream receivers
+    // negotiate with the sender's hello themselves
+    if (relay) {
+        localCapabilities = peerCapabilities;
+        sendHello();
+        relay->setUpstreamHello(data);
+    }
+    
+    // Better no connection than one that plays noise
+    NegotiatedSession session;
+    QString message;
+    if (!SessionHandshake::negotiate(localCapabilities, peerCapabilities, session, &message)) {
+        emit error(tr("Incompatible peer: %1").arg(message));
+        dropConnection();
+        return;
+    }
+    
+    // The peer plays buffers of frameSize, so smaller packets only add overhead
+    int bufferFrames = qMax(1, static_cast<int>(localCapabilities.bufferFrames));
+    {
+        QMutexLocker locker(&sendQueueMutex);
+        negotiatedFramesPerPacket = qMax(1, session.frameSize / bufferFrames);
+    }
+    
+    qDebug() << "Negotiated" << (session.mode == TransmissionMode::Opus ? "Opus" : "raw") << "at"
+             << session.sampleRate << "Hz," << session.frameSize << "frames per packet";
+    emit sessionNegotiated(session);
+}
@@ -0,0 +1,431 @@
+#include "../include/opuscodec.h"
+#include <QtCore/QObject>
+#include <cstring>
+
+#include <cstdlib>
+
+#ifdef AUDIOBRIDGE_HAVE_OPUS
+#include <opus.h>
+#include <opus_multistream.h>
+#endif
+
+// Largest Opus frame duration in milliseconds
+const int MAX_FRAME_DURATION_MS = 60;
+
+// Upper bound for one encoded packet (recommended by libopus)
+const int MAX_PACKET_SIZE = 4000;
+
+// Marker of the passthrough format used when libopus is not available
+const char PASSTHROUGH_MARKER[] = "OPUS";
+const int PASSTHROUGH_MARKER_SIZE = 4;
+
+#ifdef AUDIOBRIDGE_HAVE_OPUS
+/**
+ * @brief Computes the multistream layout of a channel map.
+ * @param map The channel map.
+ * @param coupledStreams The number of coupled (stereo) streams (output).
+ * @param mapping The coded channel of every input channel (output).
+ * @return The total number of streams.
+ */
+static int streamLayout(const ChannelMap &map, int &coupledStreams, unsigned char *mapping)
+{
+    const ChannelPosition pairs[][2] = {
+        { FrontLeft, FrontRight },
+        { BackLeft, BackRight },
+        { SideLeft, SideRight }
+    };
+    
+    bool assigned[MAX_CHANNELS] = {};
+    coupledStreams = 0;
+    
+    // Left/right pairs share a coupled stream (coded channels 2k and 2k + 1)
+    for (const auto &pair : pairs) {
+        int left = map.indexOf(pair[0]);
+        int right = map.indexOf(pair[1]);
+        if (left >= 0 && right >= 0) {
+            mapping[left] = static_cast<unsigned char>(2 * coupledStreams);
+            mapping[right] = static_cast<unsigned char>(2 * coupledStreams + 1);
+            assigned[left] = assigned[right] = true;
+            coupledStreams++;
+        }
+    }
+    
+    // Every other channel is a mono stream after the coupled ones
+    int next = 2 * coupledStreams;
+    for (int c = 0; c < map.size(); c++) {
+        if (!assigned[c]) {
+            mapping[c] = static_cast<unsigned char>(next++);
+        }
+    }
+    
+    return map.size() - coupledStreams;
+}
+#endif
+
+/**
+ * @brief Constructor for OpusCodec.
+ */
+OpusCodec::OpusCodec()
+    : encoder(nullptr)
+    , decoder(nullptr)
+    , sampleRate(48000)
+    , encoderChannels(2)
+    , decoderChannels(2)
+    , bitrate(64000)
+    , packetLossPercent(0)
+    , fec(false)
+    , frameDurationMs(10)
+    , frameSize(480)
+    , requestedFrameSize(480)
+    , pendingFrames(0)
+{
+}
+
+/**
+ * @brief Destructor for OpusCodec.
+ */
+OpusCodec::~OpusCodec()
+{
+    close();
+}
+
+/**
+ * @brief Creates the encoder and decoder, both for stereo.
+ * @param sampleRate The sample rate.
+ * @param errorMessage The error description (output), if opening fails.
+ * @return True if the codec is ready, false otherwise.
+ */
+bool OpusCodec::open(int sampleRate, QString *errorMessage)
+{
+    close();
+    
+    this->sampleRate = sampleRate;
+    frameSize = sampleRate * frameDurationMs / 1000;
+    requestedFrameSize = frameSize;
+    
+    // Pre-allocate the re-framing and packet buffers for the widest stream
+    pendingInput.resize(sampleRate * MAX_FRAME_DURATION_MS / 1000 * MAX_CHANNELS);
+    pendingFrames = 0;
+    encodeBuffer.resize(MAX_PACKET_SIZE * MAX_CHANNELS);
+
+#ifdef AUDIOBRIDGE_HAVE_OPUS
+    // Size the state for the largest layout of MAX_CHANNELS channels
+    opus_int32 encoderSize = 0;
+    opus_int32 decoderSize = 0;
+    for (int coupled = 0; coupled <= MAX_CHANNELS / 2; coupled++) {
+        encoderSize = qMax(encoderSize, opus_multistream_encoder_get_size(MAX_CHANNELS - coupled, coupled));
+        decoderSize = qMax(decoderSize, opus_multistream_decoder_get_size(MAX_CHANNELS - coupled, coupled));
+    }
+    
+    encoder = malloc(encoderSize);
+    decoder = malloc(decoderSize);
+    if (!encoder || !decoder) {
+        close();
+        if (errorMessage) {
+            *errorMessage = QObject::tr("Failed to allocate the Opus codec.");
+        }
+        return false;
+    }
+    
+    const ChannelMap stereo = AudioFormat::defaultChannelMap(2);
+    if (!setEncoderChannelMap(stereo) || !setDecoderChannelMap(stereo)) {
+        close();
+        if (errorMessage) {
+            *errorMessage = QObject::tr("Failed to initialize the Opus codec.");
+        }
+        return false;
+    }
+#else
+    Q_UNUSED(errorMessage);
+    
+    // Passthrough mode, nothing to create
+    encoder = this;
+    decoder = this;
+    encoderChannels = 2;
+    decoderChannels = 2;
+#endif
+    
+    return true;
+}
+
+/**
+ * @brief Destroys the encoder and decoder.
+ */
+void OpusCodec::close()
+{
+#ifdef AUDIOBRIDGE_HAVE_OPUS
+    free(encoder);
+    free(decoder);
+#endif
+    
+    encoder = nullptr;
+    decoder = nullptr;
+    pendingFrames = 0;
+}
+
+/**
+ * @brief Checks if the codec is open.
+ * @return True if open, false otherwise.
+ */
+bool OpusCodec::isOpen() const
+{
+    return encoder != nullptr;
+}
+
+/**
+ * @brief Re-initializes the encoder for a channel map (encoding thread).
+ * @param map The channel map of the encoded stream.
+ * @return True if successful, false otherwise.
+ */
+bool OpusCodec::setEncoderChannelMap(const ChannelMap &map)
+{
+    if (!encoder || !AudioFormat::isValidChannelMap(map)) {
+        return false;
+    }
+
+#ifdef AUDIOBRIDGE_HAVE_OPUS
+    OpusMSEncoder *opusEncoder = static_cast<OpusMSEncoder*>(encoder);
+    unsigned char mapping[MAX_CHANNELS];
+    int coupledStreams = 0;
+    int streams = streamLayout(map, coupledStreams, mapping);
+    
+    // Initializes in place, the memory was sized for the largest layout
+    if (opus_multistream_encoder_init(opusEncoder, sampleRate, map.size(), streams, coupledStreams,
+                                      mapping, OPUS_APPLICATION_AUDIO) != OPUS_OK) {
+        return false;
+    }
+    
+    opus_multistream_encoder_ctl(opusEncoder, OPUS_SET_BITRATE(bitrate));
+    opus_multistream_encoder_ctl(opusEncoder, OPUS_SET_INBAND_FEC(fec ? 1 : 0));
+    opus_multistream_encoder_ctl(opusEncoder, OPUS_SET_PACKET_LOSS_PERC(packetLossPercent));
+#endif
+    
+    encoderChannels = map.size();
+    pendingFrames = 0;
+    return true;
+}
+
+/**
+ * @brief Re-initializes the decoder for a channel map (decoding thread).
+ * @param map The channel map of the decoded stream.
+ * @return True if successful, false otherwise.
+ */
+bool OpusCodec::setDecoderChannelMap(const ChannelMap &map)
+{
+    if (!decoder || !AudioFormat::isValidChannelMap(map)) {
+        return false;
+    }
+
+#ifdef AUDIOBRIDGE_HAVE_OPUS
+    unsigned char mapping[MAX_CHANNELS];
+    int coupledStreams = 0;
+    int streams = streamLayout(map, coupledStreams, mapping);
+    
+    if (opus_multistream_decoder_init(static_cast<OpusMSDecoder*>(decoder), sampleRate, map.size(),
+                                      streams, coupledStreams, mapping) != OPUS_OK) {
+        return false;
+    }
+#endif
+    
+    decoderChannels = map.size();
+    return true;
+}
+
+/**
+ * @brief Sets the target encoder bitrate.
+ * @param bitsPerSecond The bitrate in bits per second.
+ */
+void OpusCodec::setBitrate(int bitsPerSecond)
+{
+    bitrate = bitsPerSecond;
+
+#ifdef AUDIOBRIDGE_HAVE_OPUS
+    if (encoder) {
+        opus_multistream_encoder_ctl(static_cast<OpusMSEncoder*>(encoder), OPUS_SET_BITRATE(bitrate));
+    }
+#endif
+}
+
+/**
+ * @brief Gets the target encoder bitrate.
+ * @return The bitrate in bits per second.
+ */
+int OpusCodec::getBitrate() const
+{
+    return bitrate;
+}
+
+/**
+ * @brief Enables or disables in-band forward error correction.
+ * @param enabled Whether FEC is enabled.
+ */
+void OpusCodec::setFec(bool enabled)
+{
+    fec = enabled;
+
+#ifdef AUDIOBRIDGE_HAVE_OPUS
+    if (encoder) {
+        opus_multistream_encoder_ctl(static_cast<OpusMSEncoder*>(encoder), OPUS_SET_INBAND_FEC(fec ? 1 : 0));
+    }
+#endif
+}
+
+/**
+ * @brief Sets the packet loss the encoder should be robust against.
+ * @param percent The expected packet loss (0-100).
+ */
+void OpusCodec::setPacketLossPercent(int percent)
+{
+    packetLossPercent = qBound(0, percent, 100);
+
+#ifdef AUDIOBRIDGE_HAVE_OPUS
+    if (encoder) {
+        opus_multistream_encoder_ctl(static_cast<OpusMSEncoder*>(encoder),
+                                     OPUS_SET_PACKET_LOSS_PERC(packetLossPercent));
+    }
+#endif
+}
+
+/**
+ * @brief Sets the duration of each encoded frame.
+ * @param milliseconds The frame duration (5, 10, 20, 40 or 60 ms).
+ */
+void OpusCodec::setFrameDuration(int milliseconds)
+{
+    // Snap to a duration Opus supports
+    const int durations[] = { 5, 10, 20, 40, 60 };
+    int duration = durations[0];
+    for (int candidate : durations) {
+        if (candidate <= milliseconds) {
+            duration = candidate;
+        }
+    }
+    
+    frameDurationMs = duration;
+    
+    // Takes effect at the next frame boundary, see encode()
+    requestedFrameSize = sampleRate * frameDurationMs / 1000;
+}
+
+/**
+ * @brief Gets the duration of each encoded frame.
+ * @return The frame duration in milliseconds.
+ */
+int OpusCodec::getFrameDuration() const
+{
+    return frameDurationMs;
+}
+
+/**
+ * @brief Gets the number of frames waiting in the encoder for a whole Opus frame.
+ * @return The number of frames.
+ */
+int OpusCodec::getPendingFrames() const
+{
+    return pendingFrames;
+}
+
+/**
+ * @brief Encodes interleaved samples until a packet is complete.
+ * @param samples The interleaved input samples.
+ * @param frames The number of frames in the input.
+ * @param packet The completed packet (output), its size is 0 if the input was used up first.
+ * @return The number of input frames consumed.
+ */
+int OpusCodec::encode(const float *samples, int frames, EncodedPacket &packet)
+{
+    packet = { encodeBuffer.constData(), 0, 0 };
+    if (!encoder || frames <= 0) {
+        return qMax(frames, 0);
+    }
+
+#ifdef AUDIOBRIDGE_HAVE_OPUS
+    OpusMSEncoder *opusEncoder = static_cast<OpusMSEncoder*>(encoder);
+    int channels = encoderChannels;
+    int consumed = 0;
+    
+    // Re-frame the device buffers into whole Opus frames
+    while (consumed < frames) {
+        // Switch frame size only between frames
+        if (pendingFrames == 0) {
+            frameSize = requestedFrameSize;
+        }
+        
+        int count = qMin(frames - consumed, frameSize - pendingFrames);
+        memcpy(pendingInput.data() + pendingFrames * channels, samples + consumed * channels,
+               count * channels * sizeof(float));
+        pendingFrames += count;
+        consumed += count;
+        
+        if (pendingFrames < frameSize) {
+            break;
+        }
+        
+        int size = opus_multistream_encode_float(opusEncoder, pendingInput.constData(), frameSize,
+                                                 reinterpret_cast<unsigned char*>(encodeBuffer.data()),
+                                                 encodeBuffer.size());
+        pendingFrames = 0;
+        
+        if (size > 0) {
+            packet.size = size;
+            packet.frames = frameSize;
+            break;
+        }
+    }
+    
+    return consumed;
+#else
+    // Passthrough: marker followed by the raw samples, as many as the buffer holds
+    int channels = encoderChannels;
+    int frameBytes = channels * static_cast<int>(sizeof(float));
+    int count = qMin(frames, (encodeBuffer.size() - PASSTHROUGH_MARKER_SIZE) / frameBytes);
+    char *data = encodeBuffer.data();
+    memcpy(data, PASSTHROUGH_MARKER, PASSTHROUGH_MARKER_SIZE);
+    memcpy(data + PASSTHROUGH_MARKER_SIZE, samples, count * frameBytes);
+    packet.size = PASSTHROUGH_MARKER_SIZE + count * frameBytes;
+    packet.frames = count;
+    
+    return count;
+#endif
+}
+
+/**
+ * @brief Decodes a packet.
+ * @param packet The encoded packet.
+ * @param output The decoded interleaved samples (output).
+ * @return The number of decoded frames, or -1 on error.
+ */
+int OpusCodec::decode(const QByteArray &packet, QVector<float> &output)
+{
+    if (!decoder) {
+        return -1;
+    }
+
+#ifdef AUDIOBRIDGE_HAVE_OPUS
+    // Room for the longest possible Opus packet (120 ms)
+    int channels = decoderChannels;
+    int maxFrames = sampleRate * 120 / 1000;
+    if (output.size() < maxFrames * channels) {
+        output.resize(maxFrames * channels);
+    }
+    
+    int frames = opus_multistream_decode_float(static_cast<OpusMSDecoder*>(decoder),
+                                               reinterpret_cast<const unsigned char*>(packet.constData()),
+                                               packet.size(), output.data(), maxFrames, 0);
+    return frames < 0 ? -1 : frames;
+#else
+    if (!packet.startsWith(PASSTHROUGH_MARKER)) {
+        return -1;
+    }
+    
+    int channels = decoderChannels;
+    int samples = (packet.size() - PASSTHROUGH_MARKER_SIZE) / sizeof(float);
+    int frames = samples / channels;
+    if (output.size() < frames * channels) {
+        output.resize(frames * channels);
+    }
+    memcpy(output.data(), packet.constData() + PASSTHROUGH_MARKER_SIZE, frames * channels * sizeof(float));
+    
+    return frames;
+#endif
+}
@@ -0,0 +1,311 @@
+#include "../include/packetcapture.h"
+#include <QtCore/QDateTime>
+#include <QtCore/QtEndian>
+#include <climits>
+
+#ifdef Q_OS_UNIX
+#include <sys/mman.h>
+#endif
+
+// Magic number at the start of a capture file
+const char CAPTURE_MAGIC[4] = { 'A', 'B', 'P', 'C' };
+
+// Version of the capture format (2: records hold protocol version 2 packets)
+const quint32 CAPTURE_VERSION = 2;
+
+// Size of the capture file header (magic, version, start time)
+const int CAPTURE_HEADER_SIZE = 16;
+
+// Size of the timestamp delta in front of each record
+const int RECORD_HEADER_SIZE = 4;
+
+// Records are buffered until this many bytes are pending
+const int CAPTURE_FLUSH_SIZE = 256 * 1024;
+
+/**
+ * @brief Constructor for CaptureWriter.
+ */
+CaptureWriter::CaptureWriter()
+    : lastTimestampUs(0)
+    , packetCount(0)
+{
+}
+
+/**
+ * @brief Destructor for CaptureWriter.
+ */
+CaptureWriter::~CaptureWriter()
+{
+    close();
+}
+
+/**
+ * @brief Creates a capture file.
+ * @param filePath The path of the file to create.
+ * @param errorMessage Receives the reason of a failure (optional).
+ * @return True if the file was created, false otherwise.
+ */
+bool CaptureWriter::open(const QString &filePath, QString *errorMessage)
+{
+    close();
+    
+    file.setFileName(filePath);
+    if (!file.open(QIODevice::WriteOnly | QIODevice::Truncate | QIODevice::Unbuffered)) {
+        if (errorMessage) {
+            *errorMessage = file.errorString();
+        }
+        return false;
+    }
+    
+    buffer.reserve(CAPTURE_FLUSH_SIZE + 64 * 1024);
+    buffer.resize(CAPTURE_HEADER_SIZE);
+    char *header = buffer.data();
+    memcpy(header, CAPTURE_MAGIC, sizeof(CAPTURE_MAGIC));
+    qToLittleEndian<quint32>(CAPTURE_VERSION, header + 4);
+    qToLittleEndian<qint64>(QDateTime::currentMSecsSinceEpoch(), header + 8);
+    
+    clock.start();
+    lastTimestampUs = 0;
+    packetCount = 0;
+    
+    if (!flush()) {
+        if (errorMessage) {
+            *errorMessage = file.errorString();
+        }
+        file.close();
+        return false;
+    }
+    
+    return true;
+}
+
+/**
+ * @brief Flushes and closes the capture file.
+ */
+void CaptureWriter::close()
+{
+    if (!file.isOpen()) {
+        return;
+    }
+    
+    flush();
+    file.close();
+}
+
+/**
+ * @brief Checks if a capture file is open.
+ * @return True if open, false otherwise.
+ */
+bool CaptureWriter::isOpen() const
+{
+    return file.isOpen();
+}
+
+/**
+ * @brief Logs a received packet with the current arrival time.
+ * @param packet The packet, referencing the receive buffer.
+ * @return True if successful, false on a write error.
+ */
+bool CaptureWriter::write(const PacketView &packet)
+{
+    if (!file.isOpen()) {
+        return false;
+    }
+    
+    // Delta to the previous record on the monotonic clock
+    qint64 timestampUs = clock.nsecsElapsed() / 1000;
+    qint64 delta = qBound<qint64>(0, timestampUs - lastTimestampUs, UINT_MAX);
+    lastTimestampUs += delta;
+    
+    // The header in front of the view is still in the receive buffer
+    int used = buffer.size();
+    int wireSize = PacketFraming::HeaderSize + packet.size;
+    buffer.resize(used + RECORD_HEADER_SIZE + wireSize);
+    qToLittleEndian<quint32>(static_cast<quint32>(delta), buffer.data() + used);
+    memcpy(buffer.data() + used + RECORD_HEADER_SIZE, packet.data - PacketFraming::HeaderSize, wireSize);
+    packetCount++;
+    
+    if (buffer.size() >= CAPTURE_FLUSH_SIZE) {
+        return flush();
+    }
+    
+    return true;
+}
+
+/**
+ * @brief Gets the number of packets logged.
+ * @return The packet count.
+ */
+qint64 CaptureWriter::getPacketCount() const
+{
+    return packetCount;
+}
+
+/**
+ * @brief Gets the description of the last error.
+ * @return The error message.
+ */
+QString CaptureWriter::errorString() const
+{
+    return file.errorString();
+}
+
+/**
+ * @brief Writes the buffered records to the file.
+ * @return True if successful, false on a write error.
+ */
+bool CaptureWriter::flush()
+{
+    if (buffer.isEmpty()) {
+        return true;
+    }
+    
+    bool ok = file.write(buffer) == buffer.size();
+    buffer.resize(0); // keeps the reserved capacity
+    
+    return ok;
+}
+
+/**
+ * @brief Constructor for CaptureReader.
+ */
+CaptureReader::CaptureReader()
+    : data(nullptr)
+    , size(0)
+    , offset(0)
+    , timestampUs(0)
+    , startTime(0)
+{
+}
+
+/**
+ * @brief Destructor for CaptureReader.
+ */
+CaptureReader::~CaptureReader()
+{
+    close();
+}
+
+/**
+ * @brief Opens and maps a capture file.
+ * @param filePath The path of the capture file.
+ * @param errorMessage Receives the reason of a failure (optional).
+ * @return True if the file is a valid capture, false otherwise.
+ */
+bool CaptureReader::open(const QString &filePath, QString *errorMessage)
+{
+    close();
+    
+    file.setFileName(filePath);
+    if (!file.open(QIODevice::ReadOnly)) {
+        if (errorMessage) {
+            *errorMessage = file.errorString();
+        }
+        return false;
+    }
+    
+    size = file.size();
+    data = size >= CAPTURE_HEADER_SIZE ? file.map(0, size) : nullptr;
+    if (!data || memcmp(data, CAPTURE_MAGIC, sizeof(CAPTURE_MAGIC)) != 0
+        || qFromLittleEndian<quint32>(data + 4) != CAPTURE_VERSION) {
+        if (errorMessage) {
+            *errorMessage = data ? QObject::tr("Not a capture file") : file.errorString();
+        }
+        close();
+        return false;
+    }
+
+#ifdef Q_OS_UNIX
+    // Records are read front to back, so let the kernel read ahead aggressively
+    madvise(const_cast<uchar*>(data), static_cast<size_t>(size), MADV_SEQUENTIAL);
+#endif
+    
+    startTime = qFromLittleEndian<qint64>(data + 8);
+    rewind();
+    
+    return true;
+}
+
+/**
+ * @brief Unmaps and closes the capture file.
+ */
+void CaptureReader::close()
+{
+    if (data) {
+        file.unmap(const_cast<uchar*>(data));
+        data = nullptr;
+    }
+    if (file.isOpen()) {
+        file.close();
+    }
+    size = 0;
+    offset = 0;
+}
+
+/**
+ * @brief Checks if a capture file is open.
+ * @return True if open, false otherwise.
+ */
+bool CaptureReader::isOpen() const
+{
+    return data != nullptr;
+}
+
+/**
+ * @brief Reads the next record.
+ *
+ * The record references the mapped file and stays valid until close().
+ *
+ * @param record The record (output).
+ * @return True if a record was read, false at the end of the capture.
+ */
+bool CaptureReader::next(CaptureRecord &record)
+{
+    qint64 remaining = size - offset - RECORD_HEADER_SIZE;
+    if (!data || remaining < PacketFraming::HeaderSize) {
+        return false;
+    }
+    
+    const char *start = reinterpret_cast<const char*>(data + offset);
+    if (!PacketFraming::parse(start + RECORD_HEADER_SIZE, static_cast<int>(qMin<qint64>(remaining, INT_MAX)),
+                              record.packet)) {
+        return false;
+    }
+    
+    timestampUs += qFromLittleEndian<quint32>(start);
+    record.timestampUs = timestampUs;
+    offset += RECORD_HEADER_SIZE + PacketFraming::HeaderSize + record.packet.size;
+    
+    return true;
+}
+
+/**
+ * @brief Goes back to the first record.
+ */
+void CaptureReader::rewind()
+{
+    offset = CAPTURE_HEADER_SIZE;
+    timestampUs = 0;
+}
+
+/**
+ * @brief Checks if reading stopped in front of an incomplete record.
+ *
+ * Only meaningful once next() has returned false, e.g. for a capture cut
+ * short by a crash.
+ *
+ * @return True if bytes are left after the last complete record, false otherwise.
+ */
+bool CaptureReader::isTruncated() const
+{
+    return data && offset < size;
+}
+
+/**
+ * @brief Gets the wall-clock time the capture started.
+ * @return The start time in milliseconds since the epoch.
+ */
+qint64 CaptureReader::getStartTime() const
+{
+    return startTime;
+}
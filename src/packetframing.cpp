@@ -0,0 +1,343 @@
+#include "../include/packetframing.h"
+#include <QtCore/QObject>
+#include <QtCore/QtEndian>
+#include <cstring>
+
+#if defined(__SSE4_2__) && defined(__x86_64__)
+#include <nmmintrin.h>
+#endif
+
+// Offsets of the header fields
+const int VERSION_OFFSET = 0;
+const int TYPE_OFFSET = 1;
+const int STREAM_OFFSET = 2;
+const int CODEC_OFFSET = 3;
+const int LENGTH_OFFSET = 4;
+const int SEQUENCE_OFFSET = 8;
+const int TIMESTAMP_OFFSET = 12;
+const int CHECKSUM_OFFSET = 16;
+
+#if !defined(__SSE4_2__) || !defined(__x86_64__)
+/**
+ * @brief Gets the lookup table of the CRC-32C (Castagnoli) polynomial.
+ * @return The table, built on first use.
+ */
+static const quint32 *crc32cTable()
+{
+    static const struct Table {
+        quint32 entries[256];
+        Table() {
+            for (quint32 i = 0; i < 256; i++) {
+                quint32 crc = i;
+                for (int bit = 0; bit < 8; bit++) {
+                    crc = (crc >> 1) ^ (0x82F63B78u & (0u - (crc & 1u)));
+                }
+                entries[i] = crc;
+            }
+        }
+    } table;
+    return table.entries;
+}
+#endif
+
+/**
+ * @brief Continues a CRC-32C over more bytes.
+ * @param crc The running CRC (inverted, start with 0xFFFFFFFF).
+ * @param data The bytes.
+ * @param size The number of bytes.
+ * @return The updated running CRC.
+ */
+static quint32 crc32cUpdate(quint32 crc, const char *data, int size)
+{
+    const uchar *bytes = reinterpret_cast<const uchar*>(data);
+    int i = 0;
+#if defined(__SSE4_2__) && defined(__x86_64__)
+    // The CRC32 instruction computes exactly this polynomial, eight bytes at a time
+    quint64 wide = crc;
+    for (; i + 8 <= size; i += 8) {
+        quint64 chunk;
+        memcpy(&chunk, bytes + i, sizeof(chunk));
+        wide = _mm_crc32_u64(wide, chunk);
+    }
+    crc = static_cast<quint32>(wide);
+    for (; i < size; i++) {
+        crc = _mm_crc32_u8(crc, bytes[i]);
+    }
+#else
+    const quint32 *table = crc32cTable();
+    for (; i < size; i++) {
+        crc = table[(crc ^ bytes[i]) & 0xFF] ^ (crc >> 8);
+    }
+#endif
+    return crc;
+}
+
+/**
+ * @brief Fills in the header fields of a packet and its checksum.
+ * @param header The header buffer (HeaderSize bytes, followed by any length table).
+ * @param type The packet type.
+ * @param payloadSize The payload size, including any length table.
+ * @param stamp The sequence number, timestamp, stream and codec.
+ * @param payloads The payload segments after the header buffer.
+ */
+static void writeHeader(QByteArray &header, char type, quint32 payloadSize, const PacketStamp &stamp,
+                        const QList<QByteArray> &payloads)
+{
+    char *bytes = header.data();
+    bytes[VERSION_OFFSET] = static_cast<char>(PacketFraming::ProtocolVersion);
+    bytes[TYPE_OFFSET] = type;
+    bytes[STREAM_OFFSET] = static_cast<char>(stamp.stream);
+    bytes[CODEC_OFFSET] = static_cast<char>(stamp.codec);
+    qToBigEndian<quint32>(payloadSize, bytes + LENGTH_OFFSET);
+    qToBigEndian<quint32>(stamp.sequence, bytes + SEQUENCE_OFFSET);
+    qToBigEndian<quint32>(stamp.timestamp, bytes + TIMESTAMP_OFFSET);
+    
+    quint32 crc = crc32cUpdate(0xFFFFFFFFu, bytes, CHECKSUM_OFFSET);
+    crc = crc32cUpdate(crc, bytes + PacketFraming::HeaderSize, header.size() - PacketFraming::HeaderSize);
+    for (const QByteArray &segment : payloads) {
+        crc = crc32cUpdate(crc, segment.constData(), segment.size());
+    }
+    qToBigEndian<quint32>(~crc, bytes + CHECKSUM_OFFSET);
+}
+
+/**
+ * @brief Gets the total number of bytes on the wire.
+ * @return The header size plus the size of every payload segment.
+ */
+int OutgoingPacket::wireSize() const
+{
+    int size = header.size();
+    for (const QByteArray &segment : payloads) {
+        size += segment.size();
+    }
+    return size;
+}
+
+/**
+ * @brief Checks if the packet carries audio, which may be dropped under congestion.
+ * @return True for audio and audio batch packets, false for control packets.
+ */
+bool OutgoingPacket::isDroppable() const
+{
+    return header.size() > TYPE_OFFSET &&
+           (header.at(TYPE_OFFSET) == PACKET_TYPE_AUDIO || header.at(TYPE_OFFSET) == PACKET_TYPE_AUDIO_BATCH);
+}
+
+/**
+ * @brief Wraps the payload in a QByteArray without copying it.
+ * @return A QByteArray referencing the receive buffer.
+ */
+QByteArray PacketView::payload() const
+{
+    return QByteArray::fromRawData(data, size);
+}
+
+/**
+ * @brief Frames a payload without copying it.
+ * @param type The packet type.
+ * @param payload The packet payload.
+ * @param stamp The sequence number, timestamp, stream and codec.
+ * @return The outgoing packet.
+ */
+OutgoingPacket PacketFraming::frame(char type, const QByteArray &payload, const PacketStamp &stamp)
+{
+    OutgoingPacket packet;
+    
+    // Share the payload
+    if (!payload.isEmpty()) {
+        packet.payloads.append(payload);
+    }
+    
+    packet.header.resize(HeaderSize);
+    writeHeader(packet.header, type, payload.size(), stamp, packet.payloads);
+    
+    return packet;
+}
+
+/**
+ * @brief Frames several audio frames as one batch packet without copying them.
+ * @param frames The audio frames, in order.
+ * @param stamp The sequence number, timestamp, stream and codec.
+ * @return The outgoing batch packet.
+ */
+OutgoingPacket PacketFraming::frameBatch(const QList<QByteArray> &frames, const PacketStamp &stamp)
+{
+    OutgoingPacket packet;
+    
+    // Header, frame count and frame length table
+    quint32 count = frames.size();
+    int tableSize = static_cast<int>((1 + count) * sizeof(quint32));
+    packet.header.resize(HeaderSize + tableSize);
+    
+    char *table = packet.header.data() + HeaderSize;
+    qToBigEndian<quint32>(count, table);
+    
+    quint32 size = tableSize;
+    for (int i = 0; i < frames.size(); i++) {
+        quint32 frameSize = frames.at(i).size();
+        qToBigEndian<quint32>(frameSize, table + (1 + i) * sizeof(quint32));
+        size += frameSize;
+    }
+    
+    // Share the frames
+    packet.payloads = frames;
+    writeHeader(packet.header, PACKET_TYPE_AUDIO_BATCH, size, stamp, packet.payloads);
+    
+    return packet;
+}
+
+/**
+ * @brief Flattens an outgoing packet into a single buffer.
+ * @param packet The packet to flatten.
+ * @return The packet bytes as they appear on the wire.
+ */
+QByteArray PacketFraming::flatten(const OutgoingPacket &packet)
+{
+    QByteArray bytes;
+    bytes.reserve(packet.wireSize());
+    bytes.append(packet.header);
+    for (const QByteArray &segment : packet.payloads) {
+        bytes.append(segment);
+    }
+    return bytes;
+}
+
+/**
+ * @brief Parses and verifies the packet at the start of a buffer.
+ * @param data The buffer.
+ * @param size The number of bytes in the buffer.
+ * @param view The parsed packet (output), referencing the buffer.
+ * @param error Receives why the buffer holds no valid packet (optional); PacketError::None
+ *              if more data is needed.
+ * @return True if a complete, valid packet was found, false otherwise.
+ */
+bool PacketFraming::parse(const char *data, int size, PacketView &view, PacketError *error)
+{
+    if (error) {
+        *error = PacketError::None;
+    }
+    
+    // The version is checked first, so an old peer is recognized by its first byte
+    if (size < 1) {
+        return false;
+    }
+    if (static_cast<quint8>(data[VERSION_OFFSET]) != ProtocolVersion) {
+        if (error) {
+            *error = PacketError::Version;
+        }
+        return false;
+    }
+    
+    // Check minimum packet size
+    if (size < HeaderSize) {
+        return false;
+    }
+    
+    // Extract data size
+    quint32 payloadSize = qFromBigEndian<quint32>(data + LENGTH_OFFSET);
+    if (payloadSize > static_cast<quint32>(MaxPayloadSize)) {
+        if (error) {
+            *error = PacketError::Size;
+        }
+        return false;
+    }
+    
+    // Check packet size
+    if (static_cast<quint32>(size - HeaderSize) < payloadSize) {
+        return false;
+    }
+    
+    // Verify the checksum over the header fields and the payload
+    quint32 crc = crc32cUpdate(0xFFFFFFFFu, data, CHECKSUM_OFFSET);
+    crc = ~crc32cUpdate(crc, data + HeaderSize, static_cast<int>(payloadSize));
+    if (crc != qFromBigEndian<quint32>(data + CHECKSUM_OFFSET)) {
+        if (error) {
+            *error = PacketError::Checksum;
+        }
+        return false;
+    }
+    
+    view.type = data[TYPE_OFFSET];
+    view.data = data + HeaderSize;
+    view.size = static_cast<int>(payloadSize);
+    view.stamp.stream = static_cast<quint8>(data[STREAM_OFFSET]);
+    view.stamp.codec = static_cast<quint8>(data[CODEC_OFFSET]);
+    view.stamp.sequence = qFromBigEndian<quint32>(data + SEQUENCE_OFFSET);
+    view.stamp.timestamp = qFromBigEndian<quint32>(data + TIMESTAMP_OFFSET);
+    
+    return true;
+}
+
+/**
+ * @brief Splits a batch payload into views of its frames.
+ * @param batch The batch packet payload.
+ * @param frames The frame views (output), referencing the payload.
+ * @return True if the batch was well formed, false otherwise.
+ */
+bool PacketFraming::splitBatch(const PacketView &batch, QList<PacketView> &frames)
+{
+    frames.clear();
+    
+    if (batch.size < static_cast<int>(sizeof(quint32))) {
+        return false;
+    }
+    
+    // Read the frame count and make sure the length table fits
+    quint32 count = qFromBigEndian<quint32>(batch.data);
+    
+    quint64 tableSize = (1 + static_cast<quint64>(count)) * sizeof(quint32);
+    if (tableSize > static_cast<quint64>(batch.size)) {
+        return false;
+    }
+    
+    // Walk the table, the frames follow it back to back
+    const char *table = batch.data + sizeof(quint32);
+    quint64 offset = tableSize;
+    
+    for (quint32 i = 0; i < count; i++) {
+        quint32 frameSize = qFromBigEndian<quint32>(table + i * sizeof(quint32));
+        
+        if (offset + frameSize > static_cast<quint64>(batch.size)) {
+            frames.clear();
+            return false;
+        }
+        
+        PacketView frame;
+        frame.type = PACKET_TYPE_AUDIO;
+        frame.data = batch.data + offset;
+        frame.size = static_cast<int>(frameSize);
+        frame.stamp = batch.stamp;
+        frames.append(frame);
+        
+        offset += frameSize;
+    }
+    
+    return true;
+}
+
+/**
+ * @brief Describes a parse error for the user.
+ * @param error The error.
+ * @param data The start of the offending packet (for the version byte).
+ * @return The description.
+ */
+QString PacketFraming::errorString(PacketError error, const char *data)
+{
+    switch (error) {
+        case PacketError::Version:
+            // Version 1 packets start with their type letter instead of a version
+            if (static_cast<quint8>(data[VERSION_OFFSET]) >= 'A') {
+                return QObject::tr("The peer runs an older AudioBridge (protocol version 1). "
+                                   "Both sides need protocol version %1.").arg(ProtocolVersion);
+            }
+            return QObject::tr("The peer speaks protocol version %1, this AudioBridge speaks version %2.")
+                .arg(static_cast<quint8>(data[VERSION_OFFSET])).arg(ProtocolVersion);
+        case PacketError::Size:
+            return QObject::tr("The peer sent a packet larger than the protocol allows.");
+        case PacketError::Checksum:
+            return QObject::tr("The peer sent a corrupted packet (checksum mismatch).");
+        case PacketError::None:
+            break;
+    }
+    return QString();
+}
@@ -0,0 +1,207 @@
+#include "../include/ratecontroller.h"
+
+// Interval between controller updates
+const int UPDATE_INTERVAL_MS = 100;
+
+// Time the link must be clear before the bitrate is increased again
+const int INCREASE_HOLD_MS = 2000;
+
+// Loss (percent) above which the link counts as congested
+const int CONGESTION_LOSS_PERCENT = 5;
+
+// Loss (percent) above which in-band FEC is enabled
+const int FEC_LOSS_PERCENT = 1;
+
+// Frame durations used by the controller (shortest first)
+const int MIN_FRAME_DURATION_MS = 10;
+const int MAX_FRAME_DURATION_MS = 40;
+
+/**
+ * @brief Constructor for RateController.
+ * @param parent The parent object.
+ */
+RateController::RateController(QObject *parent)
+    : QObject(parent)
+    , updateTimer(new QTimer(this))
+    , lastDecreaseMs(0)
+    , lastIncreaseMs(0)
+    , sendBacklog(0)
+    , roundTripTimeMs(0)
+    , targetQueueDelayMs(40)
+    , queueDelayMs(0)
+    , minBitrate(12000)
+    , maxBitrate(128000)
+    , bitrate(64000)
+    , lossPercent(0)
+    , sendDrops(0)
+    , frameDurationMs(MIN_FRAME_DURATION_MS)
+    , fec(false)
+{
+    updateTimer->setInterval(UPDATE_INTERVAL_MS);
+    connect(updateTimer, &QTimer::timeout, this, &RateController::update);
+}
+
+/**
+ * @brief Starts controlling from the given initial bitrate.
+ * @param initialBitrate The bitrate to start with, in bits per second.
+ */
+void RateController::start(int initialBitrate)
+{
+    bitrate = qBound(minBitrate, initialBitrate, maxBitrate);
+    lossPercent = 0;
+    frameDurationMs = MIN_FRAME_DURATION_MS;
+    fec = false;
+    sendBacklog = 0;
+    sendDrops = 0;
+    queueDelayMs = 0;
+    
+    clock.start();
+    lastDecreaseMs = 0;
+    lastIncreaseMs = 0;
+    updateTimer->start();
+    
+    emit encoderSettingsChanged(bitrate, fec, lossPercent, frameDurationMs);
+}
+
+/**
+ * @brief Stops controlling.
+ */
+void RateController::stop()
+{
+    updateTimer->stop();
+}
+
+/**
+ * @brief Sets the queueing delay the controller keeps the stream under.
+ * @param delayMs The target queueing delay in milliseconds.
+ */
+void RateController::setTargetQueueDelay(int delayMs)
+{
+    targetQueueDelayMs = qMax(1, delayMs);
+}
+
+/**
+ * @brief Sets the range the bitrate is adjusted in.
+ * @param minBitrate The lowest bitrate, in bits per second.
+ * @param maxBitrate The highest bitrate, in bits per second.
+ */
+void RateController::setBitrateRange(int minBitrate, int maxBitrate)
+{
+    this->minBitrate = qMax(6000, minBitrate);
+    this->maxBitrate = qMax(this->minBitrate, maxBitrate);
+    bitrate = qBound(this->minBitrate, bitrate, this->maxBitrate);
+}
+
+/**
+ * @brief Gets the current target bitrate.
+ * @return The bitrate in bits per second.
+ */
+int RateController::getBitrate() const
+{
+    return bitrate;
+}
+
+/**
+ * @brief Gets the last estimated queueing delay.
+ * @return The queueing delay in milliseconds.
+ */
+int RateController::getQueueDelay() const
+{
+    return queueDelayMs;
+}
+
+/**
+ * @brief Updates the round-trip time.
+ * @param rttMs The round-trip time in milliseconds.
+ */
+void RateController::setRoundTripTime(int rttMs)
+{
+    roundTripTimeMs = qMax(0, rttMs);
+}
+
+/**
+ * @brief Updates the number of bytes waiting to be sent.
+ * @param bytes The send backlog in bytes.
+ */
+void RateController::setSendBacklog(qint64 bytes)
+{
+    sendBacklog = qMax<qint64>(0, bytes);
+}
+
+/**
+ * @brief Processes a loss report from the receiver.
+ * @param framesExpected The number of frames the receiver expected to play.
+ * @param framesLost The number of those frames that were missing.
+ */
+void RateController::processReceiverReport(quint32 framesExpected, quint32 framesLost)
+{
+    if (framesExpected == 0) {
+        return;
+    }
+    
+    // Smooth the reported loss so a single bad second doesn't dominate
+    int reported = static_cast<int>(qMin<quint64>(100, 100ULL * framesLost / framesExpected));
+    lossPercent = (lossPercent + 3 * reported + 3) / 4;
+}
+
+/**
+ * @brief Processes audio the sender dropped because it waited too long to be sent.
+ * @param packets The number of packets dropped.
+ */
+void RateController::processSendDrops(int packets)
+{
+    sendDrops += packets;
+}
+
+/**
+ * @brief Re-evaluates the encoder settings.
+ */
+void RateController::update()
+{
+    qint64 now = clock.elapsed();
+    
+    // Time the backlog needs to drain at the current bitrate
+    queueDelayMs = static_cast<int>(sendBacklog * 8000 / qMax(1, bitrate));
+    
+    // Drops from the send queue mean the backlog already hit its limit
+    bool congested = queueDelayMs > targetQueueDelayMs || lossPercent > CONGESTION_LOSS_PERCENT ||
+                     sendDrops > 0;
+    sendDrops = 0;
+    
+    int newBitrate = bitrate;
+    int newFrameDuration = frameDurationMs;
+    
+    // Give every decrease at least one round trip to take effect
+    int reactionMs = qMax(UPDATE_INTERVAL_MS, roundTripTimeMs);
+    
+    if (congested) {
+        if (now - lastDecreaseMs >= reactionMs) {
+            newBitrate = qMax(minBitrate, bitrate * 7 / 10);
+            lastDecreaseMs = now;
+            
+            // Deep backlog: longer frames cut the per-packet overhead
+            if (queueDelayMs > 2 * targetQueueDelayMs) {
+                newFrameDuration = qMin(MAX_FRAME_DURATION_MS, frameDurationMs * 2);
+            }
+        }
+    } else if (queueDelayMs < targetQueueDelayMs / 2 &&
+               now - lastDecreaseMs >= INCREASE_HOLD_MS &&
+               now - lastIncreaseMs >= qMax(500, reactionMs)) {
+        newBitrate = qMin(maxBitrate, bitrate + qMax(1000, bitrate / 20));
+        lastIncreaseMs = now;
+        
+        // Return to short frames once the link has recovered
+        if (frameDurationMs > MIN_FRAME_DURATION_MS && lossPercent == 0) {
+            newFrameDuration = frameDurationMs / 2;
+        }
+    }
+    
+    bool newFec = lossPercent >= FEC_LOSS_PERCENT;
+    
+    if (newBitrate != bitrate || newFec != fec || newFrameDuration != frameDurationMs) {
+        bitrate = newBitrate;
+        fec = newFec;
+        frameDurationMs = newFrameDuration;
+        emit encoderSettingsChanged(bitrate, fec, lossPercent, frameDurationMs);
+    }
+}
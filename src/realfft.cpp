@@ -0,0 +1,205 @@
+#include "../include/realfft.h"
+#include <cmath>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+/**
+ * @brief Constructor for RealFft.
+ * @param size The transform size (a power of two, at least 4), or 0 for none yet.
+ */
+RealFft::RealFft(int size)
+    : size(0)
+{
+    if (size > 0) {
+        setSize(size);
+    }
+}
+
+/**
+ * @brief Sets the transform size and builds the tables.
+ * @param size The transform size (a power of two, at least 4).
+ */
+void RealFft::setSize(int size)
+{
+    this->size = size;
+    int half = size / 2;
+    
+    // Bit-reversal permutation of the half-size complex transform
+    int bits = 0;
+    while ((1 << bits) < half) {
+        bits++;
+    }
+    bitReverse.resize(half);
+    for (int i = 0; i < half; i++) {
+        int reversed = 0;
+        for (int b = 0; b < bits; b++) {
+            reversed |= ((i >> b) & 1) << (bits - 1 - b);
+        }
+        bitReverse[i] = reversed;
+    }
+    
+    // Butterfly twiddles of the complex transform, one contiguous run per
+    // stage: the stage of span 2h uses e^(-i pi j / h) for j < h, stored from
+    // index h - 1
+    stageCos.resize(qMax(1, half - 1));
+    stageSin.resize(qMax(1, half - 1));
+    for (int h = 1; h < half; h <<= 1) {
+        for (int j = 0; j < h; j++) {
+            double angle = M_PI * j / h;
+            stageCos[h - 1 + j] = static_cast<float>(std::cos(angle));
+            stageSin[h - 1 + j] = static_cast<float>(std::sin(angle));
+        }
+    }
+    
+    // Twiddles that split the packed transform into the real spectrum: e^(-2 pi i k / size)
+    twiddleCos.resize(half + 1);
+    twiddleSin.resize(half + 1);
+    for (int k = 0; k <= half; k++) {
+        double angle = 2.0 * M_PI * k / size;
+        twiddleCos[k] = static_cast<float>(std::cos(angle));
+        twiddleSin[k] = static_cast<float>(std::sin(angle));
+    }
+    
+    workRe.resize(half);
+    workIm.resize(half);
+}
+
+/**
+ * @brief Gets the transform size.
+ * @return The number of real samples per transform.
+ */
+int RealFft::getSize() const
+{
+    return size;
+}
+
+/**
+ * @brief Transforms real samples to a spectrum.
+ * @param input The size real samples.
+ * @param re The real parts of the size / 2 + 1 bins (output).
+ * @param im The imaginary parts of the size / 2 + 1 bins (output).
+ */
+void RealFft::forward(const float *input, float *re, float *im)
+{
+    int half = size / 2;
+    float *zr = workRe.data();
+    float *zi = workIm.data();
+    
+    // Pack even samples as real and odd samples as imaginary parts
+    for (int k = 0; k < half; k++) {
+        zr[k] = input[2 * k];
+        zi[k] = input[2 * k + 1];
+    }
+    transform(zr, zi);
+    
+    // Separate the spectra of the even and odd samples and combine them
+    for (int k = 0; k <= half; k++) {
+        int a = k % half;
+        int b = (half - k) % half;
+        float evenRe = 0.5f * (zr[a] + zr[b]);
+        float evenIm = 0.5f * (zi[a] - zi[b]);
+        float oddRe = 0.5f * (zi[a] + zi[b]);
+        float oddIm = -0.5f * (zr[a] - zr[b]);
+        float c = twiddleCos[k];
+        float s = twiddleSin[k];
+        re[k] = evenRe + c * oddRe + s * oddIm;
+        im[k] = evenIm + c * oddIm - s * oddRe;
+    }
+}
+
+/**
+ * @brief Transforms a spectrum back to real samples.
+ * @param re The real parts of the size / 2 + 1 bins.
+ * @param im The imaginary parts of the size / 2 + 1 bins.
+ * @param output The size real samples (output).
+ */
+void RealFft::inverse(const float *re, const float *im, float *output)
+{
+    int half = size / 2;
+    float *zr = workRe.data();
+    float *zi = workIm.data();
+    
+    // Rebuild the packed spectrum of the even and odd samples
+    for (int k = 0; k < half; k++) {
+        int b = half - k;
+        float evenRe = 0.5f * (re[k] + re[b]);
+        float evenIm = 0.5f * (im[k] - im[b]);
+        float diffRe = 0.5f * (re[k] - re[b]);
+        float diffIm = 0.5f * (im[k] + im[b]);
+        float c = twiddleCos[k];
+        float s = twiddleSin[k];
+        float oddRe = diffRe * c - diffIm * s;
+        float oddIm = diffRe * s + diffIm * c;
+        zr[k] = evenRe - oddIm;
+        zi[k] = evenIm + oddRe;
+    }
+    
+    // Inverse complex transform by swapping real and imaginary parts
+    transform(zi, zr);
+    
+    float scale = 1.0f / half;
+    for (int k = 0; k < half; k++) {
+        output[2 * k] = zr[k] * scale;
+        output[2 * k + 1] = zi[k] * scale;
+    }
+}
+
+/**
+ * @brief Runs the in-place complex forward FFT of size / 2 points.
+ * @param re The real parts.
+ * @param im The imaginary parts.
+ */
+void RealFft::transform(float *re, float *im) const
+{
+    int n = size / 2;
+    
+    for (int i = 0; i < n; i++) {
+        int j = bitReverse[i];
+        if (j > i) {
+            std::swap(re[i], re[j]);
+            std::swap(im[i], im[j]);
+        }
+    }
+    
+    for (int halfLength = 1; halfLength < n; halfLength <<= 1) {
+        const float *wr = stageCos.constData() + halfLength - 1;
+        const float *ws = stageSin.constData() + halfLength - 1;
+        
+        for (int i = 0; i < n; i += 2 * halfLength) {
+            float *topRe = re + i;
+            float *topIm = im + i;
+            float *bottomRe = topRe + halfLength;
+            float *bottomIm = topIm + halfLength;
+            int j = 0;
+            
+#if defined(__SSE2__)
+            for (; j + 4 <= halfLength; j += 4) {
+                __m128 c = _mm_loadu_ps(wr + j);
+                __m128 s = _mm_loadu_ps(ws + j);
+                __m128 br = _mm_loadu_ps(bottomRe + j);
+                __m128 bi = _mm_loadu_ps(bottomIm + j);
+                __m128 vr = _mm_add_ps(_mm_mul_ps(br, c), _mm_mul_ps(bi, s));
+                __m128 vi = _mm_sub_ps(_mm_mul_ps(bi, c), _mm_mul_ps(br, s));
+                __m128 tr = _mm_loadu_ps(topRe + j);
+                __m128 ti = _mm_loadu_ps(topIm + j);
+                _mm_storeu_ps(bottomRe + j, _mm_sub_ps(tr, vr));
+                _mm_storeu_ps(bottomIm + j, _mm_sub_ps(ti, vi));
+                _mm_storeu_ps(topRe + j, _mm_add_ps(tr, vr));
+                _mm_storeu_ps(topIm + j, _mm_add_ps(ti, vi));
+            }
+#endif
+            
+            // Multiply by the twiddle e^(-i angle) = cos - i sin
+            for (; j < halfLength; j++) {
+                float vr = bottomRe[j] * wr[j] + bottomIm[j] * ws[j];
+                float vi = bottomIm[j] * wr[j] - bottomRe[j] * ws[j];
+                bottomRe[j] = topRe[j] - vr;
+                bottomIm[j] = topIm[j] - vi;
+                topRe[j] += vr;
+                topIm[j] += vi;
+            }
+        }
+    }
+}
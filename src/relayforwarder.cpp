@@ -0,0 +1,453 @@
+#include "../include/relayforwarder.h"
+#include <QtCore/QDebug>
+#include <QtCore/QRandomGenerator>
+#include <QtCore/QtEndian>
+
+#ifdef Q_OS_UNIX
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <errno.h>
+#endif
+
+// Offsets of the type and the payload length in the packet header (see PacketFraming)
+const int HEADER_TYPE_OFFSET = 1;
+const int HEADER_LENGTH_OFFSET = 4;
+
+// Bytes a downstream may have waiting before its audio is dropped (well over
+// 100 ms of raw stereo audio at 48 kHz)
+const qint64 MAX_DOWNSTREAM_BACKLOG = 128 * 1024;
+
+// Interval of the reconnect attempts to downstream receivers
+const int DOWNSTREAM_RECONNECT_INTERVAL_MS = 1000;
+
+// Interval of the logged counters
+const int RELAY_REPORT_INTERVAL_MS = 10000;
+
+/**
+ * @brief Constructor for RelayForwarder.
+ * @param parent The parent object.
+ */
+RelayForwarder::RelayForwarder(QObject *parent)
+    : QObject(parent)
+    , reconnectTimer(new QTimer(this))
+    , reportTimer(new QTimer(this))
+    , hopSumUs(0.0)
+    , hops(0)
+{
+    reconnectTimer->setInterval(DOWNSTREAM_RECONNECT_INTERVAL_MS);
+    connect(reconnectTimer, &QTimer::timeout, this, &RelayForwarder::reconnectDownstreams);
+    reconnectTimer->start();
+    
+    reportTimer->setInterval(RELAY_REPORT_INTERVAL_MS);
+    connect(reportTimer, &QTimer::timeout, this, &RelayForwarder::reportStats);
+    reportTimer->start();
+}
+
+/**
+ * @brief Destructor for RelayForwarder.
+ */
+RelayForwarder::~RelayForwarder()
+{
+    for (Downstream *downstream : downstreams) {
+        closeDownstream(downstream);
+    }
+    qDeleteAll(downstreams);
+}
+
+/**
+ * @brief Checks if packets of a type are passed on to the downstream receivers.
+ * @param type The packet type.
+ * @return True for the packets of the stream, false for per-link control packets.
+ */
+bool RelayForwarder::isForwarded(char type)
+{
+    return type == PACKET_TYPE_AUDIO || type == PACKET_TYPE_AUDIO_BATCH || type == PACKET_TYPE_COMFORT_NOISE ||
+           type == PACKET_TYPE_FORMAT || type == PACKET_TYPE_CODEC;
+}
+
+/**
+ * @brief Adds a downstream receiver and connects to it (reconnecting whenever the link drops).
+ * @param address The receiver's address.
+ * @param port The receiver's port.
+ */
+void RelayForwarder::addDownstream(const QString &address, int port)
+{
+    Downstream *downstream = new Downstream;
+    downstream->address = address;
+    downstream->port = port;
+    do {
+        downstream->sessionToken = QRandomGenerator::global()->generate64();
+    } while (downstream->sessionToken == 0);
+    downstreams.append(downstream);
+    
+    connectDownstream(downstream);
+}
+
+/**
+ * @brief Sets the hello the sender sent, which is passed on to every downstream.
+ * @param payload The hello payload (empty while there is no sender).
+ */
+void RelayForwarder::setUpstreamHello(const QByteArray &payload)
+{
+    // A resuming sender says hello again; the receivers already have it
+    if (payload == upstreamHello) {
+        return;
+    }
+    
+    upstreamHello = payload;
+    if (!SessionHandshake::decode(upstreamHello, upstreamCapabilities)) {
+        upstreamHello.clear();
+    }
+    
+    // Another sender may suit the receivers that refused the last one
+    for (Downstream *downstream : downstreams) {
+        downstream->incompatible = false;
+        if (!downstream->socket || downstream->socket->state() != QAbstractSocket::ConnectedState) {
+            continue;
+        }
+        if (!downstream->hello.isEmpty() && !checkDownstreamHello(downstream, downstream->hello)) {
+            continue;
+        }
+        startStreaming(downstream);
+    }
+}
+
+/**
+ * @brief Sets the estimate of the sender's clock, used to answer the downstream pings.
+ * @param estimate The estimate.
+ */
+void RelayForwarder::setUpstreamClock(const ClockEstimate &estimate)
+{
+    upstreamClock = estimate;
+}
+
+/**
+ * @brief Forgets the sender's stream (a new sender starts its own).
+ */
+void RelayForwarder::resetStream()
+{
+    upstreamHello.clear();
+    lastFormatPacket.clear();
+    lastCodecPacket.clear();
+    upstreamClock = ClockEstimate();
+    
+    // The links stay up; the receivers get the next sender's hello
+    for (Downstream *downstream : downstreams) {
+        downstream->streaming = false;
+    }
+}
+
+/**
+ * @brief Passes packets on to every streaming downstream receiver.
+ * @param data One or more complete packets of forwarded types, as they arrived.
+ * @param size The size in bytes.
+ * @param receiveUs When the packets arrived, on the ClockSync::now() clock.
+ */
+void RelayForwarder::forward(const char *data, int size, qint64 receiveUs)
+{
+    // Only the headers are looked at: to count the packets and to keep the
+    // stream state for receivers that connect later
+    int offset = 0;
+    int packets = 0;
+    while (offset + PacketFraming::HeaderSize <= size) {
+        char type = data[offset + HEADER_TYPE_OFFSET];
+        int packetSize = PacketFraming::HeaderSize +
+                         static_cast<int>(qFromBigEndian<quint32>(data + offset + HEADER_LENGTH_OFFSET));
+        if (type == PACKET_TYPE_FORMAT) {
+            lastFormatPacket = QByteArray(data + offset, packetSize);
+        } else if (type == PACKET_TYPE_CODEC) {
+            lastCodecPacket = QByteArray(data + offset, packetSize);
+        }
+        offset += packetSize;
+        packets++;
+    }
+    
+    for (Downstream *downstream : downstreams) {
+        if (downstream->streaming) {
+            writeDownstream(downstream, data, size);
+        }
+    }
+    
+    stats.forwardedPackets += packets;
+    stats.forwardedBytes += size;
+    
+    qint64 hopUs = ClockSync::now() - receiveUs;
+    hopSumUs += hopUs;
+    hops++;
+    stats.maxHopUs = qMax(stats.maxHopUs, hopUs);
+}
+
+/**
+ * @brief Passes on a packet that is no longer in its wire form (re-framed with its stamp).
+ * @param packet The packet.
+ * @param receiveUs When the packet arrived, on the ClockSync::now() clock.
+ */
+void RelayForwarder::forwardPacket(const PacketView &packet, qint64 receiveUs)
+{
+    QByteArray bytes = PacketFraming::flatten(PacketFraming::frame(packet.type, packet.payload(), packet.stamp));
+    forward(bytes.constData(), bytes.size(), receiveUs);
+}
+
+/**
+ * @brief Gets the relay counters.
+ * @return The statistics since construction.
+ */
+RelayStats RelayForwarder::getStats() const
+{
+    RelayStats current = stats;
+    current.downstreams = downstreams.size();
+    for (const Downstream *downstream : downstreams) {
+        if (downstream->streaming) {
+            current.connectedDownstreams++;
+        }
+    }
+    current.averageHopUs = hops > 0 ? hopSumUs / hops : 0.0;
+    return current;
+}
+
+/**
+ * @brief Reconnects the downstream receivers that are not connected.
+ */
+void RelayForwarder::reconnectDownstreams()
+{
+    for (Downstream *downstream : downstreams) {
+        if (!downstream->socket && !downstream->incompatible) {
+            connectDownstream(downstream);
+        }
+    }
+}
+
+/**
+ * @brief Logs the counters if anything was forwarded since the last report.
+ */
+void RelayForwarder::reportStats()
+{
+    RelayStats current = getStats();
+    if (current.forwardedPackets == reportedStats.forwardedPackets) {
+        return;
+    }
+    
+    qDebug() << "Relay:" << current.forwardedPackets - reportedStats.forwardedPackets << "packets to"
+             << current.connectedDownstreams << "of" << current.downstreams << "downstreams,"
+             << current.droppedPackets - reportedStats.droppedPackets << "dropped, hop"
+             << qRound(current.averageHopUs) << "us on average," << current.maxHopUs << "us at most";
+    reportedStats = current;
+}
+
+/**
+ * @brief Opens the link to a downstream receiver.
+ * @param downstream The receiver.
+ */
+void RelayForwarder::connectDownstream(Downstream *downstream)
+{
+    QTcpSocket *socket = new QTcpSocket(this);
+    downstream->socket = socket;
+    downstream->receiveBuffer.clear();
+    downstream->hello.clear();
+    downstream->streaming = false;
+    
+    connect(socket, &QTcpSocket::connected, this, [this, downstream]() {
+        downstream->socket->setSocketOption(QAbstractSocket::LowDelayOption, 1);
+        qDebug() << "Relaying to" << downstream->address << "port" << downstream->port;
+        
+        // The session goes first, so the receiver resumes it after a drop
+        QByteArray payload(sizeof(quint64), '\0');
+        qToBigEndian<quint64>(downstream->sessionToken, payload.data());
+        writeControl(downstream, PACKET_TYPE_SESSION, payload);
+        
+        if (!upstreamHello.isEmpty()) {
+            startStreaming(downstream);
+        }
+    });
+    connect(socket, &QTcpSocket::readyRead, this, [this, downstream]() {
+        readDownstream(downstream);
+    });
+    connect(socket, &QTcpSocket::disconnected, this, [this, downstream]() {
+        closeDownstream(downstream);
+    });
+    connect(socket, QOverload<QAbstractSocket::SocketError>::of(&QTcpSocket::error), this, [this, downstream]() {
+        // Retried by the reconnect timer
+        closeDownstream(downstream);
+    });
+    
+    socket->connectToHost(downstream->address, static_cast<quint16>(downstream->port));
+}
+
+/**
+ * @brief Closes the link to a downstream receiver.
+ * @param downstream The receiver.
+ */
+void RelayForwarder::closeDownstream(Downstream *downstream)
+{
+    if (!downstream->socket) {
+        return;
+    }
+    
+    // We may be called from one of its signals
+    QObject::disconnect(downstream->socket, nullptr, this, nullptr);
+    downstream->socket->abort();
+    downstream->socket->deleteLater();
+    downstream->socket = nullptr;
+    downstream->streaming = false;
+}
+
+/**
+ * @brief Sends the hello and the stream state to a receiver and starts streaming to it.
+ * @param downstream The receiver (connected).
+ */
+void RelayForwarder::startStreaming(Downstream *downstream)
+{
+    writeControl(downstream, PACKET_TYPE_HELLO, upstreamHello);
+    if (!lastFormatPacket.isEmpty()) {
+        writeDownstream(downstream, lastFormatPacket.constData(), lastFormatPacket.size());
+    }
+    if (!lastCodecPacket.isEmpty()) {
+        writeDownstream(downstream, lastCodecPacket.constData(), lastCodecPacket.size());
+    }
+    downstream->streaming = true;
+}
+
+/**
+ * @brief Parses and answers what a downstream receiver sent.
+ * @param downstream The receiver.
+ */
+void RelayForwarder::readDownstream(Downstream *downstream)
+{
+    qint64 receiveUs = ClockSync::now();
+    downstream->receiveBuffer.append(downstream->socket->readAll());
+    
+    PacketView packet;
+    PacketError parseError = PacketError::None;
+    int offset = 0;
+    
+    while (PacketFraming::parse(downstream->receiveBuffer.constData() + offset,
+                                downstream->receiveBuffer.size() - offset, packet, &parseError)) {
+        offset += PacketFraming::HeaderSize + packet.size;
+        
+        if (packet.type == PACKET_TYPE_HELLO) {
+            // The receiver negotiates with the sender's hello; it has to agree too
+            if (!checkDownstreamHello(downstream, QByteArray(packet.data, packet.size))) {
+                return;
+            }
+        } else if (packet.type == PACKET_TYPE_PING && packet.size >= static_cast<int>(sizeof(qint64))) {
+            // Answered on the sender's clock, which the forwarded timestamps are on;
+            // until it is known the receiver waits for its clock
+            if (upstreamClock.synchronized) {
+                QByteArray payload(3 * sizeof(qint64), '\0');
+                memcpy(payload.data(), packet.data, sizeof(qint64));
+                qToBigEndian<qint64>(upstreamClock.toPeer(receiveUs), payload.data() + sizeof(qint64));
+                qToBigEndian<qint64>(upstreamClock.toPeer(ClockSync::now()), payload.data() + 2 * sizeof(qint64));
+                writeControl(downstream, PACKET_TYPE_PONG, payload);
+            }
+        } else if (packet.type == PACKET_TYPE_FORMAT) {
+            emit downstreamFormatReceived(QByteArray(packet.data, packet.size));
+        }
+        // Anything else (the receiver's own audio, its reports) ends here
+    }
+    
+    if (parseError != PacketError::None) {
+        emit error(tr("Downstream %1: %2").arg(downstream->address,
+                                              PacketFraming::errorString(parseError,
+                                                                         downstream->receiveBuffer.constData() + offset)));
+        closeDownstream(downstream);
+        return;
+    }
+    
+    downstream->receiveBuffer.remove(0, offset);
+}
+
+/**
+ * @brief Checks the receiver's hello against the sender's settings.
+ * @param downstream The receiver.
+ * @param payload The receiver's hello payload.
+ * @return True if the receiver can play the sender's stream, false otherwise.
+ */
+bool RelayForwarder::checkDownstreamHello(Downstream *downstream, const QByteArray &payload)
+{
+    downstream->hello = payload;
+    
+    SessionCapabilities capabilities;
+    NegotiatedSession session;
+    QString message;
+    if (!SessionHandshake::decode(payload, capabilities)) {
+        message = tr("malformed handshake");
+    } else if (upstreamHello.isEmpty() ||
+               SessionHandshake::negotiate(upstreamCapabilities, capabilities, session, &message)) {
+        return true;
+    }
+    
+    // Not retried until another sender connects
+    emit error(tr("Downstream %1 cannot take the stream: %2").arg(downstream->address, message));
+    downstream->incompatible = true;
+    closeDownstream(downstream);
+    return false;
+}
+
+/**
+ * @brief Writes packets to a receiver, dropping audio if it fell behind.
+ * @param downstream The receiver.
+ * @param data One or more complete packets.
+ * @param size The size in bytes.
+ */
+void RelayForwarder::writeDownstream(Downstream *downstream, const char *data, int size)
+{
+    QTcpSocket *socket = downstream->socket;
+    
+    // A receiver that cannot keep up only gets the control packets until it
+    // caught up; the audio would arrive too late to be played anyway
+    if (socket->bytesToWrite() > MAX_DOWNSTREAM_BACKLOG) {
+        int offset = 0;
+        while (offset + PacketFraming::HeaderSize <= size) {
+            char type = data[offset + HEADER_TYPE_OFFSET];
+            int packetSize = PacketFraming::HeaderSize +
+                             static_cast<int>(qFromBigEndian<quint32>(data + offset + HEADER_LENGTH_OFFSET));
+            if (type == PACKET_TYPE_AUDIO || type == PACKET_TYPE_AUDIO_BATCH) {
+                stats.droppedPackets++;
+            } else {
+                socket->write(data + offset, packetSize);
+            }
+            offset += packetSize;
+        }
+        return;
+    }
+
+#ifdef Q_OS_UNIX
+    // Straight from the receive buffer to the kernel while Qt has nothing
+    // buffered, otherwise we would reorder bytes on the stream
+    if (socket->bytesToWrite() == 0) {
+        int flags = 0;
+#ifdef MSG_NOSIGNAL
+        flags = MSG_NOSIGNAL;
+#endif
+        ssize_t written;
+        do {
+            written = ::send(static_cast<int>(socket->socketDescriptor()), data, static_cast<size_t>(size), flags);
+        } while (written < 0 && errno == EINTR);
+        
+        // Qt buffers the rest (and reports real errors)
+        if (written > 0) {
+            data += written;
+            size -= static_cast<int>(written);
+        }
+    }
+#endif
+    
+    if (size > 0) {
+        socket->write(data, size);
+    }
+}
+
+/**
+ * @brief Writes a control packet of the relay's own to a receiver.
+ * @param downstream The receiver.
+ * @param type The packet type.
+ * @param payload The payload.
+ */
+void RelayForwarder::writeControl(Downstream *downstream, char type, const QByteArray &payload)
+{
+    PacketStamp stamp;
+    stamp.timestamp = static_cast<quint32>(ClockSync::now());
+    
+    // Behind whatever is buffered, so the stream stays in order
+    downstream->socket->write(PacketFraming::flatten(PacketFraming::frame(type, payload, stamp)));
+}
@@ -0,0 +1,399 @@
+#include "../include/rtcheck.h"
+
+#ifdef AUDIOBRIDGE_RT_CHECK
+
+#if !defined(__linux__) || !defined(__GLIBC__)
+#error "AUDIOBRIDGE_RT_CHECK needs Linux with glibc"
+#endif
+
+#include <atomic>
+#include <cerrno>
+#include <cstdarg>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <dlfcn.h>
+#include <execinfo.h>
+#include <poll.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <QtCore/QMutex>
+#include <QtCore/QReadWriteLock>
+
+// Qt 6 locks an uncontended QMutex inline, where nothing can be interposed
+#if QT_VERSION >= QT_VERSION_CHECK(6, 0, 0)
+#error "AUDIOBRIDGE_RT_CHECK needs Qt 5"
+#endif
+
+// glibc's own allocator entry points, which the interposed functions forward to
+extern "C" {
+void *__libc_malloc(size_t size);
+void *__libc_calloc(size_t count, size_t size);
+void *__libc_realloc(void *pointer, size_t size);
+void *__libc_memalign(size_t alignment, size_t size);
+void __libc_free(void *pointer);
+}
+
+namespace {
+
+// Violations reported with a stack trace, later ones are only counted
+const int MAX_REPORTS = 20;
+
+// Frames of a reported stack trace
+const int MAX_FRAMES = 32;
+
+/**
+ * @brief What a violation does.
+ */
+enum class CheckMode {
+    Off,      ///< Nothing
+    Report,   ///< Print it with a stack trace
+    Abort     ///< Print it and abort the process
+};
+
+// Per-thread state in static TLS, which is never allocated lazily
+__thread int realtimeDepth __attribute__((tls_model("initial-exec"))) = 0;
+__thread int waiverDepth __attribute__((tls_model("initial-exec"))) = 0;
+__thread bool reporting __attribute__((tls_model("initial-exec"))) = false;
+
+std::atomic<quint64> violations(0);
+std::atomic<int> reports(0);
+CheckMode checkMode = CheckMode::Report;
+
+using MutexLockFunction = int (*)(pthread_mutex_t *);
+using SyscallFunction = long (*)(long, ...);
+using ReadFunction = ssize_t (*)(int, void *, size_t);
+using WriteFunction = ssize_t (*)(int, const void *, size_t);
+using PollFunction = int (*)(struct pollfd *, nfds_t, int);
+using QtLockFunction = void (*)(void *);
+using QtTryLockFunction = bool (*)(void *, int);
+
+MutexLockFunction realMutexLock = nullptr;
+SyscallFunction realSyscall = nullptr;
+ReadFunction realRead = nullptr;
+WriteFunction realWrite = nullptr;
+PollFunction realPoll = nullptr;
+
+// Qt's definitions, by their mangled names
+QtLockFunction realQMutexLock = nullptr;
+QtTryLockFunction realQMutexTryLock = nullptr;
+QtLockFunction realLockForRead = nullptr;
+QtLockFunction realLockForWrite = nullptr;
+
+/**
+ * @brief Looks up the definition of a function that the process interposes.
+ * @param function Receives the next definition.
+ * @param name The name of the function.
+ */
+template<typename Function>
+void resolve(Function &function, const char *name)
+{
+    // dlsym() may allocate, which is fine: nothing is real-time yet, or the
+    // allocation goes straight to glibc
+    if (!function) {
+        function = reinterpret_cast<Function>(dlsym(RTLD_NEXT, name));
+    }
+}
+
+/**
+ * @brief Checks if a call on the calling thread is a violation.
+ * @return True inside a real-time section that is not waived.
+ */
+inline bool isViolation()
+{
+    return realtimeDepth > 0 && waiverDepth == 0 && !reporting && checkMode != CheckMode::Off;
+}
+
+/**
+ * @brief Counts a violation and reports it.
+ * @param call The name of the offending call.
+ */
+void reportViolation(const char *call)
+{
+    // What the report itself calls is not checked
+    reporting = true;
+    quint64 count = violations.fetch_add(1, std::memory_order_relaxed) + 1;
+    
+    if (reports.fetch_add(1, std::memory_order_relaxed) < MAX_REPORTS || checkMode == CheckMode::Abort) {
+        char line[160];
+        int length = snprintf(line, sizeof(line), "RtCheck: %s() on a real-time thread (violation %llu)\n",
+                              call, static_cast<unsigned long long>(count));
+        resolve(realWrite, "write");
+        realWrite(STDERR_FILENO, line, static_cast<size_t>(qMax(0, length)));
+        
+        // Skip this function's own frame
+        void *frames[MAX_FRAMES];
+        int depth = backtrace(frames, MAX_FRAMES);
+        backtrace_symbols_fd(frames + 1, depth - 1, STDERR_FILENO);
+    }
+    
+    if (checkMode == CheckMode::Abort) {
+        abort();
+    }
+    reporting = false;
+}
+
+/**
+ * @brief Prints the number of violations when the process exits.
+ */
+void printSummary()
+{
+    char line[160];
+    int length = snprintf(line, sizeof(line), "RtCheck: %llu violations on real-time threads\n",
+                          static_cast<unsigned long long>(violations.load()));
+    resolve(realWrite, "write");
+    realWrite(STDERR_FILENO, line, static_cast<size_t>(qMax(0, length)));
+}
+
+/**
+ * @brief Reads the mode and prepares the reporting before main() runs.
+ */
+struct Initializer
+{
+    Initializer()
+    {
+        const char *setting = getenv("AUDIOBRIDGE_RT_CHECK");
+        if (setting && strcmp(setting, "off") == 0) {
+            checkMode = CheckMode::Off;
+            return;
+        }
+        if (setting && strcmp(setting, "abort") == 0) {
+            checkMode = CheckMode::Abort;
+        }
+        
+        // The first backtrace() loads the unwinder, which allocates
+        void *frame;
+        backtrace(&frame, 1);
+        
+        resolve(realMutexLock, "pthread_mutex_lock");
+        resolve(realSyscall, "syscall");
+        resolve(realRead, "read");
+        resolve(realWrite, "write");
+        resolve(realPoll, "poll");
+        resolve(realQMutexLock, "_ZN6QMutex4lockEv");
+        resolve(realQMutexTryLock, "_ZN6QMutex7tryLockEi");
+        resolve(realLockForRead, "_ZN14QReadWriteLock11lockForReadEv");
+        resolve(realLockForWrite, "_ZN14QReadWriteLock12lockForWriteEv");
+        atexit(printSummary);
+    }
+} initializer;
+
+} // namespace
+
+/**
+ * @brief Checks if the checks are compiled in and enabled.
+ * @return True if violations are detected, false otherwise.
+ */
+bool RtCheck::isEnabled()
+{
+    return checkMode != CheckMode::Off;
+}
+
+/**
+ * @brief Gets the number of violations so far.
+ * @return The number of flagged calls since the process started.
+ */
+quint64 RtCheck::getViolations()
+{
+    return violations.load(std::memory_order_relaxed);
+}
+
+/**
+ * @brief Enters a real-time section on the calling thread.
+ */
+void RtCheck::enter()
+{
+    realtimeDepth++;
+}
+
+/**
+ * @brief Leaves a real-time section on the calling thread.
+ */
+void RtCheck::leave()
+{
+    realtimeDepth--;
+}
+
+/**
+ * @brief Enters a waived section on the calling thread.
+ */
+void RtCheck::waive()
+{
+    waiverDepth++;
+}
+
+/**
+ * @brief Leaves a waived section on the calling thread.
+ */
+void RtCheck::unwaive()
+{
+    waiverDepth--;
+}
+
+// The interposed functions. They take precedence over glibc's for the whole
+// process, Qt and PortAudio included.
+extern "C" {
+
+void *malloc(size_t size) noexcept
+{
+    if (isViolation()) {
+        reportViolation("malloc");
+    }
+    return __libc_malloc(size);
+}
+
+void *calloc(size_t count, size_t size) noexcept
+{
+    if (isViolation()) {
+        reportViolation("calloc");
+    }
+    return __libc_calloc(count, size);
+}
+
+void *realloc(void *pointer, size_t size) noexcept
+{
+    if (isViolation()) {
+        reportViolation("realloc");
+    }
+    return __libc_realloc(pointer, size);
+}
+
+void free(void *pointer) noexcept
+{
+    if (pointer && isViolation()) {
+        reportViolation("free");
+    }
+    __libc_free(pointer);
+}
+
+void *memalign(size_t alignment, size_t size) noexcept
+{
+    if (isViolation()) {
+        reportViolation("memalign");
+    }
+    return __libc_memalign(alignment, size);
+}
+
+void *aligned_alloc(size_t alignment, size_t size) noexcept
+{
+    if (isViolation()) {
+        reportViolation("aligned_alloc");
+    }
+    return __libc_memalign(alignment, size);
+}
+
+int posix_memalign(void **pointer, size_t alignment, size_t size) noexcept
+{
+    if (isViolation()) {
+        reportViolation("posix_memalign");
+    }
+    if (alignment == 0 || (alignment & (alignment - 1)) != 0 || alignment % sizeof(void *) != 0) {
+        return EINVAL;
+    }
+    void *memory = __libc_memalign(alignment, size);
+    if (!memory) {
+        return ENOMEM;
+    }
+    *pointer = memory;
+    return 0;
+}
+
+int pthread_mutex_lock(pthread_mutex_t *mutex) noexcept
+{
+    if (isViolation()) {
+        reportViolation("pthread_mutex_lock");
+    }
+    resolve(realMutexLock, "pthread_mutex_lock");
+    return realMutexLock(mutex);
+}
+
+long syscall(long number, ...) noexcept
+{
+    // No system call takes more than six arguments
+    va_list arguments;
+    va_start(arguments, number);
+    long a = va_arg(arguments, long);
+    long b = va_arg(arguments, long);
+    long c = va_arg(arguments, long);
+    long d = va_arg(arguments, long);
+    long e = va_arg(arguments, long);
+    long f = va_arg(arguments, long);
+    va_end(arguments);
+    
+    if (isViolation()) {
+        reportViolation("syscall");
+    }
+    resolve(realSyscall, "syscall");
+    return realSyscall(number, a, b, c, d, e, f);
+}
+
+ssize_t read(int fd, void *buffer, size_t size)
+{
+    if (isViolation()) {
+        reportViolation("read");
+    }
+    resolve(realRead, "read");
+    return realRead(fd, buffer, size);
+}
+
+ssize_t write(int fd, const void *buffer, size_t size)
+{
+    if (isViolation()) {
+        reportViolation("write");
+    }
+    resolve(realWrite, "write");
+    return realWrite(fd, buffer, size);
+}
+
+int poll(struct pollfd *fds, nfds_t count, int timeout)
+{
+    if (isViolation()) {
+        reportViolation("poll");
+    }
+    resolve(realPoll, "poll");
+    return realPoll(fds, count, timeout);
+}
+
+} // extern "C"
+
+// Qt's lock calls, which are out of line in Qt 5. Calls from this program,
+// QMutexLocker's included, bind to these definitions; Qt's calls among its
+// own functions may not.
+void QMutex::lock() QT_MUTEX_LOCK_NOEXCEPT
+{
+    if (isViolation()) {
+        reportViolation("QMutex::lock");
+    }
+    resolve(realQMutexLock, "_ZN6QMutex4lockEv");
+    realQMutexLock(this);
+}
+
+bool QMutex::tryLock(int timeout) QT_MUTEX_LOCK_NOEXCEPT
+{
+    // Without a timeout it returns at once, which the callbacks may do
+    if (timeout != 0 && isViolation()) {
+        reportViolation("QMutex::tryLock");
+    }
+    resolve(realQMutexTryLock, "_ZN6QMutex7tryLockEi");
+    return realQMutexTryLock(this, timeout);
+}
+
+void QReadWriteLock::lockForRead()
+{
+    if (isViolation()) {
+        reportViolation("QReadWriteLock::lockForRead");
+    }
+    resolve(realLockForRead, "_ZN14QReadWriteLock11lockForReadEv");
+    realLockForRead(this);
+}
+
+void QReadWriteLock::lockForWrite()
+{
+    if (isViolation()) {
+        reportViolation("QReadWriteLock::lockForWrite");
+    }
+    resolve(realLockForWrite, "_ZN14QReadWriteLock12lockForWriteEv");
+    realLockForWrite(this);
+}
+
+#endif // AUDIOBRIDGE_RT_CHECK
@@ -0,0 +1,134 @@
+#include "../include/sessionhandshake.h"
+#include "../include/packetframing.h"
+#include <QtCore/QObject>
+#include <QtCore/QtEndian>
+
+// Size of the hello payload of this version
+const int HELLO_SIZE = 10;
+
+/**
+ * @brief Gets the capabilities of this build for the given device settings.
+ * @param sampleRate The sample rate.
+ * @param bufferFrames The frames per device buffer.
+ * @param preferredMode The transmission mode chosen by the user.
+ * @return The capabilities.
+ */
+SessionCapabilities SessionHandshake::localCapabilities(int sampleRate, int bufferFrames, TransmissionMode preferredMode)
+{
+    SessionCapabilities capabilities;
+    capabilities.codecs = 1 << PACKET_CODEC_RAW;
+#ifdef AUDIOBRIDGE_HAVE_OPUS
+    // Without libopus the "Opus" mode is a private passthrough format
+    capabilities.codecs |= 1 << PACKET_CODEC_OPUS;
+#endif
+    capabilities.sampleFormats = SAMPLE_FORMAT_FLOAT32;
+    capabilities.preferredMode = preferredMode;
+    capabilities.sampleRate = static_cast<quint32>(sampleRate);
+    capabilities.bufferFrames = static_cast<quint16>(qBound(0, bufferFrames, 0xFFFF));
+    return capabilities;
+}
+
+/**
+ * @brief Builds the payload of a hello packet.
+ * @param capabilities The capabilities to announce.
+ * @return The payload.
+ */
+QByteArray SessionHandshake::encode(const SessionCapabilities &capabilities)
+{
+    QByteArray payload(HELLO_SIZE, '\0');
+    char *bytes = payload.data();
+    bytes[0] = static_cast<char>(capabilities.codecs);
+    bytes[1] = static_cast<char>(codecId(capabilities.preferredMode));
+    bytes[2] = static_cast<char>(capabilities.sampleFormats);
+    qToBigEndian<quint32>(capabilities.sampleRate, bytes + 4);
+    qToBigEndian<quint16>(capabilities.bufferFrames, bytes + 8);
+    return payload;
+}
+
+/**
+ * @brief Parses the payload of a hello packet.
+ * @param payload The payload.
+ * @param capabilities The announced capabilities (output).
+ * @return True if the payload was well formed, false otherwise.
+ */
+bool SessionHandshake::decode(const QByteArray &payload, SessionCapabilities &capabilities)
+{
+    if (payload.size() < HELLO_SIZE) {
+        return false;
+    }
+    
+    const char *bytes = payload.constData();
+    quint8 preferred = static_cast<quint8>(bytes[1]);
+    if (preferred != PACKET_CODEC_RAW && preferred != PACKET_CODEC_OPUS) {
+        return false;
+    }
+    
+    capabilities.codecs = static_cast<quint8>(bytes[0]);
+    capabilities.preferredMode = preferred == PACKET_CODEC_OPUS ? TransmissionMode::Opus : TransmissionMode::Raw;
+    capabilities.sampleFormats = static_cast<quint8>(bytes[2]);
+    capabilities.sampleRate = qFromBigEndian<quint32>(bytes + 4);
+    capabilities.bufferFrames = qFromBigEndian<quint16>(bytes + 8);
+    return true;
+}
+
+/**
+ * @brief Agrees on the session settings.
+ * @param local Our capabilities.
+ * @param peer The peer's capabilities.
+ * @param session The agreed settings (output).
+ * @param errorMessage Receives which setting differs if there is no agreement (optional).
+ * @return True if both sides are compatible, false otherwise.
+ */
+bool SessionHandshake::negotiate(const SessionCapabilities &local, const SessionCapabilities &peer,
+                                 NegotiatedSession &session, QString *errorMessage)
+{
+    // Nothing resamples, so both sides have to run at the same rate
+    if (local.sampleRate != peer.sampleRate) {
+        if (errorMessage) {
+            *errorMessage = QObject::tr("The peer runs at %1 Hz and this side at %2 Hz. "
+                                        "Set both to the same sample rate.")
+                                .arg(peer.sampleRate).arg(local.sampleRate);
+        }
+        return false;
+    }
+    
+    if ((local.sampleFormats & peer.sampleFormats) == 0) {
+        if (errorMessage) {
+            *errorMessage = QObject::tr("The peer supports no sample format this side supports.");
+        }
+        return false;
+    }
+    
+    quint8 common = local.codecs & peer.codecs;
+    if ((common & (1 << PACKET_CODEC_RAW | 1 << PACKET_CODEC_OPUS)) == 0) {
+        if (errorMessage) {
+            *errorMessage = QObject::tr("The peer supports no codec this side supports.");
+        }
+        return false;
+    }
+    
+    // The mode both asked for, or else the one costing the least bandwidth
+    quint8 agreed;
+    if (local.preferredMode == peer.preferredMode && (common & (1 << codecId(local.preferredMode)))) {
+        agreed = codecId(local.preferredMode);
+    } else if (common & (1 << PACKET_CODEC_OPUS)) {
+        agreed = PACKET_CODEC_OPUS;
+    } else {
+        agreed = PACKET_CODEC_RAW;
+    }
+    
+    session.mode = agreed == PACKET_CODEC_OPUS ? TransmissionMode::Opus : TransmissionMode::Raw;
+    session.sampleRate = static_cast<int>(local.sampleRate);
+    session.frameSize = qMax(local.bufferFrames, peer.bufferFrames);
+    return true;
+}
+
+/**
+ * @brief Gets the packet codec id of a transmission mode.
+ * @param mode The transmission mode.
+ * @return The PACKET_CODEC_* id.
+ */
+quint8 SessionHandshake::codecId(TransmissionMode mode)
+{
+    return mode == TransmissionMode::Opus ? PACKET_CODEC_OPUS : PACKET_CODEC_RAW;
+}
@@ -0,0 +1,302 @@
+#include "../include/sessionmanager.h"
+#include <QtCore/QDebug>
+#include <QtCore/QFile>
+#include <QtCore/QFileInfo>
+#include <QtCore/QHash>
+#ifdef Q_OS_LINUX
+#include <unistd.h>
+#endif
+
+/**
+ * @brief Constructor for SessionManager.
+ * @param parent The parent object.
+ */
+SessionManager::SessionManager(QObject *parent)
+    : QObject(parent)
+    , encodePool(nullptr)
+    , deviceRegistry(new DeviceRegistry(this))
+    , reportTimer(new QTimer(this))
+    , workerCount(0)
+{
+    reportTimer->setInterval(10000);
+    connect(reportTimer, &QTimer::timeout, this, &SessionManager::reportStats);
+}
+
+/**
+ * @brief Destructor for SessionManager.
+ */
+SessionManager::~SessionManager()
+{
+    stop();
+}
+
+/**
+ * @brief Reads the sessions from a file and checks their routing.
+ * @param filePath The path of the sessions file.
+ * @param errorMessage Receives the reason if the file is invalid (optional).
+ * @return True if every session was valid, false otherwise.
+ */
+bool SessionManager::loadSessions(const QString &filePath, QString *errorMessage)
+{
+    auto fail = [&](const QString &message) {
+        if (errorMessage) {
+            *errorMessage = message;
+        }
+        return false;
+    };
+    
+    if (!QFileInfo(filePath).isReadable()) {
+        return fail(QString("Cannot read %1").arg(filePath));
+    }
+    
+    QSettings file(filePath, QSettings::IniFormat);
+    if (file.status() != QSettings::NoError) {
+        return fail(QString("%1 is not a valid sessions file").arg(filePath));
+    }
+    
+    QVector<SessionConfig> loaded;
+    QHash<int, QString> listeningPorts;
+    QHash<QString, QString> inputDevices;
+    QHash<QString, QString> outputDevices;
+    
+    const QStringList names = file.childGroups();
+    for (const QString &name : names) {
+        SessionConfig config;
+        QString parseError;
+        if (!SessionConfig::parse(file, name, config, &parseError)) {
+            return fail(parseError);
+        }
+        
+        if (!config.sender) {
+            if (listeningPorts.contains(config.port)) {
+                return fail(QString("Sessions \"%1\" and \"%2\" both listen on port %3")
+                                .arg(listeningPorts.value(config.port), name).arg(config.port));
+            }
+            listeningPorts.insert(config.port, name);
+        }
+        
+        // Empty names are the default devices, shared just the same
+        if (inputDevices.contains(config.inputDevice)) {
+            qWarning().noquote() << QString("Sessions \"%1\" and \"%2\" share the input device \"%3\"")
+                                        .arg(inputDevices.value(config.inputDevice), name, config.inputDevice);
+        }
+        if (outputDevices.contains(config.outputDevice)) {
+            qWarning().noquote() << QString("Sessions \"%1\" and \"%2\" share the output device \"%3\"")
+                                        .arg(outputDevices.value(config.outputDevice), name, config.outputDevice);
+        }
+        inputDevices.insert(config.inputDevice, name);
+        outputDevices.insert(config.outputDevice, name);
+        
+        loaded.append(config);
+    }
+    
+    if (loaded.isEmpty()) {
+        return fail(QString("%1 defines no sessions").arg(filePath));
+    }
+    
+    configs = loaded;
+    return true;
+}
+
+/**
+ * @brief Sets the number of worker threads (takes effect on start()).
+ * @param count The number of workers (0 for one per core).
+ */
+void SessionManager::setWorkerCount(int count)
+{
+    workerCount = qMax(0, count);
+}
+
+/**
+ * @brief Sets the interval of the logged report.
+ * @param milliseconds The interval (0 disables the report).
+ */
+void SessionManager::setReportInterval(int milliseconds)
+{
+    reportTimer->setInterval(qMax(0, milliseconds));
+    if (milliseconds <= 0) {
+        reportTimer->stop();
+    } else if (!sessions.isEmpty()) {
+        reportTimer->start();
+    }
+}
+
+/**
+ * @brief Starts the workers and every session.
+ * @return The number of sessions that started.
+ */
+int SessionManager::start()
+{
+    stop();
+    
+    // One worker per core; more would only take turns on the same cores
+    int count = workerCount > 0 ? workerCount : qMax(1, QThread::idealThreadCount());
+    count = qMin(count, configs.size());
+    for (int i = 0; i < count; i++) {
+        QThread *worker = new QThread(this);
+        worker->setObjectName(QString("SessionWorker%1").arg(i));
+        worker->start(QThread::HighestPriority);
+        workers.append(worker);
+        workerLoads.append(0.0);
+    }
+    encodePool = new WorkerPool(count, this);
+    
+    int started = 0;
+    for (const SessionConfig &config : configs) {
+        int worker = pickWorker(config);
+        BridgeSession *session = new BridgeSession(config, workers.at(worker), deviceRegistry, encodePool, this);
+        connect(session, &BridgeSession::error, this, [this, config](const QString &message) {
+            qWarning().noquote() << QString("[%1] %2").arg(config.name, message);
+            emit error(config.name, message);
+        });
+        connect(session, &BridgeSession::connectionStatusChanged, this,
+                [config](bool, const QString &message) {
+            qInfo().noquote() << QString("[%1] %2").arg(config.name, message);
+        });
+        sessions.append(session);
+        sessionWorkers.append(worker);
+        
+        // A session that fails stays in the list, so the report shows it
+        if (session->start()) {
+            started++;
+        } else {
+            qWarning().noquote() << QString("[%1] Failed to start").arg(config.name);
+        }
+    }
+    
+    qInfo().noquote() << QString("Started %1 of %2 sessions on %3 workers")
+                             .arg(started).arg(sessions.size()).arg(workers.size());
+    
+    // Zero the load counters, the first report covers the interval from here
+    sampleStats();
+    if (reportTimer->interval() > 0) {
+        reportTimer->start();
+    }
+    return started;
+}
+
+/**
+ * @brief Stops every session and the workers.
+ */
+void SessionManager::stop()
+{
+    reportTimer->stop();
+    
+    // The sessions hand their network managers back to the workers for deletion
+    qDeleteAll(sessions);
+    sessions.clear();
+    sessionWorkers.clear();
+    
+    for (QThread *worker : workers) {
+        worker->quit();
+        worker->wait();
+        delete worker;
+    }
+    workers.clear();
+    workerLoads.clear();
+    
+    // The sessions are stopped, so the pool has no more work coming
+    delete encodePool;
+    encodePool = nullptr;
+}
+
+/**
+ * @brief Takes a snapshot of every session.
+ * @return The statistics, in the order of the sessions file.
+ */
+QVector<SessionStats> SessionManager::sampleStats()
+{
+    QVector<SessionStats> stats;
+    stats.reserve(sessions.size());
+    for (int i = 0; i < sessions.size(); i++) {
+        SessionStats sessionStats = sessions.at(i)->sampleStats();
+        sessionStats.worker = sessionWorkers.at(i);
+        stats.append(sessionStats);
+    }
+    return stats;
+}
+
+/**
+ * @brief Gets the resident memory of the process.
+ * @return The size in bytes, 0 where it cannot be read.
+ */
+qint64 SessionManager::processMemory()
+{
+#ifdef Q_OS_LINUX
+    // The second field is the resident set in pages
+    QFile statm("/proc/self/statm");
+    if (statm.open(QFile::ReadOnly)) {
+        QList<QByteArray> fields = statm.readAll().split(' ');
+        if (fields.size() > 1) {
+            return fields.at(1).toLongLong() * sysconf(_SC_PAGESIZE);
+        }
+    }
+#endif
+    return 0;
+}
+
+/**
+ * @brief Logs and emits the statistics of every session.
+ */
+void SessionManager::reportStats()
+{
+    const QVector<SessionStats> stats = sampleStats();
+    
+    double totalLoad = 0.0;
+    qint64 totalMemory = 0;
+    for (const SessionStats &session : stats) {
+        // The wire latency and the queueing on top of it, where kernel timestamps split them
+        QString latency = QString("%1 ms").arg(session.latencyMs);
+        if (session.queueingMs >= 0) {
+            latency += QString(" + %1 ms queueing").arg(session.queueingMs);
+        }
+        
+        qInfo().noquote() << QString("[%1] %2, worker %3, latency %4, CPU %5 %, memory %6 KiB, "
+                                     "%7 frames lost, %8 packets dropped, %9 capture frames dropped")
+                                 .arg(session.name)
+                                 .arg(!session.running ? "stopped" : session.connected ? "connected" : "waiting")
+                                 .arg(session.worker).arg(latency)
+                                 .arg(session.cpuLoad * 100.0, 0, 'f', 1)
+                                 .arg(session.memoryBytes / 1024)
+                                 .arg(session.lostFrames).arg(session.droppedPackets)
+                                 .arg(session.droppedCaptureFrames);
+        totalLoad += session.cpuLoad;
+        totalMemory += session.memoryBytes;
+    }
+    
+    // What the process holds beyond the sessions' buffers is the shared runtime
+    qint64 resident = processMemory();
+    qInfo().noquote() << QString("%1 sessions: CPU %2 % of one core, buffers %3 MiB, process %4 MiB")
+                             .arg(stats.size()).arg(totalLoad * 100.0, 0, 'f', 1)
+                             .arg(totalMemory / (1024.0 * 1024.0), 0, 'f', 1)
+                             .arg(resident / (1024.0 * 1024.0), 0, 'f', 1);
+    
+    if (encodePool) {
+        WorkerPoolStats pool = encodePool->getStats();
+        qInfo().noquote() << QString("Encode pool: %1 threads, %2 tasks run, %3 stolen, %4 rejected")
+                                 .arg(pool.threads).arg(pool.tasksRun).arg(pool.tasksStolen)
+                                 .arg(pool.submitsRejected);
+    }
+    
+    emit statsUpdated(stats);
+}
+
+/**
+ * @brief Picks the worker with the least load for a session.
+ * @param config The session.
+ * @return The index of the worker.
+ */
+int SessionManager::pickWorker(const SessionConfig &config)
+{
+    // The worker's cost is mostly per packet, in both directions
+    double packetsPerSecond = 2.0 * config.sampleRate / (config.bufferSize * qMax(1, config.framesPerPacket));
+    
+    int best = 0;
+    for (int i = 1; i < workerLoads.size(); i++) {
+        if (workerLoads.at(i) < workerLoads.at(best)) {
+            best = i;
+        }
+    }
+    workerLoads[best] += packetsPerSecond;
+    return best;
+}
@@ -0,0 +1,627 @@
+#include "../include/sockettransport.h"
+#include "../include/clocksync.h"
+#include <QtCore/QDebug>
+#include <QtCore/QSocketNotifier>
+
+#ifdef Q_OS_LINUX
+#include <linux/errqueue.h>
+#include <linux/net_tstamp.h>
+#include <linux/sockios.h>
+#include <netinet/in.h>
+#include <sys/ioctl.h>
+#include <sys/socket.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#endif
+
+// Bytes asked for per receive call
+const int RECEIVE_CHUNK_SIZE = 64 * 1024;
+
+// Sent bytes that are dropped from the front of the send buffer at once
+const int COMPACT_THRESHOLD = 64 * 1024;
+
+// Requested send timestamps that may be outstanding; older ones are given up
+const int MAX_PENDING_STAMPS = 64;
+
+// Tries at reading the send queue around enabling timestamps without an ACK in between
+const int KEY_BASE_ATTEMPTS = 8;
+
+#ifdef Q_OS_LINUX
+#ifndef SOF_TIMESTAMPING_OPT_ID_TCP
+// Keys counted from the next byte written (Linux 6.2, missing from older headers)
+#define SOF_TIMESTAMPING_OPT_ID_TCP (1 << 16)
+#endif
+#endif
+
+#ifdef Q_OS_LINUX
+namespace {
+
+/**
+ * @brief Converts a kernel software timestamp to the ClockSync::now() clock.
+ * @param time The timestamp (CLOCK_REALTIME).
+ * @return The time in microseconds, 0 for an empty timestamp.
+ */
+qint64 toClockTime(const struct timespec &time)
+{
+    if (time.tv_sec == 0 && time.tv_nsec == 0) {
+        return 0;
+    }
+    
+    // The stamp's age on the realtime clock, taken back from now
+    struct timespec realtime;
+    ::clock_gettime(CLOCK_REALTIME, &realtime);
+    qint64 now = ClockSync::now();
+    qint64 ageNs = (static_cast<qint64>(realtime.tv_sec) - time.tv_sec) * 1000000000LL
+                   + (realtime.tv_nsec - time.tv_nsec);
+    return now - ageNs / 1000;
+}
+
+} // namespace
+#endif
+
+/**
+ * @brief Constructor for SocketTransport.
+ * @param parent The parent object.
+ */
+SocketTransport::SocketTransport(QObject *parent)
+    : StreamTransport(parent)
+    , readNotifier(nullptr)
+    , writeNotifier(nullptr)
+    , descriptor(-1)
+    , pendingOffset(0)
+    , sentBytes(0)
+    , transmitKeyBase(0)
+    , newestReceiveUs(0)
+    , receiveTimestampUs(0)
+    , receiveTimestamps(false)
+    , transmitTimestamps(false)
+{
+}
+
+/**
+ * @brief Destructor for SocketTransport.
+ */
+SocketTransport::~SocketTransport()
+{
+    close();
+}
+
+/**
+ * @brief Checks if socket transports can be used on this platform.
+ * @return True if available, false otherwise.
+ */
+bool SocketTransport::isAvailable()
+{
+#ifdef Q_OS_LINUX
+    return true;
+#else
+    return false;
+#endif
+}
+
+/**
+ * @brief Takes over a connected socket and enables its timestamps.
+ * @param socketDescriptor The socket descriptor; the transport owns it from now on,
+ *                         also if opening fails.
+ * @param errorMessage Receives the reason of a failure (optional).
+ * @return True if the transport is ready, false otherwise.
+ */
+bool SocketTransport::open(int socketDescriptor, QString *errorMessage)
+{
+    close();
+    descriptor = socketDescriptor;
+    lastError.clear();
+
+#ifdef Q_OS_LINUX
+    int flags = ::fcntl(descriptor, F_GETFL);
+    if (flags < 0 || ::fcntl(descriptor, F_SETFL, flags | O_NONBLOCK) < 0) {
+        lastError = QString("Failed to make the socket non-blocking: %1").arg(strerror(errno));
+        if (errorMessage) {
+            *errorMessage = lastError;
+        }
+        close();
+        return false;
+    }
+    
+    if (!enableTimestamps()) {
+        qDebug() << "Kernel timestamps not available:" << strerror(errno);
+    }
+    
+    // Reserved buffers keep their memory when they are emptied
+    received.reserve(RECEIVE_CHUNK_SIZE);
+    pending.reserve(COMPACT_THRESHOLD);
+    
+    readNotifier = new QSocketNotifier(descriptor, QSocketNotifier::Read, this);
+    connect(readNotifier, &QSocketNotifier::activated, this, &SocketTransport::handleReadable);
+    writeNotifier = new QSocketNotifier(descriptor, QSocketNotifier::Write, this);
+    writeNotifier->setEnabled(false);
+    connect(writeNotifier, &QSocketNotifier::activated, this, &SocketTransport::handleWritable);
+    return true;
+#else
+    lastError = "Socket transports are only available on Linux";
+    if (errorMessage) {
+        *errorMessage = lastError;
+    }
+    close();
+    return false;
+#endif
+}
+
+/**
+ * @brief Enables the receive and send timestamps and finds the base of the send keys.
+ *
+ * The kernel keys a send timestamp by the stamped byte's sequence number
+ * less a base it takes when the timestamps are enabled. With
+ * SOF_TIMESTAMPING_OPT_ID_TCP the base is the next byte written, where our
+ * offsets start. Older kernels take the oldest unacknowledged byte instead,
+ * which lies the send queue's length (SIOCOUTQ) before it; the queue is read
+ * on both sides of the call so an ACK in between cannot skew the keys.
+ *
+ * @return True if the receive timestamps are enabled, false otherwise (errno is set).
+ */
+bool SocketTransport::enableTimestamps()
+{
+#ifdef Q_OS_LINUX
+    // Receive timestamps on every read. Send timestamps are asked for per
+    // send call, only the error queue entry's key is wanted back.
+    int timestamping = SOF_TIMESTAMPING_RX_SOFTWARE | SOF_TIMESTAMPING_SOFTWARE | SOF_TIMESTAMPING_OPT_ID
+                       | SOF_TIMESTAMPING_OPT_TSONLY;
+    int exact = timestamping | SOF_TIMESTAMPING_OPT_ID_TCP;
+    if (::setsockopt(descriptor, SOL_SOCKET, SO_TIMESTAMPING, &exact, sizeof(exact)) == 0) {
+        receiveTimestamps = true;
+        transmitTimestamps = true;
+        transmitKeyBase = 0;
+        return true;
+    }
+    
+    for (int attempt = 0; attempt < KEY_BASE_ATTEMPTS; attempt++) {
+        int before = 0;
+        int after = 0;
+        if (::ioctl(descriptor, SIOCOUTQ, &before) < 0
+            || ::setsockopt(descriptor, SOL_SOCKET, SO_TIMESTAMPING, &timestamping, sizeof(timestamping)) < 0) {
+            return false;
+        }
+        receiveTimestamps = true;
+        if (::ioctl(descriptor, SIOCOUTQ, &after) == 0 && after == before) {
+            transmitTimestamps = true;
+            transmitKeyBase = before;
+            return true;
+        }
+        
+        // The base is only taken when the keys are switched on anew
+        int receiveOnly = SOF_TIMESTAMPING_RX_SOFTWARE | SOF_TIMESTAMPING_SOFTWARE;
+        ::setsockopt(descriptor, SOL_SOCKET, SO_TIMESTAMPING, &receiveOnly, sizeof(receiveOnly));
+    }
+    qDebug() << "Kernel send timestamps not available: the send queue kept moving";
+    return true;
+#else
+    return false;
+#endif
+}
+
+/**
+ * @brief Stops watching the socket, drops the unsent bytes and closes the socket.
+ */
+void SocketTransport::close()
+{
+    // We may be called from a notifier's signal
+    if (readNotifier) {
+        readNotifier->setEnabled(false);
+        readNotifier->deleteLater();
+        readNotifier = nullptr;
+    }
+    if (writeNotifier) {
+        writeNotifier->setEnabled(false);
+        writeNotifier->deleteLater();
+        writeNotifier = nullptr;
+    }
+
+#ifdef Q_OS_UNIX
+    if (descriptor >= 0) {
+        ::close(descriptor);
+    }
+#endif
+    descriptor = -1;
+    
+    received.clear();
+    pending.clear();
+    stampsToSend.clear();
+    stampsToReceive.clear();
+    pendingOffset = 0;
+    sentBytes = 0;
+    transmitKeyBase = 0;
+    newestReceiveUs = 0;
+    receiveTimestampUs = 0;
+    receiveTimestamps = false;
+    transmitTimestamps = false;
+}
+
+/**
+ * @brief Checks if the transport is open.
+ * @return True if open, false otherwise.
+ */
+bool SocketTransport::isOpen() const
+{
+    // A failed connection stays disabled until it is closed
+    return readNotifier && readNotifier->isEnabled();
+}
+
+/**
+ * @brief Gets the socket descriptor.
+ * @return The descriptor, or -1 if the transport is closed.
+ */
+int SocketTransport::socketDescriptor() const
+{
+    return descriptor;
+}
+
+/**
+ * @brief Gets the number of received bytes waiting to be read.
+ * @return The number of bytes.
+ */
+qint64 SocketTransport::bytesAvailable() const
+{
+    return received.size();
+}
+
+/**
+ * @brief Appends all received bytes to a buffer.
+ * @param buffer The buffer to append to.
+ * @return The number of bytes appended.
+ */
+qint64 SocketTransport::read(QByteArray &buffer)
+{
+    qint64 size = received.size();
+    if (size > 0) {
+        buffer.append(received);
+        received.clear();
+        receiveTimestampUs = newestReceiveUs;
+    }
+    return size;
+}
+
+/**
+ * @brief Buffers bytes; they go out with the next flush().
+ * @param data The bytes.
+ * @param size The number of bytes.
+ */
+void SocketTransport::write(const char *data, qint64 size)
+{
+    if (!isOpen() || size <= 0) {
+        return;
+    }
+    
+    pending.append(data, static_cast<int>(size));
+}
+
+/**
+ * @brief Hands as many written bytes to the kernel as the socket takes.
+ */
+void SocketTransport::flush()
+{
+    // A full socket is retried once it is writable, in order
+    if (!isOpen() || writeNotifier->isEnabled()) {
+        return;
+    }
+    
+    sendPending();
+}
+
+/**
+ * @brief Gets the number of bytes written but not yet taken by the kernel.
+ * @return The number of bytes.
+ */
+qint64 SocketTransport::bytesToWrite() const
+{
+    return pending.size() - pendingOffset;
+}
+
+/**
+ * @brief Gets the description of the last error.
+ * @return The error description.
+ */
+QString SocketTransport::errorString() const
+{
+    return lastError;
+}
+
+/**
+ * @brief Gets when the kernel received the newest bytes returned by the last read().
+ * @return The time on the ClockSync::now() clock in microseconds, 0 if unknown.
+ */
+qint64 SocketTransport::getReceiveTimestamp() const
+{
+    return receiveTimestampUs;
+}
+
+/**
+ * @brief Asks for the time the kernel sends the last byte written so far.
+ *
+ * The send call that carries the byte ends with it, so the kernel stamps
+ * exactly that byte. Must be called before the byte is flushed.
+ *
+ * @return The id the timestamp will carry, -1 if send timestamps are not available.
+ */
+qint64 SocketTransport::requestTransmitTimestamp()
+{
+    // The id is the stream offset just past the byte
+    qint64 end = sentBytes + bytesToWrite();
+    if (!transmitTimestamps || end == sentBytes) {
+        return -1;
+    }
+    if (stampsToSend.isEmpty() || stampsToSend.last() != end) {
+        stampsToSend.enqueue(end);
+    }
+    return end;
+}
+
+/**
+ * @brief Collects the send timestamps and the received bytes.
+ */
+void SocketTransport::handleReadable()
+{
+    // Queued timestamps keep the socket readable (POLLERR) until collected
+    if (transmitTimestamps) {
+        readTransmitTimestamps();
+    }
+    
+    bool closed = false;
+    qint64 bytes = receive(closed);
+    if (bytes < 0) {
+        return;
+    }
+    
+    if (bytes > 0) {
+        emit readyRead();
+    }
+    if (closed && isOpen()) {
+        fail("The peer closed the connection");
+    }
+}
+
+/**
+ * @brief Sends the bytes the socket could not take before.
+ */
+void SocketTransport::handleWritable()
+{
+    writeNotifier->setEnabled(false);
+    qint64 bytes = sendPending();
+    if (bytes > 0) {
+        emit bytesWritten(bytes);
+    }
+}
+
+/**
+ * @brief Sends the buffered bytes until they are gone or the socket is full.
+ * @return The number of bytes the kernel took.
+ */
+qint64 SocketTransport::sendPending()
+{
+    qint64 taken = 0;
+
+#ifdef Q_OS_LINUX
+    while (pendingOffset < pending.size()) {
+        // A call ends at the next byte to stamp: the kernel stamps the last
+        // byte of each call. A call cut short is stamped at the wrong byte,
+        // which readTransmitTimestamps() ignores, and the rest is stamped again.
+        qint64 end = sentBytes + bytesToWrite();
+        bool stamp = false;
+        if (!stampsToSend.isEmpty() && stampsToSend.head() <= end) {
+            end = stampsToSend.head();
+            stamp = true;
+        }
+        
+        struct iovec vector;
+        vector.iov_base = pending.data() + pendingOffset;
+        vector.iov_len = static_cast<size_t>(end - sentBytes);
+        
+        struct msghdr message;
+        memset(&message, 0, sizeof(message));
+        message.msg_iov = &vector;
+        message.msg_iovlen = 1;
+        
+        union {
+            char buffer[CMSG_SPACE(sizeof(int))];
+            struct cmsghdr align;
+        } control;
+        if (stamp) {
+            memset(&control, 0, sizeof(control));
+            message.msg_control = control.buffer;
+            message.msg_controllen = sizeof(control.buffer);
+            struct cmsghdr *header = CMSG_FIRSTHDR(&message);
+            header->cmsg_level = SOL_SOCKET;
+            header->cmsg_type = SO_TIMESTAMPING;
+            header->cmsg_len = CMSG_LEN(sizeof(int));
+            int flags = SOF_TIMESTAMPING_TX_SOFTWARE;
+            memcpy(CMSG_DATA(header), &flags, sizeof(flags));
+        }
+        
+        ssize_t sent = ::sendmsg(descriptor, &message, MSG_DONTWAIT | MSG_NOSIGNAL);
+        if (sent < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            if (errno == EAGAIN || errno == EWOULDBLOCK) {
+                writeNotifier->setEnabled(true);
+                break;
+            }
+            if (stamp && errno == EINVAL) {
+                // Kernels before per-call timestamps (4.13) refuse the control message
+                qDebug() << "Kernel send timestamps not available";
+                transmitTimestamps = false;
+                stampsToSend.clear();
+                continue;
+            }
+            fail(QString("Failed to send: %1").arg(strerror(errno)));
+            return taken;
+        }
+        
+        pendingOffset += static_cast<int>(sent);
+        sentBytes += sent;
+        taken += sent;
+        if (stamp && sentBytes == stampsToSend.head()) {
+            stampsToReceive.enqueue(stampsToSend.dequeue());
+            while (stampsToReceive.size() > MAX_PENDING_STAMPS) {
+                stampsToReceive.dequeue();
+            }
+        }
+    }
+#endif
+    
+    if (pendingOffset == pending.size()) {
+        pending.clear();
+        pendingOffset = 0;
+    } else if (pendingOffset >= COMPACT_THRESHOLD) {
+        pending.remove(0, pendingOffset);
+        pendingOffset = 0;
+    }
+    return taken;
+}
+
+/**
+ * @brief Receives until the socket is empty.
+ * @param closed Set to true if the peer closed the connection.
+ * @return The number of bytes received, -1 on an error.
+ */
+qint64 SocketTransport::receive(bool &closed)
+{
+    qint64 total = 0;
+
+#ifdef Q_OS_LINUX
+    for (;;) {
+        int used = received.size();
+        received.resize(used + RECEIVE_CHUNK_SIZE);
+        
+        struct iovec vector;
+        vector.iov_base = received.data() + used;
+        vector.iov_len = RECEIVE_CHUNK_SIZE;
+        
+        union {
+            char buffer[CMSG_SPACE(sizeof(struct scm_timestamping))];
+            struct cmsghdr align;
+        } control;
+        struct msghdr message;
+        memset(&message, 0, sizeof(message));
+        message.msg_iov = &vector;
+        message.msg_iovlen = 1;
+        if (receiveTimestamps) {
+            message.msg_control = control.buffer;
+            message.msg_controllen = sizeof(control.buffer);
+        }
+        
+        ssize_t bytes = ::recvmsg(descriptor, &message, MSG_DONTWAIT);
+        received.resize(used + static_cast<int>(qMax<ssize_t>(0, bytes)));
+        if (bytes < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            if (errno == EAGAIN || errno == EWOULDBLOCK) {
+                break;
+            }
+            fail(QString("Failed to receive: %1").arg(strerror(errno)));
+            return -1;
+        }
+        if (bytes == 0) {
+            closed = true;
+            break;
+        }
+        total += bytes;
+        
+        // The stamp of the newest segment this call returned
+        for (struct cmsghdr *header = CMSG_FIRSTHDR(&message); header; header = CMSG_NXTHDR(&message, header)) {
+            if (header->cmsg_level == SOL_SOCKET && header->cmsg_type == SCM_TIMESTAMPING) {
+                struct scm_timestamping stamps;
+                memcpy(&stamps, CMSG_DATA(header), sizeof(stamps));
+                qint64 timeUs = toClockTime(stamps.ts[0]);
+                if (timeUs > 0) {
+                    newestReceiveUs = timeUs;
+                }
+            }
+        }
+    }
+#else
+    Q_UNUSED(closed)
+#endif
+    
+    return total;
+}
+
+/**
+ * @brief Reads the send timestamps from the socket's error queue.
+ */
+void SocketTransport::readTransmitTimestamps()
+{
+#ifdef Q_OS_LINUX
+    for (;;) {
+        union {
+            char buffer[CMSG_SPACE(sizeof(struct scm_timestamping)) + CMSG_SPACE(sizeof(struct sock_extended_err) + 64)];
+            struct cmsghdr align;
+        } control;
+        struct msghdr message;
+        memset(&message, 0, sizeof(message));
+        message.msg_control = control.buffer;
+        message.msg_controllen = sizeof(control.buffer);
+        
+        if (::recvmsg(descriptor, &message, MSG_ERRQUEUE | MSG_DONTWAIT) < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            break;
+        }
+        
+        // An entry holds the stamp and, as the error, the key of the stamped byte
+        qint64 timeUs = 0;
+        qint64 key = -1;
+        for (struct cmsghdr *header = CMSG_FIRSTHDR(&message); header; header = CMSG_NXTHDR(&message, header)) {
+            if (header->cmsg_level == SOL_SOCKET && header->cmsg_type == SCM_TIMESTAMPING) {
+                struct scm_timestamping stamps;
+                memcpy(&stamps, CMSG_DATA(header), sizeof(stamps));
+                timeUs = toClockTime(stamps.ts[0]);
+            } else if ((header->cmsg_level == SOL_IP && header->cmsg_type == IP_RECVERR)
+                       || (header->cmsg_level == SOL_IPV6 && header->cmsg_type == IPV6_RECVERR)) {
+                struct sock_extended_err error;
+                memcpy(&error, CMSG_DATA(header), sizeof(error));
+                if (error.ee_errno == ENOMSG && error.ee_origin == SO_EE_ORIGIN_TIMESTAMPING
+                    && error.ee_info == SCM_TSTAMP_SND) {
+                    key = error.ee_data;
+                }
+            }
+        }
+        if (timeUs <= 0 || key < 0) {
+            continue;
+        }
+        
+        // Keys are the 32-bit offsets of the stamped bytes. Stamps of calls
+        // that were cut short match nothing; requests passed over were lost.
+        for (int i = 0; i < stampsToReceive.size(); i++) {
+            qint64 id = stampsToReceive.at(i);
+            if (static_cast<quint32>(id - 1 + transmitKeyBase) == static_cast<quint32>(key)) {
+                for (int j = 0; j <= i; j++) {
+                    stampsToReceive.dequeue();
+                }
+                emit transmitTimestamp(id, timeUs);
+                break;
+            }
+        }
+    }
+#endif
+}
+
+/**
+ * @brief Fails the connection.
+ * @param message The error description.
+ */
+void SocketTransport::fail(const QString &message)
+{
+    lastError = message;
+    if (readNotifier) {
+        readNotifier->setEnabled(false);
+    }
+    if (writeNotifier) {
+        writeNotifier->setEnabled(false);
+    }
+    emit disconnected();
+}
@@ -0,0 +1,276 @@
+#include "../include/spectrumanalyzer.h"
+#include <QtCore/QElapsedTimer>
+#include <cmath>
+#include <cstring>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+// Frames the audio thread downmixes at once
+const int PUSH_CHUNK_FRAMES = 1024;
+
+// Audio the ring holds between two frames of a slow analysis thread
+const int RING_SAMPLES = 4 * SpectrumAnalyzer::FftSize;
+
+// Frequency range of the bands
+const float MIN_FREQUENCY = 20.0f;
+const float MAX_FREQUENCY = 20000.0f;
+
+// Level range; anything quieter is shown as the floor
+const float FLOOR_DB = -120.0f;
+
+// How fast levels and released peaks fall
+const float RELEASE_DB_PER_SECOND = 60.0f;
+const float PEAK_RELEASE_DB_PER_SECOND = 20.0f;
+
+// How long a peak stays before it falls
+const float PEAK_HOLD_SECONDS = 1.0f;
+
+// Sample magnitude counted as clipping
+const float CLIP_LEVEL = 0.999f;
+
+/**
+ * @brief Constructor for SpectrumAnalyzer.
+ * @param parent The parent object.
+ */
+SpectrumAnalyzer::SpectrumAnalyzer(QObject *parent)
+    : QObject(parent)
+    , analysisThread(nullptr)
+    , fft(FftSize)
+    , ring(RING_SAMPLES)
+    , sampleRate(48000)
+    , frameIntervalMs(1000 / 30)
+    , running(false)
+    , stopRequested(false)
+    , activeWriters(0)
+    , clipped(false)
+{
+    qRegisterMetaType<SpectrumFrame>();
+    
+    // Everything is allocated here, the sizes never change
+    pushScratch.resize(PUSH_CHUNK_FRAMES);
+    history.fill(0.0f, FftSize);
+    windowed.resize(FftSize);
+    spectrumRe.resize(FftSize / 2 + 1);
+    spectrumIm.resize(FftSize / 2 + 1);
+    
+    // Hann window, scaled so a full-scale sine peaks at 0 dBFS
+    window.resize(FftSize);
+    for (int i = 0; i < FftSize; i++) {
+        double hann = 0.5 - 0.5 * std::cos(2.0 * M_PI * i / FftSize);
+        window[i] = static_cast<float>(hann * 4.0 / FftSize);
+    }
+    
+    frame.levels.fill(FLOOR_DB, BandCount);
+    frame.peaks.fill(FLOOR_DB, BandCount);
+    frame.minFrequency = MIN_FREQUENCY;
+    frame.maxFrequency = MAX_FREQUENCY;
+    frame.clipped = false;
+    peakHoldSeconds.fill(0.0f, BandCount);
+    bandFirstBin.resize(BandCount);
+    bandLastBin.resize(BandCount);
+}
+
+/**
+ * @brief Destructor for SpectrumAnalyzer.
+ */
+SpectrumAnalyzer::~SpectrumAnalyzer()
+{
+    stop();
+}
+
+/**
+ * @brief Starts the analysis thread.
+ * @param sampleRate The sample rate of the pushed audio.
+ */
+void SpectrumAnalyzer::start(int sampleRate)
+{
+    stop();
+    
+    this->sampleRate = sampleRate;
+    
+    // Log-spaced bands up to the Nyquist frequency, at least one bin each
+    float binWidth = static_cast<float>(sampleRate) / FftSize;
+    float maxFrequency = qMin(MAX_FREQUENCY, sampleRate / 2.0f);
+    float ratio = std::pow(maxFrequency / MIN_FREQUENCY, 1.0f / BandCount);
+    for (int b = 0; b < BandCount; b++) {
+        float low = MIN_FREQUENCY * std::pow(ratio, static_cast<float>(b));
+        float high = low * ratio;
+        int first = qBound(1, static_cast<int>(std::ceil(low / binWidth)), FftSize / 2);
+        int last = qBound(first, static_cast<int>(std::ceil(high / binWidth)) - 1, FftSize / 2);
+        bandFirstBin[b] = first;
+        bandLastBin[b] = last;
+    }
+    frame.minFrequency = MIN_FREQUENCY;
+    frame.maxFrequency = maxFrequency;
+    frame.levels.fill(FLOOR_DB);
+    frame.peaks.fill(FLOOR_DB);
+    peakHoldSeconds.fill(0.0f);
+    history.fill(0.0f);
+    ring.skip(ring.availableToRead());
+    clipped = false;
+    
+    stopRequested = false;
+    analysisThread = QThread::create([this]() { analysisLoop(); });
+    analysisThread->start(QThread::LowestPriority);
+    running = true;
+}
+
+/**
+ * @brief Stops the analysis thread.
+ */
+void SpectrumAnalyzer::stop()
+{
+    if (!analysisThread) {
+        return;
+    }
+    
+    // Close the tap and wait for a push() that is still in progress
+    running = false;
+    while (activeWriters.load() > 0) {
+        QThread::yieldCurrentThread();
+    }
+    
+    stopRequested = true;
+    analysisThread->wait();
+    delete analysisThread;
+    analysisThread = nullptr;
+}
+
+/**
+ * @brief Sets how many frames per second are analysed (capped at 60).
+ * @param framesPerSecond The frame rate.
+ */
+void SpectrumAnalyzer::setFrameRate(int framesPerSecond)
+{
+    frameIntervalMs = 1000 / qBound(1, framesPerSecond, 60);
+}
+
+/**
+ * @brief Queues interleaved frames for analysis (audio thread, lock-free).
+ * @param samples The interleaved samples.
+ * @param frames The number of frames.
+ * @param channels The number of interleaved channels.
+ */
+void SpectrumAnalyzer::push(const float *samples, int frames, int channels)
+{
+    activeWriters.fetch_add(1);
+    
+    if (running.load() && channels > 0) {
+        float scale = 1.0f / channels;
+        float peak = 0.0f;
+        float *mono = pushScratch.data();
+        
+        while (frames > 0) {
+            int count = qMin(frames, PUSH_CHUNK_FRAMES);
+            for (int f = 0; f < count; f++) {
+                float sum = 0.0f;
+                for (int c = 0; c < channels; c++) {
+                    float sample = samples[f * channels + c];
+                    peak = qMax(peak, std::fabs(sample));
+                    sum += sample;
+                }
+                mono[f] = sum * scale;
+            }
+            
+            // A full ring only means the analysis fell behind, it catches up on newer audio
+            ring.write(mono, count);
+            samples += count * channels;
+            frames -= count;
+        }
+        
+        if (peak >= CLIP_LEVEL) {
+            clipped.store(true, std::memory_order_relaxed);
+        }
+    }
+    
+    activeWriters.fetch_sub(1);
+}
+
+/**
+ * @brief Body of the analysis thread.
+ */
+void SpectrumAnalyzer::analysisLoop()
+{
+    QElapsedTimer clock;
+    clock.start();
+    qint64 previous = 0;
+    
+    while (!stopRequested.load()) {
+        // Sleep to the next frame, whatever the analysis took
+        qint64 next = previous + frameIntervalMs.load();
+        qint64 now = clock.elapsed();
+        if (next > now) {
+            QThread::msleep(static_cast<unsigned long>(next - now));
+        }
+        
+        now = clock.elapsed();
+        analyse((now - previous) / 1000.0f);
+        previous = now;
+    }
+}
+
+/**
+ * @brief Analyses the latest samples and publishes the frame.
+ * @param elapsedSeconds The time since the previous frame.
+ */
+void SpectrumAnalyzer::analyse(float elapsedSeconds)
+{
+    // Keep the newest FftSize samples: skip what the window cannot hold and
+    // shift the history by the rest
+    int available = ring.availableToRead();
+    if (available >= FftSize) {
+        ring.skip(available - FftSize);
+        ring.read(history.data(), FftSize);
+    } else if (available > 0) {
+        memmove(history.data(), history.constData() + available, (FftSize - available) * sizeof(float));
+        ring.read(history.data() + FftSize - available, available);
+    }
+    
+    // Window and transform
+    const float *samples = history.constData();
+    const float *weights = window.constData();
+    float *input = windowed.data();
+    int i = 0;
+#if defined(__SSE2__)
+    for (; i + 4 <= FftSize; i += 4) {
+        _mm_storeu_ps(input + i, _mm_mul_ps(_mm_loadu_ps(samples + i), _mm_loadu_ps(weights + i)));
+    }
+#endif
+    for (; i < FftSize; i++) {
+        input[i] = samples[i] * weights[i];
+    }
+    fft.forward(input, spectrumRe.data(), spectrumIm.data());
+    
+    // The loudest bin of every band, in dB
+    const float *re = spectrumRe.constData();
+    const float *im = spectrumIm.constData();
+    float release = RELEASE_DB_PER_SECOND * elapsedSeconds;
+    float peakRelease = PEAK_RELEASE_DB_PER_SECOND * elapsedSeconds;
+    
+    for (int b = 0; b < BandCount; b++) {
+        float power = 0.0f;
+        for (int k = bandFirstBin.at(b); k <= bandLastBin.at(b); k++) {
+            power = qMax(power, re[k] * re[k] + im[k] * im[k]);
+        }
+        float level = power > 0.0f ? qMax(FLOOR_DB, 10.0f * std::log10(power)) : FLOOR_DB;
+        
+        // Rise at once, fall at a steady rate
+        float &smoothed = frame.levels[b];
+        smoothed = qMax(level, smoothed - release);
+        
+        float &peak = frame.peaks[b];
+        if (smoothed >= peak) {
+            peak = smoothed;
+            peakHoldSeconds[b] = PEAK_HOLD_SECONDS;
+        } else if (peakHoldSeconds[b] > 0.0f) {
+            peakHoldSeconds[b] -= elapsedSeconds;
+        } else {
+            peak = qMax(smoothed, peak - peakRelease);
+        }
+    }
+    
+    frame.clipped = clipped.exchange(false, std::memory_order_relaxed);
+    emit spectrumReady(frame);
+}
@@ -0,0 +1,279 @@
+#include "../include/spectrumwidget.h"
+#include <QtGui/QPainter>
+#include <QtGui/QPaintEvent>
+#include <QtGui/QResizeEvent>
+
+// Level range of the display
+const float DISPLAY_FLOOR_DB = -100.0f;
+const float DISPLAY_CEILING_DB = 0.0f;
+
+// Frames the clip indicator stays lit after clipping
+const int CLIP_HOLD_FRAMES = 30;
+
+// Size of the clip indicator
+const int CLIP_INDICATOR_SIZE = 8;
+
+// Spacing between dB grid lines of the bars
+const int GRID_STEP_DB = 20;
+
+const QColor BACKGROUND_COLOR(18, 18, 24);
+const QColor GRID_COLOR(44, 44, 56);
+const QColor BAR_COLOR(70, 160, 230);
+const QColor PEAK_COLOR(230, 230, 240);
+const QColor CURSOR_COLOR(255, 255, 255);
+const QColor CLIP_ON_COLOR(230, 40, 40);
+const QColor CLIP_OFF_COLOR(60, 30, 30);
+
+/**
+ * @brief Constructor for SpectrumWidget.
+ * @param parent The parent widget.
+ */
+SpectrumWidget::SpectrumWidget(QWidget *parent)
+    : QWidget(parent)
+    , spectrogram(HistoryColumns, SpectrumAnalyzer::BandCount, QImage::Format_RGB32)
+    , writeColumn(0)
+    , clipHoldFrames(0)
+{
+    setMinimumHeight(120);
+    setAttribute(Qt::WA_OpaquePaintEvent);
+    
+    // Color table from black through blue, magenta and orange to white
+    const int stops[][4] = {
+        {0, 0, 0, 0},
+        {64, 20, 20, 120},
+        {128, 160, 30, 150},
+        {192, 250, 140, 30},
+        {255, 255, 255, 230}
+    };
+    colorTable.resize(256);
+    for (int s = 0; s < 4; s++) {
+        for (int i = stops[s][0]; i <= stops[s + 1][0]; i++) {
+            float t = static_cast<float>(i - stops[s][0]) / (stops[s + 1][0] - stops[s][0]);
+            colorTable[i] = qRgb(qRound(stops[s][1] + t * (stops[s + 1][1] - stops[s][1])),
+                              qRound(stops[s][2] + t * (stops[s + 1][2] - stops[s][2])),
+                              qRound(stops[s][3] + t * (stops[s + 1][3] - stops[s][3])));
+        }
+    }
+    
+    clear();
+}
+
+/**
+ * @brief Gets the preferred size of the widget.
+ * @return The size hint.
+ */
+QSize SpectrumWidget::sizeHint() const
+{
+    return QSize(480, 160);
+}
+
+/**
+ * @brief Shows a new spectrum frame.
+ * @param frame The spectrum.
+ */
+void SpectrumWidget::setFrame(const SpectrumFrame &frame)
+{
+    int bandCount = qMin(frame.levels.size(), levels.size());
+    QRect bars = barArea();
+    
+    // Invalidate the span of bars whose drawn height changed
+    int firstChanged = -1;
+    int lastChanged = -1;
+    for (int b = 0; b < bandCount; b++) {
+        levels[b] = frame.levels.at(b);
+        peaks[b] = frame.peaks.at(b);
+        int levelHeight = barHeight(levels.at(b));
+        int peakHeight = barHeight(peaks.at(b));
+        if (levelHeight != drawnLevelHeights.at(b) || peakHeight != drawnPeakHeights.at(b)) {
+            drawnLevelHeights[b] = levelHeight;
+            drawnPeakHeights[b] = peakHeight;
+            if (firstChanged < 0) {
+                firstChanged = b;
+            }
+            lastChanged = b;
+        }
+    }
+    if (firstChanged >= 0) {
+        update(QRect(barLeft(firstChanged), bars.top(),
+                     barLeft(lastChanged + 1) - barLeft(firstChanged), bars.height()));
+    }
+    
+    // Paint the new spectrogram column, highest band at the top
+    int rows = spectrogram.height();
+    float scale = 255.0f / (DISPLAY_CEILING_DB - DISPLAY_FLOOR_DB);
+    for (int b = 0; b < bandCount; b++) {
+        int index = qBound(0, static_cast<int>((levels.at(b) - DISPLAY_FLOOR_DB) * scale), 255);
+        QRgb *row = reinterpret_cast<QRgb*>(spectrogram.scanLine(rows - 1 - b));
+        row[writeColumn] = colorTable.at(index);
+    }
+    
+    // Invalidate the written column and the column the cursor moves to
+    QRect area = spectrogramArea();
+    int written = writeColumn;
+    writeColumn = (writeColumn + 1) % HistoryColumns;
+    for (int column : {written, writeColumn}) {
+        int left = columnLeft(column);
+        update(QRect(left, area.top(), qMax(1, columnLeft(column + 1) - left), area.height()));
+    }
+    
+    // The clip indicator only needs a repaint when it turns on or off
+    bool wasLit = clipHoldFrames > 0;
+    clipHoldFrames = frame.clipped ? CLIP_HOLD_FRAMES : qMax(0, clipHoldFrames - 1);
+    if (wasLit != (clipHoldFrames > 0)) {
+        update(clipArea());
+    }
+}
+
+/**
+ * @brief Clears the bars and the spectrogram.
+ */
+void SpectrumWidget::clear()
+{
+    levels.fill(DISPLAY_FLOOR_DB, SpectrumAnalyzer::BandCount);
+    peaks.fill(DISPLAY_FLOOR_DB, SpectrumAnalyzer::BandCount);
+    drawnLevelHeights.fill(0, SpectrumAnalyzer::BandCount);
+    drawnPeakHeights.fill(0, SpectrumAnalyzer::BandCount);
+    spectrogram.fill(colorTable.first());
+    writeColumn = 0;
+    clipHoldFrames = 0;
+    update();
+}
+
+/**
+ * @brief Paints the invalidated part of the widget.
+ * @param event The paint event.
+ */
+void SpectrumWidget::paintEvent(QPaintEvent *event)
+{
+    QPainter painter(this);
+    QRect dirty = event->rect();
+    
+    // Bars: background and grid, then the bands under the invalidated span
+    QRect bars = barArea();
+    QRect dirtyBars = dirty.intersected(bars);
+    if (!dirtyBars.isEmpty()) {
+        painter.fillRect(dirtyBars, BACKGROUND_COLOR);
+        painter.setPen(GRID_COLOR);
+        for (int db = GRID_STEP_DB; db < DISPLAY_CEILING_DB - DISPLAY_FLOOR_DB; db += GRID_STEP_DB) {
+            int y = bars.top() + static_cast<int>(db * bars.height() / (DISPLAY_CEILING_DB - DISPLAY_FLOOR_DB));
+            painter.drawLine(dirtyBars.left(), y, dirtyBars.right(), y);
+        }
+        
+        int first = qBound(0, (dirtyBars.left() - bars.left()) * SpectrumAnalyzer::BandCount / bars.width(),
+                           SpectrumAnalyzer::BandCount - 1);
+        int last = qBound(first, ((dirtyBars.right() + 1 - bars.left()) * SpectrumAnalyzer::BandCount
+                                  + bars.width() - 1) / bars.width() - 1, SpectrumAnalyzer::BandCount - 1);
+        for (int b = first; b <= last; b++) {
+            int left = barLeft(b);
+            int width = barLeft(b + 1) - left;
+            if (width > 2) {
+                width--;  // Leave a gap between wide bars
+            }
+            int levelHeight = barHeight(levels.at(b));
+            if (levelHeight > 0) {
+                painter.fillRect(left, bars.bottom() - levelHeight + 1, width, levelHeight, BAR_COLOR);
+            }
+            int peakHeight = barHeight(peaks.at(b));
+            if (peakHeight > 0) {
+                painter.fillRect(left, bars.bottom() - peakHeight + 1, width, 1, PEAK_COLOR);
+            }
+        }
+    }
+    
+    // Spectrogram: blit only the invalidated columns, then the cursor
+    QRect area = spectrogramArea();
+    QRect dirtyArea = dirty.intersected(area);
+    if (!dirtyArea.isEmpty()) {
+        // Every column that covers a pixel of the invalidated span (several share a pixel on narrow widgets)
+        int first = qBound(0, (dirtyArea.left() - area.left()) * HistoryColumns / area.width(), HistoryColumns - 1);
+        int last = qBound(first, ((dirtyArea.right() + 1 - area.left()) * HistoryColumns + area.width() - 1)
+                                 / area.width() - 1, HistoryColumns - 1);
+        QRect target(columnLeft(first), area.top(), columnLeft(last + 1) - columnLeft(first), area.height());
+        QRect source(first, 0, last - first + 1, spectrogram.height());
+        painter.drawImage(target, spectrogram, source);
+        
+        if (writeColumn >= first && writeColumn <= last) {
+            painter.fillRect(columnLeft(writeColumn), area.top(), 1, area.height(), CURSOR_COLOR);
+        }
+    }
+    
+    // Clip indicator
+    QRect clip = clipArea();
+    if (dirty.intersects(clip)) {
+        painter.fillRect(clip, clipHoldFrames > 0 ? CLIP_ON_COLOR : CLIP_OFF_COLOR);
+    }
+}
+
+/**
+ * @brief Forgets the drawn bar heights, the whole widget is repainted after a resize.
+ * @param event The resize event.
+ */
+void SpectrumWidget::resizeEvent(QResizeEvent *event)
+{
+    QWidget::resizeEvent(event);
+    
+    for (int b = 0; b < drawnLevelHeights.size(); b++) {
+        drawnLevelHeights[b] = barHeight(levels.at(b));
+        drawnPeakHeights[b] = barHeight(peaks.at(b));
+    }
+}
+
+/**
+ * @brief Gets the area of the bars.
+ * @return The rectangle in widget coordinates.
+ */
+QRect SpectrumWidget::barArea() const
+{
+    return QRect(0, 0, width(), height() / 2);
+}
+
+/**
+ * @brief Gets the area of the spectrogram.
+ * @return The rectangle in widget coordinates.
+ */
+QRect SpectrumWidget::spectrogramArea() const
+{
+    int top = height() / 2;
+    return QRect(0, top, width(), height() - top);
+}
+
+/**
+ * @brief Gets the area of the clip indicator.
+ * @return The rectangle in widget coordinates.
+ */
+QRect SpectrumWidget::clipArea() const
+{
+    return QRect(width() - CLIP_INDICATOR_SIZE - 2, 2, CLIP_INDICATOR_SIZE, CLIP_INDICATOR_SIZE);
+}
+
+/**
+ * @brief Gets the left edge of a bar (BandCount gives the right edge of the last bar).
+ * @param band The band index.
+ * @return The x coordinate.
+ */
+int SpectrumWidget::barLeft(int band) const
+{
+    return band * width() / SpectrumAnalyzer::BandCount;
+}
+
+/**
+ * @brief Gets the left edge of a spectrogram column (HistoryColumns gives the right edge).
+ * @param column The column index.
+ * @return The x coordinate.
+ */
+int SpectrumWidget::columnLeft(int column) const
+{
+    return column * width() / HistoryColumns;
+}
+
+/**
+ * @brief Converts a level to a bar height.
+ * @param levelDb The level in dBFS.
+ * @return The height in pixels within the bar area.
+ */
+int SpectrumWidget::barHeight(float levelDb) const
+{
+    int areaHeight = height() / 2;
+    float fraction = (levelDb - DISPLAY_FLOOR_DB) / (DISPLAY_CEILING_DB - DISPLAY_FLOOR_DB);
+    return qBound(0, static_cast<int>(fraction * areaHeight), areaHeight);
+}
@@ -0,0 +1,387 @@
+#include "../include/streamrecorder.h"
+#include <QtCore/QElapsedTimer>
+#include <QtCore/QtEndian>
+#include <cstring>
+
+#ifdef Q_OS_LINUX
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+// Size of the file header; the audio data starts on this (block-aligned) offset
+const int HEADER_SIZE = 4096;
+
+// Size of the aligned block the writer thread writes at once
+const int WRITE_BUFFER_SIZE = 1024 * 1024;
+
+// File space reserved ahead of the data
+const qint64 PREALLOCATION_STEP = 64 * 1024 * 1024;
+
+// Audio the ring holds while the writer is busy (e.g. syncing)
+const int RING_SECONDS = 10;
+
+// Interval of the header fixups
+const int HEADER_UPDATE_INTERVAL_MS = 5000;
+
+// Interval at which the writer thread drains the ring
+const int POLL_INTERVAL_MS = 20;
+
+// WAVE_FORMAT_EXTENSIBLE sub-format GUID of 32-bit IEEE float samples
+const unsigned char IEEE_FLOAT_GUID[16] = {
+    0x03, 0x00, 0x00, 0x00, 0x00, 0x00, 0x10, 0x00, 0x80, 0x00, 0x00, 0xAA, 0x00, 0x38, 0x9B, 0x71
+};
+
+/**
+ * @brief Gets the WAVE speaker mask of a channel map.
+ * @param map The channel map.
+ * @return The speaker mask, or 0 if the map cannot be expressed as one.
+ */
+static quint32 speakerMask(const ChannelMap &map)
+{
+    quint32 mask = 0;
+    quint32 previous = 0;
+    
+    for (ChannelPosition position : map) {
+        quint32 bit;
+        switch (position) {
+            case FrontLeft: bit = 0x1; break;
+            case FrontRight: bit = 0x2; break;
+            case FrontCenter: bit = 0x4; break;
+            case LowFrequency: bit = 0x8; break;
+            case BackLeft: bit = 0x10; break;
+            case BackRight: bit = 0x20; break;
+            case BackCenter: bit = 0x100; break;
+            case SideLeft: bit = 0x200; break;
+            case SideRight: bit = 0x400; break;
+            default: return 0;
+        }
+        
+        // WAVE requires the channels in mask bit order
+        if (bit <= previous) {
+            return 0;
+        }
+        mask |= bit;
+        previous = bit;
+    }
+    
+    return mask;
+}
+
+/**
+ * @brief Constructor for StreamRecorder.
+ * @param parent The parent object.
+ */
+StreamRecorder::StreamRecorder(QObject *parent)
+    : QObject(parent)
+    , writerThread(nullptr)
+    , writeBuffer(nullptr)
+    , writeBufferFill(0)
+    , dataBytes(0)
+    , allocatedBytes(0)
+    , syncedBytes(0)
+    , sampleRate(48000)
+    , channels(2)
+    , recording(false)
+    , stopRequested(false)
+    , activeWriters(0)
+    , framesWritten(0)
+    , droppedFrames(0)
+{
+}
+
+/**
+ * @brief Destructor for StreamRecorder.
+ */
+StreamRecorder::~StreamRecorder()
+{
+    stop();
+    
+    if (writeBuffer) {
+        qFreeAligned(writeBuffer);
+    }
+}
+
+/**
+ * @brief Starts recording to a new file.
+ * @param filePath The path of the file to create.
+ * @param sampleRate The sample rate.
+ * @param channelMap The channel map of the recorded audio.
+ * @return True if recording started, false otherwise.
+ */
+bool StreamRecorder::start(const QString &filePath, int sampleRate, const ChannelMap &channelMap)
+{
+    stop();
+    
+    this->sampleRate = sampleRate;
+    this->channelMap = channelMap;
+    channels = qMax(1, channelMap.size());
+    
+    file.setFileName(filePath);
+    if (!file.open(QIODevice::WriteOnly | QIODevice::Truncate | QIODevice::Unbuffered)) {
+        emit error(tr("Failed to create recording %1: %2").arg(filePath).arg(file.errorString()));
+        return false;
+    }
+    
+    // Buffers are allocated here, never on the audio path
+    ring.reset(sampleRate * RING_SECONDS * channels);
+    if (!writeBuffer) {
+        writeBuffer = static_cast<char*>(qMallocAligned(WRITE_BUFFER_SIZE, HEADER_SIZE));
+    }
+    writeBufferFill = 0;
+    dataBytes = 0;
+    allocatedBytes = 0;
+    syncedBytes = 0;
+    framesWritten = 0;
+    droppedFrames = 0;
+    
+    if (!writeHeader()) {
+        file.close();
+        emit error(tr("Failed to write recording %1: %2").arg(filePath).arg(file.errorString()));
+        return false;
+    }
+    
+    stopRequested = false;
+    writerThread = QThread::create([this]() { writerLoop(); });
+    writerThread->start(QThread::LowPriority);
+    recording = true;
+    
+    return true;
+}
+
+/**
+ * @brief Stops recording and finalizes the file.
+ */
+void StreamRecorder::stop()
+{
+    if (!writerThread) {
+        return;
+    }
+    
+    // Close the tap and wait for a write() that is still in progress
+    recording = false;
+    while (activeWriters.load() > 0) {
+        QThread::yieldCurrentThread();
+    }
+    
+    // The writer drains what is left and finalizes the file
+    stopRequested = true;
+    writerThread->wait();
+    delete writerThread;
+    writerThread = nullptr;
+}
+
+/**
+ * @brief Checks if a recording is running.
+ * @return True if recording, false otherwise.
+ */
+bool StreamRecorder::isRecording() const
+{
+    return recording.load(std::memory_order_relaxed);
+}
+
+/**
+ * @brief Queues interleaved frames for recording (audio thread, lock-free).
+ * @param samples The interleaved samples.
+ * @param frames The number of frames.
+ */
+void StreamRecorder::write(const float *samples, int frames)
+{
+    activeWriters.fetch_add(1);
+    
+    if (recording.load()) {
+        // Only whole frames, so the file never gets out of step
+        int count = qMin(frames, ring.availableToWrite() / channels);
+        ring.write(samples, count * channels);
+        if (count < frames) {
+            droppedFrames.fetch_add(frames - count, std::memory_order_relaxed);
+        }
+    }
+    
+    activeWriters.fetch_sub(1);
+}
+
+/**
+ * @brief Gets the number of frames written to the file.
+ * @return The number of frames.
+ */
+quint64 StreamRecorder::getFramesWritten() const
+{
+    return framesWritten.load(std::memory_order_relaxed);
+}
+
+/**
+ * @brief Gets the number of frames lost because the writer fell behind.
+ * @return The number of frames.
+ */
+quint64 StreamRecorder::getDroppedFrames() const
+{
+    return droppedFrames.load(std::memory_order_relaxed);
+}
+
+/**
+ * @brief Body of the writer thread.
+ */
+void StreamRecorder::writerLoop()
+{
+    QElapsedTimer headerTimer;
+    headerTimer.start();
+    bool ok = true;
+    
+    while (ok && !stopRequested.load()) {
+        ok = drain();
+        
+        if (ok && headerTimer.elapsed() >= HEADER_UPDATE_INTERVAL_MS) {
+            ok = writeHeader();
+            headerTimer.restart();
+        }
+        
+        QThread::msleep(POLL_INTERVAL_MS);
+    }
+    
+    // Write the remainder (the only unaligned write), the final header and
+    // give back the preallocated space
+    if (ok) {
+        ok = drain() && flushWriteBuffer() && writeHeader() && file.resize(HEADER_SIZE + dataBytes);
+    }
+    
+    if (!ok) {
+        recording = false;
+        emit error(tr("Recording to %1 failed: %2").arg(file.fileName()).arg(file.errorString()));
+    }
+    
+    file.close();
+}
+
+/**
+ * @brief Moves everything queued in the ring into the file.
+ * @return True if successful, false on a write error.
+ */
+bool StreamRecorder::drain()
+{
+    for (;;) {
+        int space = (WRITE_BUFFER_SIZE - writeBufferFill) / static_cast<int>(sizeof(float));
+        int count = ring.read(reinterpret_cast<float*>(writeBuffer + writeBufferFill), space);
+        if (count == 0) {
+            return true;
+        }
+        
+        writeBufferFill += count * static_cast<int>(sizeof(float));
+        if (writeBufferFill == WRITE_BUFFER_SIZE && !flushWriteBuffer()) {
+            return false;
+        }
+    }
+}
+
+/**
+ * @brief Writes the filled part of the write buffer to the file.
+ * @return True if successful, false on a write error.
+ */
+bool StreamRecorder::flushWriteBuffer()
+{
+    if (writeBufferFill == 0) {
+        return true;
+    }
+    
+    qint64 offset = HEADER_SIZE + dataBytes;
+    preallocate(offset + writeBufferFill);
+    
+    if (!file.seek(offset) || file.write(writeBuffer, writeBufferFill) != writeBufferFill) {
+        return false;
+    }
+    
+    dataBytes += writeBufferFill;
+    writeBufferFill = 0;
+    framesWritten.store(dataBytes / (channels * sizeof(float)), std::memory_order_relaxed);
+    return true;
+}
+
+/**
+ * @brief Makes sure the file has space reserved beyond the given size.
+ * @param size The number of bytes about to be in use.
+ */
+void StreamRecorder::preallocate(qint64 size)
+{
+    if (size <= allocatedBytes) {
+        return;
+    }
+    
+    qint64 target = allocatedBytes;
+    while (target < size) {
+        target += PREALLOCATION_STEP;
+    }
+
+#ifdef Q_OS_LINUX
+    // Reserve the blocks without changing the file size, so the file stays
+    // valid and the extents stay contiguous. Not every filesystem supports it.
+    ::fallocate(file.handle(), FALLOC_FL_KEEP_SIZE, allocatedBytes, target - allocatedBytes);
+#endif
+    
+    allocatedBytes = target;
+}
+
+/**
+ * @brief Rewrites the header with the current data size.
+ * @return True if successful, false on a write error.
+ */
+bool StreamRecorder::writeHeader()
+{
+    QByteArray header(HEADER_SIZE, 0);
+    char *p = header.data();
+    
+    quint64 riffSize = HEADER_SIZE - 8 + dataBytes;
+    quint64 frames = dataBytes / (channels * sizeof(float));
+    bool rf64 = riffSize > 0xFFFFFFFFULL;
+    
+    // RIFF header, switched to RF64 once the sizes no longer fit 32 bits
+    memcpy(p, rf64 ? "RF64" : "RIFF", 4);
+    qToLittleEndian<quint32>(rf64 ? 0xFFFFFFFFU : static_cast<quint32>(riffSize), p + 4);
+    memcpy(p + 8, "WAVE", 4);
+    
+    // ds64 chunk with the 64-bit sizes (a JUNK placeholder while not needed)
+    memcpy(p + 12, rf64 ? "ds64" : "JUNK", 4);
+    qToLittleEndian<quint32>(28, p + 16);
+    qToLittleEndian<quint64>(riffSize, p + 20);
+    qToLittleEndian<quint64>(dataBytes, p + 28);
+    qToLittleEndian<quint64>(frames, p + 36);
+    qToLittleEndian<quint32>(0, p + 44);
+    
+    // fmt chunk: WAVE_FORMAT_EXTENSIBLE, 32-bit float
+    memcpy(p + 48, "fmt ", 4);
+    qToLittleEndian<quint32>(40, p + 52);
+    qToLittleEndian<quint16>(0xFFFE, p + 56);
+    qToLittleEndian<quint16>(channels, p + 58);
+    qToLittleEndian<quint32>(sampleRate, p + 60);
+    qToLittleEndian<quint32>(sampleRate * channels * sizeof(float), p + 64);
+    qToLittleEndian<quint16>(channels * sizeof(float), p + 68);
+    qToLittleEndian<quint16>(32, p + 70);
+    qToLittleEndian<quint16>(22, p + 72);
+    qToLittleEndian<quint16>(32, p + 74);
+    qToLittleEndian<quint32>(speakerMask(channelMap), p + 76);
+    memcpy(p + 80, IEEE_FLOAT_GUID, sizeof(IEEE_FLOAT_GUID));
+    
+    // fact chunk (required for non-PCM data)
+    memcpy(p + 96, "fact", 4);
+    qToLittleEndian<quint32>(4, p + 100);
+    qToLittleEndian<quint32>(rf64 ? 0xFFFFFFFFU : static_cast<quint32>(frames), p + 104);
+    
+    // Padding, so the samples start on a block boundary
+    memcpy(p + 108, "JUNK", 4);
+    qToLittleEndian<quint32>(HEADER_SIZE - 108 - 8 - 8, p + 112);
+    
+    memcpy(p + HEADER_SIZE - 8, "data", 4);
+    qToLittleEndian<quint32>(rf64 ? 0xFFFFFFFFU : static_cast<quint32>(dataBytes), p + HEADER_SIZE - 4);
+    
+    if (!file.seek(0) || file.write(header) != HEADER_SIZE) {
+        return false;
+    }
+
+#ifdef Q_OS_LINUX
+    // Make the new size durable and drop the written audio from the page
+    // cache, so a recording running for days doesn't crowd out other data
+    ::fdatasync(file.handle());
+    ::posix_fadvise(file.handle(), HEADER_SIZE + syncedBytes, dataBytes - syncedBytes, POSIX_FADV_DONTNEED);
+    syncedBytes = dataBytes;
+#endif
+    
+    return true;
+}
@@ -0,0 +1,569 @@
+#include "../include/uringtransport.h"
+#include <QtCore/QSocketNotifier>
+#include <cstring>
+
+#ifdef AUDIOBRIDGE_HAVE_URING
+#include <liburing.h>
+#include <sys/eventfd.h>
+#include <sys/mman.h>
+#include <fcntl.h>
+#include <errno.h>
+#endif
+
+#ifdef Q_OS_UNIX
+#include <unistd.h>
+#endif
+
+// Send slots and receive buffers of the packet pool
+const int SEND_SLOT_COUNT = 64;
+const int RECEIVE_BUFFER_COUNT = 64;
+
+// Submission queue depth: a full chain of writes plus the receive and a cancel
+const unsigned RING_ENTRIES = 128;
+
+// Buffer group of the receive buffers
+const int RECEIVE_BUFFER_GROUP = 0;
+
+// User data of the operations that are not writes (writes carry their slot index)
+const quint64 RECEIVE_TAG = ~0ULL;
+const quint64 CANCEL_TAG = ~0ULL - 1;
+
+/**
+ * @brief Constructor for UringTransport.
+ * @param parent The parent object.
+ */
+UringTransport::UringTransport(QObject *parent)
+    : StreamTransport(parent)
+    , ring(nullptr)
+    , bufferRing(nullptr)
+    , notifier(nullptr)
+    , pool(nullptr)
+    , receivedBytes(0)
+    , queuedBytes(0)
+    , descriptor(-1)
+    , eventDescriptor(-1)
+    , submittedSlots(0)
+    , inflightWrites(0)
+    , receiveArmed(false)
+{
+}
+
+/**
+ * @brief Destructor for UringTransport.
+ */
+UringTransport::~UringTransport()
+{
+    close();
+}
+
+/**
+ * @brief Checks if io_uring transports can be used (built in and supported by the kernel).
+ * @return True if available, false otherwise.
+ */
+bool UringTransport::isAvailable()
+{
+#ifdef AUDIOBRIDGE_HAVE_URING
+    // Kernels that accept a single-issuer ring (6.0) also support multishot receive
+    static const bool available = []() {
+        struct io_uring probe;
+        if (io_uring_queue_init(2, &probe, IORING_SETUP_SINGLE_ISSUER) < 0) {
+            return false;
+        }
+        io_uring_queue_exit(&probe);
+        return true;
+    }();
+    return available;
+#else
+    return false;
+#endif
+}
+
+/**
+ * @brief Takes over a connected socket and arms the receive.
+ * @param socketDescriptor The socket descriptor; the transport owns it from now on,
+ *                         also if opening fails.
+ * @param errorMessage Receives the reason of a failure (optional).
+ * @return True if the transport is ready, false otherwise.
+ */
+bool UringTransport::open(int socketDescriptor, QString *errorMessage)
+{
+    close();
+    descriptor = socketDescriptor;
+
+#ifdef AUDIOBRIDGE_HAVE_URING
+    auto failOpen = [&](const QString &message, int result) {
+        close();
+        if (errorMessage) {
+            *errorMessage = QString("%1: %2").arg(message, QString::fromLocal8Bit(strerror(-result)));
+        }
+        return false;
+    };
+    
+    // The ring polls the socket itself. A non-blocking descriptor would make
+    // reads and writes fail with EAGAIN instead.
+    int flags = ::fcntl(descriptor, F_GETFL);
+    if (flags < 0 || ::fcntl(descriptor, F_SETFL, flags & ~O_NONBLOCK) < 0) {
+        return failOpen(tr("Failed to configure the socket"), -errno);
+    }
+    
+    // Only this thread submits, which spares the kernel some locking
+    ring = new io_uring;
+    int result = io_uring_queue_init(RING_ENTRIES, ring, IORING_SETUP_SINGLE_ISSUER);
+    if (result < 0) {
+        delete ring;
+        ring = nullptr;
+        return failOpen(tr("Failed to create the io_uring"), result);
+    }
+    
+    // One pool for all I/O memory: the send slots, then the receive buffers
+    size_t poolSize = static_cast<size_t>(SEND_SLOT_COUNT + RECEIVE_BUFFER_COUNT) * SlotSize;
+    void *memory = ::mmap(nullptr, poolSize, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (memory == MAP_FAILED) {
+        return failOpen(tr("Failed to allocate the packet pool"), -errno);
+    }
+    pool = static_cast<char*>(memory);
+    
+    // Register the send slots, so writes skip the page pinning per operation
+    struct iovec sendBuffers[SEND_SLOT_COUNT];
+    for (int i = 0; i < SEND_SLOT_COUNT; i++) {
+        sendBuffers[i].iov_base = pool + i * SlotSize;
+        sendBuffers[i].iov_len = SlotSize;
+    }
+    result = io_uring_register_buffers(ring, sendBuffers, SEND_SLOT_COUNT);
+    if (result < 0) {
+        return failOpen(tr("Failed to register the send buffers"), result);
+    }
+    freeSlots.clear();
+    for (int i = SEND_SLOT_COUNT - 1; i >= 0; i--) {
+        freeSlots.append(i);
+    }
+    
+    // Provide the receive buffers, the kernel picks one per completion
+    bufferRing = io_uring_setup_buf_ring(ring, RECEIVE_BUFFER_COUNT, RECEIVE_BUFFER_GROUP, 0, &result);
+    if (!bufferRing) {
+        return failOpen(tr("Failed to set up the receive buffers"), result);
+    }
+    int mask = io_uring_buf_ring_mask(RECEIVE_BUFFER_COUNT);
+    char *receiveBuffers = pool + SEND_SLOT_COUNT * SlotSize;
+    for (int i = 0; i < RECEIVE_BUFFER_COUNT; i++) {
+        io_uring_buf_ring_add(bufferRing, receiveBuffers + i * SlotSize, SlotSize, i, mask, i);
+    }
+    io_uring_buf_ring_advance(bufferRing, RECEIVE_BUFFER_COUNT);
+    
+    // Completions wake the event loop through an eventfd
+    eventDescriptor = ::eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (eventDescriptor < 0) {
+        return failOpen(tr("Failed to create the completion event"), -errno);
+    }
+    result = io_uring_register_eventfd(ring, eventDescriptor);
+    if (result < 0) {
+        return failOpen(tr("Failed to register the completion event"), result);
+    }
+    notifier = new QSocketNotifier(eventDescriptor, QSocketNotifier::Read, this);
+    connect(notifier, &QSocketNotifier::activated, this, &UringTransport::processCompletions);
+    
+    if (!armReceive()) {
+        return failOpen(tr("Failed to arm the receive"), -EBUSY);
+    }
+    io_uring_submit(ring);
+    
+    lastError.clear();
+    return true;
+#else
+    close();
+    if (errorMessage) {
+        *errorMessage = tr("AudioBridge was built without io_uring support");
+    }
+    return false;
+#endif
+}
+
+/**
+ * @brief Cancels the outstanding operations, frees the pool and closes the socket.
+ */
+void UringTransport::close()
+{
+#ifdef AUDIOBRIDGE_HAVE_URING
+    if (ring) {
+        delete notifier;
+        notifier = nullptr;
+        
+        // The kernel may still write into the pool, so wait until nothing references it
+        if (descriptor >= 0 && (receiveArmed || inflightWrites > 0)) {
+            struct io_uring_sqe *sqe = io_uring_get_sqe(ring);
+            if (sqe) {
+                io_uring_prep_cancel_fd(sqe, descriptor, IORING_ASYNC_CANCEL_ALL);
+                io_uring_sqe_set_data64(sqe, CANCEL_TAG);
+                io_uring_submit(ring);
+            }
+            
+            while (receiveArmed || inflightWrites > 0) {
+                struct io_uring_cqe *cqe;
+                if (io_uring_wait_cqe(ring, &cqe) < 0) {
+                    break;
+                }
+                quint64 tag = io_uring_cqe_get_data64(cqe);
+                if (tag == RECEIVE_TAG && !(cqe->flags & IORING_CQE_F_MORE)) {
+                    receiveArmed = false;
+                } else if (tag != RECEIVE_TAG && tag != CANCEL_TAG) {
+                    inflightWrites--;
+                }
+                io_uring_cqe_seen(ring, cqe);
+            }
+        }
+        
+        if (bufferRing) {
+            io_uring_free_buf_ring(ring, bufferRing, RECEIVE_BUFFER_COUNT, RECEIVE_BUFFER_GROUP);
+            bufferRing = nullptr;
+        }
+        io_uring_queue_exit(ring);
+        delete ring;
+        ring = nullptr;
+    }
+    
+    if (pool) {
+        ::munmap(pool, static_cast<size_t>(SEND_SLOT_COUNT + RECEIVE_BUFFER_COUNT) * SlotSize);
+        pool = nullptr;
+    }
+    if (eventDescriptor >= 0) {
+        ::close(eventDescriptor);
+        eventDescriptor = -1;
+    }
+#endif
+
+#ifdef Q_OS_UNIX
+    if (descriptor >= 0) {
+        ::close(descriptor);
+    }
+#endif
+    descriptor = -1;
+    
+    freeSlots.clear();
+    sendQueue.clear();
+    received.clear();
+    overflow.clear();
+    receivedBytes = 0;
+    queuedBytes = 0;
+    submittedSlots = 0;
+    inflightWrites = 0;
+    receiveArmed = false;
+}
+
+/**
+ * @brief Checks if the transport is open.
+ * @return True if open, false otherwise.
+ */
+bool UringTransport::isOpen() const
+{
+    return ring != nullptr;
+}
+
+/**
+ * @brief Gets the socket descriptor.
+ * @return The descriptor, or -1 if the transport is closed.
+ */
+int UringTransport::socketDescriptor() const
+{
+    return ring ? descriptor : -1;
+}
+
+/**
+ * @brief Gets the number of received bytes waiting to be read.
+ * @return The number of bytes.
+ */
+qint64 UringTransport::bytesAvailable() const
+{
+    return receivedBytes;
+}
+
+/**
+ * @brief Appends all received bytes to a buffer and recycles their receive buffers.
+ * @param buffer The buffer to append to.
+ * @return The number of bytes appended.
+ */
+qint64 UringTransport::read(QByteArray &buffer)
+{
+    qint64 bytes = receivedBytes;
+    if (bytes == 0) {
+        return 0;
+    }
+
+#ifdef AUDIOBRIDGE_HAVE_URING
+    int used = buffer.size();
+    buffer.resize(used + static_cast<int>(bytes));
+    char *target = buffer.data() + used;
+    
+    // Copy out and hand the buffers straight back to the kernel
+    char *receiveBuffers = pool + SEND_SLOT_COUNT * SlotSize;
+    int mask = io_uring_buf_ring_mask(RECEIVE_BUFFER_COUNT);
+    int recycled = 0;
+    while (!received.isEmpty()) {
+        ReceivedBuffer entry = received.dequeue();
+        char *source = receiveBuffers + entry.id * SlotSize;
+        memcpy(target, source, entry.size);
+        target += entry.size;
+        io_uring_buf_ring_add(bufferRing, source, SlotSize, entry.id, mask, recycled++);
+    }
+    io_uring_buf_ring_advance(bufferRing, recycled);
+    receivedBytes = 0;
+    
+    // The receive stops when it runs out of buffers, resume it now that there are some
+    if (!receiveArmed && armReceive()) {
+        io_uring_submit(ring);
+    }
+#else
+    Q_UNUSED(buffer);
+#endif
+    
+    return bytes;
+}
+
+/**
+ * @brief Packs bytes into the send slots; they go out with the next flush().
+ * @param data The bytes.
+ * @param size The number of bytes.
+ */
+void UringTransport::write(const char *data, qint64 size)
+{
+    if (!ring) {
+        return;
+    }
+    
+    while (size > 0) {
+        SendSlot *slot = writableSlot();
+        if (!slot) {
+            // Every slot is in flight. The caller stops writing at a backlog,
+            // so this only happens for control packets; keep them in order.
+            overflow.append(data, static_cast<int>(size));
+            queuedBytes += size;
+            return;
+        }
+        
+        int chunk = static_cast<int>(qMin<qint64>(size, SlotSize - slot->size));
+        memcpy(pool + slot->index * SlotSize + slot->size, data, chunk);
+        slot->size += chunk;
+        queuedBytes += chunk;
+        data += chunk;
+        size -= chunk;
+    }
+}
+
+/**
+ * @brief Submits the written bytes to the kernel with one syscall.
+ */
+void UringTransport::flush()
+{
+    // A chain in flight is followed by the next one once it completed, so
+    // concurrent chains cannot reorder the stream
+    if (!ring || inflightWrites > 0 || submittedSlots >= sendQueue.size()) {
+        return;
+    }
+    
+    submitSlots();
+}
+
+/**
+ * @brief Gets the number of bytes written but not yet taken by the kernel.
+ * @return The number of bytes.
+ */
+qint64 UringTransport::bytesToWrite() const
+{
+    return queuedBytes;
+}
+
+/**
+ * @brief Gets the description of the last error.
+ * @return The error description.
+ */
+QString UringTransport::errorString() const
+{
+    return lastError;
+}
+
+/**
+ * @brief Processes the completions signalled through the eventfd.
+ */
+void UringTransport::processCompletions()
+{
+#ifdef AUDIOBRIDGE_HAVE_URING
+    quint64 events;
+    while (::read(eventDescriptor, &events, sizeof(events)) > 0) {
+    }
+    
+    bool dataReceived = false;
+    bool peerClosed = false;
+    qint64 bytesTaken = 0;
+    QString failure;
+    
+    struct io_uring_cqe *cqes[RING_ENTRIES];
+    unsigned count;
+    while (ring && (count = io_uring_peek_batch_cqe(ring, cqes, RING_ENTRIES)) > 0) {
+        for (unsigned i = 0; i < count; i++) {
+            const struct io_uring_cqe *cqe = cqes[i];
+            quint64 tag = io_uring_cqe_get_data64(cqe);
+            
+            if (tag == RECEIVE_TAG) {
+                if (!(cqe->flags & IORING_CQE_F_MORE)) {
+                    receiveArmed = false;
+                }
+                if (cqe->res > 0 && (cqe->flags & IORING_CQE_F_BUFFER)) {
+                    ReceivedBuffer entry;
+                    entry.id = static_cast<int>(cqe->flags >> IORING_CQE_BUFFER_SHIFT);
+                    entry.size = cqe->res;
+                    received.enqueue(entry);
+                    receivedBytes += cqe->res;
+                    dataReceived = true;
+                } else if (cqe->res == 0) {
+                    peerClosed = true;
+                } else if (cqe->res != -ENOBUFS) {
+                    // Out of buffers only pauses the receive until read() recycles some
+                    failure = QString::fromLocal8Bit(strerror(-cqe->res));
+                }
+                continue;
+            }
+            
+            if (tag == CANCEL_TAG) {
+                continue;
+            }
+            
+            // Writes of a chain complete in order, the front slot is the one.
+            // After a short write the rest of the chain is cancelled; those
+            // slots stay queued and go again with the next chain.
+            inflightWrites--;
+            if (cqe->res == -ECANCELED) {
+                continue;
+            }
+            if (cqe->res < 0) {
+                failure = QString::fromLocal8Bit(strerror(-cqe->res));
+                continue;
+            }
+            
+            SendSlot &slot = sendQueue.head();
+            slot.offset += cqe->res;
+            queuedBytes -= cqe->res;
+            bytesTaken += cqe->res;
+            if (slot.offset == slot.size) {
+                freeSlots.append(sendQueue.dequeue().index);
+                submittedSlots--;
+            }
+        }
+        io_uring_cq_advance(ring, count);
+    }
+    
+    if (!failure.isEmpty()) {
+        fail(failure);
+        return;
+    }
+    
+    // Once the chain is done, send what it left behind and what was written meanwhile
+    if (inflightWrites == 0) {
+        submittedSlots = 0;
+        while (!overflow.isEmpty() && writableSlot()) {
+            QByteArray pending = overflow;
+            overflow.clear();
+            queuedBytes -= pending.size();
+            write(pending.constData(), pending.size());
+        }
+        if (!sendQueue.isEmpty()) {
+            submitSlots();
+        }
+    }
+    
+    if (bytesTaken > 0) {
+        emit bytesWritten(bytesTaken);
+    }
+    if (dataReceived && ring) {
+        emit readyRead();
+    }
+    if (peerClosed && ring) {
+        lastError = tr("The remote host closed the connection");
+        emit disconnected();
+    }
+#endif
+}
+
+/**
+ * @brief Arms the multishot receive.
+ * @return True if it was queued, false otherwise.
+ */
+bool UringTransport::armReceive()
+{
+#ifdef AUDIOBRIDGE_HAVE_URING
+    struct io_uring_sqe *sqe = io_uring_get_sqe(ring);
+    if (!sqe) {
+        return false;
+    }
+    
+    io_uring_prep_recv_multishot(sqe, descriptor, nullptr, 0, 0);
+    sqe->flags |= IOSQE_BUFFER_SELECT;
+    sqe->buf_group = RECEIVE_BUFFER_GROUP;
+    io_uring_sqe_set_data64(sqe, RECEIVE_TAG);
+    receiveArmed = true;
+    return true;
+#else
+    return false;
+#endif
+}
+
+/**
+ * @brief Submits every queued slot as one linked chain of writes.
+ */
+void UringTransport::submitSlots()
+{
+#ifdef AUDIOBRIDGE_HAVE_URING
+    int last = sendQueue.size() - 1;
+    for (int i = 0; i <= last; i++) {
+        const SendSlot &slot = sendQueue.at(i);
+        struct io_uring_sqe *sqe = io_uring_get_sqe(ring);
+        if (!sqe) {
+            break;
+        }
+        
+        io_uring_prep_write_fixed(sqe, descriptor, pool + slot.index * SlotSize + slot.offset,
+                                  slot.size - slot.offset, 0, slot.index);
+        
+        // A link keeps the writes in stream order
+        if (i < last) {
+            sqe->flags |= IOSQE_IO_LINK;
+        }
+        io_uring_sqe_set_data64(sqe, static_cast<quint64>(slot.index));
+        inflightWrites++;
+        submittedSlots++;
+    }
+    
+    io_uring_submit(ring);
+#endif
+}
+
+/**
+ * @brief Gets the slot to pack bytes into.
+ * @return The slot, or nullptr if every slot is in use.
+ */
+UringTransport::SendSlot *UringTransport::writableSlot()
+{
+    // The last slot takes more bytes until it is submitted or full
+    if (sendQueue.size() > submittedSlots && sendQueue.last().size < SlotSize) {
+        return &sendQueue.last();
+    }
+    
+    if (freeSlots.isEmpty()) {
+        return nullptr;
+    }
+    
+    SendSlot slot;
+    slot.index = freeSlots.takeLast();
+    slot.size = 0;
+    slot.offset = 0;
+    sendQueue.enqueue(slot);
+    return &sendQueue.last();
+}
+
+/**
+ * @brief Fails the connection.
+ * @param message The error description.
+ */
+void UringTransport::fail(const QString &message)
+{
+    lastError = message;
+    emit disconnected();
+}
@@ -0,0 +1,437 @@
+#include "../include/workerpool.h"
+#include "../include/rtcheck.h"
+
+// Tasks the shared queue holds (a power of two)
+const int SHARED_QUEUE_CAPACITY = 4096;
+
+// A strand waited on is polled: a few yields, then sleeps growing to this
+const int IDLE_WAIT_YIELDS = 64;
+const unsigned long IDLE_WAIT_MAX_SLEEP_US = 1000;
+
+namespace {
+
+// The pool and worker the calling thread belongs to, if any
+thread_local WorkerPool *currentPool = nullptr;
+thread_local int currentWorker = -1;
+
+/**
+ * @brief A posted function, deleted once it has run.
+ */
+class FunctionTask : public PoolTask
+{
+public:
+    /**
+     * @brief Constructor for FunctionTask.
+     * @param function The function to run.
+     */
+    explicit FunctionTask(const std::function<void()> &function)
+        : function(function)
+    {
+    }
+    
+    /**
+     * @brief Runs the function and deletes the task.
+     */
+    void run() override
+    {
+        function();
+        delete this;
+    }
+
+private:
+    std::function<void()> function;
+};
+
+} // namespace
+
+/**
+ * @brief A worker thread of a WorkerPool.
+ */
+class PoolThread : public QThread
+{
+public:
+    /**
+     * @brief Constructor for PoolThread.
+     * @param pool The pool.
+     * @param index The index of the worker.
+     */
+    PoolThread(WorkerPool *pool, int index)
+        : pool(pool)
+        , index(index)
+    {
+    }
+
+protected:
+    /**
+     * @brief Runs the worker until the pool stops.
+     */
+    void run() override
+    {
+        pool->runWorker(index);
+    }
+
+private:
+    WorkerPool *pool;
+    int index;
+};
+
+/**
+ * @brief Constructor for WorkerStrand.
+ * @param pool The pool that runs the job.
+ * @param job The job, which drains the stream's queued work.
+ */
+WorkerStrand::WorkerStrand(WorkerPool *pool, const std::function<void()> &job)
+    : pool(pool)
+    , job(job)
+    , pending(0)
+{
+}
+
+/**
+ * @brief Asks for the job to run (lock-free, allocation-free).
+ * @return True if the job will run, false if the pool is saturated.
+ */
+bool WorkerStrand::schedule()
+{
+    // Only the request that finds the strand idle queues it
+    if (pending.fetch_add(1, std::memory_order_acq_rel) > 0) {
+        return true;
+    }
+    
+    // Nothing runs or will run the strand, and no one else schedules it
+    if (!pool->submit(this)) {
+        pending.store(0, std::memory_order_release);
+        return false;
+    }
+    return true;
+}
+
+/**
+ * @brief Waits until the job is neither queued nor running.
+ */
+void WorkerStrand::waitUntilIdle()
+{
+    // The worker cannot signal the end of the last run: the strand may be
+    // gone as soon as it is idle. Polling backs off instead, so a wait behind
+    // a saturated pool costs its thread at most a wakeup per millisecond.
+    unsigned long sleepUs = 1;
+    for (int polls = 0; pending.load(std::memory_order_acquire) != 0; polls++) {
+        if (polls < IDLE_WAIT_YIELDS) {
+            QThread::yieldCurrentThread();
+        } else {
+            QThread::usleep(sleepUs);
+            sleepUs = qMin(2 * sleepUs, IDLE_WAIT_MAX_SLEEP_US);
+        }
+    }
+}
+
+/**
+ * @brief Runs the job (on a worker thread).
+ */
+void WorkerStrand::run()
+{
+    int covered = pending.load(std::memory_order_acquire);
+    job();
+    
+    // Requests that came in while running need another run, behind the
+    // other streams already waiting. Nothing is touched once idle.
+    if (!pending.compare_exchange_strong(covered, 0, std::memory_order_acq_rel)) {
+        pool->requeue(this);
+    }
+}
+
+/**
+ * @brief Constructor for WorkerPool. Starts the workers.
+ * @param threadCount The number of workers (0 for one per core).
+ * @param parent The parent object.
+ */
+WorkerPool::WorkerPool(int threadCount, QObject *parent)
+    : QObject(parent)
+    , sharedSlots(new Slot[SHARED_QUEUE_CAPACITY])
+    , sharedMask(SHARED_QUEUE_CAPACITY - 1)
+    , sharedHead(0)
+    , sharedTail(0)
+    , sleepingWorkers(0)
+    , stopping(false)
+    , nextWorker(0)
+    , tasksRun(0)
+    , tasksStolen(0)
+    , submitsRejected(0)
+{
+    for (int i = 0; i < SHARED_QUEUE_CAPACITY; i++) {
+        sharedSlots[i].sequence.store(static_cast<quint64>(i), std::memory_order_relaxed);
+        sharedSlots[i].task = nullptr;
+    }
+    
+    // The queues exist before any worker can look at another's
+    int count = threadCount > 0 ? threadCount : qMax(1, QThread::idealThreadCount());
+    for (int i = 0; i < count; i++) {
+        workers.emplace_back(new Worker);
+    }
+    for (int i = 0; i < count; i++) {
+        Worker &worker = *workers[i];
+        worker.thread = new PoolThread(this, i);
+        worker.thread->setObjectName(QString("PoolWorker%1").arg(i));
+        worker.thread->start(QThread::HighPriority);
+    }
+}
+
+/**
+ * @brief Destructor for WorkerPool. Runs the queued tasks and stops the workers.
+ */
+WorkerPool::~WorkerPool()
+{
+    stopping.store(true, std::memory_order_seq_cst);
+    wakeup.release(static_cast<int>(workers.size()));
+    for (const std::unique_ptr<Worker> &worker : workers) {
+        worker->thread->wait();
+        delete worker->thread;
+    }
+}
+
+/**
+ * @brief Gets the number of workers.
+ * @return The number of threads.
+ */
+int WorkerPool::getThreadCount() const
+{
+    return static_cast<int>(workers.size());
+}
+
+/**
+ * @brief Queues a task (lock-free and allocation-free from outside the pool).
+ * @param task The task, which must stay alive until it has run.
+ * @return True if the task was queued, false if the shared queue is full.
+ */
+bool WorkerPool::submit(PoolTask *task)
+{
+    // A worker keeps what it submits, others steal it if they run dry
+    if (currentPool == this) {
+        Worker &worker = *workers[currentWorker];
+        worker.mutex.lock();
+        worker.tasks.push_back(task);
+        worker.mutex.unlock();
+        wakeWorker();
+        return true;
+    }
+    
+    if (!pushShared(task)) {
+        submitsRejected.fetch_add(1, std::memory_order_relaxed);
+        return false;
+    }
+    wakeWorker();
+    return true;
+}
+
+/**
+ * @brief Queues a task that just ran again, behind every task already queued.
+ * @param task The task, which must stay alive until it has run.
+ */
+void WorkerPool::requeue(PoolTask *task)
+{
+    if (!pushShared(task)) {
+        // The shared queue is full: behind a worker's own work instead
+        int index = currentPool == this ? currentWorker
+                                        : nextWorker.fetch_add(1, std::memory_order_relaxed) % getThreadCount();
+        Worker &worker = *workers[index];
+        worker.mutex.lock();
+        worker.tasks.push_back(task);
+        worker.mutex.unlock();
+    }
+    wakeWorker();
+}
+
+/**
+ * @brief Queues a function (allocates; not for the audio callbacks).
+ * @param function The function to run.
+ */
+void WorkerPool::post(const std::function<void()> &function)
+{
+    FunctionTask *task = new FunctionTask(function);
+    if (currentPool == this) {
+        submit(task);
+        return;
+    }
+    if (pushShared(task)) {
+        wakeWorker();
+        return;
+    }
+    
+    // The shared queue is full: hand it to a worker directly
+    int index = nextWorker.fetch_add(1, std::memory_order_relaxed) % getThreadCount();
+    Worker &worker = *workers[index];
+    worker.mutex.lock();
+    worker.tasks.push_back(task);
+    worker.mutex.unlock();
+    wakeWorker();
+}
+
+/**
+ * @brief Gets the statistics of the pool.
+ * @return The statistics since the pool started.
+ */
+WorkerPoolStats WorkerPool::getStats() const
+{
+    WorkerPoolStats stats;
+    stats.threads = getThreadCount();
+    stats.tasksRun = tasksRun.load(std::memory_order_relaxed);
+    stats.tasksStolen = tasksStolen.load(std::memory_order_relaxed);
+    stats.submitsRejected = submitsRejected.load(std::memory_order_relaxed);
+    return stats;
+}
+
+/**
+ * @brief Runs tasks until the pool stops (worker thread).
+ * @param index The index of the worker.
+ */
+void WorkerPool::runWorker(int index)
+{
+    currentPool = this;
+    currentWorker = index;
+    
+    for (;;) {
+        PoolTask *task = takeTask(index);
+        if (!task) {
+            // Queued work is finished before stopping
+            if (stopping.load(std::memory_order_acquire)) {
+                break;
+            }
+            
+            // Announce the sleep, then look once more: a submitter either sees
+            // the announcement and wakes us, or its task is found here
+            sleepingWorkers.fetch_add(1, std::memory_order_seq_cst);
+            task = takeTask(index);
+            if (!task) {
+                if (!stopping.load(std::memory_order_seq_cst)) {
+                    wakeup.acquire();
+                }
+                sleepingWorkers.fetch_sub(1, std::memory_order_relaxed);
+                continue;
+            }
+            sleepingWorkers.fetch_sub(1, std::memory_order_relaxed);
+        }
+        
+        task->run();
+        tasksRun.fetch_add(1, std::memory_order_relaxed);
+    }
+    
+    currentPool = nullptr;
+    currentWorker = -1;
+}
+
+/**
+ * @brief Takes the next task for a worker: its own, shared, then stolen.
+ * @param index The index of the worker.
+ * @return The task, nullptr if every queue is empty.
+ */
+PoolTask *WorkerPool::takeTask(int index)
+{
+    // Own work oldest first, so tasks run in the order they were queued
+    Worker &self = *workers[index];
+    self.mutex.lock();
+    if (!self.tasks.empty()) {
+        PoolTask *task = self.tasks.front();
+        self.tasks.pop_front();
+        self.mutex.unlock();
+        return task;
+    }
+    self.mutex.unlock();
+    
+    if (PoolTask *task = popShared()) {
+        return task;
+    }
+    
+    // Steal the oldest task of the next busy worker
+    int count = getThreadCount();
+    for (int i = 1; i < count; i++) {
+        Worker &victim = *workers[(index + i) % count];
+        if (!victim.mutex.tryLock()) {
+            continue;
+        }
+        if (!victim.tasks.empty()) {
+            PoolTask *task = victim.tasks.front();
+            victim.tasks.pop_front();
+            victim.mutex.unlock();
+            tasksStolen.fetch_add(1, std::memory_order_relaxed);
+            return task;
+        }
+        victim.mutex.unlock();
+    }
+    return nullptr;
+}
+
+/**
+ * @brief Adds a task to the shared queue.
+ * @param task The task.
+ * @return True if queued, false if the queue is full.
+ */
+bool WorkerPool::pushShared(PoolTask *task)
+{
+    // Each slot's sequence says whose turn it is: a producer's when it equals
+    // the position, a consumer's when it is one past
+    quint64 position = sharedHead.load(std::memory_order_relaxed);
+    Slot *slot;
+    for (;;) {
+        slot = &sharedSlots[position & sharedMask];
+        quint64 sequence = slot->sequence.load(std::memory_order_acquire);
+        qint64 difference = static_cast<qint64>(sequence - position);
+        if (difference == 0) {
+            if (sharedHead.compare_exchange_weak(position, position + 1, std::memory_order_relaxed)) {
+                break;
+            }
+        } else if (difference < 0) {
+            return false;
+        } else {
+            position = sharedHead.load(std::memory_order_relaxed);
+        }
+    }
+    
+    slot->task = task;
+    slot->sequence.store(position + 1, std::memory_order_release);
+    return true;
+}
+
+/**
+ * @brief Takes the oldest task from the shared queue.
+ * @return The task, nullptr if the queue is empty.
+ */
+PoolTask *WorkerPool::popShared()
+{
+    quint64 position = sharedTail.load(std::memory_order_relaxed);
+    Slot *slot;
+    for (;;) {
+        slot = &sharedSlots[position & sharedMask];
+        quint64 sequence = slot->sequence.load(std::memory_order_acquire);
+        qint64 difference = static_cast<qint64>(sequence - (position + 1));
+        if (difference == 0) {
+            if (sharedTail.compare_exchange_weak(position, position + 1, std::memory_order_relaxed)) {
+                break;
+            }
+        } else if (difference < 0) {
+            return nullptr;
+        } else {
+            position = sharedTail.load(std::memory_order_relaxed);
+        }
+    }
+    
+    PoolTask *task = slot->task;
+    slot->sequence.store(position + sharedMask + 1, std::memory_order_release);
+    return task;
+}
+
+/**
+ * @brief Wakes a sleeping worker, if any.
+ */
+void WorkerPool::wakeWorker()
+{
+    // Pairs with the announcement in runWorker(): the task is visible to a
+    // worker that announced its sleep before this load
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    if (sleepingWorkers.load(std::memory_order_relaxed) == 0) {
+        return;
+    }
+    
+    // A futex wake, which never blocks the caller
+    RtCheck::Waiver waiver;
+    wakeup.release();
+}
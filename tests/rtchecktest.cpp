@@ -0,0 +1,167 @@
+#include <QtCore/QCoreApplication>
+#include <QtCore/QElapsedTimer>
+#include <QtCore/QMutex>
+#include <QtCore/QThread>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include "../include/audiomanager.h"
+
+// Format of the synthetic streams
+const int SAMPLE_RATE = 48000;
+const int BUFFER_FRAMES = 256;
+const int CHANNELS = 2;
+
+// Scheduled playout delay, so the capture time marks are exercised as well
+const int PLAYOUT_DELAY_MS = 20;
+
+/**
+ * @brief Drives AudioManager's device callbacks without devices, for the real-time checker.
+ */
+class RtCheckTest
+{
+public:
+    /**
+     * @brief Streams synthetic buffers through the send path, back into the receive path and out to playout.
+     *
+     * The callbacks run at the device rate for four seconds: a tone, a second
+     * of silence (comfort noise), then the tone again while the encoder
+     * settings change and the send format switches to the other mode and back.
+     * Every packet the send path queues is drained and received again, as
+     * the network thread would between the callbacks.
+     *
+     * @param mode The transmission mode to start with.
+     * @return True if the manager could be set up, false otherwise.
+     */
+    static bool run(TransmissionMode mode)
+    {
+        AudioManager manager;
+        QObject::connect(&manager, &AudioManager::audioDataReady, [&](const QByteArray &data, qint64 captureUs) {
+            manager.processIncomingAudio(data, captureUs);
+        });
+        QObject::connect(&manager, &AudioManager::comfortNoiseReady, [&](float noiseLevel) {
+            manager.processComfortNoise(noiseLevel);
+        });
+        QObject::connect(&manager, &AudioManager::codecChanged, [&](TransmissionMode codec, int) {
+            manager.setReceiveTransmissionMode(codec);
+        });
+        
+        ChannelMap stereo = AudioFormat::defaultChannelMap(CHANNELS);
+        manager.setChannelMaps(stereo, stereo);
+        manager.setPlayoutDelay(PLAYOUT_DELAY_MS);
+        if (!manager.prepareStreams(SAMPLE_RATE, BUFFER_FRAMES, mode)) {
+            return false;
+        }
+        manager.isRunning = true;
+        manager.setPeerFormat(stereo, stereo);
+        
+        QVector<float> tone(BUFFER_FRAMES * CHANNELS);
+        for (int i = 0; i < BUFFER_FRAMES; i++) {
+            float sample = 0.25f * std::sin(2.0f * 3.14159265f * 440.0f * i / SAMPLE_RATE);
+            for (int channel = 0; channel < CHANNELS; channel++) {
+                tone[i * CHANNELS + channel] = sample;
+            }
+        }
+        QVector<float> silence(BUFFER_FRAMES * CHANNELS, 0.0f);
+        QVector<float> output(BUFFER_FRAMES * CHANNELS, 0.0f);
+        
+        TransmissionMode other = mode == TransmissionMode::Raw ? TransmissionMode::Opus : TransmissionMode::Raw;
+        int buffersPerSecond = SAMPLE_RATE / BUFFER_FRAMES;
+        QElapsedTimer clock;
+        clock.start();
+        
+        for (int i = 0; i < 4 * buffersPerSecond; i++) {
+            // Wait for the buffer's period, like a device would
+            qint64 dueNs = static_cast<qint64>(i) * BUFFER_FRAMES * 1000000000LL / SAMPLE_RATE;
+            while (clock.nsecsElapsed() < dueNs) {
+                QThread::usleep(200);
+            }
+            
+            if (i == 2 * buffersPerSecond) {
+                manager.setEncoderSettings(32000, true, 10, 20);
+            } else if (i == 2 * buffersPerSecond + buffersPerSecond / 2) {
+                manager.setTransmissionMode(other);
+            } else if (i == 3 * buffersPerSecond) {
+                manager.setTransmissionMode(mode);
+            }
+            
+            bool silent = i >= buffersPerSecond && i < 2 * buffersPerSecond;
+            const QVector<float> &input = silent ? silence : tone;
+            AudioManager::inputCallback(input.constData(), nullptr, BUFFER_FRAMES, nullptr, 0, &manager);
+            manager.drainSendQueue();
+            AudioManager::outputCallback(nullptr, output.data(), BUFFER_FRAMES, nullptr, 0, &manager);
+        }
+        
+        // There are no streams for stop() to close
+        manager.isRunning = false;
+        manager.opusCodec.close();
+        return true;
+    }
+};
+
+/**
+ * @brief Main function of the real-time checker test.
+ *
+ * Runs the capture and playout callbacks in Raw and in Opus mode and fails
+ * on any allocation, lock or system call they make outside a waiver. Then
+ * checks that an allocation and an uncontended QMutex lock in a real-time
+ * section are counted at all.
+ * Needs a build configured with -DAUDIOBRIDGE_RT_CHECK=ON.
+ *
+ * @param argc The number of command line arguments.
+ * @param argv The command line arguments.
+ * @return The exit code.
+ */
+int main(int argc, char *argv[])
+{
+    QCoreApplication app(argc, argv);
+    
+    if (!RtCheck::isEnabled()) {
+        fprintf(stderr, "The real-time checker is not enabled\n");
+        return 1;
+    }
+    
+    bool passed = true;
+    for (TransmissionMode mode : { TransmissionMode::Raw, TransmissionMode::Opus }) {
+        const char *name = mode == TransmissionMode::Raw ? "Raw" : "Opus";
+        quint64 before = RtCheck::getViolations();
+        if (!RtCheckTest::run(mode)) {
+            fprintf(stderr, "%s: failed to set up the streams\n", name);
+            passed = false;
+            continue;
+        }
+        printf("%s: %llu violations\n", name, static_cast<unsigned long long>(RtCheck::getViolations() - before));
+    }
+    if (RtCheck::getViolations() != 0) {
+        passed = false;
+    }
+    
+    // The checker itself must notice an allocation on a real-time thread
+    quint64 before = RtCheck::getViolations();
+    {
+        RtCheck::Scope realtime;
+        void *volatile block = malloc(64);
+        free(block);
+    }
+    quint64 caught = RtCheck::getViolations() - before;
+    printf("malloc in a real-time section: %llu violations\n", static_cast<unsigned long long>(caught));
+    if (caught == 0) {
+        passed = false;
+    }
+    
+    // And a QMutexLocker, which never contends here and so never reaches the kernel
+    QMutex mutex;
+    before = RtCheck::getViolations();
+    {
+        RtCheck::Scope realtime;
+        QMutexLocker locker(&mutex);
+    }
+    caught = RtCheck::getViolations() - before;
+    printf("QMutexLocker in a real-time section: %llu violations\n", static_cast<unsigned long long>(caught));
+    if (caught == 0) {
+        passed = false;
+    }
+    
+    printf("%s\n", passed ? "PASSED" : "FAILED");
+    return passed ? 0 : 1;
+}
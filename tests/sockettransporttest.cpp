@@ -0,0 +1,278 @@
+#include <QtCore/QCoreApplication>
+#include <QtCore/QElapsedTimer>
+#include <QtNetwork/QTcpServer>
+#include <QtNetwork/QHostAddress>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <fcntl.h>
+#include <string.h>
+#include <unistd.h>
+#include <cstdio>
+#include "../include/networkmanager.h"
+#include "../include/sockettransport.h"
+
+// Bytes of each ping and of its echo
+const int PING_SIZE = 64;
+
+// Pings sent one after the other
+const int PINGS = 20;
+
+// Receive buffer of the echoing side, small so the first bytes stay unacknowledged
+const int SMALL_RECEIVE_BUFFER = 4096;
+
+// Clock exchanges between two peers that must use the kernel times
+const int KERNEL_EXCHANGES = 8;
+
+// Audio format of the peers
+const int SAMPLE_RATE = 48000;
+const int BUFFER_FRAMES = 128;
+const int CHANNELS = 2;
+
+/**
+ * @brief Runs the event loop until a condition holds or the time is up.
+ * @param condition The condition.
+ * @param timeoutMs The time limit in milliseconds.
+ * @return True if the condition holds, false on a timeout.
+ */
+template<typename Condition>
+static bool waitFor(Condition condition, int timeoutMs)
+{
+    QElapsedTimer clock;
+    clock.start();
+    while (!condition() && clock.elapsed() < timeoutMs) {
+        QCoreApplication::processEvents(QEventLoop::AllEvents, 10);
+    }
+    return condition();
+}
+
+/**
+ * @brief Connects two TCP sockets over loopback.
+ * @param client Receives the connecting socket.
+ * @param server Receives the accepted socket, whose receive buffer is small.
+ * @return True if connected, false otherwise.
+ */
+static bool connectLoopback(int &client, int &server)
+{
+    client = -1;
+    server = -1;
+    int listener = ::socket(AF_INET, SOCK_STREAM, 0);
+    if (listener < 0) {
+        return false;
+    }
+    
+    // Accepted sockets inherit the listener's buffer size
+    int receiveBuffer = SMALL_RECEIVE_BUFFER;
+    ::setsockopt(listener, SOL_SOCKET, SO_RCVBUF, &receiveBuffer, sizeof(receiveBuffer));
+    struct sockaddr_in address;
+    memset(&address, 0, sizeof(address));
+    address.sin_family = AF_INET;
+    address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    socklen_t length = sizeof(address);
+    if (::bind(listener, reinterpret_cast<struct sockaddr *>(&address), sizeof(address)) == 0
+        && ::listen(listener, 1) == 0
+        && ::getsockname(listener, reinterpret_cast<struct sockaddr *>(&address), &length) == 0) {
+        client = ::socket(AF_INET, SOCK_STREAM, 0);
+        if (client >= 0 && ::connect(client, reinterpret_cast<struct sockaddr *>(&address), sizeof(address)) == 0) {
+            server = ::accept(listener, nullptr, nullptr);
+        }
+    }
+    ::close(listener);
+    return client >= 0 && server >= 0;
+}
+
+/**
+ * @brief Checks the send timestamp ids and the kernel round trip of a transport.
+ *
+ * The client's send queue is filled with bytes the server does not read
+ * before the client's transport enables its timestamps, so the kernel's keys
+ * do not start where the transport's offsets do. The client then sends pings
+ * the server echoes. Every ping's send timestamp must carry the id asked
+ * for, and the round trip between the kernel's send and receive stamps must
+ * lie within the one the application sees.
+ *
+ * @return True if every ping got its timestamp and the round trips agree, false otherwise.
+ */
+static bool testTransmitKeys()
+{
+    int clientDescriptor;
+    int serverDescriptor;
+    if (!connectLoopback(clientDescriptor, serverDescriptor)) {
+        printf("transmit keys: failed to connect over loopback: FAILED\n");
+        return false;
+    }
+    
+    // Bytes the server has not acknowledged yet when the timestamps are enabled
+    char filler[PING_SIZE] = {};
+    qint64 unacknowledged = 0;
+    ::fcntl(clientDescriptor, F_SETFL, ::fcntl(clientDescriptor, F_GETFL) | O_NONBLOCK);
+    for (ssize_t sent; (sent = ::send(clientDescriptor, filler, sizeof(filler), MSG_NOSIGNAL)) > 0;) {
+        unacknowledged += sent;
+    }
+    
+    SocketTransport client;
+    SocketTransport server;
+    QString message;
+    if (!client.open(clientDescriptor, &message) || !server.open(serverDescriptor, &message)) {
+        printf("transmit keys: %s: FAILED\n", qPrintable(message));
+        return false;
+    }
+    
+    // The server skips the filler and echoes every whole ping
+    qint64 fillerLeft = unacknowledged;
+    QByteArray serverReceived;
+    QObject::connect(&server, &StreamTransport::readyRead, [&]() {
+        server.read(serverReceived);
+        int skipped = static_cast<int>(qMin<qint64>(fillerLeft, serverReceived.size()));
+        serverReceived.remove(0, skipped);
+        fillerLeft -= skipped;
+        while (serverReceived.size() >= PING_SIZE) {
+            server.write(serverReceived.constData(), PING_SIZE);
+            serverReceived.remove(0, PING_SIZE);
+        }
+        server.flush();
+    });
+    
+    qint64 stampedId = -1;
+    qint64 transmitUs = 0;
+    QObject::connect(&client, &StreamTransport::transmitTimestamp, [&](qint64 id, qint64 timeUs) {
+        stampedId = id;
+        transmitUs = timeUs;
+    });
+    QByteArray clientReceived;
+    qint64 replyUs = 0;
+    qint64 arrivalUs = 0;
+    QObject::connect(&client, &StreamTransport::readyRead, [&]() {
+        client.read(clientReceived);
+        if (clientReceived.size() >= PING_SIZE) {
+            replyUs = ClockSync::now();
+            arrivalUs = client.getReceiveTimestamp();
+        }
+    });
+    
+    int matched = 0;
+    int within = 0;
+    qint64 kernelSumUs = 0;
+    qint64 applicationSumUs = 0;
+    for (int ping = 0; ping < PINGS; ping++) {
+        char payload[PING_SIZE];
+        memset(payload, ping + 1, sizeof(payload));
+        clientReceived.clear();
+        stampedId = -1;
+        replyUs = 0;
+        
+        qint64 sendUs = ClockSync::now();
+        client.write(payload, sizeof(payload));
+        qint64 requestedId = client.requestTransmitTimestamp();
+        client.flush();
+        if (requestedId < 0
+            || !waitFor([&]() { return replyUs > 0 && stampedId >= 0; }, 5000)) {
+            printf("transmit keys: ping %d got %s: FAILED\n", ping,
+                   requestedId < 0 ? "no timestamp id" : "no reply or no timestamp");
+            return false;
+        }
+        
+        qint64 kernelUs = arrivalUs - transmitUs;
+        qint64 applicationUs = replyUs - sendUs;
+        if (stampedId == requestedId) {
+            matched++;
+        }
+        if (kernelUs > 0 && kernelUs <= applicationUs) {
+            within++;
+        }
+        kernelSumUs += kernelUs;
+        applicationSumUs += applicationUs;
+    }
+    bool passed = matched == PINGS && within == PINGS;
+    printf("transmit keys: %lld bytes unacknowledged at open, %d/%d ids matched, kernel round trip "
+           "%lld us, application %lld us (mean), %d/%d within: %s\n",
+           static_cast<long long>(unacknowledged), matched, PINGS, static_cast<long long>(kernelSumUs / PINGS),
+           static_cast<long long>(applicationSumUs / PINGS), within, PINGS, passed ? "ok" : "FAILED");
+    return passed;
+}
+
+/**
+ * @brief Checks that two peers with kernel timestamps exchange their clocks on the kernel times.
+ *
+ * An exchange only counts as a kernel one when the ping's and the pong's
+ * send timestamps both came back under the ids their peer asked for. The
+ * round trip between the kernels must lie within the application's.
+ *
+ * @return True if the peers completed enough kernel exchanges, false otherwise.
+ */
+static bool testKernelClockExchange()
+{
+    QTcpServer probe;
+    if (!probe.listen(QHostAddress::LocalHost)) {
+        printf("kernel clock exchange: no free port: FAILED\n");
+        return false;
+    }
+    quint16 port = probe.serverPort();
+    probe.close();
+    
+    SessionCapabilities capabilities = SessionHandshake::localCapabilities(SAMPLE_RATE, BUFFER_FRAMES,
+                                                                            TransmissionMode::Raw);
+    ChannelMap layout = AudioFormat::defaultChannelMap(CHANNELS);
+    NetworkManager server;
+    NetworkManager client;
+    for (NetworkManager *peer : { &server, &client }) {
+        peer->setKernelTimestamps(true);
+        peer->setLocalCapabilities(capabilities);
+        peer->setLocalFormat(layout, layout);
+    }
+    client.setAutoReconnect(false);
+    
+    int kernelExchanges = 0;
+    int applicationExchanges = 0;
+    int within = 0;
+    LatencyStats last;
+    QObject::connect(&client, &NetworkManager::latencyStatsChanged, [&](const LatencyStats &stats) {
+        if (!stats.kernelTimestamps) {
+            applicationExchanges++;
+            return;
+        }
+        kernelExchanges++;
+        if (stats.wireRoundTripUs <= stats.roundTripUs) {
+            within++;
+        }
+        last = stats;
+    });
+    
+    if (!server.startServer(port) || !client.connectToServer("127.0.0.1", port)
+        || !waitFor([&]() { return kernelExchanges >= KERNEL_EXCHANGES; }, 10000)) {
+        printf("kernel clock exchange: %d kernel and %d application exchanges: FAILED\n", kernelExchanges,
+               applicationExchanges);
+        return false;
+    }
+    client.disconnect();
+    server.disconnect();
+    
+    bool passed = within == kernelExchanges;
+    printf("kernel clock exchange: %d kernel and %d application exchanges, last round trip %lld us between "
+           "the kernels, %lld us between the applications: %s\n",
+           kernelExchanges, applicationExchanges, static_cast<long long>(last.wireRoundTripUs),
+           static_cast<long long>(last.roundTripUs), passed ? "ok" : "FAILED");
+    return passed;
+}
+
+/**
+ * @brief Main function of the socket transport test.
+ *
+ * Checks over loopback TCP that send timestamps come back under the ids
+ * asked for, also when the kernel's keys start elsewhere, and that two
+ * peers with kernel timestamps exchange their clocks on the kernel times.
+ *
+ * @param argc The number of command line arguments.
+ * @param argv The command line arguments.
+ * @return The exit code.
+ */
+int main(int argc, char *argv[])
+{
+    QCoreApplication app(argc, argv);
+    
+    bool passed = testTransmitKeys();
+    passed = testKernelClockExchange() && passed;
+    
+    printf("%s\n", passed ? "PASSED" : "FAILED");
+    return passed ? 0 : 1;
+}
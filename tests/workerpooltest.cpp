@@ -0,0 +1,193 @@
+#include <QtCore/QThread>
+#include <atomic>
+#include <cstdio>
+#include <memory>
+#include <vector>
+#include "../include/ringbuffer.h"
+#include "../include/workerpool.h"
+
+// Items each producer queues for its strand in the ordering test
+const int ORDER_ITEMS = 100000;
+
+// Strands that keep rescheduling themselves in the fairness test
+const int BUSY_STRANDS = 8;
+
+// How long the busy strands run
+const int FAIRNESS_DURATION_MS = 500;
+
+// Runs of the slowest strand relative to the fastest, at least
+const double MIN_FAIRNESS = 0.5;
+
+// Runs of a busy strand a newly scheduled strand may wait behind, at most
+const quint64 MAX_WAIT_RUNS = 2;
+
+/**
+ * @brief A stream whose strand drains the numbers its producer queued.
+ */
+struct OrderedStream
+{
+    SpscRingBuffer<int> items;
+    std::unique_ptr<WorkerStrand> strand;
+    std::atomic<bool> running;
+    int next = 0;
+    bool overlapped = false;
+    bool reordered = false;
+};
+
+/**
+ * @brief A strand that asks for another run from inside every run.
+ */
+struct BusyStream
+{
+    std::unique_ptr<WorkerStrand> strand;
+    std::atomic<quint64> runs;
+    std::atomic<bool> busy;
+};
+
+/**
+ * @brief Checks that a strand's runs never overlap and see its work in order.
+ *
+ * Four producers each queue numbers for a strand of their own on a pool of
+ * @p workers and schedule it after every number. Each run drains the queue
+ * and checks that the numbers follow each other.
+ *
+ * @param workers The number of pool workers.
+ * @return True if every strand saw every number once and in order, false otherwise.
+ */
+static bool testOrdering(int workers)
+{
+    WorkerPool pool(workers);
+    std::vector<std::unique_ptr<OrderedStream>> streams;
+    for (int i = 0; i < 4; i++) {
+        streams.emplace_back(new OrderedStream);
+        OrderedStream *stream = streams.back().get();
+        stream->items.reset(1024);
+        stream->running = false;
+        stream->strand.reset(new WorkerStrand(&pool, [stream]() {
+            if (stream->running.exchange(true, std::memory_order_acquire)) {
+                stream->overlapped = true;
+            }
+            int item;
+            while (stream->items.read(&item, 1) == 1) {
+                if (item != stream->next) {
+                    stream->reordered = true;
+                }
+                stream->next = item + 1;
+            }
+            stream->running.store(false, std::memory_order_release);
+        }));
+    }
+    
+    // One producer thread per strand, as only one thread may schedule a strand
+    std::vector<std::unique_ptr<QThread>> producers;
+    for (const std::unique_ptr<OrderedStream> &stream : streams) {
+        OrderedStream *target = stream.get();
+        producers.emplace_back(QThread::create([target]() {
+            for (int item = 0; item < ORDER_ITEMS;) {
+                if (target->items.write(&item, 1) == 1) {
+                    item++;
+                }
+                target->strand->schedule();
+            }
+        }));
+        producers.back()->start();
+    }
+    for (const std::unique_ptr<QThread> &producer : producers) {
+        producer->wait();
+    }
+    
+    bool passed = true;
+    for (const std::unique_ptr<OrderedStream> &stream : streams) {
+        stream->strand->waitUntilIdle();
+        if (stream->overlapped || stream->reordered || stream->next != ORDER_ITEMS) {
+            passed = false;
+        }
+    }
+    printf("ordering on %d worker(s): %s\n", workers, passed ? "ok" : "FAILED");
+    return passed;
+}
+
+/**
+ * @brief Checks that strands that keep rescheduling themselves share one worker fairly.
+ *
+ * Every busy strand asks for its next run from inside its job, which is
+ * the case a worker used to serve over and over ahead of the others. The
+ * runs must spread evenly over the strands, and a strand scheduled from
+ * outside meanwhile must get its run within a couple of runs of each
+ * busy strand.
+ *
+ * @return True if the runs were fair, false otherwise.
+ */
+static bool testFairness()
+{
+    WorkerPool pool(1);
+    std::vector<std::unique_ptr<BusyStream>> streams;
+    for (int i = 0; i < BUSY_STRANDS; i++) {
+        streams.emplace_back(new BusyStream);
+        BusyStream *stream = streams.back().get();
+        stream->runs = 0;
+        stream->busy = true;
+        stream->strand.reset(new WorkerStrand(&pool, [stream]() {
+            stream->runs.fetch_add(1, std::memory_order_relaxed);
+            if (stream->busy.load(std::memory_order_relaxed)) {
+                stream->strand->schedule();
+            }
+        }));
+    }
+    
+    // A strand scheduled once from outside while the others are busy
+    BusyStream *first = streams.front().get();
+    std::atomic<quint64> runsBeforeLate(0);
+    std::atomic<quint64> runsAtLate(0);
+    WorkerStrand late(&pool, [&]() {
+        runsAtLate.store(first->runs.load(std::memory_order_relaxed), std::memory_order_relaxed);
+    });
+    
+    for (const std::unique_ptr<BusyStream> &stream : streams) {
+        stream->strand->schedule();
+    }
+    QThread::msleep(FAIRNESS_DURATION_MS / 2);
+    runsBeforeLate = first->runs.load(std::memory_order_relaxed);
+    late.schedule();
+    QThread::msleep(FAIRNESS_DURATION_MS / 2);
+    
+    quint64 fewest = ~0ULL;
+    quint64 most = 0;
+    for (const std::unique_ptr<BusyStream> &stream : streams) {
+        quint64 runs = stream->runs.load(std::memory_order_relaxed);
+        fewest = qMin(fewest, runs);
+        most = qMax(most, runs);
+    }
+    for (const std::unique_ptr<BusyStream> &stream : streams) {
+        stream->busy = false;
+    }
+    for (const std::unique_ptr<BusyStream> &stream : streams) {
+        stream->strand->waitUntilIdle();
+    }
+    late.waitUntilIdle();
+    
+    double fairness = most > 0 ? static_cast<double>(fewest) / most : 0.0;
+    quint64 waited = runsAtLate.load() - qMin(runsAtLate.load(), runsBeforeLate.load());
+    bool passed = fairness >= MIN_FAIRNESS && runsAtLate.load() > 0 && waited <= MAX_WAIT_RUNS;
+    printf("fairness on 1 worker: fewest/most runs %.2f, late strand waited %llu runs: %s\n", fairness,
+           static_cast<unsigned long long>(waited), passed ? "ok" : "FAILED");
+    return passed;
+}
+
+/**
+ * @brief Main function of the worker pool test.
+ *
+ * Checks that a strand's runs are serial and see its work in order, on one
+ * worker and on four, and that busy strands share a single worker fairly.
+ *
+ * @return The exit code.
+ */
+int main()
+{
+    bool passed = testOrdering(1);
+    passed = testOrdering(4) && passed;
+    passed = testFairness() && passed;
+    
+    printf("%s\n", passed ? "PASSED" : "FAILED");
+    return passed ? 0 : 1;
+}